@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include "aggregator.h"
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+Aggregator::Aggregator(const Query::command_vector_t& selectArgs, const std::string& groupField)
+	: m_aggregates(), m_isGrouped(!groupField.empty()), m_groupField(Model::FieldId::Stb), m_projection(),
+	  m_groups(), m_groupKey()
+{
+	// The group value is always written to the group field's own column.
+	bool hasMatchingSelectField = false;
+	const bool isGroupSelected = m_isGrouped && std::any_of(std::begin(selectArgs), std::end(selectArgs), [&](const Command& selectArg)
+			{ return (selectArg.CommandArgs() == groupField && !Query::IsAggregateCommand(selectArg.CommandType())); });
+	std::vector<std::pair<std::string, Command::Type>> selected;
+	Model::projection_t columns;
+	size_t extraColumnCount = 0;
+	for (auto& selectArg : selectArgs) {
+		const std::string field = selectArg.CommandArgs();
+		const std::pair<std::string, Command::Type> selection(field, selectArg.CommandType());
+		if (std::find(std::begin(selected), std::end(selected), selection) != std::end(selected)) {
+			throw std::invalid_argument("Cannot execute query: " + field + " is selected more than once the same way.");
+		}
+
+		// A field selected again, aggregated another way, gets a result column of its own.
+		const Model::FieldId fieldId = Model::FieldIndex(field);
+		const bool isGroupColumn = (isGroupSelected && field == groupField);
+		const bool isFieldTaken = (std::find(std::begin(columns), std::end(columns), fieldId) != std::end(columns)) ||
+			(isGroupColumn && Query::IsAggregateCommand(selectArg.CommandType()));
+		const Model::FieldId column = isFieldTaken ? static_cast<Model::FieldId>(Model::field_count_t + extraColumnCount++) : fieldId;
+		selected.emplace_back(selection);
+		columns.emplace_back(column);
+		if (m_isGrouped && field == groupField && !Query::IsAggregateCommand(selectArg.CommandType())) {
+			hasMatchingSelectField = true;
+			m_groupField = fieldId;
+			continue;
+		}
+
+		if (!Query::IsAggregateCommand(selectArg.CommandType())) {
+			throw std::invalid_argument("Cannot execute query: " + field + " is not part of an aggregate function.");
+		}
+
+		Aggregator::Aggregate aggregate = { selectArg.CommandType(), fieldId, Model::Type(fieldId), column };
+		if (aggregate.command == Command::Type::Sum && (aggregate.type == Model::FieldType::Text || aggregate.type == Model::FieldType::Date)) {
+			throw std::invalid_argument("Cannot execute query: " + field + " is not a numeric field and cannot be summed.");
+		}
+
+		m_aggregates.emplace_back(aggregate);
+	}
+
+	if (m_isGrouped && !hasMatchingSelectField) {
+		throw std::invalid_argument("Cannot execute query: " + groupField + " is not one of the select specifiers.");
+	}
+
+	m_projection = std::make_shared<const Model::projection_t>(std::move(columns));
+}
+
+Aggregator::~Aggregator()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void Aggregator::Accumulate(const Model::field_view_t& record)
+{
+	// Reuse the key buffer so only a new group allocates.
+	if (m_isGrouped) {
+		m_groupKey.assign(record[static_cast<size_t>(m_groupField)]);
+	}
+
+	auto group = m_groups.find(m_groupKey);
+	if (group == std::end(m_groups)) {
+		group = m_groups.emplace(m_groupKey, Aggregator::accumulator_list_t(m_aggregates.size())).first;
+	}
+
+	Aggregator::accumulator_list_t& accumulators = group->second;
+	for (size_t i = 0; i < m_aggregates.size(); ++i) {
+		Aggregator::Apply(m_aggregates[i], record[static_cast<size_t>(m_aggregates[i].field)], accumulators[i]);
+	}
+}
+
+void Aggregator::Merge(Aggregator&& other)
+{
+	for (auto& otherGroup : other.m_groups) {
+		auto group = m_groups.find(otherGroup.first);
+		if (group == std::end(m_groups)) {
+			m_groups.emplace(otherGroup.first, std::move(otherGroup.second));
+			continue;
+		}
+
+		for (size_t i = 0; i < m_aggregates.size(); ++i) {
+			Aggregator::Merge(m_aggregates[i], std::move(otherGroup.second[i]), group->second[i]);
+		}
+	}
+
+	other.m_groups.clear();
+}
+
+Query::table_t Aggregator::Results() const
+{
+	std::vector<const std::pair<const std::string, Aggregator::accumulator_list_t>*> groups;
+	groups.reserve(m_groups.size());
+	for (auto& group : m_groups) {
+		groups.emplace_back(&group);
+	}
+
+	// Hashing leaves the groups unordered; present them in group field order.
+	std::sort(std::begin(groups), std::end(groups), [](auto lhs, auto rhs) { return (lhs->first < rhs->first); });
+
+	Query::table_t results;
+	results.reserve(groups.size());
+	for (auto group : groups) {
+		Query::row_t row;
+		if (m_isGrouped) {
+			row.Field(m_groupField, group->first);
+		}
+
+		for (size_t i = 0; i < m_aggregates.size(); ++i) {
+			row.ResultField(m_aggregates[i].column, Aggregator::Format(m_aggregates[i], group->second[i]));
+		}
+
+		row.SetOrdering(m_projection);
+		results.emplace_back(row);
+	}
+
+	return results;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void Aggregator::Apply(const Aggregator::Aggregate& aggregate, std::string_view fieldValue, Aggregator::Accumulator& accumulator)
+{
+	std::int64_t number = 0;
+	const bool isNumeric = (aggregate.type != Model::FieldType::Text);
+	if (isNumeric ? !Model::ParseNumber(aggregate.type, fieldValue, number) : fieldValue.empty()) {
+		return;
+	}
+
+	switch (aggregate.command) {
+		case Command::Type::Sum:
+			accumulator.number += number;
+			break;
+
+		case Command::Type::Min:
+		case Command::Type::Max: {
+			const bool isMin = (aggregate.command == Command::Type::Min);
+			if (isNumeric) {
+				if (!accumulator.hasValue || (isMin ? number < accumulator.number : number > accumulator.number)) {
+					accumulator.number = number;
+				}
+			} else if (!accumulator.hasValue || (isMin ? fieldValue < accumulator.text : fieldValue > accumulator.text)) {
+				accumulator.text.assign(fieldValue);
+			}
+
+			break;
+		}
+
+		case Command::Type::Count:
+		case Command::Type::Collect:
+			// Look up by view first so repeated values do not allocate.
+			if (accumulator.distinct.find(fieldValue) == std::end(accumulator.distinct)) {
+				accumulator.distinct.emplace(fieldValue);
+			}
+
+			break;
+
+		case Command::Type::Select:
+		case Command::Type::Order:
+		case Command::Type::Group:
+		case Command::Type::Filter:
+		case Command::Type::Limit:
+		case Command::Type::Invalid:
+		case Command::Type::NoCommand:
+		default:
+			break;
+	}
+
+	accumulator.hasValue = true;
+}
+
+void Aggregator::Merge(const Aggregator::Aggregate& aggregate, Aggregator::Accumulator&& other, Aggregator::Accumulator& accumulator)
+{
+	if (!other.hasValue) {
+		return;
+	}
+
+	switch (aggregate.command) {
+		case Command::Type::Sum:
+			accumulator.number += other.number;
+			break;
+
+		case Command::Type::Min:
+		case Command::Type::Max: {
+			const bool isMin = (aggregate.command == Command::Type::Min);
+			if (aggregate.type != Model::FieldType::Text) {
+				if (!accumulator.hasValue || (isMin ? other.number < accumulator.number : other.number > accumulator.number)) {
+					accumulator.number = other.number;
+				}
+			} else if (!accumulator.hasValue || (isMin ? other.text < accumulator.text : other.text > accumulator.text)) {
+				accumulator.text.swap(other.text);
+			}
+
+			break;
+		}
+
+		case Command::Type::Count:
+		case Command::Type::Collect:
+			if (accumulator.distinct.empty()) {
+				accumulator.distinct.swap(other.distinct);
+			} else {
+				accumulator.distinct.merge(other.distinct);
+			}
+
+			break;
+
+		case Command::Type::Select:
+		case Command::Type::Order:
+		case Command::Type::Group:
+		case Command::Type::Filter:
+		case Command::Type::Limit:
+		case Command::Type::Invalid:
+		case Command::Type::NoCommand:
+		default:
+			break;
+	}
+
+	accumulator.hasValue = true;
+}
+
+std::string Aggregator::Format(const Aggregator::Aggregate& aggregate, const Aggregator::Accumulator& accumulator)
+{
+	switch (aggregate.command) {
+		case Command::Type::Sum:
+			return Model::FormatNumber(aggregate.type, accumulator.number);
+
+		case Command::Type::Min:
+		case Command::Type::Max:
+			if (!accumulator.hasValue) {
+				return "";
+			}
+
+			return (aggregate.type != Model::FieldType::Text) ? Model::FormatNumber(aggregate.type, accumulator.number) : accumulator.text;
+
+		case Command::Type::Count:
+			return std::to_string(accumulator.distinct.size());
+
+		case Command::Type::Collect: {
+			// Typed values are collected as held, so they are listed in numeric order but need formatting.
+			std::string values = "[";
+			char buffer[Model::number_len_max_t];
+			for (auto& value : accumulator.distinct) {
+				values += (values.length() > 1) ? "," : "";
+				values += Model::Text(aggregate.field, value, buffer);
+			}
+
+			return values + "]";
+		}
+
+		case Command::Type::Select:
+		case Command::Type::Order:
+		case Command::Type::Group:
+		case Command::Type::Filter:
+		case Command::Type::Limit:
+		case Command::Type::Invalid:
+		case Command::Type::NoCommand:
+		default:
+			return "";
+	}
+}
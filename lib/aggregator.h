@@ -0,0 +1,94 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "model.h"
+#include "query.h"
+
+/// Hash aggregation of the select (-s) aggregate functions, one row per distinct value of the
+/// group (-g) field, or a single row for every record when no group field is given.
+/// Records are folded into their group's accumulators as they are scanned, so memory grows
+/// with the number of groups rather than the number of records.
+///
+/// Aggregates are typed by field: sum, min, and max of 'rev' add up cents and of 'viewtime'
+/// minutes; min and max of 'date' compare days and of text fields compare text; count and
+/// collect work on distinct values.
+class Aggregator
+{
+	public:
+		// Construction
+		/// Validates the select arguments: every field other than the group field must be aggregated,
+		/// the same aggregate of a field may be selected once, and only money and duration fields can
+		/// be summed.
+		/// Throws std::invalid_argument otherwise. An empty group field aggregates all records together.
+		Aggregator(const Query::command_vector_t& selectArgs, const std::string& groupField);
+		~Aggregator();
+
+		// Public API
+		/// Folds a record's field values into the accumulators for its group.
+		void Accumulate(const Model::field_view_t& record);
+
+		/// Combines another aggregator's groups, i.e. one that aggregated a different part of the
+		/// same datastore for the same query, into this one. The other aggregator is left empty.
+		void Merge(Aggregator&& other);
+
+		/// Gets one row per group in group field order, holding the group value and aggregate results.
+		Query::table_t Results() const;
+
+		/// Gets the number of groups accumulated so far.
+		size_t GroupCount() const { return m_groups.size(); }
+
+	private:
+		/// One select argument that is aggregated, and the result column it is written to: its field's
+		/// own for the first use of the field, otherwise an extra one past the schema's fields.
+		struct Aggregate {
+			Command::Type command;
+			Model::FieldId field;
+			Model::FieldType type;
+			Model::FieldId column;
+		};
+
+		/// Running state of one aggregate for one group. Only the members the aggregate needs are used.
+		struct Accumulator {
+			Accumulator() : hasValue(false), number(0), text(), distinct() {}
+			bool hasValue;
+			std::int64_t number;
+			std::string text;
+			std::set<std::string, std::less<>> distinct;
+		};
+
+		typedef std::vector<Aggregator::Accumulator> accumulator_list_t;
+
+		/// Applies one field value to an accumulator; empty and malformed values are skipped.
+		static void Apply(const Aggregator::Aggregate& aggregate, std::string_view fieldValue, Aggregator::Accumulator& accumulator);
+
+		/// Combines the state of the same aggregate from another part of the datastore into an accumulator.
+		static void Merge(const Aggregator::Aggregate& aggregate, Aggregator::Accumulator&& other, Aggregator::Accumulator& accumulator);
+
+		/// Formats an accumulator as the value of a result row.
+		static std::string Format(const Aggregator::Aggregate& aggregate, const Aggregator::Accumulator& accumulator);
+
+		/// The aggregated select arguments, in select order.
+		std::vector<Aggregator::Aggregate> m_aggregates;
+
+		/// The group by field, if one was given.
+		bool m_isGrouped;
+		Model::FieldId m_groupField;
+
+		/// Output column order shared by every result row.
+		Model::projection_ptr_t m_projection;
+
+		/// Accumulators per group, keyed by the group field value.
+		std::unordered_map<std::string, Aggregator::accumulator_list_t> m_groups;
+
+		/// Reused buffer for looking up a record's group without allocating.
+		std::string m_groupKey;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "columnar_repository.h"
+
+static Model::field_view_t FieldValues(const Model& model);
+static void RecordKey(const Model::field_view_t& record, std::string& key);
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ColumnarRepository::ColumnarRepository() : m_directory(), m_segment(), m_rowKeys(), m_hasRowKeys(false), m_version(0)
+{
+}
+
+ColumnarRepository::~ColumnarRepository()
+{
+	try {
+		this->Disconnect();
+	} catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+}
+
+
+// ****************************************************************************
+// IRepository implementation
+// ****************************************************************************
+void ColumnarRepository::Connect(const std::string& connectionString)
+{
+	// Check if already connected
+	if (!m_directory.empty()) {
+		return;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(connectionString, error);
+	if (!std::filesystem::is_directory(connectionString)) {
+		throw std::invalid_argument("Unable to create directory: " + connectionString);
+	}
+
+	m_segment.Open(connectionString);
+	m_directory = connectionString;
+	++m_version;
+	return;
+}
+
+void ColumnarRepository::Disconnect()
+{
+	// Every write already rewrote the segment, so there is nothing left to persist.
+	m_segment.Close();
+	m_rowKeys.clear();
+	m_hasRowKeys = false;
+	m_directory.clear();
+	return;
+}
+
+Query::table_t ColumnarRepository::QueryData(Query& query)
+{
+	Query::table_t results;
+	this->QueryData(query, [&](const Query::row_t& row) { results.emplace_back(row); });
+	return results;
+}
+
+void ColumnarRepository::QueryData(Query& query, const Query::row_sink_t& sink)
+{
+	// Sorts that outgrow memory spill next to the datastore unless told otherwise.
+	if (query.SpillDirectory().empty()) {
+		query.SpillDirectory(std::filesystem::path(m_directory).parent_path().string());
+	}
+
+	query.QueryCommand(m_segment, sink);
+}
+
+Model ColumnarRepository::GetModelByKey(const std::string& key) const
+{
+	this->LoadKeys();
+	auto rowKey = m_rowKeys.find(key);
+	if (rowKey == std::end(m_rowKeys)) {
+		return Model();
+	}
+
+	return m_segment.Row(rowKey->second);
+}
+
+void ColumnarRepository::CreateModel(const Model& model)
+{
+	// Implementation for create and update are the same for this demo.
+	this->UpdateModel(model);
+	return;
+}
+
+void ColumnarRepository::CreateModels(const model_batch_t& models)
+{
+	this->Rewrite(models, "");
+	return;
+}
+
+void ColumnarRepository::UpdateModel(const Model& model)
+{
+	// Don't process an empty model object
+	if (!model) {
+		return;
+	}
+
+	this->Rewrite(model_batch_t{ model }, "");
+	return;
+}
+
+void ColumnarRepository::DeleteModel(std::string& key)
+{
+	// Don't process an empty model key, or rewrite the segment for a record it doesn't hold.
+	this->LoadKeys();
+	if (key.empty() || m_rowKeys.count(key) == 0) {
+		return;
+	}
+
+	this->Rewrite(model_batch_t(), key);
+	return;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void ColumnarRepository::Rewrite(const model_batch_t& models, const std::string& deletedKey)
+{
+	// Dedupe the batch by key; the last record in the batch for a given key wins.
+	std::unordered_map<std::string, size_t> batchKeys;
+	batchKeys.reserve(models.size());
+	for (size_t i = 0; i < models.size(); ++i) {
+		if (!!models[i]) {
+			batchKeys[models[i].Key()] = i;
+		}
+	}
+
+	if (batchKeys.empty() && deletedKey.empty()) {
+		return;
+	}
+
+	// Carry every existing row over, replacing those the batch holds a newer version of.
+	ColumnarSegmentWriter writer;
+	std::vector<bool> isWritten(models.size(), false);
+	const Model::projection_t allFields = *Model::MakeProjection(Model::m_validFields);
+	std::string key;
+	for (size_t partition = 0; partition < m_segment.PartitionCount(); ++partition) {
+		m_segment.Scan(partition, allFields, [&](const Model::field_view_t& record)
+				{
+					RecordKey(record, key);
+					auto batchKey = batchKeys.find(key);
+					if (key == deletedKey) {
+						return true;
+					} else if (batchKey != std::end(batchKeys)) {
+						writer.Add(FieldValues(models[batchKey->second]));
+						isWritten[batchKey->second] = true;
+					} else {
+						writer.Add(record);
+					}
+
+					return true;
+				});
+	}
+
+	// Anything left in the batch is a new record, appended in order of first appearance.
+	for (auto& model : models) {
+		if (!model) {
+			continue;
+		}
+
+		size_t latest = batchKeys.at(model.Key());
+		if (isWritten[latest]) {
+			continue;
+		}
+
+		writer.Add(FieldValues(models[latest]));
+		isWritten[latest] = true;
+	}
+
+	// Swap the new columns in; the old mappings stay valid until they are closed.
+	writer.Write(m_directory);
+	m_segment.Open(m_directory);
+	m_rowKeys.clear();
+	m_hasRowKeys = false;
+	++m_version;
+	return;
+}
+
+void ColumnarRepository::LoadKeys() const
+{
+	if (m_hasRowKeys) {
+		return;
+	}
+
+	// Only the key columns are read.
+	const Model::projection_t keyFields = { Model::FieldId::Stb, Model::FieldId::Title, Model::FieldId::Date };
+	size_t row = 0;
+	std::string key;
+	m_rowKeys.clear();
+	m_rowKeys.reserve(m_segment.RowCount());
+	for (size_t partition = 0; partition < m_segment.PartitionCount(); ++partition) {
+		m_segment.Scan(partition, keyFields, [&](const Model::field_view_t& record)
+				{
+					RecordKey(record, key);
+					m_rowKeys[key] = row++;
+					return true;
+				});
+	}
+
+	m_hasRowKeys = true;
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static Model::field_view_t FieldValues(const Model& model)
+{
+	Model::field_view_t fieldValues;
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		fieldValues[field] = model.Field(static_cast<Model::FieldId>(field));
+	}
+
+	return fieldValues;
+}
+
+static void RecordKey(const Model::field_view_t& record, std::string& key)
+{
+	// Same as Model::Key(), without materializing the record.
+	key.assign(record[static_cast<size_t>(Model::FieldId::Stb)]);
+	key.append(record[static_cast<size_t>(Model::FieldId::Title)]);
+	key.append(record[static_cast<size_t>(Model::FieldId::Date)]);
+}
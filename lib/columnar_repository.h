@@ -0,0 +1,63 @@
+#ifndef COLUMNAR_REPOSITORY_H
+#define COLUMNAR_REPOSITORY_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "columnar_segment.h"
+#include "model.h"
+#include "query.h"
+#include "repository.h"
+
+/// Repository keeping the datastore as a columnar segment in a directory rather than a text file,
+/// so queries only read the columns of the fields they use. Writes rewrite the segment.
+class ColumnarRepository : public IRepository
+{
+	public:
+		ColumnarRepository();
+		ColumnarRepository(const ColumnarRepository&) = delete;
+		ColumnarRepository& operator= (const ColumnarRepository&) = delete;
+		~ColumnarRepository();
+
+		// IRepository implementation
+		/// Opens the segment in the directory named by the connection string, creating the directory if needed.
+		void Connect(const std::string& connectionString) override;
+		void Disconnect() override;
+		Query::table_t QueryData(Query& query) override;
+		void QueryData(Query& query, const Query::row_sink_t& sink) override;
+		Model GetModelByKey(const std::string& key) const override;
+		void CreateModel(const Model& model) override;
+		void CreateModels(const model_batch_t& models) override;
+		void UpdateModel(const Model& model) override;
+		void DeleteModel(std::string& key) override;
+		bool IsAppendOnly() const override { return false; }
+		std::uint64_t Version() const override { return m_version; }
+
+		// Public accessors
+		/// Gets the segment queries are run against.
+		const ColumnarSegment& Segment() const { return m_segment; }
+
+	private:
+		/// Rewrites the segment with the batch merged in and the given key, if any, removed. Existing
+		/// rows keep their place, replaced by the last model in the batch with the same key, and new
+		/// models are appended in order of first appearance.
+		void Rewrite(const model_batch_t& models, const std::string& deletedKey);
+
+		/// Maps every record key to its row, on first use after the segment changes.
+		void LoadKeys() const;
+
+		/// Directory holding the segment's column files; empty while disconnected.
+		std::string m_directory;
+
+		/// Segment of the datastore's records.
+		ColumnarSegment m_segment;
+
+		/// Row of each record key, built only when a key is looked up.
+		mutable std::unordered_map<std::string, size_t> m_rowKeys;
+		mutable bool m_hasRowKeys;
+
+		/// Number of times the segment was opened or rewritten.
+		std::uint64_t m_version;
+};
+
+#endif
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "columnar_segment.h"
+
+/// Fixed header at the start of every column file, followed by its sections, each 8 byte aligned:
+///     per row values    uint32 codes, int32 dates, or int64 integers; none for a text column
+///     value rows        uint64 row of each exception; date and integer columns only
+///     value offsets     uint64 offset of each text value in the bytes, plus one for the end
+///     value bytes       the text values back to back
+struct ColumnHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t encoding;
+	std::uint32_t field;
+	std::uint64_t rowCount;
+	std::uint64_t valueCount;
+};
+
+static size_t RowWidth(ColumnarSegment::Encoding encoding);
+static size_t Align(size_t size);
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const char ColumnarSegment::m_magic[4] = { 'S', 'D', 'S', 'C' };
+const std::uint32_t ColumnarSegment::m_version = 2;
+const std::int32_t ColumnarSegment::m_dateException = std::numeric_limits<std::int32_t>::min();
+const std::int64_t ColumnarSegment::m_integerException = std::numeric_limits<std::int64_t>::min();
+const size_t ColumnarSegment::m_partitionRowCount = 1 << 16;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ColumnarSegment::ColumnarSegment() : m_columns(), m_rowCount(0)
+{
+}
+
+ColumnarSegment::~ColumnarSegment()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void ColumnarSegment::Open(const std::string& directory)
+{
+	this->Close();
+
+	// A segment is all of its columns or none of them.
+	size_t columnCount = 0;
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		columnCount += std::filesystem::exists(ColumnarSegment::ColumnPath(directory, static_cast<Model::FieldId>(field))) ? 1 : 0;
+	}
+
+	if (columnCount == 0) {
+		return;
+	}
+
+	try {
+		for (size_t field = 0; field < Model::field_count_t; ++field) {
+			this->OpenColumn(ColumnarSegment::ColumnPath(directory, static_cast<Model::FieldId>(field)), static_cast<Model::FieldId>(field));
+		}
+	} catch (...) {
+		this->Close();
+		throw;
+	}
+}
+
+void ColumnarSegment::Close()
+{
+	for (auto& column : m_columns) {
+		column.file.Close();
+		column.codes = nullptr;
+		column.dates = nullptr;
+		column.integers = nullptr;
+		column.valueRows = nullptr;
+		column.valueOffsets = nullptr;
+		column.valueBytes = nullptr;
+		column.valueCount = 0;
+	}
+
+	m_rowCount = 0;
+}
+
+Model ColumnarSegment::Row(size_t row) const
+{
+	Model model;
+	char buffer[Model::number_len_max_t];
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		model.Field(static_cast<Model::FieldId>(field), this->Value(static_cast<Model::FieldId>(field), row, buffer));
+	}
+
+	return model;
+}
+
+ColumnarSegment::Encoding ColumnarSegment::FieldEncoding(Model::FieldId field)
+{
+	switch (field) {
+		case Model::FieldId::Title:
+		case Model::FieldId::Provider:
+			return ColumnarSegment::Encoding::Dictionary;
+
+		case Model::FieldId::Date:
+			return ColumnarSegment::Encoding::Date;
+
+		case Model::FieldId::Rev:
+		case Model::FieldId::ViewTime:
+			return ColumnarSegment::Encoding::Integer;
+
+		case Model::FieldId::Stb:
+		default:
+			return ColumnarSegment::Encoding::Text;
+	}
+}
+
+std::string ColumnarSegment::ColumnPath(const std::string& directory, Model::FieldId field)
+{
+	return (std::filesystem::path(directory) / (Model::m_validFields[static_cast<size_t>(field)] + ".col")).string();
+}
+
+
+// ****************************************************************************
+// RecordSource implementation
+// ****************************************************************************
+size_t ColumnarSegment::PartitionCount() const
+{
+	return (m_rowCount + ColumnarSegment::m_partitionRowCount - 1) / ColumnarSegment::m_partitionRowCount;
+}
+
+bool ColumnarSegment::Scan(size_t partition, const Model::projection_t& fields, const RecordSource::record_consumer_t& consumer) const
+{
+	const size_t rowBegin = partition * ColumnarSegment::m_partitionRowCount;
+	const size_t rowEnd = std::min(rowBegin + ColumnarSegment::m_partitionRowCount, m_rowCount);
+
+	// Fields not asked for stay empty, and their columns are never touched.
+	Model::field_view_t record;
+	char buffers[Model::field_count_t][Model::number_len_max_t];
+	for (size_t row = rowBegin; row < rowEnd; ++row) {
+		for (auto field : fields) {
+			record[static_cast<size_t>(field)] = this->Value(field, row, buffers[static_cast<size_t>(field)]);
+		}
+
+		if (!consumer(record)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void ColumnarSegment::OpenColumn(const std::string& path, Model::FieldId field)
+{
+	ColumnarSegment::Column& column = m_columns[static_cast<size_t>(field)];
+	column.file.Open(path);
+
+	ColumnHeader header;
+	if (column.file.Size() < sizeof(header)) {
+		throw std::runtime_error("Invalid column file: " + path);
+	}
+
+	std::memcpy(&header, column.file.Data(), sizeof(header));
+	column.encoding = ColumnarSegment::FieldEncoding(field);
+	if (std::memcmp(header.magic, ColumnarSegment::m_magic, sizeof(header.magic)) != 0 || header.version != ColumnarSegment::m_version ||
+			header.field != static_cast<std::uint32_t>(field) || header.encoding != static_cast<std::uint32_t>(column.encoding)) {
+		throw std::runtime_error("Invalid column file: " + path);
+	}
+
+	// Every column of a segment holds the same rows.
+	if (field != Model::FieldId::Stb && header.rowCount != m_rowCount) {
+		throw std::runtime_error("Column file does not match the rest of its segment: " + path);
+	}
+
+	// Locate the sections, checking each fits before it is used.
+	const size_t rowCount = static_cast<size_t>(header.rowCount);
+	const size_t valueCount = static_cast<size_t>(header.valueCount);
+	const bool hasValueRows = (column.encoding == ColumnarSegment::Encoding::Date || column.encoding == ColumnarSegment::Encoding::Integer);
+	const size_t rowsBegin = sizeof(header);
+	const size_t valueRowsBegin = rowsBegin + Align(rowCount * RowWidth(column.encoding));
+	const size_t valueOffsetsBegin = valueRowsBegin + (hasValueRows ? valueCount * sizeof(std::uint64_t) : 0);
+	const size_t valueBytesBegin = valueOffsetsBegin + (valueCount + 1) * sizeof(std::uint64_t);
+	if (column.file.Size() < valueBytesBegin) {
+		throw std::runtime_error("Truncated column file: " + path);
+	}
+
+	const char* data = column.file.Data();
+	column.codes = reinterpret_cast<const std::uint32_t*>(data + rowsBegin);
+	column.dates = reinterpret_cast<const std::int32_t*>(data + rowsBegin);
+	column.integers = reinterpret_cast<const std::int64_t*>(data + rowsBegin);
+	column.valueRows = reinterpret_cast<const std::uint64_t*>(data + valueRowsBegin);
+	column.valueOffsets = reinterpret_cast<const std::uint64_t*>(data + valueOffsetsBegin);
+	column.valueBytes = data + valueBytesBegin;
+	column.valueCount = valueCount;
+	if (column.file.Size() - valueBytesBegin < column.valueOffsets[valueCount]) {
+		throw std::runtime_error("Truncated column file: " + path);
+	}
+
+	m_rowCount = rowCount;
+}
+
+std::string_view ColumnarSegment::Value(Model::FieldId field, size_t row, char* buffer) const
+{
+	const ColumnarSegment::Column& column = m_columns[static_cast<size_t>(field)];
+	switch (column.encoding) {
+		case ColumnarSegment::Encoding::Text:
+			return ColumnarSegment::Text(column, row);
+
+		case ColumnarSegment::Encoding::Dictionary:
+			return ColumnarSegment::Text(column, column.codes[row]);
+
+		case ColumnarSegment::Encoding::Date:
+			if (column.dates[row] == ColumnarSegment::m_dateException) {
+				return ColumnarSegment::Exception(column, row);
+			}
+
+			return std::string_view(buffer, Model::EncodeNumber(column.dates[row], buffer));
+
+		case ColumnarSegment::Encoding::Integer:
+			if (column.integers[row] == ColumnarSegment::m_integerException) {
+				return ColumnarSegment::Exception(column, row);
+			}
+
+			return std::string_view(buffer, Model::EncodeNumber(column.integers[row], buffer));
+
+		default:
+			return std::string_view();
+	}
+}
+
+std::string_view ColumnarSegment::Text(const ColumnarSegment::Column& column, size_t i)
+{
+	const std::uint64_t begin = column.valueOffsets[i];
+	return std::string_view(column.valueBytes + begin, static_cast<size_t>(column.valueOffsets[i + 1] - begin));
+}
+
+std::string_view ColumnarSegment::Exception(const ColumnarSegment::Column& column, size_t row)
+{
+	const std::uint64_t* end = column.valueRows + column.valueCount;
+	const std::uint64_t* valueRow = std::lower_bound(column.valueRows, end, static_cast<std::uint64_t>(row));
+	return (valueRow != end && *valueRow == row) ? ColumnarSegment::Text(column, static_cast<size_t>(valueRow - column.valueRows)) : std::string_view();
+}
+
+
+// ****************************************************************************
+// Writer construction
+// ****************************************************************************
+ColumnarSegmentWriter::ColumnarSegmentWriter() : m_columns(), m_rowCount(0)
+{
+}
+
+ColumnarSegmentWriter::~ColumnarSegmentWriter()
+{
+}
+
+ColumnarSegmentWriter::ColumnBuffer::~ColumnBuffer()
+{
+}
+
+
+// ****************************************************************************
+// Writer public API
+// ****************************************************************************
+void ColumnarSegmentWriter::Add(const Model::field_view_t& record)
+{
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		ColumnarSegmentWriter::ColumnBuffer& column = m_columns[field];
+		const std::string_view fieldValue = record[field];
+		switch (ColumnarSegment::FieldEncoding(static_cast<Model::FieldId>(field))) {
+			case ColumnarSegment::Encoding::Text:
+				ColumnarSegmentWriter::AddText(column, fieldValue);
+				break;
+
+			case ColumnarSegment::Encoding::Dictionary: {
+				auto entry = column.dictionary.emplace(std::string(fieldValue), static_cast<std::uint32_t>(column.dictionary.size()));
+				if (entry.second) {
+					ColumnarSegmentWriter::AddText(column, fieldValue);
+				}
+
+				column.codes.emplace_back(entry.first->second);
+				break;
+			}
+
+			case ColumnarSegment::Encoding::Date:
+			case ColumnarSegment::Encoding::Integer: {
+				// Only a value that is given back exactly, encoded or as its canonical text, is stored as a number.
+				std::int64_t number = 0;
+				char buffer[Model::number_len_max_t];
+				const Model::FieldType type = Model::Type(static_cast<Model::FieldId>(field));
+				const bool isDate = (type == Model::FieldType::Date);
+				const bool isNumber = Model::ParseNumber(type, fieldValue, number) &&
+					(isDate ? (number > ColumnarSegment::m_dateException && number <= std::numeric_limits<std::int32_t>::max()) : number != ColumnarSegment::m_integerException) &&
+					(fieldValue == std::string_view(buffer, Model::EncodeNumber(number, buffer)) ||
+					 fieldValue == std::string_view(buffer, Model::FormatNumber(type, number, buffer)));
+				if (isNumber && isDate) {
+					column.dates.emplace_back(static_cast<std::int32_t>(number));
+				} else if (isDate) {
+					column.dates.emplace_back(ColumnarSegment::m_dateException);
+					column.valueRows.emplace_back(m_rowCount);
+					ColumnarSegmentWriter::AddText(column, fieldValue);
+				} else if (isNumber) {
+					column.integers.emplace_back(number);
+				} else {
+					column.integers.emplace_back(ColumnarSegment::m_integerException);
+					column.valueRows.emplace_back(m_rowCount);
+					ColumnarSegmentWriter::AddText(column, fieldValue);
+				}
+
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	++m_rowCount;
+}
+
+void ColumnarSegmentWriter::Write(const std::string& directory) const
+{
+	std::filesystem::create_directories(directory);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		this->WriteColumn(ColumnarSegment::ColumnPath(directory, static_cast<Model::FieldId>(field)) + ".tmp", static_cast<Model::FieldId>(field));
+	}
+
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		const std::string columnPath = ColumnarSegment::ColumnPath(directory, static_cast<Model::FieldId>(field));
+		std::filesystem::rename(columnPath + ".tmp", columnPath);
+	}
+}
+
+
+// ****************************************************************************
+// Writer private implementation
+// ****************************************************************************
+void ColumnarSegmentWriter::AddText(ColumnarSegmentWriter::ColumnBuffer& column, std::string_view fieldValue)
+{
+	column.valueBytes.append(fieldValue);
+	column.valueOffsets.emplace_back(column.valueBytes.size());
+}
+
+void ColumnarSegmentWriter::WriteColumn(const std::string& path, Model::FieldId field) const
+{
+	const ColumnarSegmentWriter::ColumnBuffer& column = m_columns[static_cast<size_t>(field)];
+	const ColumnarSegment::Encoding encoding = ColumnarSegment::FieldEncoding(field);
+	std::vector<std::uint32_t> codes = column.codes;
+	std::vector<std::uint64_t> valueOffsets = column.valueOffsets;
+	std::string valueBytes = column.valueBytes;
+
+	// Give a dictionary's values codes in sorted order, so codes compare the way their values do.
+	if (encoding == ColumnarSegment::Encoding::Dictionary) {
+		const size_t valueCount = column.valueOffsets.size() - 1;
+		auto value = [&](std::uint32_t code)
+		{
+			return std::string_view(column.valueBytes).substr(column.valueOffsets[code], column.valueOffsets[code + 1] - column.valueOffsets[code]);
+		};
+
+		std::vector<std::uint32_t> sortedCodes(valueCount);
+		for (size_t i = 0; i < valueCount; ++i) {
+			sortedCodes[i] = static_cast<std::uint32_t>(i);
+		}
+
+		std::sort(std::begin(sortedCodes), std::end(sortedCodes), [&](std::uint32_t lhs, std::uint32_t rhs) { return value(lhs) < value(rhs); });
+
+		std::vector<std::uint32_t> sortedPositions(valueCount);
+		valueOffsets.assign(1, 0);
+		valueBytes.clear();
+		for (size_t i = 0; i < valueCount; ++i) {
+			sortedPositions[sortedCodes[i]] = static_cast<std::uint32_t>(i);
+			valueBytes.append(value(sortedCodes[i]));
+			valueOffsets.emplace_back(valueBytes.size());
+		}
+
+		for (auto& code : codes) {
+			code = sortedPositions[code];
+		}
+	}
+
+	std::ofstream columnFile(path, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!columnFile) {
+		throw std::runtime_error("Unable to create file: " + path);
+	}
+
+	ColumnHeader header = { { 0, 0, 0, 0 }, ColumnarSegment::m_version, static_cast<std::uint32_t>(encoding), static_cast<std::uint32_t>(field),
+		m_rowCount, valueOffsets.size() - 1 };
+	std::memcpy(header.magic, ColumnarSegment::m_magic, sizeof(header.magic));
+	columnFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// Per row values, padded so the sections after them stay aligned.
+	const char* rows = nullptr;
+	switch (encoding) {
+		case ColumnarSegment::Encoding::Dictionary:
+			rows = reinterpret_cast<const char*>(codes.data());
+			break;
+
+		case ColumnarSegment::Encoding::Date:
+			rows = reinterpret_cast<const char*>(column.dates.data());
+			break;
+
+		case ColumnarSegment::Encoding::Integer:
+			rows = reinterpret_cast<const char*>(column.integers.data());
+			break;
+
+		case ColumnarSegment::Encoding::Text:
+		default:
+			break;
+	}
+
+	const size_t rowsSize = m_rowCount * RowWidth(encoding);
+	const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	columnFile.write(rows, static_cast<std::streamsize>(rowsSize));
+	columnFile.write(padding, static_cast<std::streamsize>(Align(rowsSize) - rowsSize));
+
+	if (encoding == ColumnarSegment::Encoding::Date || encoding == ColumnarSegment::Encoding::Integer) {
+		columnFile.write(reinterpret_cast<const char*>(column.valueRows.data()), static_cast<std::streamsize>(column.valueRows.size() * sizeof(std::uint64_t)));
+	}
+
+	columnFile.write(reinterpret_cast<const char*>(valueOffsets.data()), static_cast<std::streamsize>(valueOffsets.size() * sizeof(std::uint64_t)));
+	columnFile.write(valueBytes.data(), static_cast<std::streamsize>(valueBytes.size()));
+	columnFile.close();
+	if (!columnFile) {
+		throw std::runtime_error("Failed to write column file: " + path);
+	}
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static size_t RowWidth(ColumnarSegment::Encoding encoding)
+{
+	switch (encoding) {
+		case ColumnarSegment::Encoding::Dictionary:
+			return sizeof(std::uint32_t);
+
+		case ColumnarSegment::Encoding::Date:
+			return sizeof(std::int32_t);
+
+		case ColumnarSegment::Encoding::Integer:
+			return sizeof(std::int64_t);
+
+		case ColumnarSegment::Encoding::Text:
+		default:
+			return 0;
+	}
+}
+
+static size_t Align(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
@@ -0,0 +1,173 @@
+#ifndef COLUMNAR_SEGMENT_H
+#define COLUMNAR_SEGMENT_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "mapped_file.h"
+#include "model.h"
+#include "record_source.h"
+
+/// Column oriented image of the datastore's records: one file per field in the segment directory,
+/// each holding that field's value for every row in an encoding suited to it:
+///     stb              Text: the values back to back, located by row offsets
+///     title, provider  Dictionary: a 32-bit code per row into the sorted distinct values
+///     date             Date: a 32-bit count of days per row
+///     rev, viewtime    Integer: a 64-bit count of cents or minutes per row
+/// Dates and integers are given back encoded, the way Model holds them. Values that are not a
+/// number of the field's type, or would not come back exactly as given, i.e. an empty or padded
+/// value, are kept as text exceptions instead.
+///
+/// The column files are memory mapped, and a scan only reads the columns of the fields it asks for.
+class ColumnarSegment : public RecordSource
+{
+	public:
+		/// How a column's values are stored.
+		enum class Encoding : std::uint32_t {
+			Text,
+			Dictionary,
+			Date,
+			Integer,
+		};
+
+		// Construction
+		ColumnarSegment();
+		ColumnarSegment(const ColumnarSegment&) = delete;
+		ColumnarSegment& operator= (const ColumnarSegment&) = delete;
+		~ColumnarSegment();
+
+		// Public API
+		/// Maps the segment in the given directory, replacing any segment already open. A directory
+		/// without column files holds an empty segment. Throws if a column file is missing or malformed.
+		void Open(const std::string& directory);
+
+		/// Releases the column files.
+		void Close();
+
+		/// Gets the number of rows in the segment.
+		size_t RowCount() const { return m_rowCount; }
+
+		/// Materializes every field of the given row.
+		Model Row(size_t row) const;
+
+		/// Gets how the given field's column is stored.
+		static ColumnarSegment::Encoding FieldEncoding(Model::FieldId field);
+
+		/// Gets the path of the given field's column file in a segment directory.
+		static std::string ColumnPath(const std::string& directory, Model::FieldId field);
+
+		// RecordSource implementation
+		/// Partitions are runs of m_partitionRowCount rows.
+		size_t PartitionCount() const override;
+		bool Scan(size_t partition, const Model::projection_t& fields, const RecordSource::record_consumer_t& consumer) const override;
+
+		/// Identifies a column file and its format version.
+		static const char m_magic[4];
+		static const std::uint32_t m_version;
+
+		/// Date and integer value standing in for a row whose text is kept as an exception.
+		static const std::int32_t m_dateException;
+		static const std::int64_t m_integerException;
+
+	private:
+		/// A mapped column file and the sections of it; only those of its encoding are set.
+		struct Column {
+			Column() : file(), encoding(ColumnarSegment::Encoding::Text), codes(nullptr), dates(nullptr), integers(nullptr),
+				valueRows(nullptr), valueOffsets(nullptr), valueBytes(nullptr), valueCount(0) {}
+			Column(const Column&) = delete;
+			Column& operator= (const Column&) = delete;
+
+			MappedFile file;
+			ColumnarSegment::Encoding encoding;
+
+			/// Per row dictionary codes, dates, or integers.
+			const std::uint32_t* codes;
+			const std::int32_t* dates;
+			const std::int64_t* integers;
+
+			/// Text values: one per row for a text column, per distinct value for a dictionary, or per
+			/// exception otherwise. Value i is valueBytes[valueOffsets[i], valueOffsets[i + 1]), and
+			/// exception i belongs to row valueRows[i].
+			const std::uint64_t* valueRows;
+			const std::uint64_t* valueOffsets;
+			const char* valueBytes;
+			size_t valueCount;
+		};
+
+		/// Maps a column file and locates its sections, checking they fit the file.
+		void OpenColumn(const std::string& path, Model::FieldId field);
+
+		/// Gets a field's value for a row; dates and integers are encoded into the buffer, which
+		/// must hold at least Model::number_len_max_t chars.
+		std::string_view Value(Model::FieldId field, size_t row, char* buffer) const;
+
+		/// Gets text value i of a column.
+		static std::string_view Text(const ColumnarSegment::Column& column, size_t i);
+
+		/// Gets the text exception kept for a row of a date or integer column.
+		static std::string_view Exception(const ColumnarSegment::Column& column, size_t row);
+
+		/// Number of rows in each partition scanned.
+		static const size_t m_partitionRowCount;
+
+		/// Columns indexed by FieldId.
+		std::array<ColumnarSegment::Column, Model::field_count_t> m_columns;
+		size_t m_rowCount;
+};
+
+
+/// Gathers rows in memory and writes them out as a columnar segment.
+class ColumnarSegmentWriter
+{
+	public:
+		// Construction
+		ColumnarSegmentWriter();
+		ColumnarSegmentWriter(const ColumnarSegmentWriter&) = delete;
+		ColumnarSegmentWriter& operator= (const ColumnarSegmentWriter&) = delete;
+		~ColumnarSegmentWriter();
+
+		// Public API
+		/// Appends a row.
+		void Add(const Model::field_view_t& record);
+
+		/// Gets the number of rows added.
+		size_t RowCount() const { return m_rowCount; }
+
+		/// Writes the rows as the segment in the given directory, creating it if needed. Each column
+		/// is written to a temporary file and only renamed over the old one once all are written.
+		void Write(const std::string& directory) const;
+
+	private:
+		/// A column being gathered; only the members of its encoding are used.
+		struct ColumnBuffer {
+			ColumnBuffer() : codes(), dates(), integers(), valueRows(), valueOffsets(1, 0), valueBytes(), dictionary() {}
+			~ColumnBuffer();
+
+			std::vector<std::uint32_t> codes;
+			std::vector<std::int32_t> dates;
+			std::vector<std::int64_t> integers;
+
+			/// Text values as laid out in the column file; a dictionary's are in code order until written.
+			std::vector<std::uint64_t> valueRows;
+			std::vector<std::uint64_t> valueOffsets;
+			std::string valueBytes;
+
+			/// Codes of a dictionary's distinct values.
+			std::unordered_map<std::string, std::uint32_t> dictionary;
+		};
+
+		/// Appends a text value to a column's values.
+		static void AddText(ColumnarSegmentWriter::ColumnBuffer& column, std::string_view fieldValue);
+
+		/// Writes a column to the given path.
+		void WriteColumn(const std::string& path, Model::FieldId field) const;
+
+		/// Columns indexed by FieldId.
+		std::array<ColumnarSegmentWriter::ColumnBuffer, Model::field_count_t> m_columns;
+		size_t m_rowCount;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "datastore_client.h"
+
+static size_t ParseCount(std::string_view& result);
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+DataStoreClient::DataStoreClient() : m_socketDescriptor(-1), m_authenticationToken(), m_input(), m_inputPosition(0)
+{
+}
+
+DataStoreClient::~DataStoreClient()
+{
+	if (m_socketDescriptor >= 0) {
+		::close(m_socketDescriptor);
+	}
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void DataStoreClient::Connect(const std::string& socketPath, const std::string& clientId, const std::string& password)
+{
+	this->Disconnect();
+
+	struct sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		throw std::invalid_argument("Socket path is too long: " + socketPath);
+	}
+
+	std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+	m_socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_socketDescriptor < 0) {
+		throw std::runtime_error("Unable to create socket: " + socketPath);
+	}
+
+	if (::connect(m_socketDescriptor, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+		::close(m_socketDescriptor);
+		m_socketDescriptor = -1;
+		throw std::runtime_error("Unable to connect to datastore server: " + socketPath);
+	}
+
+	m_authenticationToken = this->Request("CONNECT " + clientId + " " + password, [](std::string_view) {});
+}
+
+void DataStoreClient::Disconnect()
+{
+	if (m_socketDescriptor < 0) {
+		return;
+	}
+
+	// The server closes the connection once it has answered; a server already gone is no error.
+	try {
+		this->Request("DISCONNECT", [](std::string_view) {});
+	}
+	catch (std::exception&) {
+	}
+
+	::close(m_socketDescriptor);
+	m_socketDescriptor = -1;
+	m_authenticationToken.clear();
+	m_input.clear();
+	m_inputPosition = 0;
+}
+
+void DataStoreClient::Cancel()
+{
+	// Not answered on its own; the query's response ends with the error instead.
+	this->Send("CANCEL");
+}
+
+Query::ScanStatistics DataStoreClient::QueryData(const std::string& queryString, const DataStoreClient::line_sink_t& sink)
+{
+	// Requests are single lines, so the query string's own line breaks become spaces.
+	std::string request = "QUERY " + queryString;
+	for (auto& c : request) {
+		c = (c == '\n') ? ' ' : c;
+	}
+
+	const std::string result = this->Request(request, sink);
+	std::string_view remaining(result);
+	Query::ScanStatistics statistics;
+	statistics.blocksRead = ParseCount(remaining);
+	statistics.blocksSkipped = ParseCount(remaining);
+	statistics.indexedRecords = ParseCount(remaining);
+	statistics.indexField = std::string(remaining);
+	return statistics;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void DataStoreClient::Send(const std::string& request)
+{
+	if (m_socketDescriptor < 0) {
+		throw std::runtime_error("Not connected to a datastore server");
+	}
+
+	const std::string line = request + "\n";
+	std::string_view bytes(line);
+	while (!bytes.empty()) {
+		const ssize_t sent = ::send(m_socketDescriptor, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (sent < 0) {
+			throw std::runtime_error("Lost connection to datastore server");
+		}
+
+		bytes.remove_prefix(static_cast<size_t>(sent));
+	}
+}
+
+std::string DataStoreClient::Request(const std::string& request, const DataStoreClient::line_sink_t& sink)
+{
+	this->Send(request);
+
+	// Data lines until the status line; a leading '.' on a data line was doubled by the server.
+	while (true) {
+		std::string_view response = this->ReadLine();
+		if (response.empty() || response[0] != '.') {
+			sink(response);
+		} else if (response.size() >= 2 && response[1] == '.') {
+			sink(response.substr(1));
+		} else if (response == ".OK") {
+			return std::string();
+		} else if (response.substr(0, 4) == ".OK ") {
+			return std::string(response.substr(4));
+		} else if (response.substr(0, 7) == ".ERROR ") {
+			throw std::runtime_error(std::string(response.substr(7)));
+		} else {
+			throw std::runtime_error("Invalid response from datastore server: " + std::string(response));
+		}
+	}
+}
+
+std::string_view DataStoreClient::ReadLine()
+{
+	std::string::size_type lineEnd = m_input.find('\n', m_inputPosition);
+	while (lineEnd == std::string::npos) {
+		// Drop the lines already read before receiving more.
+		m_input.erase(0, m_inputPosition);
+		m_inputPosition = 0;
+
+		char buffer[64 << 10];
+		const ssize_t received = ::recv(m_socketDescriptor, buffer, sizeof(buffer), 0);
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (received <= 0) {
+			throw std::runtime_error("Lost connection to datastore server");
+		}
+
+		const size_t searchBegin = m_input.size();
+		m_input.append(buffer, static_cast<size_t>(received));
+		lineEnd = m_input.find('\n', searchBegin);
+	}
+
+	std::string_view line = std::string_view(m_input).substr(m_inputPosition, lineEnd - m_inputPosition);
+	m_inputPosition = lineEnd + 1;
+	return line;
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static size_t ParseCount(std::string_view& result)
+{
+	// Reads a count off the front of the status line's result, along with the space after it.
+	size_t count = 0;
+	auto parsed = std::from_chars(result.data(), result.data() + result.size(), count);
+	result.remove_prefix(static_cast<size_t>(parsed.ptr - result.data()));
+	if (!result.empty() && result[0] == ' ') {
+		result.remove_prefix(1);
+	}
+
+	return count;
+}
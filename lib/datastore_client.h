@@ -0,0 +1,64 @@
+#ifndef DATASTORE_CLIENT_H
+#define DATASTORE_CLIENT_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include "query.h"
+
+/// Client of a DataStoreServer: connects to its Unix domain socket, starts a session, and sends
+/// queries over it, receiving the result rows as the server produces them. Failures, including
+/// errors the server reports, are thrown.
+class DataStoreClient
+{
+	public:
+		/// Receives each result row as serialized by the server; the view is only valid during the call.
+		typedef std::function<void(std::string_view)> line_sink_t;
+
+		// Construction
+		DataStoreClient();
+		DataStoreClient(const DataStoreClient&) = delete;
+		DataStoreClient& operator= (const DataStoreClient&) = delete;
+		~DataStoreClient();
+
+		// Public API
+		/// Connects to the server listening on the socket and starts a session as the given client.
+		void Connect(const std::string& socketPath, const std::string& clientId, const std::string& password);
+
+		/// Ends the session, if any, and closes the connection.
+		void Disconnect();
+
+		/// Stops the query in flight, which then throws "Query cancelled" from QueryData(); may be called
+		/// from another thread, or from the sink.
+		void Cancel();
+
+		/// Runs a query given as a query tool command line, i.e. "-s TITLE -f REV>4.00", passing each
+		/// result row to the sink, and returns what the server's scan of the datastore read.
+		Query::ScanStatistics QueryData(const std::string& queryString, const DataStoreClient::line_sink_t& sink);
+
+		// Public accessors
+		bool IsConnected() const { return (m_socketDescriptor >= 0); }
+
+		/// Gets the session's token, as the server's datastore manager issued it.
+		const std::string& AuthenticationToken() const { return m_authenticationToken; }
+
+	private:
+		/// Sends a request line to the server.
+		void Send(const std::string& request);
+
+		/// Sends a request and passes each data line of the response to the sink; returns the
+		/// result of its status line, or throws the error it reports.
+		std::string Request(const std::string& request, const DataStoreClient::line_sink_t& sink);
+
+		/// Reads the next line from the server, without its newline; throws if the connection closes first.
+		std::string_view ReadLine();
+
+		int m_socketDescriptor;
+		std::string m_authenticationToken;
+
+		/// Bytes received from the server but not yet read as lines.
+		std::string m_input;
+		std::string::size_type m_inputPosition;
+};
+
+#endif
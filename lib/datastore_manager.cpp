@@ -1,24 +1,53 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include "datastore_manager.h"
+#include "delimiter_scanner.h"
 #include "model.h"
 
 
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t DataStoreManager::m_parseChunkSize = 1 << 20;
+const size_t DataStoreManager::m_maxQueuedBatches = 2;
+
+
 // ****************************************************************************
 // Construction
 // ****************************************************************************
 DataStoreManager::DataStoreManager(IRepository& repository, const std::string& dataStorePath)
-	: m_repository(repository), m_authenticatedClients()
+	: m_repository(repository), m_authenticatedClients(), m_clientsMutex(), m_tokenGenerator(std::random_device()()), m_scheduler(nullptr), m_resultCache(), m_resultCacheMutex()
 {
 	m_repository.Connect(dataStorePath);
 }
 
+DataStoreManager::~DataStoreManager()
+{
+}
+
 
 // ****************************************************************************
 // Public API
 // ****************************************************************************
 void DataStoreManager::ImportData(const Credentials& credentials, const std::string& importDataPath)
+{
+	this->ImportData(credentials, std::vector<std::string>{ importDataPath });
+}
+
+void DataStoreManager::ImportData(const Credentials& credentials, const std::vector<std::string>& importDataPaths)
 {
 	if (!this->Authenticate(credentials)) {
 		std::cout << "Unable to authenticate token " << credentials.AuthenticationToken()
@@ -26,35 +55,262 @@ void DataStoreManager::ImportData(const Credentials& credentials, const std::str
 		return;
 	}
 
-	std::ifstream importDataFile(importDataPath);
-	if (!importDataFile)
-	{
-		throw std::invalid_argument("Unable to open file: " + importDataPath);
+	// Open every file up front, so a missing one fails the import before anything is written.
+	std::vector<std::ifstream> importDataFiles;
+	for (auto& importDataPath : importDataPaths) {
+		importDataFiles.emplace_back(importDataPath, std::ios::in | std::ios::binary);
+		if (!importDataFiles.back()) {
+			throw std::invalid_argument("Unable to open file: " + importDataPath);
+		}
 	}
 
-	std::string record;
-	while (std::getline(importDataFile, record))
-	{
-		Model model(record);
-		if (!model)
-		{
-			continue;
-		}
+	// A repository that appends is written each batch as it is parsed, so the import never holds
+	// more than a few of them; one that rewrites itself on every write takes the import whole, so
+	// it merges every file in a single pass.
+	const bool isStreamed = m_repository.IsAppendOnly();
+	model_batch_t models;
+	this->ParseImportData(importDataFiles, [&](model_batch_t& batch)
+			{
+				if (isStreamed) {
+					m_repository.CreateModels(batch);
+				} else {
+					std::move(std::begin(batch), std::end(batch), std::back_inserter(models));
+				}
+			});
 
-		m_repository.CreateModel(model);
+	if (!isStreamed) {
+		m_repository.CreateModels(models);
 	}
 }
 
 Query::table_t DataStoreManager::QueryData(const Credentials& credentials, Query& query)
 {
 	Query::table_t results;
+	this->QueryData(credentials, query, [&](const Query::row_t& row) { results.emplace_back(row); });
+	return results;
+}
+
+void DataStoreManager::QueryData(const Credentials& credentials, Query& query, const Query::row_sink_t& sink)
+{
 	if (!this->Authenticate(credentials)) {
 		std::cout << "Unable to authenticate token " << credentials.AuthenticationToken()
 			<< " for client " << credentials.ClientId() << std::endl;
-		return results;
+		return;
+	}
+
+	// The same query against the same version of the datastore gives the same rows, however it
+	// was written. The version is read first, so the rows are never older than it.
+	const std::string queryKey = query.CanonicalForm();
+	const std::uint64_t version = m_repository.Version();
+	ResultCache::result_t cachedRows;
+	size_t maxResultSize = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		maxResultSize = m_resultCache.MaxResultSize();
+		if (maxResultSize > 0) {
+			m_resultCache.Find(queryKey, version, cachedRows);
+		}
+	}
+
+	if (cachedRows != nullptr) {
+		for (auto& row : *cachedRows) {
+			if (query.IsCancelled()) {
+				return;
+			}
+
+			sink(row);
+		}
+
+		return;
+	}
+
+	// Otherwise the rows are kept as they are passed on, until they outgrow what the cache holds.
+	std::shared_ptr<Query::table_t> rows = std::make_shared<Query::table_t>();
+	size_t resultSize = 0;
+	bool isKept = (maxResultSize > 0);
+	auto start = std::chrono::steady_clock::now();
+	m_repository.QueryData(query, [&](const Query::row_t& row)
+			{
+				if (isKept) {
+					resultSize += ResultCache::RowSize(row);
+					isKept = (resultSize <= maxResultSize);
+					if (isKept) {
+						rows->emplace_back(row);
+					} else {
+						Query::table_t().swap(*rows);
+					}
+				}
+
+				sink(row);
+			});
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	if (isKept && !query.IsCancelled()) {
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		m_resultCache.Insert(queryKey, version, rows, elapsed);
 	}
+}
 
-	return m_repository.QueryData(query);
+void DataStoreManager::ResultCacheCapacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+	m_resultCache.Capacity(capacity);
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void DataStoreManager::ParseImportData(std::vector<std::ifstream>& importDataFiles, const DataStoreManager::batch_sink_t& sink) const
+{
+	// Parsed batches wait here, in input order, for the writer; the parser stalls while
+	// m_maxQueuedBatches are waiting, which bounds the memory an import takes however large it is.
+	std::deque<model_batch_t> batches;
+	std::mutex batchesMutex;
+	std::condition_variable batchesCondition;
+	bool isParsed = false;
+	bool isStopped = false;
+	std::exception_ptr parseError;
+
+	std::thread parser([&]()
+			{
+				try {
+					size_t file = 0;
+					std::string carry = "";
+					std::vector<std::string> chunks;
+					while (this->ReadImportChunks(importDataFiles, file, carry, chunks)) {
+						model_batch_t batch = this->ParseImportChunks(chunks);
+						std::unique_lock<std::mutex> lock(batchesMutex);
+						batchesCondition.wait(lock, [&]() { return batches.size() < DataStoreManager::m_maxQueuedBatches || isStopped; });
+						if (isStopped) {
+							break;
+						}
+
+						batches.emplace_back(std::move(batch));
+						batchesCondition.notify_all();
+					}
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(batchesMutex);
+					parseError = std::current_exception();
+				}
+
+				std::lock_guard<std::mutex> lock(batchesMutex);
+				isParsed = true;
+				batchesCondition.notify_all();
+			});
+
+	// Ordered writer stage: the calling thread writes the batches one at a time as they come, while
+	// the next are parsed.
+	try {
+		while (true) {
+			model_batch_t batch;
+			{
+				std::unique_lock<std::mutex> lock(batchesMutex);
+				batchesCondition.wait(lock, [&]() { return !batches.empty() || isParsed; });
+				if (batches.empty()) {
+					break;
+				}
+
+				batch = std::move(batches.front());
+				batches.pop_front();
+				batchesCondition.notify_all();
+			}
+
+			sink(batch);
+		}
+	} catch (...) {
+		{
+			std::lock_guard<std::mutex> lock(batchesMutex);
+			isStopped = true;
+			batchesCondition.notify_all();
+		}
+
+		parser.join();
+		throw;
+	}
+
+	parser.join();
+	if (parseError != nullptr) {
+		std::rethrow_exception(parseError);
+	}
+}
+
+bool DataStoreManager::ReadImportChunks(std::vector<std::ifstream>& importDataFiles, size_t& file, std::string& carry,
+		std::vector<std::string>& chunks) const
+{
+	// One chunk per parse thread, each cut at its last newline; the partial line after it starts the next.
+	chunks.clear();
+	const size_t chunkCount = (m_scheduler != nullptr) ? m_scheduler->ThreadCount() : 1;
+	while (chunks.size() < chunkCount && file < importDataFiles.size()) {
+		std::string chunk = std::move(carry);
+		carry.clear();
+		const size_t chunkBegin = chunk.size();
+		chunk.resize(chunkBegin + DataStoreManager::m_parseChunkSize);
+		importDataFiles[file].read(&chunk[chunkBegin], static_cast<std::streamsize>(DataStoreManager::m_parseChunkSize));
+		chunk.resize(chunkBegin + static_cast<size_t>(importDataFiles[file].gcount()));
+		if (importDataFiles[file].bad()) {
+			throw std::runtime_error("Failed to read import file.");
+		}
+
+		// The last chunk of a file keeps whatever it ends with, newline or not.
+		if (importDataFiles[file].eof()) {
+			++file;
+		} else {
+			const std::string::size_type lineEnd = chunk.rfind('\n');
+			if (lineEnd == std::string::npos) {
+				carry = std::move(chunk);
+				continue;
+			}
+
+			carry.assign(chunk, lineEnd + 1, std::string::npos);
+			chunk.resize(lineEnd + 1);
+		}
+
+		if (!chunk.empty()) {
+			chunks.emplace_back(std::move(chunk));
+		}
+	}
+
+	return !chunks.empty();
+}
+
+model_batch_t DataStoreManager::ParseImportChunks(const std::vector<std::string>& chunks) const
+{
+	// Parse chunks concurrently on the scheduler, if there is one.
+	std::vector<model_batch_t> parsedChunks(chunks.size());
+	auto parseChunk = [&](size_t, size_t i)
+	{
+		Model::field_view_t fieldValues;
+		std::string_view record;
+		RecordScanner scanner(chunks[i]);
+		while (scanner.Next(record, fieldValues)) {
+			if (!record.empty()) {
+				parsedChunks[i].emplace_back(fieldValues);
+			}
+		}
+	};
+
+	if (m_scheduler != nullptr) {
+		m_scheduler->ParallelFor(chunks.size(), 1, parseChunk);
+	} else {
+		for (size_t i = 0; i < chunks.size(); ++i) {
+			parseChunk(0, i);
+		}
+	}
+
+	// Concatenate the parsed chunks back in input order.
+	size_t modelCount = 0;
+	for (auto& parsedChunk : parsedChunks) {
+		modelCount += parsedChunk.size();
+	}
+
+	model_batch_t models;
+	models.reserve(modelCount);
+	for (auto& parsedChunk : parsedChunks) {
+		std::move(std::begin(parsedChunk), std::end(parsedChunk), std::back_inserter(models));
+	}
+
+	return models;
 }
 
 
@@ -63,6 +319,7 @@ Query::table_t DataStoreManager::QueryData(const Credentials& credentials, Query
 // ****************************************************************************
 bool DataStoreManager::Authenticate(const Credentials& credentials) const
 {
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
 	if (m_authenticatedClients.count(credentials.AuthenticationToken()) == 0) {
 		return false;
 	}
@@ -76,7 +333,12 @@ Credentials DataStoreManager::Connect(const std::string& clientId, const std::st
 	Credentials credentials;
 	std::string authenticationToken = "";
 	if (!password.empty()) {
-		authenticationToken = std::to_string(std::rand()); // definitely a true random number
+		std::lock_guard<std::mutex> lock(m_clientsMutex);
+		// 64 bit tokens, drawn again in the unlikely case one is still held by another session.
+		do {
+			authenticationToken = std::to_string(m_tokenGenerator());
+		} while (m_authenticatedClients.count(authenticationToken) > 0);
+
 		credentials.AuthenticationToken(authenticationToken);
 		credentials.ClientId(clientId);
 		m_authenticatedClients[authenticationToken] = clientId;
@@ -88,6 +350,7 @@ Credentials DataStoreManager::Connect(const std::string& clientId, const std::st
 
 void DataStoreManager::Disconnect(const Credentials& credentials)
 {
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
 	if (m_authenticatedClients.count(credentials.AuthenticationToken()) == 0) {
 		return;
 	}
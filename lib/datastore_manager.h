@@ -1,11 +1,18 @@
 #ifndef DATASTORE_MANAGER_H
 #define DATASTORE_MANAGER_H
 
+#include <fstream>
+#include <functional>
 #include <string>
 #include <map>
+#include <mutex>
+#include <random>
+#include <vector>
 #include "authenticate.h"
 #include "query.h"
 #include "repository.h"
+#include "result_cache.h"
+#include "task_scheduler.h"
 
 /// Manager for data access layer
 class DataStoreManager : public IAuthenticate
@@ -13,23 +20,84 @@ class DataStoreManager : public IAuthenticate
 	public:
 		DataStoreManager() = delete;
 		DataStoreManager(IRepository& repository, const std::string& dataStorePath);
+		DataStoreManager(const DataStoreManager&) = delete;
+		DataStoreManager& operator= (const DataStoreManager&) = delete;
+		~DataStoreManager();
 
 		// Datastore API
 		void ImportData(const Credentials& credentials, const std::string& importDataPath);
+
+		/// Imports the files in the order given, the last record for a key winning. They are parsed on
+		/// the scheduler while batches already parsed are written, so memory stays bounded.
+		void ImportData(const Credentials& credentials, const std::vector<std::string>& importDataPaths);
+
 		Query::table_t QueryData(const Credentials& credentials, Query& query);
 
+		/// Streams the query's result rows to the sink as they are produced. A query already run since
+		/// the repository's last write, by any client, is answered from the result cache instead.
+		void QueryData(const Credentials& credentials, Query& query, const Query::row_sink_t& sink);
+
 		// IAuthenticate implementation
 		bool Authenticate(const Credentials& credentials) const override;
 		Credentials Connect(const std::string& clientId, const std::string& credentials) override;
 		void Disconnect(const Credentials& credentials) override;
 
+		// Public accessors
+		/// Gets the scheduler import data is parsed on; null if it is parsed on the calling thread.
+		TaskScheduler* Scheduler() const { return m_scheduler; }
+
+		/// Sets the scheduler import data is parsed on, which must outlive this object; null parses on the calling thread.
+		void Scheduler(TaskScheduler* scheduler) { m_scheduler = scheduler; }
+
+		/// Gets the cache of query results; its statistics are only settled once no query is running.
+		const ResultCache& Results() const { return m_resultCache; }
+
+		/// Sets the most bytes the result cache may hold; zero caches nothing.
+		void ResultCacheCapacity(size_t capacity);
+
 	private:
+		/// Writer of a batch of parsed import data.
+		typedef std::function<void(model_batch_t&)> batch_sink_t;
+
+		/// Reads the given files a few chunks at a time and parses each lot into a batch of models
+		/// on the scheduler, while the calling thread passes the batches already parsed to the sink
+		/// in input order.
+		void ParseImportData(std::vector<std::ifstream>& importDataFiles, const DataStoreManager::batch_sink_t& sink) const;
+
+		/// Reads the next newline aligned chunks of the import files, one per parse thread, from the
+		/// given file on; the partial line a chunk ends with is carried over to the next. Returns
+		/// false once every file has been read.
+		bool ReadImportChunks(std::vector<std::ifstream>& importDataFiles, size_t& file, std::string& carry,
+				std::vector<std::string>& chunks) const;
+
+		/// Parses chunks of import data into a batch of models, keeping the records in input order.
+		model_batch_t ParseImportChunks(const std::vector<std::string>& chunks) const;
+
+		/// Size in bytes of the newline aligned slices that import files are split into for parsing.
+		static const size_t m_parseChunkSize;
+
+		/// Number of parsed batches that may wait for the writer before parsing stalls.
+		static const size_t m_maxQueuedBatches;
+
 		/// Data access interface
 		IRepository& m_repository;
 
 		/// Map of security tokens to their respective client IDs to cache
 		/// clients that have been authenticated for using the datastore.
 		std::map<std::string, std::string> m_authenticatedClients;
+
+		/// Guards the authenticated clients, so sessions can be checked from the threads running their queries.
+		mutable std::mutex m_clientsMutex;
+
+		/// Draws authentication tokens; seeded once from std::random_device and guarded by m_clientsMutex.
+		std::mt19937_64 m_tokenGenerator;
+
+		/// Scheduler import data is parsed on, if any; not owned.
+		TaskScheduler* m_scheduler;
+
+		/// Results of recent queries, shared by the threads running queries and guarded by m_resultCacheMutex.
+		ResultCache m_resultCache;
+		std::mutex m_resultCacheMutex;
 };
 
 #endif
@@ -0,0 +1,684 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "datastore_server.h"
+#include "query.h"
+
+static int WatchDescriptor(int epollDescriptor, int operation, int descriptor, std::uint32_t events);
+static void AppendDataLine(std::string& buffer, std::string_view line);
+static std::string StatusLine(std::string status);
+
+
+// ****************************************************************************
+// Session state
+// ****************************************************************************
+struct DataStoreServer::Session
+{
+	explicit Session(int sessionDescriptor)
+		: descriptor(sessionDescriptor), credentials(), input(), requests(), events(0), isBusy(false), isClosing(false),
+		  cancellation(), mutex(), drained(), output(), isQueryDone(false)
+	{
+	}
+
+	/// Socket of the connection; -1 once closed. The rest of this block is only used by the event loop.
+	int descriptor;
+	Credentials credentials;
+
+	/// Bytes received after the last whole request, and the requests not yet started.
+	std::string input;
+	std::deque<std::string> requests;
+
+	/// Events the socket is watched for.
+	std::uint32_t events;
+
+	/// True while a query of the session is queued or running, and once the client sent its last request.
+	bool isBusy;
+	bool isClosing;
+
+	/// Token of the query in flight.
+	std::shared_ptr<CancellationToken> cancellation;
+
+	/// Guards the output shared with the worker running the session's query, which waits on
+	/// drained while the output is over m_maxPendingBytes.
+	std::mutex mutex;
+	std::condition_variable drained;
+	std::string output;
+	bool isQueryDone;
+};
+
+DataStoreServer::Job::Job() : session(), queryString(), cancellation(), isNestable(true)
+{
+}
+
+DataStoreServer::Job::Job(const std::shared_ptr<DataStoreServer::Session>& jobSession, const std::string& jobQueryString,
+		const std::shared_ptr<CancellationToken>& jobCancellation)
+	: session(jobSession), queryString(jobQueryString), cancellation(jobCancellation), isNestable(true)
+{
+}
+
+DataStoreServer::Job::~Job()
+{
+}
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t DataStoreServer::m_sendBufferSize = 64 << 10;
+const size_t DataStoreServer::m_maxPendingBytes = 256 << 10;
+const size_t DataStoreServer::m_maxQueuedRequests = 64;
+const size_t DataStoreServer::m_maxRequestSize = 64 << 10;
+const std::chrono::milliseconds DataStoreServer::m_yieldQuantum(2);
+const size_t DataStoreServer::m_maxYieldDepth = 8;
+const size_t DataStoreServer::m_maxNestedOutput = 64 << 10;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+DataStoreServer::DataStoreServer(DataStoreManager& dataStore, const std::string& socketPath, size_t workerCount)
+	: m_dataStore(dataStore), m_socketPath(socketPath), m_workerCount(std::max<size_t>(workerCount, 1)),
+	  m_listenDescriptor(-1), m_epollDescriptor(-1), m_wakeDescriptor(-1), m_isListening(false), m_isStopping(false),
+	  m_sessions(), m_jobMutex(), m_jobCondition(), m_jobs(), m_notifiedSessions(), m_areWorkersStopping(false), m_workers(),
+	  m_connections(0), m_requests(0), m_cancellations(0), m_yields(0), m_peakPendingBytes(0)
+{
+	m_wakeDescriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_wakeDescriptor < 0) {
+		throw std::runtime_error("Unable to create server event counter");
+	}
+}
+
+DataStoreServer::~DataStoreServer()
+{
+	::close(m_wakeDescriptor);
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void DataStoreServer::Run()
+{
+	struct sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (m_socketPath.size() >= sizeof(address.sun_path)) {
+		throw std::invalid_argument("Socket path is too long: " + m_socketPath);
+	}
+
+	std::memcpy(address.sun_path, m_socketPath.c_str(), m_socketPath.size() + 1);
+	m_listenDescriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_listenDescriptor < 0) {
+		throw std::runtime_error("Unable to create socket: " + m_socketPath);
+	}
+
+	// A socket file left by a server that didn't shut down cleanly would fail the bind.
+	::unlink(m_socketPath.c_str());
+	m_epollDescriptor = ::epoll_create1(EPOLL_CLOEXEC);
+	if (::bind(m_listenDescriptor, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0 ||
+			::listen(m_listenDescriptor, SOMAXCONN) != 0 || m_epollDescriptor < 0 ||
+			WatchDescriptor(m_epollDescriptor, EPOLL_CTL_ADD, m_listenDescriptor, EPOLLIN) != 0 ||
+			WatchDescriptor(m_epollDescriptor, EPOLL_CTL_ADD, m_wakeDescriptor, EPOLLIN) != 0) {
+		::close(m_listenDescriptor);
+		::close(m_epollDescriptor);
+		m_listenDescriptor = -1;
+		m_epollDescriptor = -1;
+		throw std::runtime_error("Unable to listen on socket: " + m_socketPath);
+	}
+
+	m_areWorkersStopping = false;
+	for (size_t i = 0; i < m_workerCount; ++i) {
+		m_workers.emplace_back(&DataStoreServer::WorkerLoop, this);
+	}
+
+	m_isListening = true;
+	struct epoll_event events[64];
+	while (!m_isStopping) {
+		const int eventCount = ::epoll_wait(m_epollDescriptor, events, static_cast<int>(sizeof(events) / sizeof(events[0])), -1);
+		if (eventCount < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (eventCount < 0) {
+			break;
+		}
+
+		for (int i = 0; i < eventCount; ++i) {
+			const int descriptor = events[i].data.fd;
+			if (descriptor == m_listenDescriptor) {
+				this->Accept();
+				continue;
+			}
+
+			if (descriptor == m_wakeDescriptor) {
+				std::uint64_t wakeCount = 0;
+				while (::read(m_wakeDescriptor, &wakeCount, sizeof(wakeCount)) > 0) {
+				}
+
+				continue;
+			}
+
+			auto found = m_sessions.find(descriptor);
+			if (found == std::end(m_sessions)) {
+				continue;
+			}
+
+			// A client that hung up entirely can't read its results, so its query is cancelled.
+			std::shared_ptr<DataStoreServer::Session> session = found->second;
+			if ((events[i].events & (EPOLLHUP | EPOLLERR)) != 0) {
+				this->Close(session);
+			} else if ((events[i].events & EPOLLIN) != 0) {
+				this->Receive(session);
+			} else {
+				this->Dispatch(session);
+			}
+		}
+
+		// Send what workers queued since, and start the next requests of sessions whose query finished.
+		std::vector<std::shared_ptr<DataStoreServer::Session>> notifiedSessions;
+		{
+			std::lock_guard<std::mutex> lock(m_jobMutex);
+			notifiedSessions.swap(m_notifiedSessions);
+		}
+
+		for (auto& session : notifiedSessions) {
+			this->Dispatch(session);
+		}
+	}
+
+	// Cancel whatever is still running, then let the workers finish with it.
+	m_isListening = false;
+	while (!m_sessions.empty()) {
+		std::shared_ptr<DataStoreServer::Session> session = std::begin(m_sessions)->second;
+		this->Close(session);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_areWorkersStopping = true;
+	}
+
+	m_jobCondition.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+
+	m_workers.clear();
+	m_jobs.clear();
+	m_notifiedSessions.clear();
+	::close(m_epollDescriptor);
+	::close(m_listenDescriptor);
+	m_epollDescriptor = -1;
+	m_listenDescriptor = -1;
+	::unlink(m_socketPath.c_str());
+}
+
+void DataStoreServer::Stop()
+{
+	// Only touches an atomic and writes the event counter, so a signal handler may call it.
+	m_isStopping = true;
+	const std::uint64_t wakeCount = 1;
+	if (::write(m_wakeDescriptor, &wakeCount, sizeof(wakeCount)) < 0) {
+		return;
+	}
+}
+
+
+// ****************************************************************************
+// Event loop
+// ****************************************************************************
+void DataStoreServer::Accept()
+{
+	while (true) {
+		const int descriptor = ::accept4(m_listenDescriptor, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (descriptor < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (descriptor < 0) {
+			return;
+		}
+
+		auto session = std::make_shared<DataStoreServer::Session>(descriptor);
+		if (WatchDescriptor(m_epollDescriptor, EPOLL_CTL_ADD, descriptor, EPOLLIN | EPOLLRDHUP) != 0) {
+			::close(descriptor);
+			continue;
+		}
+
+		session->events = EPOLLIN | EPOLLRDHUP;
+		m_sessions[descriptor] = session;
+		++m_connections;
+	}
+}
+
+void DataStoreServer::Receive(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	char buffer[64 << 10];
+	while (session->requests.size() < DataStoreServer::m_maxQueuedRequests) {
+		const ssize_t received = ::recv(session->descriptor, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+
+		if (received < 0) {
+			this->Close(session);
+			return;
+		}
+
+		// The client is done sending; what it asked for is still answered.
+		if (received == 0) {
+			session->isClosing = true;
+			break;
+		}
+
+		// Queue every whole request; a cancellation takes effect at once rather than in turn.
+		session->input.append(buffer, static_cast<size_t>(received));
+		std::string::size_type requestBegin = 0;
+		std::string::size_type requestEnd = session->input.find('\n');
+		while (requestEnd != std::string::npos) {
+			std::string request = session->input.substr(requestBegin, requestEnd - requestBegin);
+			if (request == "CANCEL") {
+				++m_requests;
+				if (session->isBusy && session->cancellation && !session->cancellation->IsCancelled()) {
+					++m_cancellations;
+					session->cancellation->Cancel();
+					std::lock_guard<std::mutex> lock(session->mutex);
+					session->drained.notify_all();
+				}
+			} else {
+				session->requests.emplace_back(std::move(request));
+			}
+
+			requestBegin = requestEnd + 1;
+			requestEnd = session->input.find('\n', requestBegin);
+		}
+
+		session->input.erase(0, requestBegin);
+		if (session->input.size() > DataStoreServer::m_maxRequestSize) {
+			this->Close(session);
+			return;
+		}
+	}
+
+	this->Dispatch(session);
+}
+
+void DataStoreServer::Dispatch(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	do {
+		while (session->descriptor >= 0 && !session->isBusy && !session->requests.empty()) {
+			std::string request = std::move(session->requests.front());
+			session->requests.pop_front();
+			this->HandleRequest(session, request);
+		}
+	} while (session->descriptor >= 0 && this->Flush(session));
+
+	if (session->descriptor < 0) {
+		return;
+	}
+
+	// Once every request of a client that stopped sending is answered and sent, it is done with.
+	bool isFlushed = false;
+	{
+		std::lock_guard<std::mutex> lock(session->mutex);
+		isFlushed = session->output.empty();
+	}
+
+	if (session->isClosing && !session->isBusy && session->requests.empty() && isFlushed) {
+		this->Close(session);
+		return;
+	}
+
+	this->UpdateEvents(session);
+}
+
+void DataStoreServer::HandleRequest(const std::shared_ptr<DataStoreServer::Session>& session, const std::string& request)
+{
+	++m_requests;
+	const std::string::size_type separator = request.find(' ');
+	const std::string verb = request.substr(0, separator);
+	const std::string arguments = (separator != std::string::npos) ? request.substr(separator + 1) : std::string();
+
+	std::string status;
+	if (verb == "CONNECT") {
+		const std::string::size_type argumentSeparator = arguments.find(' ');
+		const std::string clientId = arguments.substr(0, argumentSeparator);
+		const std::string password = (argumentSeparator != std::string::npos) ? arguments.substr(argumentSeparator + 1) : std::string();
+		m_dataStore.Disconnect(session->credentials);
+		session->credentials = m_dataStore.Connect(clientId, password);
+		status = m_dataStore.Authenticate(session->credentials) ? ".OK " + session->credentials.AuthenticationToken() :
+			".ERROR Unable to connect client " + clientId;
+	} else if (verb == "QUERY" && !m_dataStore.Authenticate(session->credentials)) {
+		status = ".ERROR Not connected";
+	} else if (verb == "QUERY") {
+		// Answered by a worker; the session's later requests wait for it.
+		session->isBusy = true;
+		session->cancellation = std::make_shared<CancellationToken>();
+		{
+			std::lock_guard<std::mutex> lock(m_jobMutex);
+			m_jobs.emplace_back(session, arguments, session->cancellation);
+		}
+
+		m_jobCondition.notify_one();
+		return;
+	} else if (verb == "DISCONNECT") {
+		m_dataStore.Disconnect(session->credentials);
+		session->credentials = Credentials();
+		session->isClosing = true;
+		session->requests.clear();
+		status = ".OK";
+	} else {
+		status = ".ERROR Unknown request " + verb;
+	}
+
+	std::lock_guard<std::mutex> lock(session->mutex);
+	session->output.append(StatusLine(status));
+}
+
+bool DataStoreServer::Flush(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	bool isBroken = false;
+	bool isQueryDone = false;
+	{
+		std::lock_guard<std::mutex> lock(session->mutex);
+		size_t sentBytes = 0;
+		while (sentBytes < session->output.size()) {
+			const ssize_t sent = ::send(session->descriptor, session->output.data() + sentBytes, session->output.size() - sentBytes,
+					MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (sent < 0) {
+				isBroken = (errno != EAGAIN && errno != EWOULDBLOCK);
+				break;
+			}
+
+			sentBytes += static_cast<size_t>(sent);
+		}
+
+		session->output.erase(0, sentBytes);
+		if (session->output.size() < DataStoreServer::m_maxPendingBytes) {
+			session->drained.notify_all();
+		}
+
+		isQueryDone = session->isQueryDone;
+		session->isQueryDone = false;
+	}
+
+	if (isBroken) {
+		this->Close(session);
+		return false;
+	}
+
+	if (isQueryDone) {
+		session->isBusy = false;
+		session->cancellation.reset();
+	}
+
+	return (isQueryDone && !session->requests.empty());
+}
+
+void DataStoreServer::UpdateEvents(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	std::uint32_t events = 0;
+	if (!session->isClosing && session->requests.size() < DataStoreServer::m_maxQueuedRequests) {
+		events |= EPOLLIN | EPOLLRDHUP;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(session->mutex);
+		events |= session->output.empty() ? 0 : static_cast<std::uint32_t>(EPOLLOUT);
+	}
+
+	if (events != session->events) {
+		WatchDescriptor(m_epollDescriptor, EPOLL_CTL_MOD, session->descriptor, events);
+		session->events = events;
+	}
+}
+
+void DataStoreServer::Close(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	if (session->descriptor < 0) {
+		return;
+	}
+
+	::epoll_ctl(m_epollDescriptor, EPOLL_CTL_DEL, session->descriptor, nullptr);
+	::close(session->descriptor);
+	m_sessions.erase(session->descriptor);
+	session->descriptor = -1;
+	session->requests.clear();
+	m_dataStore.Disconnect(session->credentials);
+
+	// Its query stops at the next partition, and stops waiting for output to drain.
+	if (session->cancellation) {
+		session->cancellation->Cancel();
+		std::lock_guard<std::mutex> lock(session->mutex);
+		session->drained.notify_all();
+	}
+}
+
+
+// ****************************************************************************
+// Workers
+// ****************************************************************************
+void DataStoreServer::WorkerLoop()
+{
+	while (true) {
+		DataStoreServer::Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_jobMutex);
+			m_jobCondition.wait(lock, [&]() { return (m_areWorkersStopping || !m_jobs.empty()); });
+			if (m_areWorkersStopping) {
+				return;
+			}
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		this->RunQuery(job, 0);
+	}
+}
+
+void DataStoreServer::RunQuery(const DataStoreServer::Job& job, size_t depth)
+{
+	DataStoreServer::Session& session = *job.session;
+	const CancellationToken& cancellation = *job.cancellation;
+	const bool isNested = (depth > 0);
+	std::string status;
+	try {
+		// A nested scan stops on a token of its own, so it can give up without cancelling the
+		// client's query; the client's cancellation is passed on to it as the scan goes.
+		CancellationToken stop;
+		bool isOverflowed = false;
+		Query query(job.queryString);
+		query.Cancellation(isNested ? &stop : &cancellation);
+
+		// Between partitions, a scan that has had its quantum runs the queries waiting, if any,
+		// before going on. A waiting scan run that way yields in turn, so the queries behind it
+		// still get through.
+		auto quantumBegin = std::chrono::steady_clock::now();
+		query.YieldPoint([&]()
+				{
+					if (cancellation.IsCancelled()) {
+						stop.Cancel();
+					}
+
+					if (depth + 1 >= DataStoreServer::m_maxYieldDepth ||
+							std::chrono::steady_clock::now() - quantumBegin < DataStoreServer::m_yieldQuantum) {
+						return;
+					}
+
+					DataStoreServer::Job waitingJob;
+					while (this->TryTakeJob(waitingJob)) {
+						++m_yields;
+						this->RunQuery(waitingJob, depth + 1);
+					}
+
+					quantumBegin = std::chrono::steady_clock::now();
+				});
+
+		// A nested query runs on another query's thread, so it must never wait on its own client:
+		// it holds its rows until it is done, and gives up to be run again by a worker of its own
+		// once they pass m_maxNestedOutput, having sent nothing yet.
+		std::string output;
+		if (!cancellation.IsCancelled()) {
+			m_dataStore.QueryData(session.credentials, query, [&](const Query::row_t& row)
+					{
+						if (cancellation.IsCancelled()) {
+							stop.Cancel();
+						}
+
+						if (isOverflowed) {
+							return;
+						}
+
+						AppendDataLine(output, row.ToString(Model::SerializeMode::Query));
+						if (!isNested && output.size() >= DataStoreServer::m_sendBufferSize) {
+							this->Deliver(job, output, true);
+						} else if (isNested && output.size() > DataStoreServer::m_maxNestedOutput) {
+							isOverflowed = true;
+							stop.Cancel();
+						}
+					});
+		}
+
+		if (isOverflowed && !cancellation.IsCancelled()) {
+			this->RequeueJob(job);
+			return;
+		}
+
+		this->Deliver(job, output, !isNested);
+		if (cancellation.IsCancelled()) {
+			status = ".ERROR Query cancelled";
+		} else {
+			const Query::ScanStatistics& statistics = query.ScanStats();
+			status = ".OK " + std::to_string(statistics.blocksRead) + " " + std::to_string(statistics.blocksSkipped) + " " +
+				std::to_string(statistics.indexedRecords);
+			if (!statistics.indexField.empty()) {
+				status.append(" ").append(statistics.indexField);
+			}
+		}
+	}
+	catch (std::exception& e) {
+		status = ".ERROR " + std::string(e.what());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(session.mutex);
+		session.output.append(StatusLine(status));
+		session.isQueryDone = true;
+	}
+
+	this->Notify(job.session);
+}
+
+void DataStoreServer::Deliver(const DataStoreServer::Job& job, std::string& output, bool canWait)
+{
+	if (output.empty()) {
+		return;
+	}
+
+	DataStoreServer::Session& session = *job.session;
+	const CancellationToken& cancellation = *job.cancellation;
+	{
+		// Backpressure: the query waits here until its client has read enough of what is pending.
+		std::unique_lock<std::mutex> lock(session.mutex);
+		if (canWait) {
+			session.drained.wait(lock, [&]() { return (session.output.size() < DataStoreServer::m_maxPendingBytes || cancellation.IsCancelled()); });
+		}
+
+		if (!cancellation.IsCancelled()) {
+			session.output.append(output);
+			size_t peakPendingBytes = m_peakPendingBytes.load();
+			while (session.output.size() > peakPendingBytes && !m_peakPendingBytes.compare_exchange_weak(peakPendingBytes, session.output.size())) {
+			}
+		}
+	}
+
+	output.clear();
+	this->Notify(job.session);
+}
+
+bool DataStoreServer::TryTakeJob(DataStoreServer::Job& job)
+{
+	std::lock_guard<std::mutex> lock(m_jobMutex);
+	if (m_areWorkersStopping) {
+		return false;
+	}
+
+	auto waitingJob = std::find_if(std::begin(m_jobs), std::end(m_jobs), [](const DataStoreServer::Job& queued) { return queued.isNestable; });
+	if (waitingJob == std::end(m_jobs)) {
+		return false;
+	}
+
+	job = std::move(*waitingJob);
+	m_jobs.erase(waitingJob);
+	return true;
+}
+
+void DataStoreServer::RequeueJob(const DataStoreServer::Job& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_jobs.emplace_front(job);
+		m_jobs.front().isNestable = false;
+	}
+
+	m_jobCondition.notify_one();
+}
+
+void DataStoreServer::Notify(const std::shared_ptr<DataStoreServer::Session>& session)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_notifiedSessions.emplace_back(session);
+	}
+
+	const std::uint64_t wakeCount = 1;
+	if (::write(m_wakeDescriptor, &wakeCount, sizeof(wakeCount)) < 0) {
+		return;
+	}
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static int WatchDescriptor(int epollDescriptor, int operation, int descriptor, std::uint32_t events)
+{
+	struct epoll_event event;
+	std::memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = descriptor;
+	return ::epoll_ctl(epollDescriptor, operation, descriptor, &event);
+}
+
+static void AppendDataLine(std::string& buffer, std::string_view line)
+{
+	if (!line.empty() && line[0] == '.') {
+		buffer.append(1, '.');
+	}
+
+	buffer.append(line).append(1, '\n');
+}
+
+static std::string StatusLine(std::string status)
+{
+	// Messages are kept to one line, so the client always finds the end of the response.
+	std::replace(std::begin(status), std::end(status), '\n', ' ');
+	return status.append(1, '\n');
+}
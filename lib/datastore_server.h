@@ -0,0 +1,197 @@
+#ifndef DATASTORE_SERVER_H
+#define DATASTORE_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "authenticate.h"
+#include "datastore_manager.h"
+#include "task_scheduler.h"
+
+/// Serves queries against a datastore held open by a long running process, over a Unix domain
+/// socket, so the datastore, its indexes and its caches stay resident between queries instead of
+/// being reopened by every query process.
+///
+/// Clients send newline terminated requests, each answered with zero or more data lines and then
+/// a status line of ".OK [result]" or ".ERROR <message>". A data line starting with '.' is sent
+/// with another '.' in front, so it can't be mistaken for the status line:
+///     CONNECT <client id> <password>   starts a session for the connection; ".OK <token>"
+///     QUERY <query string>             a query tool command line, i.e. "-s TITLE -f REV>4.00"; the
+///                                      result rows as data lines, then ".OK <blocks read>
+///                                      <blocks skipped> <indexed records> [<index field>]"
+///     CANCEL                           stops the connection's query in flight, which then ends with
+///                                      ".ERROR Query cancelled"; not answered itself
+///     DISCONNECT                       ends the session and closes the connection
+/// Requests of a connection are answered in order, one query at a time.
+///
+/// A single thread runs an epoll event loop over every connection, doing all of the socket I/O,
+/// while queries run on a pool of worker threads. A query's rows are queued for its connection
+/// and the worker pauses once m_maxPendingBytes are waiting for a slow client, so a client that
+/// stops reading holds back only its own query. A scan that has run for m_yieldQuantum lets the
+/// waiting queries run on its thread between partitions, so a few long scans can't starve short
+/// queries of workers. A query run that way never waits on its client: it sends its rows once it
+/// is done, and one with more than m_maxNestedOutput of them is put back to wait for a worker of
+/// its own instead.
+class DataStoreServer
+{
+	public:
+		// Construction
+		DataStoreServer() = delete;
+		DataStoreServer(DataStoreManager& dataStore, const std::string& socketPath, size_t workerCount);
+		DataStoreServer(const DataStoreServer&) = delete;
+		DataStoreServer& operator= (const DataStoreServer&) = delete;
+		~DataStoreServer();
+
+		// Public API
+		/// Listens on the socket, replacing a stale socket file, and serves clients until Stop() is
+		/// called; queries in flight are then cancelled. Throws if the socket can't be bound.
+		void Run();
+
+		/// Asks Run() to return; safe to call from another thread or a signal handler.
+		void Stop();
+
+		// Public accessors
+		/// True once the socket is listening, until Run() returns.
+		bool IsListening() const { return m_isListening.load(); }
+
+		/// Gets the number of threads queries are run on.
+		size_t WorkerCount() const { return m_workerCount; }
+
+		size_t Connections() const { return m_connections; }
+		size_t Requests() const { return m_requests; }
+		size_t Cancellations() const { return m_cancellations; }
+
+		/// Gets how many queries ran on another query's thread, while it yielded between partitions.
+		size_t Yields() const { return m_yields.load(); }
+
+		/// Gets the most result bytes any connection had waiting to be sent.
+		size_t PeakPendingBytes() const { return m_peakPendingBytes.load(); }
+
+		/// Size in bytes a query's rows are batched up to before being queued for its connection.
+		static const size_t m_sendBufferSize;
+
+		/// Result bytes a connection may have waiting to be sent before its query pauses.
+		static const size_t m_maxPendingBytes;
+
+		/// Requests a connection may have waiting before the server stops reading from it.
+		static const size_t m_maxQueuedRequests;
+
+		/// Longest request line accepted; a connection sending a longer one is closed.
+		static const size_t m_maxRequestSize;
+
+		/// How long a query scans before letting the waiting queries run on its thread.
+		static const std::chrono::milliseconds m_yieldQuantum;
+
+		/// Most queries a worker thread runs inside one another by yielding.
+		static const size_t m_maxYieldDepth;
+
+		/// Result bytes a query run inside another may hold before it gives up its turn.
+		static const size_t m_maxNestedOutput;
+
+	private:
+		/// State of a connected client, shared by the event loop and the worker running its query.
+		struct Session;
+
+		/// A query waiting for a worker.
+		struct Job {
+			Job();
+			Job(const std::shared_ptr<DataStoreServer::Session>& jobSession, const std::string& jobQueryString,
+					const std::shared_ptr<CancellationToken>& jobCancellation);
+			~Job();
+
+			std::shared_ptr<DataStoreServer::Session> session;
+			std::string queryString;
+			std::shared_ptr<CancellationToken> cancellation;
+
+			/// False once the query gave up running inside another, so only a worker of its own takes it.
+			bool isNestable;
+		};
+
+		/// Accepts every pending connection.
+		void Accept();
+
+		/// Reads what the client sent and queues its whole requests; closes the session once the client hangs up.
+		void Receive(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Starts the session's queued requests in order until one is a query, which goes to a worker,
+		/// sends its output, and closes it once a client that stopped sending has been answered.
+		void Dispatch(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Answers a request on the event loop, or queues it for a worker if it is a query.
+		void HandleRequest(const std::shared_ptr<DataStoreServer::Session>& session, const std::string& request);
+
+		/// Sends as much of the session's pending output as the socket takes, waking its query once
+		/// drained. Returns true if its query has finished and more requests are waiting.
+		bool Flush(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Watches the session's socket for reads while it has room for requests, and for writes while it has output.
+		void UpdateEvents(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Cancels the session's query, if any, ends its session, and closes its socket.
+		void Close(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Runs queries as they are queued until the server stops.
+		void WorkerLoop();
+
+		/// Runs a query, queuing its rows and then its status line for the session; depth counts the
+		/// queries it runs inside of on this thread.
+		void RunQuery(const DataStoreServer::Job& job, size_t depth);
+
+		/// Queues a query's rows for its session, first waiting while too many are pending, if it can
+		/// wait, unless the query is cancelled, and clears them.
+		void Deliver(const DataStoreServer::Job& job, std::string& output, bool canWait);
+
+		/// Takes the oldest queued query that may run inside another, if any.
+		bool TryTakeJob(DataStoreServer::Job& job);
+
+		/// Puts a query that gave up running inside another back at the front of the queue, for the
+		/// next free worker.
+		void RequeueJob(const DataStoreServer::Job& job);
+
+		/// Asks the event loop to look at the session's output and progress.
+		void Notify(const std::shared_ptr<DataStoreServer::Session>& session);
+
+		/// Datastore queries are run against.
+		DataStoreManager& m_dataStore;
+		std::string m_socketPath;
+		size_t m_workerCount;
+
+		int m_listenDescriptor;
+		int m_epollDescriptor;
+
+		/// Event counter workers and Stop() signal the event loop through.
+		int m_wakeDescriptor;
+
+		std::atomic<bool> m_isListening;
+		std::atomic<bool> m_isStopping;
+
+		/// Connected sessions by socket; only used by the event loop.
+		std::map<int, std::shared_ptr<DataStoreServer::Session>> m_sessions;
+
+		/// Queries waiting for a worker, and sessions a worker queued output for, guarded by m_jobMutex.
+		std::mutex m_jobMutex;
+		std::condition_variable m_jobCondition;
+		std::deque<DataStoreServer::Job> m_jobs;
+		std::vector<std::shared_ptr<DataStoreServer::Session>> m_notifiedSessions;
+		bool m_areWorkersStopping;
+
+		std::vector<std::thread> m_workers;
+
+		/// Clients served, requests answered, and queries cancelled.
+		size_t m_connections;
+		size_t m_requests;
+		size_t m_cancellations;
+		std::atomic<size_t> m_yields;
+		std::atomic<size_t> m_peakPendingBytes;
+};
+
+#endif
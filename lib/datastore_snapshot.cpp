@@ -0,0 +1,22 @@
+#include <stdexcept>
+#include "datastore_snapshot.h"
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+DataStoreSnapshot::DataStoreSnapshot(std::uint64_t version, const std::shared_ptr<const MappedFile>& dataStore, std::uintmax_t dataStoreSize,
+		const KeyIndex::offset_run_list_t& deadRuns, const ZoneMap& zoneMap)
+	: m_version(version), m_dataStore(dataStore), m_view(), m_deadRuns(deadRuns), m_zoneMap(zoneMap)
+{
+	// The mapping may already hold writes past the snapshot, which it leaves out.
+	if (m_dataStore->Size() < dataStoreSize) {
+		throw std::runtime_error("Datastore mapping is smaller than its snapshot.");
+	}
+
+	m_view = m_dataStore->View().substr(0, static_cast<size_t>(dataStoreSize));
+}
+
+DataStoreSnapshot::~DataStoreSnapshot()
+{
+}
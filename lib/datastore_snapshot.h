@@ -0,0 +1,52 @@
+#ifndef DATASTORE_SNAPSHOT_H
+#define DATASTORE_SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "key_index.h"
+#include "mapped_file.h"
+#include "zone_map.h"
+
+/// Immutable point in time view of a datastore, as of one version of its writes: a mapping of its
+/// log cut off at the size it had then, with the dead lines and block statistics it had then.
+///
+/// The log is only ever appended to, so the bytes a snapshot maps never change under it, and a
+/// compaction renames a new file over the log rather than rewriting it, leaving the mapping on the
+/// old one. Snapshots share one mapping until the log outgrows it, and share the runs of dead
+/// offsets and the sealed zone map segments too, so taking one costs little more than the writes
+/// since the last. A query scans a snapshot without any lock while writes carry on past its end.
+class DataStoreSnapshot
+{
+	public:
+		// Construction
+		DataStoreSnapshot() = delete;
+		/// Takes the first dataStoreSize bytes of the mapping of the datastore's log, which it keeps.
+		DataStoreSnapshot(std::uint64_t version, const std::shared_ptr<const MappedFile>& dataStore, std::uintmax_t dataStoreSize,
+				const KeyIndex::offset_run_list_t& deadRuns, const ZoneMap& zoneMap);
+		DataStoreSnapshot(const DataStoreSnapshot&) = delete;
+		DataStoreSnapshot& operator= (const DataStoreSnapshot&) = delete;
+		~DataStoreSnapshot();
+
+		// Public accessors
+		/// Gets the version of the datastore's writes the snapshot was taken at.
+		std::uint64_t Version() const { return m_version; }
+
+		/// Gets the datastore's records as of the snapshot.
+		std::string_view View() const { return m_view; }
+
+		/// Gets the offsets of the dead lines of the view, as runs each in order.
+		const KeyIndex::offset_run_list_t& DeadRuns() const { return m_deadRuns; }
+
+		/// Gets the block statistics of the view.
+		const ZoneMap& Zones() const { return m_zoneMap; }
+
+	private:
+		std::uint64_t m_version;
+		std::shared_ptr<const MappedFile> m_dataStore;
+		std::string_view m_view;
+		KeyIndex::offset_run_list_t m_deadRuns;
+		ZoneMap m_zoneMap;
+};
+
+#endif
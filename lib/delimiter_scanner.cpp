@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "delimiter_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DELIMITER_SCANNER_X86
+#endif
+
+static size_t ScanScalar(const char* data, size_t size, std::uint32_t* offsets);
+#ifdef DELIMITER_SCANNER_X86
+static size_t ScanSse2(const char* data, size_t size, std::uint32_t* offsets);
+static size_t ScanAvx2(const char* data, size_t size, std::uint32_t* offsets);
+#endif
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t DelimiterScanner::m_maxScanSize = std::numeric_limits<std::uint32_t>::max();
+const size_t RecordScanner::m_blockSize = 256 << 10;
+
+
+// ****************************************************************************
+// DelimiterScanner public API
+// ****************************************************************************
+size_t DelimiterScanner::Scan(DelimiterScanner::Kernel kernel, const char* data, size_t size, DelimiterScanner::offset_list_t& offsets)
+{
+	if (size > DelimiterScanner::m_maxScanSize) {
+		throw std::invalid_argument("Buffer is too large to index delimiters in one pass.");
+	}
+
+	if (!DelimiterScanner::IsSupported(kernel)) {
+		throw std::invalid_argument(std::string("Delimiter kernel not supported by this CPU: ") + DelimiterScanner::KernelName(kernel));
+	}
+
+	// Every byte could be a delimiter (plus one the caller may append), so size for the worst case.
+	if (offsets.size() <= size) {
+		offsets.resize(size + 1);
+	}
+
+	size_t count = 0;
+	switch (kernel) {
+#ifdef DELIMITER_SCANNER_X86
+		case DelimiterScanner::Kernel::Avx2:
+			count = ScanAvx2(data, size, offsets.data());
+			break;
+
+		case DelimiterScanner::Kernel::Sse2:
+			count = ScanSse2(data, size, offsets.data());
+			break;
+#else
+		case DelimiterScanner::Kernel::Avx2:
+		case DelimiterScanner::Kernel::Sse2:
+#endif
+		case DelimiterScanner::Kernel::Scalar:
+		default:
+			count = ScanScalar(data, size, offsets.data());
+			break;
+	}
+
+	return count;
+}
+
+size_t DelimiterScanner::Scan(const char* data, size_t size, DelimiterScanner::offset_list_t& offsets)
+{
+	return DelimiterScanner::Scan(DelimiterScanner::BestKernel(), data, size, offsets);
+}
+
+DelimiterScanner::Kernel DelimiterScanner::BestKernel()
+{
+	static const DelimiterScanner::Kernel bestKernel =
+		DelimiterScanner::IsSupported(DelimiterScanner::Kernel::Avx2) ? DelimiterScanner::Kernel::Avx2 :
+		DelimiterScanner::IsSupported(DelimiterScanner::Kernel::Sse2) ? DelimiterScanner::Kernel::Sse2 :
+		DelimiterScanner::Kernel::Scalar;
+	return bestKernel;
+}
+
+bool DelimiterScanner::IsSupported(DelimiterScanner::Kernel kernel)
+{
+	switch (kernel) {
+#ifdef DELIMITER_SCANNER_X86
+		case DelimiterScanner::Kernel::Avx2:
+			return __builtin_cpu_supports("avx2");
+
+		case DelimiterScanner::Kernel::Sse2:
+			return __builtin_cpu_supports("sse2");
+#else
+		case DelimiterScanner::Kernel::Avx2:
+		case DelimiterScanner::Kernel::Sse2:
+			return false;
+#endif
+
+		case DelimiterScanner::Kernel::Scalar:
+		default:
+			return true;
+	}
+}
+
+const char* DelimiterScanner::KernelName(DelimiterScanner::Kernel kernel)
+{
+	switch (kernel) {
+		case DelimiterScanner::Kernel::Avx2:
+			return "avx2";
+
+		case DelimiterScanner::Kernel::Sse2:
+			return "sse2";
+
+		case DelimiterScanner::Kernel::Scalar:
+		default:
+			return "scalar";
+	}
+}
+
+
+// ****************************************************************************
+// RecordScanner construction
+// ****************************************************************************
+RecordScanner::RecordScanner(std::string_view data)
+	: RecordScanner(data, DelimiterScanner::BestKernel())
+{
+}
+
+RecordScanner::RecordScanner(std::string_view data, DelimiterScanner::Kernel kernel)
+	: m_data(data), m_kernel(kernel), m_offsets(), m_offsetCount(0), m_blockBegin(0), m_blockEnd(0), m_cursor(0), m_recordBegin(0)
+{
+}
+
+
+// ****************************************************************************
+// RecordScanner public API
+// ****************************************************************************
+void RecordScanner::Reset(std::string_view data)
+{
+	m_data = data;
+	m_offsetCount = 0;
+	m_blockBegin = 0;
+	m_blockEnd = 0;
+	m_cursor = 0;
+	m_recordBegin = 0;
+}
+
+bool RecordScanner::Next(std::string_view& record, Model::field_view_t& fieldValues)
+{
+	if (m_cursor >= m_offsetCount && !this->LoadBlock()) {
+		return false;
+	}
+
+	// A loaded block always ends on a record delimiter, so this stops within the block.
+	size_t field = 0;
+	size_t fieldBegin = m_recordBegin;
+	bool isRecordEnd = false;
+	while (!isRecordEnd) {
+		size_t delimiter = m_blockBegin + m_offsets[m_cursor++];
+		isRecordEnd = (delimiter >= m_data.size() || m_data[delimiter] == '\n');
+
+		// Tokens past the last field in the schema are ignored, the same as Model::Split().
+		if (field < Model::field_count_t) {
+			fieldValues[field++] = m_data.substr(fieldBegin, delimiter - fieldBegin);
+		}
+
+		fieldBegin = delimiter + 1;
+	}
+
+	for (; field < Model::field_count_t; ++field) {
+		fieldValues[field] = std::string_view();
+	}
+
+	record = m_data.substr(m_recordBegin, fieldBegin - 1 - m_recordBegin);
+	m_recordBegin = fieldBegin;
+	return true;
+}
+
+
+// ****************************************************************************
+// RecordScanner private implementation
+// ****************************************************************************
+bool RecordScanner::LoadBlock()
+{
+	m_cursor = 0;
+	m_offsetCount = 0;
+	m_blockBegin = m_recordBegin;
+	if (m_blockBegin >= m_data.size()) {
+		return false;
+	}
+
+	const char* data = m_data.data();
+	m_blockEnd = std::min(m_blockBegin + RecordScanner::m_blockSize, m_data.size());
+	m_offsetCount = DelimiterScanner::Scan(m_kernel, data + m_blockBegin, m_blockEnd - m_blockBegin, m_offsets);
+
+	// Cut the block after its last record delimiter so no record spans two blocks.
+	if (m_blockEnd < m_data.size()) {
+		while (m_offsetCount > 0 && data[m_blockBegin + m_offsets[m_offsetCount - 1]] != '\n') {
+			--m_offsetCount;
+		}
+
+		// A single record longer than a block; index through to the end of that record instead.
+		if (m_offsetCount == 0) {
+			const void* newline = std::memchr(data + m_blockEnd, '\n', m_data.size() - m_blockEnd);
+			m_blockEnd = (newline != nullptr) ? static_cast<size_t>(static_cast<const char*>(newline) - data) + 1 : m_data.size();
+			m_offsetCount = DelimiterScanner::Scan(m_kernel, data + m_blockBegin, m_blockEnd - m_blockBegin, m_offsets);
+		}
+	}
+
+	// The last record may not be newline terminated; end it at the end of the buffer.
+	if (m_blockEnd == m_data.size() && m_data.back() != '\n') {
+		m_offsets[m_offsetCount++] = static_cast<std::uint32_t>(m_blockEnd - m_blockBegin);
+	}
+
+	return true;
+}
+
+
+// ****************************************************************************
+// Delimiter kernels
+// ****************************************************************************
+static size_t ScanScalar(const char* data, size_t size, std::uint32_t* offsets)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < size; ++i) {
+		if (data[i] == '|' || data[i] == '\n') {
+			offsets[count++] = static_cast<std::uint32_t>(i);
+		}
+	}
+
+	return count;
+}
+
+#ifdef DELIMITER_SCANNER_X86
+/// Writes the offsets of the set bits in a delimiter match mask.
+static inline size_t EmitMatches(std::uint32_t mask, size_t base, std::uint32_t* offsets)
+{
+	size_t count = 0;
+	while (mask != 0) {
+		offsets[count++] = static_cast<std::uint32_t>(base + static_cast<size_t>(__builtin_ctz(mask)));
+		mask &= mask - 1;
+	}
+
+	return count;
+}
+
+__attribute__((target("sse2")))
+static size_t ScanSse2(const char* data, size_t size, std::uint32_t* offsets)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i pipe = _mm_set1_epi8('|');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i matches = _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, pipe));
+		count += EmitMatches(static_cast<std::uint32_t>(_mm_movemask_epi8(matches)), i, offsets + count);
+	}
+
+	for (; i < size; ++i) {
+		if (data[i] == '|' || data[i] == '\n') {
+			offsets[count++] = static_cast<std::uint32_t>(i);
+		}
+	}
+
+	return count;
+}
+
+__attribute__((target("avx2")))
+static size_t ScanAvx2(const char* data, size_t size, std::uint32_t* offsets)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i pipe = _mm256_set1_epi8('|');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newline), _mm256_cmpeq_epi8(bytes, pipe));
+		count += EmitMatches(static_cast<std::uint32_t>(_mm256_movemask_epi8(matches)), i, offsets + count);
+	}
+
+	for (; i < size; ++i) {
+		if (data[i] == '|' || data[i] == '\n') {
+			offsets[count++] = static_cast<std::uint32_t>(i);
+		}
+	}
+
+	return count;
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef DELIMITER_SCANNER_H
+#define DELIMITER_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "model.h"
+
+/// Vectorized indexing of the '|' field and '\n' record delimiters of the datastore text format.
+class DelimiterScanner
+{
+	public:
+		/// Instruction set used to find delimiters.
+		enum class Kernel {
+			Scalar,
+			Sse2,
+			Avx2,
+		};
+
+		/// Offsets of delimiters, relative to the start of the scanned buffer.
+		typedef std::vector<std::uint32_t> offset_list_t;
+
+		/// Largest buffer that can be indexed in one call, so offsets fit the offset list type.
+		static const size_t m_maxScanSize;
+
+		// Public API
+		/// Writes the position of every delimiter in the buffer to the front of offsets using the given
+		/// kernel, and returns how many were found. offsets is scratch space that is only ever grown.
+		static size_t Scan(DelimiterScanner::Kernel kernel, const char* data, size_t size, DelimiterScanner::offset_list_t& offsets);
+
+		/// Same as above using the fastest kernel supported by the running CPU.
+		static size_t Scan(const char* data, size_t size, DelimiterScanner::offset_list_t& offsets);
+
+		/// Returns the fastest kernel supported by the running CPU; detected once.
+		static DelimiterScanner::Kernel BestKernel();
+
+		/// Returns true if the running CPU can execute the given kernel.
+		static bool IsSupported(DelimiterScanner::Kernel kernel);
+
+		/// Returns a printable name for the given kernel.
+		static const char* KernelName(DelimiterScanner::Kernel kernel);
+};
+
+
+/// Iterates the records of a newline delimited buffer, splitting each record into its fields
+/// from delimiter offsets indexed a block at a time.
+class RecordScanner
+{
+	public:
+		// Construction
+		RecordScanner(std::string_view data);
+		RecordScanner(std::string_view data, DelimiterScanner::Kernel kernel);
+
+		// Public API
+		/// Starts over on another buffer, keeping the delimiter offsets already allocated.
+		void Reset(std::string_view data);
+
+		/// Gets the next record and its fields with the same semantics as Model::Split().
+		/// Returns false once the buffer is exhausted. Empty records (blank lines) are returned as-is.
+		bool Next(std::string_view& record, Model::field_view_t& fieldValues);
+
+		/// Gets the offset of the next unread record in the buffer.
+		size_t Position() const { return m_recordBegin; }
+
+	private:
+		/// Indexes the delimiters of the next block; returns false at the end of the buffer.
+		bool LoadBlock();
+
+		/// Size of the blocks the buffer is indexed in.
+		static const size_t m_blockSize;
+
+		/// Buffer being scanned and the kernel used to index it.
+		std::string_view m_data;
+		DelimiterScanner::Kernel m_kernel;
+
+		/// Delimiter offsets of the current block, relative to the start of the block.
+		DelimiterScanner::offset_list_t m_offsets;
+		size_t m_offsetCount;
+		size_t m_blockBegin;
+		size_t m_blockEnd;
+		size_t m_cursor;
+
+		/// Offset of the next unread record.
+		size_t m_recordBegin;
+};
+
+#endif
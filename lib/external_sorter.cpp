@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <unistd.h>
+#include "external_sorter.h"
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t ExternalSorter::m_runBufferSize = 64 << 10;
+std::atomic<std::uint64_t> ExternalSorter::m_runSequence(0);
+
+
+// ****************************************************************************
+// Run reader
+// ****************************************************************************
+class ExternalSorter::RunReader
+{
+	public:
+		RunReader(const std::string& runPath, const Ordering& ordering, const Model::projection_ptr_t& projection)
+			: m_buffer(ExternalSorter::m_runBufferSize), m_runFile(), m_line(), m_row(),
+			  m_numbers(ordering.Keys().size()), m_ordering(ordering)
+		{
+			m_runFile.rdbuf()->pubsetbuf(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+			m_runFile.open(runPath, std::ios::in | std::ios::binary);
+			if (!m_runFile) {
+				throw std::runtime_error("Unable to open sort run: " + runPath);
+			}
+
+			m_row.SetOrdering(projection);
+		}
+
+		RunReader(const RunReader&) = delete;
+		RunReader& operator= (const RunReader&) = delete;
+
+		/// Reads the next row of the run; returns false once the run is exhausted.
+		bool Next()
+		{
+			if (!std::getline(m_runFile, m_line)) {
+				return false;
+			}
+
+			Model::field_view_t fieldValues;
+			Model::Split(m_line, fieldValues);
+			for (size_t field = 0; field < Model::field_count_t; ++field) {
+				m_row.Field(static_cast<Model::FieldId>(field), fieldValues[field]);
+			}
+
+			m_ordering.ParseKeys(m_row, m_numbers.data());
+			return true;
+		}
+
+		const Model& Row() const { return m_row; }
+		const std::int64_t* Numbers() const { return m_numbers.data(); }
+
+	private:
+		std::vector<char> m_buffer;
+		std::ifstream m_runFile;
+		std::string m_line;
+		Model m_row;
+		std::vector<std::int64_t> m_numbers;
+		const Ordering& m_ordering;
+};
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ExternalSorter::ExternalSorter(const Ordering& ordering, size_t memoryBudget, const std::string& spillDirectory)
+	: m_ordering(ordering), m_projection(), m_runRowLimit(0), m_mergeFanIn(0), m_spillDirectory(spillDirectory),
+	  m_rows(), m_numbers(), m_runPaths(), m_statistics()
+{
+	// A row in memory costs the row itself, its parsed keys, and its position while the run is sorted.
+	const size_t rowSize = sizeof(Model) + ordering.Keys().size() * sizeof(std::int64_t) + sizeof(size_t);
+	m_runRowLimit = std::max<size_t>(memoryBudget / rowSize, 1);
+
+	// Each run being merged costs a read buffer and its current row; keep well within open file limits.
+	m_mergeFanIn = std::min<size_t>(std::max<size_t>(memoryBudget / (ExternalSorter::m_runBufferSize + rowSize), 2), 256);
+}
+
+ExternalSorter::~ExternalSorter()
+{
+	std::error_code error;
+	for (auto& runPath : m_runPaths) {
+		std::filesystem::remove(runPath, error);
+	}
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void ExternalSorter::Add(const Model& row)
+{
+	if (!m_projection) {
+		m_projection = row.FieldOrdering();
+	}
+
+	if (m_rows.size() >= m_runRowLimit) {
+		this->SpillRun();
+	}
+
+	const size_t keyCount = m_ordering.Keys().size();
+	m_rows.emplace_back(row);
+	m_numbers.resize(m_rows.size() * keyCount);
+	m_ordering.ParseKeys(row, m_numbers.data() + (m_rows.size() - 1) * keyCount);
+	++m_statistics.rowCount;
+}
+
+void ExternalSorter::Finish(const ExternalSorter::row_sink_t& sink)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Everything fit in the budget; sort in memory.
+	if (m_runPaths.empty()) {
+		for (size_t position : this->SortRun()) {
+			sink(m_rows[position]);
+		}
+
+		m_rows.clear();
+		m_numbers.clear();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		m_statistics.seconds += elapsed.count();
+		return;
+	}
+
+	if (!m_rows.empty()) {
+		this->SpillRun();
+	}
+
+	// Release the run memory before the merge buffers are allocated.
+	std::vector<std::int64_t>().swap(m_numbers);
+	std::vector<Model>().swap(m_rows);
+
+	// Merge runs in passes until few enough remain to merge straight into the sink. Neighbouring
+	// runs are merged together so runs stay in the order their rows were added.
+	while (m_runPaths.size() > m_mergeFanIn) {
+		std::vector<std::string> mergedPaths;
+		for (size_t first = 0; first < m_runPaths.size(); first += m_mergeFanIn) {
+			const size_t last = std::min(first + m_mergeFanIn, m_runPaths.size());
+			std::vector<std::string> runPaths(std::begin(m_runPaths) + static_cast<std::ptrdiff_t>(first),
+					std::begin(m_runPaths) + static_cast<std::ptrdiff_t>(last));
+
+			std::vector<char> writeBuffer(ExternalSorter::m_runBufferSize);
+			std::ofstream mergedFile;
+			std::string mergedPath = ExternalSorter::NextRunPath(m_spillDirectory);
+			mergedFile.rdbuf()->pubsetbuf(writeBuffer.data(), static_cast<std::streamsize>(writeBuffer.size()));
+			mergedFile.open(mergedPath, std::ios::out | std::ios::trunc | std::ios::binary);
+			if (!mergedFile) {
+				throw std::runtime_error("Unable to create sort run: " + mergedPath);
+			}
+
+			mergedPaths.emplace_back(mergedPath);
+			this->MergeRuns(runPaths, [&](const Model& row) { ExternalSorter::WriteRow(mergedFile, row); });
+			mergedFile.close();
+			m_statistics.spilledBytes += std::filesystem::file_size(mergedPath);
+			for (auto& runPath : runPaths) {
+				std::filesystem::remove(runPath);
+			}
+		}
+
+		m_runPaths.swap(mergedPaths);
+	}
+
+	this->MergeRuns(m_runPaths, sink);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	m_statistics.seconds += elapsed.count();
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+std::vector<size_t> ExternalSorter::SortRun() const
+{
+	std::vector<size_t> positions(m_rows.size());
+	for (size_t i = 0; i < positions.size(); ++i) {
+		positions[i] = i;
+	}
+
+	// Positions break ties so equal rows keep the order they were added in.
+	const size_t keyCount = m_ordering.Keys().size();
+	std::sort(std::begin(positions), std::end(positions), [&](size_t lhs, size_t rhs)
+			{
+				int result = m_ordering.Compare(m_rows[lhs], m_numbers.data() + lhs * keyCount, m_rows[rhs], m_numbers.data() + rhs * keyCount);
+				return (result < 0 || (result == 0 && lhs < rhs));
+			});
+
+	return positions;
+}
+
+void ExternalSorter::SpillRun()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<char> writeBuffer(ExternalSorter::m_runBufferSize);
+	std::ofstream runFile;
+	std::string runPath = ExternalSorter::NextRunPath(m_spillDirectory);
+	runFile.rdbuf()->pubsetbuf(writeBuffer.data(), static_cast<std::streamsize>(writeBuffer.size()));
+	runFile.open(runPath, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!runFile) {
+		throw std::runtime_error("Unable to create sort run: " + runPath);
+	}
+
+	m_runPaths.emplace_back(runPath);
+	for (size_t position : this->SortRun()) {
+		ExternalSorter::WriteRow(runFile, m_rows[position]);
+	}
+
+	runFile.close();
+	if (!runFile) {
+		throw std::runtime_error("Unable to write sort run: " + runPath);
+	}
+
+	m_rows.clear();
+	m_numbers.clear();
+	++m_statistics.runCount;
+	m_statistics.spilledBytes += std::filesystem::file_size(runPath);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	m_statistics.seconds += elapsed.count();
+}
+
+void ExternalSorter::MergeRuns(const std::vector<std::string>& runPaths, const ExternalSorter::row_sink_t& sink) const
+{
+	std::vector<std::unique_ptr<ExternalSorter::RunReader>> readers;
+	std::vector<size_t> heap;
+	for (auto& runPath : runPaths) {
+		readers.emplace_back(std::make_unique<ExternalSorter::RunReader>(runPath, m_ordering, m_projection));
+		if (readers.back()->Next()) {
+			heap.emplace_back(readers.size() - 1);
+		}
+	}
+
+	// Min heap of readers by their current row; the earlier run wins a tie.
+	auto isAfter = [&](size_t lhs, size_t rhs)
+	{
+		int result = m_ordering.Compare(readers[lhs]->Row(), readers[lhs]->Numbers(), readers[rhs]->Row(), readers[rhs]->Numbers());
+		return (result > 0 || (result == 0 && lhs > rhs));
+	};
+
+	std::make_heap(std::begin(heap), std::end(heap), isAfter);
+	while (!heap.empty()) {
+		std::pop_heap(std::begin(heap), std::end(heap), isAfter);
+		ExternalSorter::RunReader& reader = *readers[heap.back()];
+		sink(reader.Row());
+		if (reader.Next()) {
+			std::push_heap(std::begin(heap), std::end(heap), isAfter);
+		} else {
+			heap.pop_back();
+		}
+	}
+}
+
+std::string ExternalSorter::NextRunPath(const std::string& spillDirectory)
+{
+	std::string runName = ".sort-" + std::to_string(::getpid()) + "-" + std::to_string(m_runSequence.fetch_add(1)) + ".run";
+	return (std::filesystem::path(spillDirectory) / runName).string();
+}
+
+void ExternalSorter::WriteRow(std::ofstream& runFile, const Model& row)
+{
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		if (field > 0) {
+			runFile.put('|');
+		}
+
+		std::string_view fieldValue = row.Field(static_cast<Model::FieldId>(field));
+		runFile.write(fieldValue.data(), static_cast<std::streamsize>(fieldValue.length()));
+	}
+
+	runFile.put('\n');
+}
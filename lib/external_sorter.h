@@ -0,0 +1,100 @@
+#ifndef EXTERNAL_SORTER_H
+#define EXTERNAL_SORTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "model.h"
+#include "ordering.h"
+
+/// Sorts a stream of rows that may not fit in memory. Rows are gathered into runs bounded by a
+/// memory budget; each full run is sorted and spilled to a temporary file in the spill directory,
+/// and the runs are then k-way merged into the output. Rows that fit in the budget are sorted in
+/// memory without touching the disk. Equal rows keep the order they were added in.
+class ExternalSorter
+{
+	public:
+		/// Receives each sorted row; the row is only valid during the call.
+		typedef std::function<void(const Model&)> row_sink_t;
+
+		/// What a sort cost, for reporting.
+		struct Statistics {
+			Statistics() : rowCount(0), runCount(0), spilledBytes(0), seconds(0.0) {}
+			size_t rowCount;
+			size_t runCount;
+			std::uint64_t spilledBytes;
+			double seconds;
+		};
+
+		// Construction
+		ExternalSorter(const Ordering& ordering, size_t memoryBudget, const std::string& spillDirectory);
+		ExternalSorter(const ExternalSorter&) = delete;
+		ExternalSorter& operator= (const ExternalSorter&) = delete;
+
+		/// Removes any run files left behind.
+		~ExternalSorter();
+
+		// Public API
+		/// Adds a row to be sorted, spilling the current run first if the row would exceed the budget.
+		void Add(const Model& row);
+
+		/// Passes every added row to the sink in order. Can only be called once.
+		void Finish(const ExternalSorter::row_sink_t& sink);
+
+		/// Gets the cost of the sort so far.
+		const ExternalSorter::Statistics& Stats() const { return m_statistics; }
+
+	private:
+		/// Reads back the rows of one spilled run in order.
+		class RunReader;
+
+		/// Sorts the rows gathered in memory, returning their positions in order.
+		std::vector<size_t> SortRun() const;
+
+		/// Sorts the rows gathered in memory and writes them to a new run file.
+		void SpillRun();
+
+		/// Merges the given runs into the sink, keeping equal rows in run order.
+		void MergeRuns(const std::vector<std::string>& runPaths, const ExternalSorter::row_sink_t& sink) const;
+
+		/// Creates a path for a new run file in the spill directory, unique among every sorter of the
+		/// process, as a server sorts many queries at once.
+		static std::string NextRunPath(const std::string& spillDirectory);
+
+		/// Writes a row as a run file line: every field, '|' delimited, so it can be read back as a record.
+		static void WriteRow(std::ofstream& runFile, const Model& row);
+
+		/// Size of the buffer each run file is written or read through.
+		static const size_t m_runBufferSize;
+
+		/// Number of run files named so far by the process.
+		static std::atomic<std::uint64_t> m_runSequence;
+
+		/// Ordering to sort by, and the projection of the rows being sorted so rows read back from runs match.
+		Ordering m_ordering;
+		Model::projection_ptr_t m_projection;
+
+		/// Largest number of rows held in memory at once, derived from the memory budget.
+		size_t m_runRowLimit;
+
+		/// Largest number of runs merged at once, derived from the memory budget.
+		size_t m_mergeFanIn;
+
+		/// Where run files are created.
+		std::string m_spillDirectory;
+
+		/// Rows of the run being gathered, and the money / duration keys parsed from each.
+		std::vector<Model> m_rows;
+		std::vector<std::int64_t> m_numbers;
+
+		/// Run files spilled so far, in the order their rows were added.
+		std::vector<std::string> m_runPaths;
+
+		ExternalSorter::Statistics m_statistics;
+};
+
+#endif
@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include "filter.h"
+
+static bool IsKeyword(const std::string& token, const std::string& keyword);
+static bool IsQuoted(const std::string& token);
+static bool IsComparison(const std::string& token);
+static bool IsComparison(const std::string& token, Filter::Operator& op);
+static bool IsOrdered(Filter::Operator op, int comparison);
+static bool Overlaps(const Filter::Range& range, std::string_view minimum, std::string_view maximum);
+static bool Intersect(const Filter::Range& lhs, const Filter::Range& rhs, Filter::Range& range);
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+Filter::Filter() : m_nodes(), m_root(0)
+{
+}
+
+Filter::Filter(const std::string& filterString) : m_nodes(), m_root(0)
+{
+	std::vector<std::string> tokens = Filter::Tokenize(filterString);
+	if (tokens.empty()) {
+		return;
+	}
+
+	size_t position = 0;
+	m_root = this->ParseExpression(tokens, position);
+	if (position != tokens.size()) {
+		throw std::invalid_argument("Invalid filter: unexpected '" + tokens[position] + "' in " + filterString);
+	}
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool Filter::Evaluate(const Model::field_view_t& record) const
+{
+	if (m_nodes.empty()) {
+		return true;
+	}
+
+	return this->Evaluate(m_root, record);
+}
+
+bool Filter::MayMatch(const ZoneMap::Block& block) const
+{
+	if (m_nodes.empty()) {
+		return true;
+	}
+
+	return this->MayMatch(m_root, block);
+}
+
+bool Filter::Ranges(Model::FieldId field, std::vector<Filter::Range>& ranges) const
+{
+	ranges.clear();
+	if (m_nodes.empty()) {
+		return false;
+	}
+
+	return this->Ranges(m_root, field, ranges);
+}
+
+std::string Filter::CanonicalForm() const
+{
+	std::string form;
+	if (!m_nodes.empty()) {
+		this->CanonicalForm(m_root, form);
+	}
+
+	return form;
+}
+
+Model::projection_t Filter::Fields() const
+{
+	Model::projection_t fields;
+	for (auto& node : m_nodes) {
+		if (node.op != Filter::Operator::And && node.op != Filter::Operator::Or && std::find(std::begin(fields), std::end(fields), node.field) == std::end(fields)) {
+			fields.emplace_back(node.field);
+		}
+	}
+
+	return fields;
+}
+
+bool Filter::Contains(const Filter::Range& range, std::string_view fieldValue)
+{
+	return ((!range.hasLower || fieldValue > range.lower || (range.isLowerInclusive && fieldValue == range.lower)) &&
+			(!range.hasUpper || fieldValue < range.upper || (range.isUpperInclusive && fieldValue == range.upper)));
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+size_t Filter::ParseExpression(const std::vector<std::string>& tokens, size_t& position)
+{
+	size_t node = this->ParseTerm(tokens, position);
+	while (position < tokens.size() && IsKeyword(tokens[position], "or")) {
+		++position;
+		size_t rhs = this->ParseTerm(tokens, position);
+		node = this->AddNode(Filter::Operator::Or, Model::FieldId::Stb, "", node, rhs);
+	}
+
+	return node;
+}
+
+size_t Filter::ParseTerm(const std::vector<std::string>& tokens, size_t& position)
+{
+	size_t node = this->ParseFactor(tokens, position);
+	while (position < tokens.size() && IsKeyword(tokens[position], "and")) {
+		++position;
+		size_t rhs = this->ParseFactor(tokens, position);
+		node = this->AddNode(Filter::Operator::And, Model::FieldId::Stb, "", node, rhs);
+	}
+
+	return node;
+}
+
+size_t Filter::ParseFactor(const std::vector<std::string>& tokens, size_t& position)
+{
+	if (position >= tokens.size()) {
+		throw std::invalid_argument("Invalid filter: expected a field comparison.");
+	}
+
+	// Parenthesized sub expression.
+	if (tokens[position] == "(") {
+		size_t node = this->ParseExpression(tokens, ++position);
+		if (position >= tokens.size() || tokens[position] != ")") {
+			throw std::invalid_argument("Invalid filter: missing ')'.");
+		}
+
+		++position;
+		return node;
+	}
+
+	// FIELD = VALUE, with the field resolved to its schema index now rather than per record.
+	Filter::Operator op = Filter::Operator::Equal;
+	std::string field = tokens[position++];
+	if (IsQuoted(field) || field == ")" || IsComparison(field)) {
+		throw std::invalid_argument("Invalid filter: expected a field name but found '" + field + "'.");
+	}
+
+	std::transform(std::begin(field), std::end(field), std::begin(field), ::tolower);
+	Model::FieldId fieldId = Model::FieldIndex(field);
+	if (position >= tokens.size() || !IsComparison(tokens[position], op)) {
+		throw std::invalid_argument("Invalid filter: expected a comparison after " + field + ".");
+	}
+
+	++position;
+	if (position >= tokens.size() || tokens[position] == "(" || tokens[position] == ")" || IsComparison(tokens[position])) {
+		throw std::invalid_argument("Invalid filter: expected a value for " + field + ".");
+	}
+
+	std::string value = tokens[position++];
+	if (IsQuoted(value)) {
+		value = value.substr(1, value.length() - 2);
+	}
+
+	// Typed values are held encoded, so match the value's encoding as well as its text.
+	size_t node = this->AddNode(op, fieldId, value, 0, 0);
+	std::int64_t number = 0;
+	char buffer[Model::number_len_max_t];
+	if (Model::ParseNumber(Model::Type(fieldId), value, number)) {
+		m_nodes[node].encodedValue.assign(buffer, Model::EncodeNumber(number, buffer));
+		m_nodes[node].number = number;
+	} else if (op != Filter::Operator::Equal && Model::Type(fieldId) != Model::FieldType::Text) {
+		throw std::invalid_argument("Invalid filter: " + field + " can only be ordered against a value of its type, not '" + value + "'.");
+	}
+
+	return node;
+}
+
+size_t Filter::AddNode(Filter::Operator op, Model::FieldId field, const std::string& value, size_t lhs, size_t rhs)
+{
+	m_nodes.push_back({ op, field, value, lhs, rhs, "", 0 });
+	return m_nodes.size() - 1;
+}
+
+bool Filter::Evaluate(size_t node, const Model::field_view_t& record) const
+{
+	const Filter::Node& current = m_nodes[node];
+	switch (current.op) {
+		case Filter::Operator::Equal: {
+			const std::string_view fieldValue = record[static_cast<size_t>(current.field)];
+			return (fieldValue == current.value || (!current.encodedValue.empty() && fieldValue == current.encodedValue));
+		}
+
+		case Filter::Operator::Less:
+		case Filter::Operator::LessEqual:
+		case Filter::Operator::Greater:
+		case Filter::Operator::GreaterEqual: {
+			// Typed values are compared by number, whether held encoded or as text.
+			const std::string_view fieldValue = record[static_cast<size_t>(current.field)];
+			if (Model::Type(current.field) == Model::FieldType::Text) {
+				return IsOrdered(current.op, fieldValue.compare(current.value));
+			}
+
+			std::int64_t number = 0;
+			return (Model::ParseNumber(Model::Type(current.field), fieldValue, number) &&
+					IsOrdered(current.op, (number < current.number) ? -1 : (number > current.number) ? 1 : 0));
+		}
+
+		case Filter::Operator::And:
+			return (this->Evaluate(current.lhs, record) && this->Evaluate(current.rhs, record));
+
+		case Filter::Operator::Or:
+			return (this->Evaluate(current.lhs, record) || this->Evaluate(current.rhs, record));
+
+		default:
+			return false;
+	}
+}
+
+bool Filter::MayMatch(size_t node, const ZoneMap::Block& block) const
+{
+	const Filter::Node& current = m_nodes[node];
+	switch (current.op) {
+		case Filter::Operator::Equal:
+			return (block.MayContain(current.field, current.value) ||
+					(!current.encodedValue.empty() && block.MayContain(current.field, current.encodedValue)));
+
+		case Filter::Operator::Less:
+		case Filter::Operator::LessEqual:
+		case Filter::Operator::Greater:
+		case Filter::Operator::GreaterEqual: {
+			const size_t field = static_cast<size_t>(current.field);
+			std::vector<Filter::Range> ranges;
+			this->ComparisonRanges(current, ranges);
+			return (block.recordCount > 0 && std::any_of(std::begin(ranges), std::end(ranges),
+						[&](const Filter::Range& range) { return Overlaps(range, block.minimums[field], block.maximums[field]); }));
+		}
+
+		case Filter::Operator::And:
+			return (this->MayMatch(current.lhs, block) && this->MayMatch(current.rhs, block));
+
+		case Filter::Operator::Or:
+			return (this->MayMatch(current.lhs, block) || this->MayMatch(current.rhs, block));
+
+		default:
+			return true;
+	}
+}
+
+bool Filter::Ranges(size_t node, Model::FieldId field, std::vector<Filter::Range>& ranges) const
+{
+	const Filter::Node& current = m_nodes[node];
+	switch (current.op) {
+		case Filter::Operator::Equal:
+			if (current.field != field) {
+				return false;
+			}
+
+			ranges.push_back({ current.value, current.value, true, true, true, true });
+			if (!current.encodedValue.empty()) {
+				ranges.push_back({ current.encodedValue, current.encodedValue, true, true, true, true });
+			}
+
+			return true;
+
+		case Filter::Operator::Less:
+		case Filter::Operator::LessEqual:
+		case Filter::Operator::Greater:
+		case Filter::Operator::GreaterEqual:
+			if (current.field != field) {
+				return false;
+			}
+
+			this->ComparisonRanges(current, ranges);
+			return true;
+
+		case Filter::Operator::And: {
+			// Either side narrows the field down on its own; when both do, only their overlap can pass.
+			std::vector<Filter::Range> lhsRanges;
+			std::vector<Filter::Range> rhsRanges;
+			const bool isLhsRanged = this->Ranges(current.lhs, field, lhsRanges);
+			const bool isRhsRanged = this->Ranges(current.rhs, field, rhsRanges);
+			if (isLhsRanged && isRhsRanged) {
+				Filter::Range range = { "", "", false, false, false, false };
+				for (auto& lhsRange : lhsRanges) {
+					for (auto& rhsRange : rhsRanges) {
+						if (Intersect(lhsRange, rhsRange, range)) {
+							ranges.push_back(range);
+						}
+					}
+				}
+			} else {
+				std::vector<Filter::Range>& narrowed = isLhsRanged ? lhsRanges : rhsRanges;
+				ranges.insert(std::end(ranges), std::begin(narrowed), std::end(narrowed));
+			}
+
+			return (isLhsRanged || isRhsRanged);
+		}
+
+		case Filter::Operator::Or: {
+			// Only narrowed if both sides are.
+			std::vector<Filter::Range> lhsRanges;
+			std::vector<Filter::Range> rhsRanges;
+			if (!this->Ranges(current.lhs, field, lhsRanges) || !this->Ranges(current.rhs, field, rhsRanges)) {
+				return false;
+			}
+
+			ranges.insert(std::end(ranges), std::begin(lhsRanges), std::end(lhsRanges));
+			ranges.insert(std::end(ranges), std::begin(rhsRanges), std::end(rhsRanges));
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+void Filter::CanonicalForm(size_t node, std::string& form) const
+{
+	const Filter::Node& current = m_nodes[node];
+	if (current.op == Filter::Operator::And || current.op == Filter::Operator::Or) {
+		form.append(1, '(');
+		this->CanonicalForm(current.lhs, form);
+		form.append((current.op == Filter::Operator::And) ? " and " : " or ");
+		this->CanonicalForm(current.rhs, form);
+		form.append(1, ')');
+		return;
+	}
+
+	static const char* const comparisons[] = { "=", "<", "<=", ">", ">=" };
+	form.append(Model::m_validFields[static_cast<size_t>(current.field)]).append(comparisons[static_cast<size_t>(current.op)]);
+	form.append(1, '"').append(current.value).append(1, '"');
+}
+
+void Filter::ComparisonRanges(const Filter::Node& node, std::vector<Filter::Range>& ranges) const
+{
+	const bool isTyped = (Model::Type(node.field) != Model::FieldType::Text);
+	const std::string& bound = isTyped ? node.encodedValue : node.value;
+	switch (node.op) {
+		case Filter::Operator::Less:
+		case Filter::Operator::LessEqual:
+			// Encoded values sort after any text, so this range already takes in values held as text.
+			ranges.push_back({ "", bound, false, true, false, node.op == Filter::Operator::LessEqual });
+			break;
+
+		case Filter::Operator::Greater:
+		case Filter::Operator::GreaterEqual:
+			ranges.push_back({ bound, "", true, false, node.op == Filter::Operator::GreaterEqual, false });
+			if (isTyped) {
+				ranges.push_back({ "", std::string(1, static_cast<char>(0x80)), false, true, false, false });
+			}
+
+			break;
+
+		case Filter::Operator::Equal:
+		case Filter::Operator::And:
+		case Filter::Operator::Or:
+		default:
+			break;
+	}
+}
+
+std::vector<std::string> Filter::Tokenize(const std::string& filterString)
+{
+	std::vector<std::string> tokens;
+	std::string::size_type position = 0;
+	while (position < filterString.length()) {
+		char current = filterString[position];
+		if (std::isspace(static_cast<unsigned char>(current))) {
+			++position;
+		} else if (current == '(' || current == ')' || current == '=') {
+			tokens.emplace_back(1, current);
+			++position;
+		} else if (current == '<' || current == '>') {
+			const bool isInclusive = (position + 1 < filterString.length() && filterString[position + 1] == '=');
+			tokens.emplace_back(filterString.substr(position, isInclusive ? 2 : 1));
+			position += isInclusive ? 2 : 1;
+		} else if (current == '"') {
+			// Quoted values keep their quotes so they are never mistaken for keywords or parentheses.
+			std::string::size_type end = filterString.find('"', position + 1);
+			if (end == std::string::npos) {
+				throw std::invalid_argument("Invalid filter: unterminated quote in " + filterString);
+			}
+
+			tokens.emplace_back(filterString.substr(position, end - position + 1));
+			position = end + 1;
+		} else {
+			std::string::size_type end = filterString.find_first_of(" \t()=<>\"", position);
+			end = (end != std::string::npos) ? end : filterString.length();
+			tokens.emplace_back(filterString.substr(position, end - position));
+			position = end;
+		}
+	}
+
+	return tokens;
+}
+
+static bool IsKeyword(const std::string& token, const std::string& keyword)
+{
+	return std::equal(std::begin(token), std::end(token), std::begin(keyword), std::end(keyword),
+			[](char lhs, char rhs) { return std::tolower(static_cast<unsigned char>(lhs)) == rhs; });
+}
+
+static bool IsQuoted(const std::string& token)
+{
+	return (token.length() >= 2 && token.front() == '"' && token.back() == '"');
+}
+
+static bool IsComparison(const std::string& token)
+{
+	Filter::Operator op = Filter::Operator::Equal;
+	return IsComparison(token, op);
+}
+
+static bool IsComparison(const std::string& token, Filter::Operator& op)
+{
+	static const std::vector<std::pair<std::string, Filter::Operator>> comparisons = {
+		{ "=", Filter::Operator::Equal },
+		{ "<", Filter::Operator::Less },
+		{ "<=", Filter::Operator::LessEqual },
+		{ ">", Filter::Operator::Greater },
+		{ ">=", Filter::Operator::GreaterEqual },
+	};
+
+	for (auto& comparison : comparisons) {
+		if (token == comparison.first) {
+			op = comparison.second;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool IsOrdered(Filter::Operator op, int comparison)
+{
+	switch (op) {
+		case Filter::Operator::Less:
+			return (comparison < 0);
+
+		case Filter::Operator::LessEqual:
+			return (comparison <= 0);
+
+		case Filter::Operator::Greater:
+			return (comparison > 0);
+
+		case Filter::Operator::GreaterEqual:
+			return (comparison >= 0);
+
+		case Filter::Operator::Equal:
+			return (comparison == 0);
+
+		case Filter::Operator::And:
+		case Filter::Operator::Or:
+		default:
+			return false;
+	}
+}
+
+static bool Overlaps(const Filter::Range& range, std::string_view minimum, std::string_view maximum)
+{
+	return ((!range.hasLower || maximum > range.lower || (range.isLowerInclusive && maximum == range.lower)) &&
+			(!range.hasUpper || minimum < range.upper || (range.isUpperInclusive && minimum == range.upper)));
+}
+
+static bool Intersect(const Filter::Range& lhs, const Filter::Range& rhs, Filter::Range& range)
+{
+	// The tighter of each pair of bounds, exclusive if either is.
+	range = lhs;
+	if (rhs.hasLower && (!range.hasLower || rhs.lower > range.lower)) {
+		range.lower = rhs.lower;
+		range.hasLower = true;
+		range.isLowerInclusive = rhs.isLowerInclusive;
+	} else if (rhs.hasLower && rhs.lower == range.lower) {
+		range.isLowerInclusive = range.isLowerInclusive && rhs.isLowerInclusive;
+	}
+
+	if (rhs.hasUpper && (!range.hasUpper || rhs.upper < range.upper)) {
+		range.upper = rhs.upper;
+		range.hasUpper = true;
+		range.isUpperInclusive = rhs.isUpperInclusive;
+	} else if (rhs.hasUpper && rhs.upper == range.upper) {
+		range.isUpperInclusive = range.isUpperInclusive && rhs.isUpperInclusive;
+	}
+
+	return (!range.hasLower || !range.hasUpper || range.lower < range.upper ||
+			(range.lower == range.upper && range.isLowerInclusive && range.isUpperInclusive));
+}
@@ -0,0 +1,124 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "model.h"
+#include "zone_map.h"
+
+/// A filter (-f) expression, compiled once into an expression tree whose comparisons are
+/// bound to schema field indices so records can be tested without any string parsing.
+///
+/// Grammar (AND binds tighter than OR; keywords and field names are case insensitive):
+///     expression := term { OR term }
+///     term       := factor { AND factor }
+///     factor     := '(' expression ')' | FIELD COMPARISON VALUE
+///     comparison := '=' | '<' | '<=' | '>' | '>='
+/// VALUE is either a "quoted string" or a bare word. Money, duration, and date fields are
+/// ordered by their value and must be compared to one; text fields are ordered by their bytes.
+class Filter
+{
+	public:
+		enum class Operator {
+			Equal,
+			Less,
+			LessEqual,
+			Greater,
+			GreaterEqual,
+			And,
+			Or,
+		};
+
+		/// A range of field values as they are held, i.e. encoded for typed fields; a bound is
+		/// only checked if it is set.
+		struct Range {
+			std::string lower;
+			std::string upper;
+			bool hasLower;
+			bool hasUpper;
+			bool isLowerInclusive;
+			bool isUpperInclusive;
+		};
+
+		// Construction
+		/// An empty filter that accepts every record.
+		Filter();
+
+		/// Compiles the given filter string; throws std::invalid_argument if it is malformed.
+		explicit Filter(const std::string& filterString);
+
+		// Public API
+		/// Returns true if no filter expression was given.
+		bool IsEmpty() const { return m_nodes.empty(); }
+
+		/// Returns true if the record's field values pass the filter.
+		bool Evaluate(const Model::field_view_t& record) const;
+
+		/// Returns false only if no record in the block can pass the filter, judging by its statistics.
+		bool MayMatch(const ZoneMap::Block& block) const;
+
+		/// Gets the ranges of the field's values that every record passing the filter has a value
+		/// within. Returns false if the filter doesn't narrow the field down.
+		bool Ranges(Model::FieldId field, std::vector<Filter::Range>& ranges) const;
+
+		/// Gets the expression as the tree it compiled to: lowercase field names, one spelling per
+		/// comparison, quoted values, and every AND / OR parenthesized. Empty if no expression was given.
+		std::string CanonicalForm() const;
+
+		/// Gets the fields the filter compares, each listed once.
+		Model::projection_t Fields() const;
+
+		/// Returns true if the value lies within the range.
+		static bool Contains(const Filter::Range& range, std::string_view fieldValue);
+
+	private:
+		/// A single operation in the expression tree; comparisons are leaves.
+		struct Node {
+			Filter::Operator op;
+			Model::FieldId field;
+			std::string value;
+			size_t lhs;
+			size_t rhs;
+
+			/// The value as an encoded number, for money, duration, and date fields whose values are
+			/// held encoded; empty if the value is not a number of the field's type.
+			std::string encodedValue;
+
+			/// The value as a number, for ordering comparisons of typed fields.
+			std::int64_t number;
+		};
+
+		/// Recursive descent over the tokenized filter string; each returns the index of the node it built.
+		size_t ParseExpression(const std::vector<std::string>& tokens, size_t& position);
+		size_t ParseTerm(const std::vector<std::string>& tokens, size_t& position);
+		size_t ParseFactor(const std::vector<std::string>& tokens, size_t& position);
+
+		/// Appends a node to the tree and returns its index.
+		size_t AddNode(Filter::Operator op, Model::FieldId field, const std::string& value, size_t lhs, size_t rhs);
+
+		/// Evaluates the subtree rooted at the given node, short circuiting AND / OR.
+		bool Evaluate(size_t node, const Model::field_view_t& record) const;
+
+		/// Same as above against a block's statistics rather than a record.
+		bool MayMatch(size_t node, const ZoneMap::Block& block) const;
+
+		/// Same as above for the subtree rooted at the given node.
+		bool Ranges(size_t node, Model::FieldId field, std::vector<Filter::Range>& ranges) const;
+
+		/// Same as above for the subtree rooted at the given node.
+		void CanonicalForm(size_t node, std::string& form) const;
+
+		/// Gets the range of held values an ordering comparison node accepts; typed fields also
+		/// accept any value held as text, which is compared by the number it parses to.
+		void ComparisonRanges(const Filter::Node& node, std::vector<Filter::Range>& ranges) const;
+
+		/// Splits a filter string into field names, values, operators, and parentheses.
+		static std::vector<std::string> Tokenize(const std::string& filterString);
+
+		/// Flattened expression tree and the index of its root.
+		std::vector<Filter::Node> m_nodes;
+		size_t m_root;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "delimiter_scanner.h"
+#include "key_index.h"
+#include "model.h"
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const std::string KeyIndex::m_fileTag = "sdsidx4";
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+KeyIndex::KeyIndex() : m_offsets(), m_deadRuns(), m_newDeadOffsets(), m_deadCount(0), m_hits(0), m_misses(0), m_isModified(false)
+{
+}
+
+KeyIndex::~KeyIndex()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool KeyIndex::Load(const std::string& indexPath, const std::string& dataStorePath)
+{
+	this->Clear();
+
+	std::ifstream indexFile;
+	size_t deadCount = 0;
+	size_t keyCount = 0;
+	if (!KeyIndex::OpenIndex(indexPath, dataStorePath, indexFile, deadCount, keyCount)) {
+		return false;
+	}
+
+	// The dead line offsets come first, in order, then each entry is the record offset followed by
+	// a single space and the key.
+	std::streamoff offset = 0;
+	KeyIndex::offset_list_t deadOffsets;
+	deadOffsets.reserve(deadCount);
+	while (deadOffsets.size() < deadCount && indexFile >> offset) {
+		deadOffsets.emplace_back(offset);
+	}
+
+	std::string key = "";
+	m_offsets.reserve(keyCount);
+	while (indexFile >> offset && indexFile.get() == ' ' && std::getline(indexFile, key)) {
+		m_offsets[key] = offset;
+	}
+
+	// A file cut short still ends cleanly at a line, so the counts catch one missing entries.
+	if (!indexFile.eof() || deadOffsets.size() != deadCount || m_offsets.size() != keyCount) {
+		m_offsets.clear();
+		return false;
+	}
+
+	m_deadCount = deadOffsets.size();
+	m_deadRuns.emplace_back(std::make_shared<const KeyIndex::offset_list_t>(std::move(deadOffsets)));
+	m_isModified = false;
+	return true;
+}
+
+void KeyIndex::Save(const std::string& indexPath, const std::string& dataStorePath)
+{
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	if (!KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime)) {
+		throw std::runtime_error("Unable to stat datastore: " + dataStorePath);
+	}
+
+	// Written aside and renamed over the old file, so a crash never leaves a partial index.
+	const std::string tmpPath = indexPath + ".tmp";
+	std::ofstream indexFile(tmpPath, std::ios::out | std::ios::trunc);
+	if (!indexFile) {
+		throw std::runtime_error("Unable to write index: " + tmpPath);
+	}
+
+	const KeyIndex::offset_list_t& deadOffsets = this->DeadOffsets();
+	indexFile << m_fileTag << " " << dataStoreSize << " " << dataStoreTime << " " << deadOffsets.size() << " " << m_offsets.size() << "\n";
+	for (auto offset : deadOffsets) {
+		indexFile << offset << "\n";
+	}
+
+	for (auto& entry : m_offsets) {
+		indexFile << entry.second << " " << entry.first << "\n";
+	}
+
+	indexFile.close();
+	if (!indexFile) {
+		throw std::runtime_error("Failed to write index: " + tmpPath);
+	}
+
+	std::filesystem::rename(tmpPath, indexPath);
+	m_isModified = false;
+}
+
+bool KeyIndex::LoadDeadOffsets(const std::string& indexPath, const std::string& dataStorePath, KeyIndex::offset_list_t& deadOffsets)
+{
+	deadOffsets.clear();
+	std::ifstream indexFile;
+	size_t deadCount = 0;
+	size_t keyCount = 0;
+	if (!KeyIndex::OpenIndex(indexPath, dataStorePath, indexFile, deadCount, keyCount)) {
+		return false;
+	}
+
+	std::streamoff offset = 0;
+	deadOffsets.reserve(deadCount);
+	while (deadOffsets.size() < deadCount && indexFile >> offset) {
+		deadOffsets.emplace_back(offset);
+	}
+
+	if (deadOffsets.size() != deadCount) {
+		deadOffsets.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void KeyIndex::Rebuild(std::string_view dataStore)
+{
+	this->Clear();
+
+	std::string_view recordString;
+	Model::field_view_t fieldValues;
+	RecordScanner scanner(dataStore);
+	size_t offset = scanner.Position();
+	while (scanner.Next(recordString, fieldValues)) {
+		if (recordString.empty()) {
+			offset = scanner.Position();
+			continue;
+		}
+
+		// A tombstone deletes the record of its key, and is dead itself.
+		if (Model::IsTombstone(recordString)) {
+			this->Erase(Model(fieldValues).Key());
+			this->MarkDead(static_cast<std::streamoff>(offset));
+		} else {
+			this->Insert(Model(fieldValues).Key(), static_cast<std::streamoff>(offset));
+		}
+
+		offset = scanner.Position();
+	}
+}
+
+bool KeyIndex::Find(const std::string& key, std::streamoff& offset)
+{
+	auto entry = m_offsets.find(key);
+	if (entry == m_offsets.end()) {
+		++m_misses;
+		return false;
+	}
+
+	++m_hits;
+	offset = entry->second;
+	return true;
+}
+
+void KeyIndex::Insert(const std::string& key, std::streamoff offset)
+{
+	auto entry = m_offsets.emplace(key, offset);
+	if (!entry.second && entry.first->second != offset) {
+		this->MarkDead(entry.first->second);
+		entry.first->second = offset;
+	}
+
+	m_isModified = true;
+}
+
+void KeyIndex::Erase(const std::string& key)
+{
+	auto entry = m_offsets.find(key);
+	if (entry == m_offsets.end()) {
+		return;
+	}
+
+	this->MarkDead(entry->second);
+	m_offsets.erase(entry);
+	m_isModified = true;
+}
+
+void KeyIndex::MarkDead(std::streamoff offset)
+{
+	m_newDeadOffsets.emplace_back(offset);
+	++m_deadCount;
+	m_isModified = true;
+}
+
+void KeyIndex::Clear()
+{
+	m_offsets.clear();
+	m_deadRuns.clear();
+	m_newDeadOffsets.clear();
+	m_deadCount = 0;
+	m_isModified = true;
+}
+
+void KeyIndex::Assign(KeyIndex::offset_map_t&& offsets)
+{
+	m_offsets = std::move(offsets);
+	m_deadRuns.clear();
+	m_newDeadOffsets.clear();
+	m_deadCount = 0;
+	m_isModified = true;
+}
+
+const KeyIndex::offset_list_t& KeyIndex::DeadOffsets()
+{
+	this->DeadRuns();
+	while (m_deadRuns.size() > 1) {
+		auto merged = KeyIndex::MergeRuns(*m_deadRuns[m_deadRuns.size() - 2], *m_deadRuns.back());
+		m_deadRuns.pop_back();
+		m_deadRuns.back() = merged;
+	}
+
+	if (m_deadRuns.empty()) {
+		m_deadRuns.emplace_back(std::make_shared<const KeyIndex::offset_list_t>());
+	}
+
+	m_deadCount = m_deadRuns.front()->size();
+	return *m_deadRuns.front();
+}
+
+const KeyIndex::offset_run_list_t& KeyIndex::DeadRuns()
+{
+	if (m_newDeadOffsets.empty()) {
+		return m_deadRuns;
+	}
+
+	// Lines are mostly marked dead in log order, so the new offsets are usually sorted already.
+	if (!std::is_sorted(std::begin(m_newDeadOffsets), std::end(m_newDeadOffsets))) {
+		std::sort(std::begin(m_newDeadOffsets), std::end(m_newDeadOffsets));
+	}
+
+	m_newDeadOffsets.erase(std::unique(std::begin(m_newDeadOffsets), std::end(m_newDeadOffsets)), std::end(m_newDeadOffsets));
+	m_deadRuns.emplace_back(std::make_shared<const KeyIndex::offset_list_t>(std::move(m_newDeadOffsets)));
+	m_newDeadOffsets.clear();
+	while (m_deadRuns.size() > 1 && m_deadRuns[m_deadRuns.size() - 2]->size() <= 2 * m_deadRuns.back()->size()) {
+		auto merged = KeyIndex::MergeRuns(*m_deadRuns[m_deadRuns.size() - 2], *m_deadRuns.back());
+		m_deadRuns.pop_back();
+		m_deadRuns.back() = merged;
+	}
+
+	m_deadCount = 0;
+	for (auto& deadRun : m_deadRuns) {
+		m_deadCount += deadRun->size();
+	}
+
+	return m_deadRuns;
+}
+
+bool KeyIndex::DataStoreStamp(const std::string& dataStorePath, std::uintmax_t& size, std::int64_t& modifiedTime)
+{
+	std::error_code error;
+	size = std::filesystem::file_size(dataStorePath, error);
+	if (error) {
+		return false;
+	}
+
+	auto writeTime = std::filesystem::last_write_time(dataStorePath, error);
+	if (error) {
+		return false;
+	}
+
+	modifiedTime = static_cast<std::int64_t>(writeTime.time_since_epoch().count());
+	return true;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+std::shared_ptr<const KeyIndex::offset_list_t> KeyIndex::MergeRuns(const KeyIndex::offset_list_t& first,
+		const KeyIndex::offset_list_t& second)
+{
+	auto merged = std::make_shared<KeyIndex::offset_list_t>();
+	merged->reserve(first.size() + second.size());
+	std::set_union(std::begin(first), std::end(first), std::begin(second), std::end(second), std::back_inserter(*merged));
+	return merged;
+}
+
+bool KeyIndex::OpenIndex(const std::string& indexPath, const std::string& dataStorePath, std::ifstream& indexFile, size_t& deadCount,
+		size_t& keyCount)
+{
+	indexFile.open(indexPath);
+	if (!indexFile) {
+		return false;
+	}
+
+	// The index is only valid for the exact datastore state it was saved against.
+	std::string tag = "";
+	std::uintmax_t indexedSize = 0;
+	std::int64_t indexedTime = 0;
+	if (!(indexFile >> tag >> indexedSize >> indexedTime >> deadCount >> keyCount) || tag != m_fileTag) {
+		return false;
+	}
+
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	return (KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime) &&
+			dataStoreSize == indexedSize && dataStoreTime == indexedTime);
+}
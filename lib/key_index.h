@@ -0,0 +1,118 @@
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Persistent mapping of record keys to the byte offset of their record in the datastore.
+/// The index is kept in a sidecar file next to the datastore and is stamped with the
+/// size and modification time of the datastore so a stale index can be detected.
+///
+/// The datastore is an append only log, so the index also keeps the offsets of its dead lines:
+/// records superseded by a later version or deleted, and the tombstones that deleted them. They
+/// are kept as sorted runs that are never changed once made, so snapshots of the datastore share
+/// them instead of copying every dead offset for each version.
+class KeyIndex
+{
+	public:
+		typedef std::unordered_map<std::string, std::streamoff> offset_map_t;
+		typedef std::vector<std::streamoff> offset_list_t;
+		typedef std::vector<std::shared_ptr<const KeyIndex::offset_list_t>> offset_run_list_t;
+
+		// Construction
+		KeyIndex();
+		~KeyIndex();
+
+		// Public API
+		/// Loads the sidecar index file. Returns false if it is missing or does not match the datastore.
+		bool Load(const std::string& indexPath, const std::string& dataStorePath);
+
+		/// Writes the sidecar index file, stamped with the current state of the datastore file; the
+		/// file is replaced whole, so it is never left partly written.
+		void Save(const std::string& indexPath, const std::string& dataStorePath);
+
+		/// Reads only the dead line offsets of the sidecar index file, in order, i.e. for a scan that
+		/// needs nothing else. Returns false if it is missing or does not match the datastore.
+		static bool LoadDeadOffsets(const std::string& indexPath, const std::string& dataStorePath, KeyIndex::offset_list_t& deadOffsets);
+
+		/// Discards the current index and rebuilds it with a single pass over the datastore, replaying
+		/// its log of records and tombstones in order.
+		void Rebuild(std::string_view dataStore);
+
+		/// Looks up the record offset for the given key; counts towards the hit/miss statistics.
+		bool Find(const std::string& key, std::streamoff& offset);
+
+		/// Adds or replaces the record offset for the given key; a replaced record is dead.
+		void Insert(const std::string& key, std::streamoff offset);
+
+		/// Removes the given key from the index if present; its record is dead.
+		void Erase(const std::string& key);
+
+		/// Marks the line at the given offset dead, i.e. a tombstone.
+		void MarkDead(std::streamoff offset);
+
+		/// Removes all keys and dead lines from the index.
+		void Clear();
+
+		/// Replaces the whole index, i.e. after the datastore file has been rewritten without dead lines.
+		void Assign(KeyIndex::offset_map_t&& offsets);
+
+		// Public accessors
+		const KeyIndex::offset_map_t& Offsets() const { return m_offsets; }
+		size_t Size() const { return m_offsets.size(); }
+		size_t Hits() const { return m_hits; }
+		size_t Misses() const { return m_misses; }
+
+		/// Gets the offsets of the dead lines of the datastore, in order, merging their runs into one.
+		const KeyIndex::offset_list_t& DeadOffsets();
+
+		/// Gets the offsets of the dead lines of the datastore as sorted runs, which a copy of the list
+		/// shares. The lines marked dead since the last call make a new run, merged into the one
+		/// before it while that is no more than twice its size, so there are only logarithmically many.
+		const KeyIndex::offset_run_list_t& DeadRuns();
+		size_t DeadCount() const { return m_deadCount; }
+
+		/// True if the index has changed since it was last loaded or saved.
+		bool IsModified() const { return m_isModified; }
+
+		/// Gets the size and modification time of the datastore file that sidecar files are stamped with.
+		static bool DataStoreStamp(const std::string& dataStorePath, std::uintmax_t& size, std::int64_t& modifiedTime);
+
+	private:
+		/// Opens the sidecar index file and reads its header, checking it matches the datastore; gets
+		/// the number of dead lines and keys the file holds.
+		static bool OpenIndex(const std::string& indexPath, const std::string& dataStorePath, std::ifstream& indexFile, size_t& deadCount,
+				size_t& keyCount);
+
+		/// Header tag written as the first token of the sidecar file.
+		static const std::string m_fileTag;
+
+		/// Key to datastore file offset lookup.
+		KeyIndex::offset_map_t m_offsets;
+
+		/// Merges two sorted runs of offsets into a new one, without duplicates.
+		static std::shared_ptr<const KeyIndex::offset_list_t> MergeRuns(const KeyIndex::offset_list_t& first,
+				const KeyIndex::offset_list_t& second);
+
+		/// Sorted runs of dead line offsets, then those marked dead since in the order they were, and
+		/// how many there are in all.
+		KeyIndex::offset_run_list_t m_deadRuns;
+		KeyIndex::offset_list_t m_newDeadOffsets;
+		size_t m_deadCount;
+
+		/// Lookup statistics.
+		size_t m_hits;
+		size_t m_misses;
+
+		/// Set when the in-memory index no longer matches the sidecar file.
+		bool m_isModified;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+MappedFile::MappedFile() : m_data(nullptr), m_size(0)
+{
+}
+
+MappedFile::MappedFile(const std::string& path) : m_data(nullptr), m_size(0)
+{
+	this->Open(path);
+}
+
+MappedFile::~MappedFile()
+{
+	this->Close();
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void MappedFile::Open(const std::string& path)
+{
+	this->Close();
+
+	int fileDescriptor = ::open(path.c_str(), O_RDONLY);
+	if (fileDescriptor < 0) {
+		throw std::invalid_argument("Unable to open file: " + path);
+	}
+
+	struct stat fileStatus;
+	if (::fstat(fileDescriptor, &fileStatus) != 0) {
+		::close(fileDescriptor);
+		throw std::runtime_error("Unable to stat file: " + path);
+	}
+
+	// An empty file can't be mapped; leave the view empty instead.
+	size_t size = static_cast<size_t>(fileStatus.st_size);
+	if (size > 0) {
+		void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (data == MAP_FAILED) {
+			::close(fileDescriptor);
+			throw std::runtime_error("Unable to map file: " + path);
+		}
+
+		// Records are scanned front to back, so let the kernel read ahead aggressively.
+		::madvise(data, size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char*>(data);
+		m_size = size;
+	}
+
+	::close(fileDescriptor);
+	return;
+}
+
+void MappedFile::Close()
+{
+	if (m_data != nullptr) {
+		::munmap(const_cast<char*>(m_data), m_size);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+	return;
+}
@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/// Read only memory mapping of a whole file.
+class MappedFile
+{
+	public:
+		// Construction
+		MappedFile();
+		explicit MappedFile(const std::string& path);
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator= (const MappedFile&) = delete;
+		~MappedFile();
+
+		// Public API
+		/// Maps the given file, replacing any existing mapping. Throws if the file can't be mapped.
+		void Open(const std::string& path);
+
+		/// Releases the mapping.
+		void Close();
+
+		/// Gets the mapped contents; empty if nothing is mapped.
+		std::string_view View() const { return std::string_view(m_data, m_size); }
+
+		const char* Data() const { return m_data; }
+		size_t Size() const { return m_size; }
+
+	private:
+		/// Start and length of the mapped region.
+		const char* m_data;
+		size_t m_size;
+};
+
+#endif
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <stdexcept>
 #include "model.h"
 
+static bool ParseDate(std::string_view fieldValue, std::int64_t& days);
+static size_t FormatDate(std::int64_t days, char* buffer);
+
 
 // ****************************************************************************
 // Static initialization
@@ -14,43 +19,65 @@ const Model::field_list_t Model::m_validFields =
 	{ "provider" }, // The distributor of the media asset. (Text, max size 64 char).
 	{ "date" },     // The local date on which the content was leased by through the STB (A date in YYYY-MM-DD format).
 	{ "rev" },      // The price incurred by the STB to lease the asset. (Price in US dollars and cents).
-	{ "viewtime" }, // The amount of time the STB played the asset.  (Time in hours:minutes).
+	{ "viewtime" }, // The amount of time the STB played the asset.  (Time in hours:minutes).
 };
 
-const size_t Model::string_len_max_t = 64;
+const std::string Model::m_tombstoneField = "deleted";
+const unsigned char Model::m_longFieldLength = 0xFF;
+const unsigned char Model::m_encodedZero = 0xF0;
+
+const Model::projection_ptr_t& Model::DefaultOrdering()
+{
+	static const Model::projection_ptr_t defaultOrdering = Model::MakeProjection(Model::m_validFields);
+	return defaultOrdering;
+}
 
 
 // ****************************************************************************
 // Construction
 // ****************************************************************************
-Model::Model() : m_fields(), m_fieldOrdering(Model::m_validFields), m_hasData(false)
+Model::Model() : m_fields(), m_longFields(), m_fieldOrdering(Model::DefaultOrdering()), m_hasData(false)
 {
-	for (auto& field : Model::m_validFields) {
-		m_fields[field] = "";
-	}
 }
 
-Model::Model(const std::string& modelRecord) : m_fields(), m_fieldOrdering(Model::m_validFields), m_hasData(false)
+Model::Model(const std::string& modelRecord) : m_fields(), m_longFields(), m_fieldOrdering(Model::DefaultOrdering()), m_hasData(false)
 {
-	for (auto& field : Model::m_validFields) {
-		m_fields[field] = "";
+	// A record with no tokens leaves the model in its default constructed state.
+	if (modelRecord.empty()) {
+		return;
 	}
 
 	// Use the known valid fields collection as a schema for parsing.
 	// Could inject a schema dependency into this constructor instead.
-	std::string fieldValue = "";
-	std::istringstream iss(modelRecord);
-	for (auto& field : Model::m_validFields) {
-		// Set the field's value if there was a matching token to parse.
-		if (std::getline(iss, fieldValue, '|')) {
-			this->Field(field, fieldValue);
-			m_hasData = true; // Flag that we are no longer in default constructed state.
-		} else {
-			this->Field(field, "");
-		}
+	Model::field_view_t fieldValues;
+	Model::Split(modelRecord, fieldValues);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		this->Field(static_cast<Model::FieldId>(field), fieldValues[field]);
+	}
+}
+
+Model::Model(const Model::field_view_t& fieldValues)
+	: m_fields(), m_longFields(), m_fieldOrdering(Model::DefaultOrdering()), m_hasData(false)
+{
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		this->Field(static_cast<Model::FieldId>(field), fieldValues[field]);
+	}
+}
+
+Model::Model(const Model::field_view_t& fieldValues, const Model::projection_t& fields)
+	: m_fields(), m_longFields(), m_fieldOrdering(Model::DefaultOrdering()), m_hasData(false)
+{
+	for (auto field : fields) {
+		this->Field(field, fieldValues[static_cast<size_t>(field)]);
 	}
 }
 
+Model::Model(const Model& model) = default;
+Model::Model(Model&& model) noexcept = default;
+Model& Model::operator= (const Model& model) = default;
+Model& Model::operator= (Model&& model) noexcept = default;
+Model::~Model() = default;
+
 
 // ****************************************************************************
 // Operator overloads
@@ -77,37 +104,92 @@ std::istream& operator>> (std::istream &inStream, Model& model)
 std::string Model::Key() const
 {
 	// Apply constraint that models be unique by fields 'stb', 'title', and 'date'
-	return m_fields.at("stb") + m_fields.at("title") + m_fields.at("date");
+	std::string_view stb = this->Field(Model::FieldId::Stb);
+	std::string_view title = this->Field(Model::FieldId::Title);
+	std::string_view date = this->Field(Model::FieldId::Date);
+
+	std::string key;
+	key.reserve(stb.length() + title.length() + date.length());
+	key.append(stb).append(title).append(date);
+	return key;
 }
 
 void Model::Field(const std::string& field, const std::string& fieldValue)
 {
-	// Known fields are populated to null values on construction of this class.
-	if (m_fields.count(field) == 0) {
-		throw std::invalid_argument("Unknown field: " + field);
+	this->Field(Model::FieldIndex(field), fieldValue);
+}
+
+std::string Model::Field(const std::string& field) const
+{
+	char buffer[Model::number_len_max_t];
+	Model::FieldId fieldId = Model::FieldIndex(field);
+	return std::string(Model::Text(fieldId, this->Field(fieldId), buffer));
+}
+
+void Model::Field(Model::FieldId field, std::string_view fieldValue)
+{
+	// Parse typed values once here rather than wherever they are compared or aggregated. Only
+	// values that format back exactly are encoded, so nothing is lost, and values that already
+	// are encoded (lead byte 0x80 or above) are copied straight in.
+	char buffer[Model::number_len_max_t];
+	std::int64_t number = 0;
+	const Model::FieldType type = Model::Type(field);
+	if (type != Model::FieldType::Text && !fieldValue.empty() && static_cast<unsigned char>(fieldValue.front()) < 0x80 &&
+			Model::ParseNumber(type, fieldValue, number) &&
+			fieldValue == std::string_view(buffer, Model::FormatNumber(type, number, buffer))) {
+		fieldValue = std::string_view(buffer, Model::EncodeNumber(number, buffer));
 	}
 
 	// TODO: Implement mock field value constraint schema and enforce it
-	if (fieldValue.length() > Model::string_len_max_t) {
-		m_fields[field] = fieldValue.substr(0, Model::string_len_max_t);
-	} else {
-		m_fields[field] = fieldValue;
-	}
+	Model::FieldValue& value = m_fields[static_cast<size_t>(field)];
+	value.length = static_cast<unsigned char>(std::min(fieldValue.length(), Model::string_len_max_t));
+	std::memcpy(value.data, fieldValue.data(), value.length);
 
 	m_hasData = true; // Flag that we are no longer in default constructed state.
 	return;
 }
 
-std::string Model::Field(const std::string& field) const
+std::string_view Model::Field(Model::FieldId field) const
+{
+	if (static_cast<size_t>(field) >= Model::field_count_t) {
+		return (static_cast<size_t>(field) < m_longFields.size()) ? std::string_view(m_longFields[static_cast<size_t>(field)]) : std::string_view();
+	}
+
+	const Model::FieldValue& value = m_fields[static_cast<size_t>(field)];
+	if (value.length == Model::m_longFieldLength) {
+		return m_longFields[static_cast<size_t>(field)];
+	}
+
+	return std::string_view(value.data, value.length);
+}
+
+void Model::ResultField(Model::FieldId field, std::string_view fieldValue)
 {
-	if (m_fields.count(field) == 0) {
-		throw std::invalid_argument("Field not in schema: " + field);
+	const size_t index = static_cast<size_t>(field);
+	const bool isExtra = (index >= Model::field_count_t);
+	if (!isExtra && fieldValue.length() <= Model::string_len_max_t) {
+		this->Field(field, fieldValue);
+		return;
+	}
+
+	if (m_longFields.size() <= std::max(index, Model::field_count_t - 1)) {
+		m_longFields.resize(std::max(index + 1, Model::field_count_t));
 	}
 
-	return m_fields.at(field);
+	m_longFields[index] = fieldValue;
+	if (!isExtra) {
+		m_fields[index].length = Model::m_longFieldLength;
+	}
+
+	m_hasData = true;
 }
 
 void Model::SetOrdering(const Model::field_list_t& fieldOrdering)
+{
+	m_fieldOrdering = Model::MakeProjection(fieldOrdering);
+}
+
+void Model::SetOrdering(const Model::projection_ptr_t& fieldOrdering)
 {
 	m_fieldOrdering = fieldOrdering;
 }
@@ -115,22 +197,25 @@ void Model::SetOrdering(const Model::field_list_t& fieldOrdering)
 std::string Model::ToString(Model::SerializeMode mode) const
 {
 	std::string output = "";
-	for (auto& field : m_fieldOrdering) {
+	char buffer[Model::number_len_max_t];
+	const Model::projection_t& fieldOrdering = *m_fieldOrdering;
+	for (size_t i = 0; i < fieldOrdering.size(); ++i) {
+		std::string_view fieldValue = this->Field(fieldOrdering[i]);
 		switch (mode) {
 			case Model::SerializeMode::DataStore:
-				output += m_fields.at(field);
+				output += fieldValue;
 				// Do not place delimiters at the beginning and end of the record string.
-				if (field != m_fieldOrdering.back()) {
+				if (i + 1 != fieldOrdering.size()) {
 					output += "|";
 				}
 
 				break;
 
 			case Model::SerializeMode::Query:
-				if (!m_fields.at(field).empty()) {
-					output += m_fields.at(field);
+				if (!fieldValue.empty()) {
+					output += Model::Text(fieldOrdering[i], fieldValue, buffer);
 					// Do not place delimiters at the beginning and end of the record string.
-					if (field != m_fieldOrdering.back()) {
+					if (i + 1 != fieldOrdering.size()) {
 						output += ",";
 					}
 				}
@@ -144,3 +229,328 @@ std::string Model::ToString(Model::SerializeMode mode) const
 
 	return output;
 }
+
+std::string Model::Tombstone(std::string_view modelRecord)
+{
+	std::string tombstone;
+	tombstone.reserve(modelRecord.length() + 1 + Model::m_tombstoneField.length());
+	tombstone.append(modelRecord).append("|").append(Model::m_tombstoneField);
+	return tombstone;
+}
+
+bool Model::IsTombstone(std::string_view modelRecord)
+{
+	// Encoded values never hold a '|' byte, so the delimiters can be counted as is.
+	return (static_cast<size_t>(std::count(std::begin(modelRecord), std::end(modelRecord), '|')) >= Model::field_count_t);
+}
+
+void Model::Split(std::string_view modelRecord, Model::field_view_t& fieldValues)
+{
+	std::string_view::size_type tokenBegin = 0;
+	for (auto& fieldValue : fieldValues) {
+		// Set the field's value if there was a matching token to parse.
+		if (tokenBegin >= modelRecord.length()) {
+			fieldValue = std::string_view();
+			continue;
+		}
+
+		std::string_view::size_type tokenEnd = modelRecord.find('|', tokenBegin);
+		tokenEnd = (tokenEnd != std::string_view::npos) ? tokenEnd : modelRecord.length();
+		fieldValue = modelRecord.substr(tokenBegin, tokenEnd - tokenBegin);
+		tokenBegin = tokenEnd + 1;
+	}
+}
+
+Model::FieldId Model::FieldIndex(const std::string& field)
+{
+	for (size_t i = 0; i < Model::m_validFields.size(); ++i) {
+		if (Model::m_validFields[i] == field) {
+			return static_cast<Model::FieldId>(i);
+		}
+	}
+
+	throw std::invalid_argument("Field not in schema: " + field);
+}
+
+Model::projection_ptr_t Model::MakeProjection(const Model::field_list_t& fields)
+{
+	auto projection = std::make_shared<Model::projection_t>();
+	projection->reserve(fields.size());
+	for (auto& field : fields) {
+		projection->emplace_back(Model::FieldIndex(field));
+	}
+
+	return projection;
+}
+
+Model::FieldType Model::Type(Model::FieldId field)
+{
+	switch (field) {
+		case Model::FieldId::Rev:
+			return Model::FieldType::Money;
+
+		case Model::FieldId::ViewTime:
+			return Model::FieldType::Duration;
+
+		case Model::FieldId::Date:
+			return Model::FieldType::Date;
+
+		case Model::FieldId::Stb:
+		case Model::FieldId::Title:
+		case Model::FieldId::Provider:
+		default:
+			return Model::FieldType::Text;
+	}
+}
+
+bool Model::ParseNumber(Model::FieldType type, std::string_view fieldValue, std::int64_t& number)
+{
+	if (type == Model::FieldType::Text) {
+		return false;
+	}
+
+	// Values read back from the datastore are already numbers.
+	if (Model::DecodeNumber(fieldValue, number)) {
+		return true;
+	}
+
+	// Tolerate the surrounding whitespace some import files carry.
+	std::string_view::size_type begin = fieldValue.find_first_not_of(" \t\r");
+	if (begin == std::string_view::npos) {
+		return false;
+	}
+
+	fieldValue = fieldValue.substr(begin, fieldValue.find_last_not_of(" \t\r") + 1 - begin);
+	if (type == Model::FieldType::Date) {
+		return ParseDate(fieldValue, number);
+	}
+
+	bool isNegative = (fieldValue.front() == '-');
+	fieldValue.remove_prefix(isNegative ? 1 : 0);
+
+	// Money is "dollars[.cents]" and duration is "[hours:]minutes"; both are two integer parts.
+	const char separator = (type == Model::FieldType::Duration) ? ':' : '.';
+	std::string_view::size_type separatorPos = fieldValue.find(separator);
+	std::string_view major = (separatorPos != std::string_view::npos) ? fieldValue.substr(0, separatorPos) : fieldValue;
+	std::string_view minor = (separatorPos != std::string_view::npos) ? fieldValue.substr(separatorPos + 1) : std::string_view();
+	if ((major.empty() && minor.empty()) || minor.length() > 2 || major.length() > 15) {
+		return false;
+	}
+
+	std::int64_t majorValue = 0;
+	for (char digit : major) {
+		if (digit < '0' || digit > '9') {
+			return false;
+		}
+
+		majorValue = majorValue * 10 + (digit - '0');
+	}
+
+	std::int64_t minorValue = 0;
+	for (char digit : minor) {
+		if (digit < '0' || digit > '9') {
+			return false;
+		}
+
+		minorValue = minorValue * 10 + (digit - '0');
+	}
+
+	switch (type) {
+		case Model::FieldType::Money:
+			// "4.5" is four dollars and fifty cents.
+			number = majorValue * 100 + ((minor.length() == 1) ? minorValue * 10 : minorValue);
+			break;
+
+		case Model::FieldType::Duration:
+			// A bare number is a count of minutes.
+			number = (separatorPos != std::string_view::npos) ? majorValue * 60 + minorValue : majorValue;
+			break;
+
+		case Model::FieldType::Text:
+		case Model::FieldType::Date:
+		default:
+			return false;
+	}
+
+	number = isNegative ? -number : number;
+	return true;
+}
+
+std::string Model::FormatNumber(Model::FieldType type, std::int64_t number)
+{
+	char buffer[Model::number_len_max_t];
+	return std::string(buffer, Model::FormatNumber(type, number, buffer));
+}
+
+size_t Model::FormatNumber(Model::FieldType type, std::int64_t number, char* buffer)
+{
+	// Split into the whole part and the two digit cents / minutes part.
+	std::uint64_t magnitude = (number < 0) ? 0 - static_cast<std::uint64_t>(number) : static_cast<std::uint64_t>(number);
+	std::uint64_t major = magnitude;
+	std::uint64_t minor = 0;
+	char separator = '\0';
+	switch (type) {
+		case Model::FieldType::Money:
+			major = magnitude / 100;
+			minor = magnitude % 100;
+			separator = '.';
+			break;
+
+		case Model::FieldType::Duration:
+			major = magnitude / 60;
+			minor = magnitude % 60;
+			separator = ':';
+			break;
+
+		case Model::FieldType::Date:
+			return FormatDate(number, buffer);
+
+		case Model::FieldType::Text:
+		default:
+			break;
+	}
+
+	// Digits come out least significant first, so build the text backwards.
+	char digits[Model::number_len_max_t];
+	size_t length = 0;
+	if (separator != '\0') {
+		digits[length++] = static_cast<char>('0' + minor % 10);
+		digits[length++] = static_cast<char>('0' + minor / 10);
+		digits[length++] = separator;
+	}
+
+	do {
+		digits[length++] = static_cast<char>('0' + major % 10);
+		major /= 10;
+	} while (major > 0);
+
+	if (number < 0) {
+		digits[length++] = '-';
+	}
+
+	std::reverse_copy(digits, digits + length, buffer);
+	return length;
+}
+
+size_t Model::EncodeNumber(std::int64_t number, char* buffer)
+{
+	// A negative number is stored as the inverted groups of -(number + 1), so it sorts below every
+	// positive number, and below negative numbers of the same length but smaller magnitude.
+	const bool isNegative = (number < 0);
+	const std::uint64_t magnitude = isNegative ? static_cast<std::uint64_t>(-(number + 1)) : static_cast<std::uint64_t>(number);
+	size_t groupCount = 1;
+	while ((magnitude >> (7 * groupCount)) != 0) {
+		++groupCount;
+	}
+
+	buffer[0] = static_cast<char>(isNegative ? Model::m_encodedZero - groupCount : Model::m_encodedZero + groupCount);
+	for (size_t i = 0; i < groupCount; ++i) {
+		std::uint64_t group = (magnitude >> (7 * (groupCount - 1 - i))) & 0x7F;
+		buffer[i + 1] = static_cast<char>(0x80 | (isNegative ? ~group & 0x7F : group));
+	}
+
+	return groupCount + 1;
+}
+
+bool Model::DecodeNumber(std::string_view fieldValue, std::int64_t& number)
+{
+	if (fieldValue.length() < 2) {
+		return false;
+	}
+
+	const unsigned char lengthByte = static_cast<unsigned char>(fieldValue.front());
+	const bool isNegative = (lengthByte < Model::m_encodedZero);
+	const size_t groupCount = isNegative ? Model::m_encodedZero - lengthByte : lengthByte - Model::m_encodedZero;
+	if (groupCount == 0 || groupCount > 9 || fieldValue.length() != groupCount + 1) {
+		return false;
+	}
+
+	std::uint64_t magnitude = 0;
+	for (size_t i = 1; i < fieldValue.length(); ++i) {
+		const unsigned char group = static_cast<unsigned char>(fieldValue[i]);
+		if ((group & 0x80) == 0) {
+			return false;
+		}
+
+		magnitude = (magnitude << 7) | (isNegative ? ~group & 0x7F : group & 0x7F);
+	}
+
+	number = isNegative ? -static_cast<std::int64_t>(magnitude) - 1 : static_cast<std::int64_t>(magnitude);
+	return true;
+}
+
+std::string_view Model::Text(Model::FieldId field, std::string_view fieldValue, char* buffer)
+{
+	std::int64_t number = 0;
+	const Model::FieldType type = Model::Type(field);
+	if (type == Model::FieldType::Text || !Model::DecodeNumber(fieldValue, number)) {
+		return fieldValue;
+	}
+
+	return std::string_view(buffer, Model::FormatNumber(type, number, buffer));
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static bool ParseDate(std::string_view fieldValue, std::int64_t& days)
+{
+	if (fieldValue.length() != 10 || fieldValue[4] != '-' || fieldValue[7] != '-') {
+		return false;
+	}
+
+	std::int64_t year = 0;
+	std::int64_t month = 0;
+	std::int64_t day = 0;
+	for (size_t i = 0; i < fieldValue.length(); ++i) {
+		if (i == 4 || i == 7) {
+			continue;
+		}
+
+		if (fieldValue[i] < '0' || fieldValue[i] > '9') {
+			return false;
+		}
+
+		std::int64_t& part = (i < 4) ? year : (i < 7) ? month : day;
+		part = part * 10 + (fieldValue[i] - '0');
+	}
+
+	// Out of range days are rejected by the caller's round trip, i.e. 2014-02-30 formats as 2014-03-02.
+	if (month < 1 || month > 12 || day < 1 || day > 31) {
+		return false;
+	}
+
+	// Days from the civil calendar, with years starting in March so the leap day comes last.
+	year -= (month <= 2) ? 1 : 0;
+	const std::int64_t era = ((year >= 0) ? year : year - 399) / 400;
+	const std::int64_t yearOfEra = year - era * 400;
+	const std::int64_t dayOfYear = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	const std::int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	days = era * 146097 + dayOfEra - 719468;
+	return true;
+}
+
+static size_t FormatDate(std::int64_t days, char* buffer)
+{
+	// Inverse of ParseDate().
+	days += 719468;
+	const std::int64_t era = ((days >= 0) ? days : days - 146096) / 146097;
+	const std::int64_t dayOfEra = days - era * 146097;
+	const std::int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	const std::int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	const std::int64_t monthIndex = (5 * dayOfYear + 2) / 153;
+	const std::int64_t day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+	const std::int64_t month = monthIndex + ((monthIndex < 10) ? 3 : -9);
+	const std::int64_t year = yearOfEra + era * 400 + ((month <= 2) ? 1 : 0);
+	if (year < 0 || year > 9999) {
+		return Model::FormatNumber(Model::FieldType::Text, days - 719468, buffer);
+	}
+
+	const std::int64_t parts[] = { year / 1000, year / 100 % 10, year / 10 % 10, year % 10, -1, month / 10, month % 10, -1, day / 10, day % 10 };
+	for (size_t i = 0; i < 10; ++i) {
+		buffer[i] = (parts[i] < 0) ? '-' : static_cast<char>('0' + parts[i]);
+	}
+
+	return 10;
+}
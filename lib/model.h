@@ -1,9 +1,12 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include <map>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Model
@@ -14,14 +17,51 @@ class Model
 			Query,
 		};
 
+		/// Compile time indices for the fields this record model defines, in schema order.
+		enum class FieldId : unsigned char {
+			Stb,
+			Title,
+			Provider,
+			Date,
+			Rev,
+			ViewTime,
+		};
+
+		/// How a field's value is interpreted when it is stored, aggregated, or compared.
+		enum class FieldType {
+			Text,      // Held and compared as text.
+			Money,     // Dollars and cents, held as a count of cents.
+			Duration,  // Hours:minutes, held as a count of minutes.
+			Date,      // YYYY-MM-DD, held as a count of days since 1970-01-01.
+		};
+
 		typedef std::vector<std::string> field_list_t;
-		typedef std::map<std::string, std::string> field_value_map_t;
-		static const size_t string_len_max_t;
+		typedef std::vector<Model::FieldId> projection_t;
+		typedef std::shared_ptr<const Model::projection_t> projection_ptr_t;
+		static constexpr size_t string_len_max_t = 64;
+		static constexpr size_t field_count_t = 6;
+		static constexpr size_t number_len_max_t = 24;
+
+		/// Unowned field values of a record, i.e. slices of a memory mapped datastore line.
+		typedef std::array<std::string_view, Model::field_count_t> field_view_t;
 
 		// Construction
 		Model();
 		Model(const std::string& modelRecord);
 
+		/// Materializes a record from already split field values.
+		explicit Model(const Model::field_view_t& fieldValues);
+
+		/// Materializes only the listed fields from already split field values; the rest are left empty.
+		Model(const Model::field_view_t& fieldValues, const Model::projection_t& fields);
+
+		/// Copy / move / destruction are defined out of line so they are not inlined into every caller.
+		Model(const Model& model);
+		Model(Model&& model) noexcept;
+		Model& operator= (const Model& model);
+		Model& operator= (Model&& model) noexcept;
+		~Model();
+
 		// Operator overloads
 		/// Implements a check for a default-constructed (empty) record model.
 		bool operator! () const;
@@ -40,24 +80,112 @@ class Model
 		/// Get the value for a given field if the field is known by the schema.
 		std::string Field(const std::string& field) const;
 
+		/// Set the value for a field by its schema index. Money, duration, and date values are parsed
+		/// here and held encoded (see EncodeNumber()) when they format back to exactly the same text;
+		/// anything else, including an already encoded value, is held as given.
+		void Field(Model::FieldId field, std::string_view fieldValue);
+
+		/// Get the value for a field by its schema index as it is held, so possibly encoded; the view is
+		/// valid while this model is unchanged. Use Text() for a value to display.
+		std::string_view Field(Model::FieldId field) const;
+
+		/// Set a computed value, i.e. an aggregate result, which unlike a record value is not limited to
+		/// the schema's maximum field length. An index past the schema's fields is an extra result
+		/// column, i.e. for a field aggregated more than one way, held as text and only ever printed.
+		void ResultField(Model::FieldId field, std::string_view fieldValue);
+
 		/// Sets an override for the defaults ordering for serialization via ToString()
 		void SetOrdering(const Model::field_list_t& fieldOrdering);
 
+		/// Shares an already resolved ordering, i.e. one projection for every row of a query.
+		void SetOrdering(const Model::projection_ptr_t& fieldOrdering);
+
+		/// Gets the ordering used for serialization via ToString().
+		const Model::projection_ptr_t& FieldOrdering() const { return m_fieldOrdering; }
+
 		/// Serialize this object as a string using a mode parameter vs creating a custom
-		/// I/O manipulator to support ostream custom formatting
+		/// I/O manipulator to support ostream custom formatting. The datastore mode writes field
+		/// values as they are held, encoded numbers included; the query mode writes text.
 		std::string ToString(Model::SerializeMode mode = Model::SerializeMode::Query) const;
 
+		/// Makes the datastore line marking a record deleted: the record's datastore line followed by a
+		/// seventh field, which no record has.
+		static std::string Tombstone(std::string_view modelRecord);
+
+		/// True if a datastore line is a tombstone rather than a record.
+		static bool IsTombstone(std::string_view modelRecord);
+
+		/// Splits a textual record on its '|' delimiters without copying; missing fields are left empty.
+		static void Split(std::string_view modelRecord, Model::field_view_t& fieldValues);
+
+		/// Resolves a field name to its schema index; throws if the field is not in the schema.
+		static Model::FieldId FieldIndex(const std::string& field);
+
+		/// Resolves a list of field names to a shareable projection.
+		static Model::projection_ptr_t MakeProjection(const Model::field_list_t& fields);
+
+		/// Gets how the given field's values are interpreted.
+		static Model::FieldType Type(Model::FieldId field);
+
+		/// Parses a Money, Duration, or Date value, as text or encoded, into its count of cents, minutes,
+		/// or days. Returns false if the value is empty or malformed.
+		static bool ParseNumber(Model::FieldType type, std::string_view fieldValue, std::int64_t& number);
+
+		/// Formats a count of cents, minutes, or days as import files write it, i.e. "4.00", "1:30", or "2014-04-01".
+		static std::string FormatNumber(Model::FieldType type, std::int64_t number);
+
+		/// Same as above without allocating; writes to a buffer of at least number_len_max_t chars
+		/// and returns the length written.
+		static size_t FormatNumber(Model::FieldType type, std::int64_t number, char* buffer);
+
+		/// Encodes a number as the datastore holds it: a length byte followed by 7-bit groups, every byte
+		/// 0x80 or above so it never looks like a delimiter, and ordered so encoded numbers compare
+		/// bytewise in numeric order. Writes at most number_len_max_t chars and returns the length.
+		static size_t EncodeNumber(std::int64_t number, char* buffer);
+
+		/// Decodes a value written by EncodeNumber(). Returns false if the value is not an encoded number.
+		static bool DecodeNumber(std::string_view fieldValue, std::int64_t& number);
+
+		/// Gets a field value as text: an encoded number is formatted into the buffer, which must hold at
+		/// least number_len_max_t chars, and anything else is returned as is.
+		static std::string_view Text(Model::FieldId field, std::string_view fieldValue, char* buffer);
+
 
 		/// Used as a schema for all the valid field names this record model defines.
 		static const Model::field_list_t m_validFields;
 
+		/// Field appended to a record's datastore line to make its tombstone.
+		static const std::string m_tombstoneField;
+
 	private:
-		/// Contains the values for the fields this record model defines.
-		Model::field_value_map_t m_fields;
+		/// Inline storage for one field value, sized so any value allowed by the schema fits.
+		/// Only the length is initialized; bytes past it are never read.
+		struct FieldValue {
+			FieldValue() : length(0) {}
+			unsigned char length;
+			char data[Model::string_len_max_t];
+		};
+
+		/// Length marking a value that did not fit inline and is held in m_longFields instead.
+		static const unsigned char m_longFieldLength;
+
+		/// Length byte of an encoded number with no 7-bit groups; positive numbers count up from it
+		/// and negative numbers down.
+		static const unsigned char m_encodedZero;
+
+		/// Projection shared by every model that uses the default schema ordering.
+		static const Model::projection_ptr_t& DefaultOrdering();
+
+		/// Contains the values for the fields this record model defines, indexed by FieldId.
+		Model::FieldValue m_fields[Model::field_count_t];
+
+		/// Result values too long for inline storage, indexed by FieldId, followed by any extra result
+		/// columns; empty unless one was set.
+		std::vector<std::string> m_longFields;
 
 		/// Specifies what fields and which order are to be printed in ToString().
-		/// Default constructed to the known fields set in Model::m_knownFields.
-		Model::field_list_t m_fieldOrdering;
+		/// Defaults to the shared projection of the known fields in Model::m_validFields.
+		Model::projection_ptr_t m_fieldOrdering;
 
 		/// Set to true after any field has been modified from its default value.
 		bool m_hasData;
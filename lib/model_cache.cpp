@@ -0,0 +1,121 @@
+#include "model_cache.h"
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t ModelCache::m_defaultCapacity = 64 << 20;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ModelCache::ModelCache() : ModelCache(ModelCache::m_defaultCapacity)
+{
+}
+
+ModelCache::ModelCache(size_t capacity)
+	: m_entries(), m_lookup(), m_capacity(capacity), m_size(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+ModelCache::~ModelCache()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool ModelCache::Find(const std::string& key, Model& model)
+{
+	auto found = m_lookup.find(key);
+	if (found == std::end(m_lookup)) {
+		++m_misses;
+		return false;
+	}
+
+	++m_hits;
+	m_entries.splice(std::begin(m_entries), m_entries, found->second);
+	model = found->second->second;
+	return true;
+}
+
+void ModelCache::Insert(const std::string& key, const Model& model)
+{
+	auto found = m_lookup.find(key);
+	if (found != std::end(m_lookup)) {
+		found->second->second = model;
+		m_entries.splice(std::begin(m_entries), m_entries, found->second);
+		return;
+	}
+
+	// A record too big for the whole cache is never held.
+	const size_t entrySize = ModelCache::EntrySize(key);
+	if (entrySize > m_capacity) {
+		return;
+	}
+
+	m_entries.emplace_front(key, model);
+	m_lookup.emplace(m_entries.front().first, std::begin(m_entries));
+	m_size += entrySize;
+	this->Evict();
+}
+
+void ModelCache::Refresh(const std::string& key, const Model& model)
+{
+	auto found = m_lookup.find(key);
+	if (found != std::end(m_lookup)) {
+		found->second->second = model;
+	}
+}
+
+void ModelCache::Erase(const std::string& key)
+{
+	auto found = m_lookup.find(key);
+	if (found == std::end(m_lookup)) {
+		return;
+	}
+
+	// The hash table key views the entry's key, so it goes first.
+	auto entry = found->second;
+	m_size -= ModelCache::EntrySize(entry->first);
+	m_lookup.erase(found);
+	m_entries.erase(entry);
+}
+
+void ModelCache::Clear()
+{
+	m_lookup.clear();
+	m_entries.clear();
+	m_size = 0;
+}
+
+void ModelCache::Capacity(size_t capacity)
+{
+	m_capacity = capacity;
+	this->Evict();
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+size_t ModelCache::EntrySize(const std::string& key)
+{
+	// List node with its two links, hash node with its link and cached hash, and a bucket pointer.
+	const size_t listNodeSize = sizeof(ModelCache::entry_list_t::value_type) + 2 * sizeof(void*);
+	const size_t hashNodeSize = sizeof(std::string_view) + sizeof(ModelCache::entry_list_t::iterator) + 2 * sizeof(void*);
+	return listNodeSize + hashNodeSize + sizeof(void*) + key.size();
+}
+
+void ModelCache::Evict()
+{
+	while (m_size > m_capacity && !m_entries.empty()) {
+		const ModelCache::entry_list_t::value_type& entry = m_entries.back();
+		m_size -= ModelCache::EntrySize(entry.first);
+		m_lookup.erase(entry.first);
+		m_entries.pop_back();
+		++m_evictions;
+	}
+}
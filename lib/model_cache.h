@@ -0,0 +1,80 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include "model.h"
+
+/// Memory cache of records by key, bounded by an estimate of the bytes it holds so a long running
+/// process keeps a flat footprint. Keys are looked up through a hash table into a list of entries
+/// kept in most recently used order, and the least recently used entries are evicted whenever the
+/// cache grows past its capacity.
+class ModelCache
+{
+	public:
+		// Construction
+		ModelCache();
+		explicit ModelCache(size_t capacity);
+		ModelCache(const ModelCache&) = delete;
+		ModelCache& operator= (const ModelCache&) = delete;
+		~ModelCache();
+
+		// Public API
+		/// Copies the record cached for the key and marks it most recently used; counts towards the
+		/// hit/miss statistics. Returns false if the key isn't cached.
+		bool Find(const std::string& key, Model& model);
+
+		/// Caches the record for the key as the most recently used, replacing any already cached.
+		void Insert(const std::string& key, const Model& model);
+
+		/// Replaces the record cached for the key, if there is one, without changing its recency.
+		void Refresh(const std::string& key, const Model& model);
+
+		/// Removes the key from the cache if present.
+		void Erase(const std::string& key);
+
+		/// Removes every entry; the statistics are kept.
+		void Clear();
+
+		// Public accessors
+		/// Sets the most bytes the cache may hold, evicting entries down to it.
+		void Capacity(size_t capacity);
+		size_t Capacity() const { return m_capacity; }
+
+		/// Gets the estimated bytes held by the cached entries.
+		size_t Size() const { return m_size; }
+		size_t Count() const { return m_lookup.size(); }
+		size_t Hits() const { return m_hits; }
+		size_t Misses() const { return m_misses; }
+		size_t Evictions() const { return m_evictions; }
+
+		/// Capacity of a cache constructed without one.
+		static const size_t m_defaultCapacity;
+
+	private:
+		typedef std::list<std::pair<std::string, Model>> entry_list_t;
+
+		/// Estimates the bytes an entry for the key takes: the list node and its record, the key's
+		/// characters, and the hash table node and bucket referring to it.
+		static size_t EntrySize(const std::string& key);
+
+		/// Evicts the least recently used entries until the cache is within its capacity.
+		void Evict();
+
+		/// Entries from most to least recently used. List nodes never move, so the hash table keys
+		/// are views of the keys held here.
+		ModelCache::entry_list_t m_entries;
+		std::unordered_map<std::string_view, ModelCache::entry_list_t::iterator> m_lookup;
+
+		size_t m_capacity;
+		size_t m_size;
+		size_t m_hits;
+		size_t m_misses;
+		size_t m_evictions;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "ordering.h"
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+Ordering::Ordering() : m_keys()
+{
+}
+
+Ordering::Ordering(const std::string& orderString) : m_keys()
+{
+	std::string token;
+	std::istringstream iss(orderString);
+	while (std::getline(iss, token, ',')) {
+		std::transform(std::begin(token), std::end(token), std::begin(token), ::tolower);
+
+		// Split off the optional direction after the ':' delimiter.
+		std::string direction = "asc";
+		std::string::size_type pos = token.find(':');
+		if (pos != std::string::npos) {
+			direction = token.substr(pos + 1);
+			token = token.substr(0, pos);
+		}
+
+		if (direction != "asc" && direction != "desc") {
+			throw std::invalid_argument("Invalid order direction " + direction + " given for " + token + ".");
+		}
+
+		Ordering::Key key = { Model::FieldIndex(token), Model::FieldType::Text, (direction == "desc") };
+		key.type = Model::Type(key.field);
+		m_keys.emplace_back(key);
+	}
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+int Ordering::Compare(const Model& lhs, const Model& rhs) const
+{
+	for (auto& key : m_keys) {
+		int result = 0;
+		if (key.type == Model::FieldType::Text) {
+			result = lhs.Field(key.field).compare(rhs.Field(key.field));
+		} else {
+			std::int64_t lhsNumber = Ordering::ParseKey(key, lhs);
+			std::int64_t rhsNumber = Ordering::ParseKey(key, rhs);
+			result = (lhsNumber < rhsNumber) ? -1 : (lhsNumber > rhsNumber) ? 1 : 0;
+		}
+
+		if (result != 0) {
+			return key.isDescending ? -result : result;
+		}
+	}
+
+	return 0;
+}
+
+void Ordering::ParseKeys(const Model& row, std::int64_t* numbers) const
+{
+	for (size_t i = 0; i < m_keys.size(); ++i) {
+		numbers[i] = (m_keys[i].type != Model::FieldType::Text) ? Ordering::ParseKey(m_keys[i], row) : 0;
+	}
+}
+
+int Ordering::Compare(const Model& lhs, const std::int64_t* lhsNumbers, const Model& rhs, const std::int64_t* rhsNumbers) const
+{
+	for (size_t i = 0; i < m_keys.size(); ++i) {
+		const Ordering::Key& key = m_keys[i];
+		int result = 0;
+		if (key.type == Model::FieldType::Text) {
+			result = lhs.Field(key.field).compare(rhs.Field(key.field));
+		} else {
+			result = (lhsNumbers[i] < rhsNumbers[i]) ? -1 : (lhsNumbers[i] > rhsNumbers[i]) ? 1 : 0;
+		}
+
+		if (result != 0) {
+			return key.isDescending ? -result : result;
+		}
+	}
+
+	return 0;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+std::int64_t Ordering::ParseKey(const Ordering::Key& key, const Model& row)
+{
+	std::int64_t number = 0;
+	if (!Model::ParseNumber(key.type, row.Field(key.field), number)) {
+		return std::numeric_limits<std::int64_t>::min();
+	}
+
+	return number;
+}
@@ -0,0 +1,60 @@
+#ifndef ORDERING_H
+#define ORDERING_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "model.h"
+
+/// An order (-o) specification, compiled once into sort keys bound to schema field indices.
+///
+/// Format: FIELD[:asc|:desc]{,FIELD[:asc|:desc]}, with fields and directions case insensitive.
+/// Rows compare field by field until one differs. Money and duration fields compare by their
+/// number of cents or minutes, and other fields compare as text, which also orders ISO dates.
+/// Values that are empty or malformed sort before every valid value.
+class Ordering
+{
+	public:
+		/// One field of the ordering and its direction.
+		struct Key {
+			Model::FieldId field;
+			Model::FieldType type;
+			bool isDescending;
+		};
+
+		// Construction
+		/// An empty ordering under which every row is equal.
+		Ordering();
+
+		/// Compiles the given order string; throws std::invalid_argument if it is malformed.
+		explicit Ordering(const std::string& orderString);
+
+		// Public API
+		/// Returns true if no order fields were given.
+		bool IsEmpty() const { return m_keys.empty(); }
+
+		/// Gets the compiled sort keys, in precedence order.
+		const std::vector<Ordering::Key>& Keys() const { return m_keys; }
+
+		/// Returns a negative number, zero, or a positive number if lhs orders before, the same as, or after rhs.
+		int Compare(const Model& lhs, const Model& rhs) const;
+
+		/// Parses the money and duration values a row is ordered by into numbers, one per key, so a
+		/// sort can parse each row once instead of on every comparison. Text keys are left as 0.
+		void ParseKeys(const Model& row, std::int64_t* numbers) const;
+
+		/// Same as Compare() above, using numbers from ParseKeys() for the money and duration keys.
+		int Compare(const Model& lhs, const std::int64_t* lhsNumbers, const Model& rhs, const std::int64_t* rhsNumbers) const;
+
+		/// Strict weak ordering for use with the standard algorithms; true if lhs orders before rhs.
+		bool operator() (const Model& lhs, const Model& rhs) const { return (this->Compare(lhs, rhs) < 0); }
+
+	private:
+		/// Parses a money or duration value; values that are empty or malformed become the lowest number.
+		static std::int64_t ParseKey(const Ordering::Key& key, const Model& row);
+
+		/// Sort keys in precedence order.
+		std::vector<Ordering::Key> m_keys;
+};
+
+#endif
@@ -1,9 +1,19 @@
 #include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <sstream>
+#include "aggregator.h"
+#include "external_sorter.h"
+#include "filter.h"
 #include "model.h"
+#include "ordering.h"
 #include "query.h"
+#include "record_source.h"
+#include "zone_map.h"
 
 
 // ****************************************************************************
@@ -15,6 +25,7 @@ const std::map<std::string, Command::Type> Query::m_knownCommands =
 	{ "o", Command::Type::Order},          // ORDER command
 	{ "g", Command::Type::Group},          // GROUP command
 	{ "f", Command::Type::Filter},         // FILTER command
+	{ "l", Command::Type::Limit},          // LIMIT command
 	{ "min", Command::Type::Min},          // MIN aggregate command
 	{ "max", Command::Type::Max},          // MAX aggregate command
 	{ "sum", Command::Type::Sum},          // SUM aggregate command
@@ -22,18 +33,77 @@ const std::map<std::string, Command::Type> Query::m_knownCommands =
 	{ "collect", Command::Type::Collect},  // COLLECT aggregate command
 };
 
+const size_t Query::m_defaultMemoryBudget = 256 << 20;
+const double Query::m_maxIndexedFraction = 0.1;
+
 
 // ****************************************************************************
 // Construction
 // ****************************************************************************
 Query::Query(const std::string& queryString)
-	: m_commandChain(), m_selectArgs(), m_aggregateCommands()
+	: m_commandChain(), m_selectArgs(), m_aggregateCommands(), m_filter(), m_ordering(), m_scanFields(),
+	  m_rowLimit(std::numeric_limits<size_t>::max()), m_memoryBudget(Query::m_defaultMemoryBudget), m_spillDirectory(),
+	  m_scheduler(nullptr), m_cancellation(nullptr), m_yieldPoint(),
+	  m_sortStatistics(), m_blocksRead(0), m_blocksSkipped(0), m_indexField(), m_indexedRecords(0)
 {
 	if (!this->IsValidQueryString(queryString)) {
 		throw std::invalid_argument("Invalid query string: " + queryString);
 	}
 
 	m_commandChain = this->ParseQueryString(queryString);
+	if (m_commandChain.count(Command::Type::Select) == 0) {
+		throw std::invalid_argument("Cannot execute query: select statement is missing.");
+	}
+
+	// Cache the select fields and any aggregate commands among them.
+	m_selectArgs = this->ParseSelectCommandArgs(m_commandChain.at(Command::Type::Select));
+	if (m_selectArgs.size() == 0) {
+		throw std::invalid_argument("Cannot execute query: select statement is missing.");
+	}
+
+	for (auto& command : m_selectArgs) {
+		if (Query::IsAggregateCommand(command.CommandType())) {
+			m_aggregateCommands.emplace_back(command);
+		}
+	}
+
+	// Compile the filter once up front instead of re-parsing it for every record.
+	if (m_commandChain.count(Command::Type::Filter) > 0) {
+		m_filter = Filter(m_commandChain.at(Command::Type::Filter));
+	}
+
+	if (m_commandChain.count(Command::Type::Order) > 0) {
+		m_ordering = Ordering(m_commandChain.at(Command::Type::Order));
+	}
+
+	if (m_commandChain.count(Command::Type::Limit) > 0) {
+		const std::string& limit = m_commandChain.at(Command::Type::Limit);
+		if (limit.empty() || limit.length() > 18 || limit.find_first_not_of("0123456789") != std::string::npos) {
+			throw std::invalid_argument("Invalid row limit " + limit + " given.");
+		}
+
+		m_rowLimit = std::stoul(limit);
+	}
+
+	// Collect every field the query reads so a columnar datastore can leave the rest untouched.
+	for (auto& command : m_selectArgs) {
+		m_scanFields.emplace_back(Model::FieldIndex(command.CommandArgs()));
+	}
+
+	for (auto field : m_filter.Fields()) {
+		m_scanFields.emplace_back(field);
+	}
+
+	for (auto& key : m_ordering.Keys()) {
+		m_scanFields.emplace_back(key.field);
+	}
+
+	if (m_commandChain.count(Command::Type::Group) > 0 && !m_commandChain.at(Command::Type::Group).empty()) {
+		m_scanFields.emplace_back(Model::FieldIndex(m_commandChain.at(Command::Type::Group)));
+	}
+
+	std::sort(std::begin(m_scanFields), std::end(m_scanFields));
+	m_scanFields.erase(std::unique(std::begin(m_scanFields), std::end(m_scanFields)), std::end(m_scanFields));
 }
 
 Query::~Query()
@@ -46,27 +116,145 @@ Query::~Query()
 // ****************************************************************************
 Query::table_t Query::QueryCommand(std::istream& inputStream)
 {
-	Query::table_t results;
 	if (!inputStream.good())
 	{
 		throw std::invalid_argument("Input stream given to query is not valid");
 	}
 
-	// Query the input stream and filter out the results by the given fields and aggregates.
-	// Select the data for the given fields
-	results = this->Select(inputStream, m_commandChain.at(Command::Type::Select));
+	std::string dataStore(std::istreambuf_iterator<char>(inputStream), {});
+	return this->QueryCommand(std::string_view(dataStore));
+}
 
-	// Order the results if requested.
-	if (m_commandChain.count(Command::Type::Order) > 0) {
-		this->Order(results, m_commandChain.at(Command::Type::Order));
+Query::table_t Query::QueryCommand(std::string_view dataStore)
+{
+	Query::table_t results;
+	this->QueryCommand(dataStore, [&](const Query::row_t& row) { results.emplace_back(row); });
+	return results;
+}
+
+void Query::QueryCommand(std::string_view dataStore, const Query::row_sink_t& sink)
+{
+	TextRecordSource source(dataStore);
+	this->QueryCommand(source, sink);
+}
+
+void Query::QueryCommand(const RecordSource& dataStore, const Query::row_sink_t& sink)
+{
+	const bool isGrouped = (m_commandChain.count(Command::Type::Group) > 0 || !m_aggregateCommands.empty());
+	if (m_rowLimit == 0) {
+		return;
+	}
+
+	// Without ordering or grouping each selected row goes straight to the sink, and the scan
+	// stops as soon as the limit is reached.
+	if (!isGrouped && m_ordering.IsEmpty()) {
+		this->Select(dataStore, sink, m_rowLimit);
+		return;
+	}
+
+	// A limited ordering only ever holds the rows within the limit.
+	if (!isGrouped && m_rowLimit != std::numeric_limits<size_t>::max()) {
+		this->SelectTop(dataStore, sink);
+		return;
+	}
+
+	// Every selected row is ordered, within the memory budget.
+	if (!isGrouped) {
+		this->SelectOrdered(dataStore, sink);
+		return;
+	}
+
+	// Group and aggregate the data as it is scanned; there is one row per group to order.
+	const std::string groupField = (m_commandChain.count(Command::Type::Group) > 0) ? m_commandChain.at(Command::Type::Group) : "";
+	Query::table_t results = this->Group(dataStore, groupField);
+	if (this->IsCancelled()) {
+		return;
+	}
+
+	this->Order(results);
+	for (auto& row : results) {
+		sink(row);
+	}
+}
+
+Query::ScanStatistics Query::ScanStats() const
+{
+	Query::ScanStatistics statistics;
+	statistics.blocksRead = m_blocksRead;
+	statistics.blocksSkipped = m_blocksSkipped;
+	statistics.indexField = m_indexField;
+	statistics.indexedRecords = m_indexedRecords;
+	return statistics;
+}
+
+std::string Query::CanonicalForm() const
+{
+	// Each command in a fixed order, written from what was parsed rather than as it was given.
+	std::string form = "-s";
+	for (auto& command : m_selectArgs) {
+		form.append(1, ' ').append(Model::m_validFields[static_cast<size_t>(Model::FieldIndex(command.CommandArgs()))]);
+		if (command.CommandType() != Command::Type::NoCommand) {
+			form.append(1, ':').append(std::to_string(static_cast<int>(command.CommandType())));
+		}
+	}
+
+	// The filter as it compiled, so spelling and spacing of the same expression don't matter.
+	if (!m_filter.IsEmpty()) {
+		form.append(" -f ").append(m_filter.CanonicalForm());
+	}
+
+	if (!m_ordering.IsEmpty()) {
+		form.append(" -o");
+		for (auto& key : m_ordering.Keys()) {
+			form.append(1, ' ').append(Model::m_validFields[static_cast<size_t>(key.field)]).append(key.isDescending ? ":desc" : ":asc");
+		}
 	}
 
-	// Group the results if requested.
 	if (m_commandChain.count(Command::Type::Group) > 0) {
-		this->Group(results, m_commandChain.at(Command::Type::Group));
+		form.append(" -g ").append(m_commandChain.at(Command::Type::Group));
 	}
 
-	return results;
+	if (m_rowLimit != std::numeric_limits<size_t>::max()) {
+		form.append(" -l ").append(std::to_string(m_rowLimit));
+	}
+
+	return form;
+}
+
+bool Query::Plan(const std::vector<const SecondaryIndex*>& indexes, SecondaryIndex::offset_list_t& offsets)
+{
+	// Pick the index that leaves the fewest records to read.
+	const SecondaryIndex* bestIndex = nullptr;
+	std::vector<Filter::Range> bestRanges;
+	size_t bestCount = std::numeric_limits<size_t>::max();
+	std::vector<Filter::Range> ranges;
+	for (auto index : indexes) {
+		if (!m_filter.Ranges(index->Field(), ranges)) {
+			continue;
+		}
+
+		size_t count = index->Count(ranges);
+		if (count < bestCount) {
+			bestIndex = index;
+			bestRanges.swap(ranges);
+			bestCount = count;
+		}
+	}
+
+	// Seeking to each record only pays off while there are few of them; otherwise a scan is cheaper.
+	if (bestIndex == nullptr || static_cast<double>(bestCount) > static_cast<double>(bestIndex->Size()) * Query::m_maxIndexedFraction) {
+		return false;
+	}
+
+	// Read the records in datastore order so the results come out the same as from a scan.
+	offsets.clear();
+	bestIndex->Lookup(bestRanges, offsets);
+	std::sort(std::begin(offsets), std::end(offsets));
+	offsets.erase(std::unique(std::begin(offsets), std::end(offsets)), std::end(offsets));
+
+	m_indexField = Model::m_validFields[static_cast<size_t>(bestIndex->Field())];
+	m_indexedRecords = offsets.size();
+	return true;
 }
 
 bool Query::IsAggregateCommand(Command::Type command)
@@ -100,196 +288,242 @@ bool Query::IsValidQueryString(const std::string& queryString)
 // ****************************************************************************
 // Private query API
 // ****************************************************************************
-Query::table_t Query::Select(std::istream& inputStream, const std::string& commandArgs)
+bool Query::Scan(const RecordSource& dataStore, size_t partition, const RecordSource::record_consumer_t& consumer) const
 {
-	Query::table_t results;
-	if (!inputStream.good())
-	{
-		return results;
+	if (m_yieldPoint) {
+		m_yieldPoint();
 	}
 
-	// Query the input stream and filter out the results by the given fields and aggregates.
-	row_t record;
-	m_selectArgs = this->ParseSelectCommandArgs(commandArgs);
-	if (m_selectArgs.size() == 0) {
-		throw std::invalid_argument("Cannot execute query: select statement is missing.");
+	// A cancelled query stops like a consumer that wants no more records.
+	if (this->IsCancelled()) {
+		return false;
+	}
+
+	const ZoneMap::Block* statistics = dataStore.PartitionStatistics(partition);
+	if (statistics != nullptr && !m_filter.MayMatch(*statistics)) {
+		++m_blocksSkipped;
+		return true;
 	}
 
-	// Cache any aggregate commands from the select statement
+	++m_blocksRead;
+	return dataStore.Scan(partition, m_scanFields, [&](const row_t::field_view_t& record)
+			{
+				// If a filter was given, then Skip this record if it doesn't pass through the filter
+				return (!m_filter.Evaluate(record) || consumer(record));
+			});
+}
+
+void Query::Select(const RecordSource& dataStore, const Query::row_sink_t& sink, size_t rowLimit) const
+{
+	// Resolve the selected fields once; every row shares the same projection.
+	row_t::field_list_t fieldOrdering;
 	for (auto& command : m_selectArgs) {
-		if (Query::IsAggregateCommand(command.CommandType())) {
-			m_aggregateCommands.emplace_back(command);
-		}
+		fieldOrdering.emplace_back(command.CommandArgs());
 	}
 
-	// Select, filter, and accumulate the data
-	Query::row_t previousRecord;
-	while (inputStream.good() && inputStream >> record) {
-		row_t::field_list_t fieldOrdering;
-		for (auto& command : m_selectArgs) {
-			std::string field = command.CommandArgs();
-			fieldOrdering.emplace_back(field);
-		}
+	const row_t::projection_ptr_t projection = row_t::MakeProjection(fieldOrdering);
+
+	// Only the selected fields and those later ordered by are copied out of the datastore.
+	row_t::projection_t materializedFields = *projection;
+	for (auto& key : m_ordering.Keys()) {
+		materializedFields.emplace_back(key.field);
+	}
+
+	std::sort(std::begin(materializedFields), std::end(materializedFields));
+	materializedFields.erase(std::unique(std::begin(materializedFields), std::end(materializedFields)), std::end(materializedFields));
 
-		// Save the select filter and store the record; accumulate with previous row if requested
-		record.SetOrdering(fieldOrdering);
-		if (!results.empty()) {
-			previousRecord = results.back();
+	// Only records that survive the filter are copied out of the datastore, each into the same row
+	// since the same fields are overwritten every time.
+	row_t row;
+	size_t rowCount = 0;
+	row.SetOrdering(projection);
+	auto emit = [&](const row_t::field_view_t& record)
+	{
+		for (auto field : materializedFields) {
+			row.Field(field, record[static_cast<size_t>(field)]);
 		}
 
-		// If a filter was given, then Skip this record if it doesn't pass through the filter
-		if (m_commandChain.count(Command::Type::Filter) > 0) {
-			if (!Query::EvaluateFilterString(record, m_commandChain.at(Command::Type::Filter))) {
-				continue;
+		sink(row);
+		return (++rowCount < rowLimit);
+	};
+
+	const size_t partitionCount = dataStore.PartitionCount();
+	if (this->WorkerCount() <= 1 || partitionCount <= 1) {
+		for (size_t partition = 0; partition < partitionCount; ++partition) {
+			if (!this->Scan(dataStore, partition, emit)) {
+				break;
 			}
 		}
 
-		// TODO: Implement aggregate functions
-		results.emplace_back(record);
+		return;
 	}
 
-	return results;
+	// Read and filter a wave of partitions on the worker threads, copying out the rows that pass
+	// since field values are only valid while they are scanned, then emit them in datastore order
+	// before starting the next wave.
+	const size_t waveSize = this->WorkerCount() * 2;
+	std::vector<Query::table_t> passedRows(waveSize);
+	bool isDone = false;
+	for (size_t waveBegin = 0; waveBegin < partitionCount && !isDone && !this->IsCancelled(); waveBegin += waveSize) {
+		const size_t waveEnd = std::min(waveBegin + waveSize, partitionCount);
+		this->RunWorkers(waveEnd - waveBegin, [&](size_t, size_t partition)
+				{
+					Query::table_t& rows = passedRows[partition];
+					rows.clear();
+					this->Scan(dataStore, waveBegin + partition, [&](const row_t::field_view_t& record)
+							{
+								rows.emplace_back(record, materializedFields);
+								rows.back().SetOrdering(projection);
+								return (rows.size() < rowLimit);
+							});
+				});
+
+		for (size_t partition = 0; partition < waveEnd - waveBegin && !isDone; ++partition) {
+			for (auto& passedRow : passedRows[partition]) {
+				sink(passedRow);
+				if (++rowCount >= rowLimit) {
+					isDone = true;
+					break;
+				}
+			}
+		}
+	}
 }
 
-void Query::Order(Query::table_t& queryData, const std::string& fields)
+void Query::SelectTop(const RecordSource& dataStore, const Query::row_sink_t& sink) const
 {
-	if (m_selectArgs.size() == 0) {
-		throw std::invalid_argument("Cannot execute query: select statement is missing.");
+	// Rows are paired with their position so ties keep datastore order, the same as a stable sort.
+	typedef std::pair<row_t, size_t> ranked_row_t;
+	auto isBefore = [&](const ranked_row_t& lhs, const ranked_row_t& rhs)
+	{
+		int result = m_ordering.Compare(lhs.first, rhs.first);
+		return (result < 0 || (result == 0 && lhs.second < rhs.second));
+	};
+
+	// Max heap of the best rows seen so far; its front is the one the next better row replaces.
+	std::vector<ranked_row_t> heap;
+	size_t position = 0;
+	this->Select(dataStore, [&](const row_t& row)
+			{
+				if (heap.size() < m_rowLimit) {
+					heap.emplace_back(row, position);
+					std::push_heap(std::begin(heap), std::end(heap), isBefore);
+				} else if (m_ordering.Compare(row, heap.front().first) < 0) {
+					std::pop_heap(std::begin(heap), std::end(heap), isBefore);
+					heap.back() = ranked_row_t(row, position);
+					std::push_heap(std::begin(heap), std::end(heap), isBefore);
+				}
+
+				++position;
+			}, std::numeric_limits<size_t>::max());
+
+	if (this->IsCancelled()) {
+		return;
 	}
 
-	// Save the tokenized ordering fields to be easily used in a sort comparator
-	std::string token;
-	std::istringstream iss(fields);
-	std::vector<std::string> fieldList;
-	while (std::getline(iss, token, ',')) {
-		// TODO: validate token
-		fieldList.emplace_back(token);
+	std::sort_heap(std::begin(heap), std::end(heap), isBefore);
+	for (auto& rankedRow : heap) {
+		sink(rankedRow.first);
 	}
+}
 
-	// Sort using all given ordering fields as custom comparator
-	std::sort(std::begin(queryData), std::end(queryData),
-			[&] (row_t& lhs, row_t& rhs)
-			{
-				bool isLessThan = true;
-				for (auto& field : fieldList) {
-					isLessThan = isLessThan && (lhs.Field(field) < rhs.Field(field));
-				}
+void Query::SelectOrdered(const RecordSource& dataStore, const Query::row_sink_t& sink)
+{
+	ExternalSorter sorter(m_ordering, m_memoryBudget, m_spillDirectory);
+	this->Select(dataStore, [&](const row_t& row) { sorter.Add(row); }, std::numeric_limits<size_t>::max());
+	if (this->IsCancelled()) {
+		return;
+	}
 
-				return isLessThan;
-			});
+	sorter.Finish(sink);
+	m_sortStatistics = sorter.Stats();
 }
 
-void Query::Group(Query::table_t& queryData, const std::string& groupField)
+void Query::Order(Query::table_t& queryData)
 {
-	if (m_selectArgs.size() == 0) {
-		throw std::invalid_argument("Cannot execute query: select statement is missing.");
+	auto start = std::chrono::steady_clock::now();
+
+	// Sort positions rather than rows, with the position breaking ties so the result is stable.
+	std::vector<size_t> positions(queryData.size());
+	for (size_t i = 0; i < positions.size(); ++i) {
+		positions[i] = i;
 	}
 
-	// Ensure the group by field is present in the select query, and that all other fields are aggregate commands
-	bool hasMatchingSelectField = false;
-	for (auto& selectArg : m_selectArgs) {
-		if (selectArg.CommandArgs() == groupField) {
-			hasMatchingSelectField = true;
-		} else if (!Query::IsAggregateCommand(selectArg.CommandType())) {
-			throw std::invalid_argument("Cannot execute query: " + selectArg.CommandArgs() + " is not part of an aggregate function.");
-		}
+	// Parse each row's money and duration keys once up front rather than on every comparison.
+	const size_t keyCount = m_ordering.Keys().size();
+	std::vector<std::int64_t> numbers(queryData.size() * keyCount);
+	for (size_t i = 0; i < queryData.size(); ++i) {
+		m_ordering.ParseKeys(queryData[i], numbers.data() + i * keyCount);
 	}
 
-	if (!hasMatchingSelectField) {
-		throw std::invalid_argument("Cannot execute query: " + groupField + " is not one of the select specifiers.");
+	auto isBefore = [&](size_t lhs, size_t rhs)
+	{
+		int result = m_ordering.Compare(queryData[lhs], numbers.data() + lhs * keyCount, queryData[rhs], numbers.data() + rhs * keyCount);
+		return (result < 0 || (result == 0 && lhs < rhs));
+	};
+
+	// Only the rows within the limit need to be put in order.
+	const size_t rowCount = std::min(m_rowLimit, positions.size());
+	if (!m_ordering.IsEmpty() && rowCount < positions.size()) {
+		std::partial_sort(std::begin(positions), std::begin(positions) + static_cast<std::ptrdiff_t>(rowCount), std::end(positions), isBefore);
+	} else if (!m_ordering.IsEmpty()) {
+		std::sort(std::begin(positions), std::end(positions), isBefore);
 	}
 
-	// Order by group field, then strip out redundant entries using the specified group specifier.
-	this->Order(queryData, groupField);
-	queryData.erase(std::unique(std::begin(queryData), std::end(queryData),
-			[&](row_t& lhs, row_t& rhs) { return (lhs.Field(groupField) == rhs.Field(groupField)); }),
-			std::end(queryData));
+	Query::table_t orderedData;
+	orderedData.reserve(rowCount);
+	for (size_t i = 0; i < rowCount; ++i) {
+		orderedData.emplace_back(std::move(queryData[positions[i]]));
+	}
+
+	queryData.swap(orderedData);
+
+	if (!m_ordering.IsEmpty()) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		m_sortStatistics.rowCount = positions.size();
+		m_sortStatistics.seconds = elapsed.count();
+	}
 }
 
-Query::row_t Query::AggregateFields(const Query::row_t& prevRecord, Query::row_t& accumulator, const std::string& groupField) const
+Query::table_t Query::Group(const RecordSource& dataStore, const std::string& groupField) const
 {
-	if (!prevRecord) {
-		return accumulator;
+	// Fold each record into its group as it is scanned instead of sorting and retaining every record.
+	// Every worker thread aggregates the partitions it claims on its own, then the partial
+	// aggregates are combined.
+	const size_t workerCount = this->WorkerCount();
+	std::vector<Aggregator> aggregators;
+	aggregators.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; ++i) {
+		aggregators.emplace_back(m_selectArgs, groupField);
 	}
 
-	// for aggregate: if current group field value matches a previous group field value then accumulate
-
-	std::string accumulatorField = "";
-	std::string accumulatedValue = "";
-	for (auto& command : m_aggregateCommands) {
-		accumulatorField = command.CommandArgs();
-		std::cout << "Accumulating field: |" << accumulatorField << "|" << std::endl;
+	this->RunWorkers(dataStore.PartitionCount(), [&](size_t worker, size_t partition)
+			{
+				Aggregator& aggregator = aggregators[worker];
+				this->Scan(dataStore, partition, [&](const row_t::field_view_t& record) { aggregator.Accumulate(record); return true; });
+			});
 
-		// TODO: Apply specific accumulator
-		// Apply 
-		if (prevRecord.Field(groupField) == accumulator.Field(groupField)) {
-			prevRecord.Field(accumulatorField);
-			accumulator.Field(accumulatorField);
-			accumulatedValue = prevRecord.Field(accumulatorField) + accumulator.Field(accumulatorField);
-			accumulator.Field(accumulatorField, accumulatedValue);
-		}
+	for (size_t i = 1; i < aggregators.size(); ++i) {
+		aggregators.front().Merge(std::move(aggregators[i]));
 	}
 
-	return accumulator;
+	return aggregators.front().Results();
 }
 
 
 // ****************************************************************************
 // Private implementation
 // ****************************************************************************
-bool Query::EvaluateFilterString(const row_t& record, const std::string& logicString)
+void Query::RunWorkers(size_t taskCount, const TaskScheduler::task_body_t& task) const
 {
-	bool result = false;
-	bool needsLHSOperand = true;
-	static const std::string orToken = " OR ";
-	static const std::string andToken = " AND ";
-
-	// Evaluate parenthesis recursively.
-	std::string logicSubString = logicString;
-	if ('(' == logicString[0]) {
-		logicSubString = logicString.substr(1, logicString.find_first_of(")") - 1);
-		result = Query::EvaluateFilterString(record, logicSubString);
-		logicSubString = logicString.substr(logicString.find_first_of(")"));
-		needsLHSOperand = false;
-	}
-
-	// Find the closest operator
-	std::string::size_type orPos = logicSubString.find(orToken);
-	std::string::size_type andPos = logicSubString.find(andToken);
-	std::string::size_type operatorPos = (orPos < andPos) ? orPos : andPos;
-
-	// Process the operator.
-	if (operatorPos != std::string::npos) {
-		// Evaluate the left operand if needed.
-		if (needsLHSOperand) { 
-			result = Query::EvaluateFilterOperandString(record, logicSubString.substr(0, operatorPos));
-		}
-
-		// Evaluate the right operand recursively.
-		// TODO: Handle right hand side parenthesis
-		if (orPos < andPos) {
-			result = (result || Query::EvaluateFilterString(record, logicSubString.substr(operatorPos + orToken.length())));
-			return result;
-		} else {
-			result = (result && Query::EvaluateFilterString(record, logicSubString.substr(operatorPos + andToken.length())));
-			return result;
-		}
-	} else {
-		// This filter string is a single field specifier, or the last right hand side operand of a grouping.
-		result = Query::EvaluateFilterOperandString(record, logicSubString);
-		return result;
+	if (m_scheduler != nullptr) {
+		m_scheduler->ParallelFor(taskCount, 1, task);
+		return;
 	}
-}
 
-bool Query::EvaluateFilterOperandString(const row_t& record, const std::string& operand)
-{
-	std::string::size_type pos = operand.find("=");
-	std::string field = operand.substr(operand.find_first_not_of(" "), pos);
-
-	// Strip the condition of trailing whitespace and then remove surrounding ""
-	std::string condition = operand.substr(pos + 1, operand.find_last_not_of(" "));
-	condition = condition.substr(condition.find_first_of("\"") + 1, condition.find_last_of("\"") - 1);
-	return (record.Field(field) == condition);
+	for (size_t i = 0; i < taskCount && !this->IsCancelled(); ++i) {
+		task(0, i);
+	}
 }
 
 Query::command_map_t Query::ParseQueryString(const std::string& queryString)
@@ -300,17 +534,28 @@ Query::command_map_t Query::ParseQueryString(const std::string& queryString)
 
 	// Tokenize by - to get command options; will be a single letter.
 	// An argument for the command will follow, and will have a command specific format.
+	// Only a '-' that starts a word outside of quotes begins an option, so values like dates are kept whole.
 	std::string item;
-	std::vector<std::string> tokens;
-	std::stringstream queryStream(queryString);
-	// TODO: Handle command line args that have '-' in the string
-	while (std::getline(queryStream, item, '-')) {
-		if (item.empty()) {
+	std::vector<std::string> items;
+	bool isQuoted = false;
+	for (std::string::size_type i = 0; i < queryString.length(); ++i) {
+		isQuoted = (queryString[i] == '"') ? !isQuoted : isQuoted;
+		if (queryString[i] == '-' && !isQuoted && (i == 0 || std::isspace(static_cast<unsigned char>(queryString[i - 1])))) {
+			items.emplace_back(item);
+			item.clear();
+		} else {
+			item += queryString[i];
+		}
+	}
+
+	items.emplace_back(item);
+	for (auto& commandItem : items) {
+		if (commandItem.find_first_not_of(" ") == std::string::npos) {
 			continue;
 		}
 
 		// Parse the first character that signfies a command
-		std::stringstream commandStream(item);
+		std::stringstream commandStream(commandItem);
 		commandStream >> commandString;
 		if (m_knownCommands.count(commandString) == 0) {
 			throw std::invalid_argument("Invalid query command string " + commandString + " given.");
@@ -322,12 +567,17 @@ Query::command_map_t Query::ParseQueryString(const std::string& queryString)
 		}
 
 		// Parse the associated arguments for the command (trim whitespace)
+		commandArgs = "";
 		std::getline(commandStream, commandArgs);
-		commandArgs = commandArgs.substr(commandArgs.find_first_not_of(" "), commandArgs.length());
+		std::string::size_type argsBegin = commandArgs.find_first_not_of(" ");
+		commandArgs = (argsBegin != std::string::npos) ? commandArgs.substr(argsBegin) : "";
 		commandArgs = commandArgs.substr(0, commandArgs.find_last_not_of(" ") + 1);
 
-		// Ignore case on field specifiers
-		std::transform(std::begin(commandArgs), std::end(commandArgs), std::begin(commandArgs), ::tolower);
+		// Ignore case on field specifiers; filter values are compared as given.
+		if (command != Command::Type::Filter) {
+			std::transform(std::begin(commandArgs), std::end(commandArgs), std::begin(commandArgs), ::tolower);
+		}
+
 		commands.emplace(command, commandArgs);
 	}
 
@@ -351,9 +601,12 @@ Query::command_vector_t Query::ParseSelectCommandArgs(const std::string& command
 		if (pos != std::string::npos) {
 			field = token.substr(0, pos);
 			std::string aggregateCommand = token.substr(pos + 1);
-			if (Query::m_knownCommands.count(aggregateCommand) > 0) {
-				command = Query::m_knownCommands.at(aggregateCommand);
+			if (Query::m_knownCommands.count(aggregateCommand) == 0 ||
+					!Query::IsAggregateCommand(Query::m_knownCommands.at(aggregateCommand))) {
+				throw std::invalid_argument("Invalid aggregate function " + aggregateCommand + " given for " + field + ".");
 			}
+
+			command = Query::m_knownCommands.at(aggregateCommand);
 		} else {
 			field = token;
 			command = Command::Type::NoCommand;
@@ -1,7 +1,19 @@
 #ifndef QUERY_H
 #define QUERY_H
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "external_sorter.h"
+#include "filter.h"
 #include "model.h"
+#include "ordering.h"
+#include "record_source.h"
+#include "secondary_index.h"
+#include "task_scheduler.h"
 
 
 /// Simple class to store information about a known command.
@@ -13,6 +25,7 @@ class Command
 			Order,
 			Group,
 			Filter,
+			Limit,
 			Min,        // Aggregate commands.
 			Max,
 			Sum,
@@ -59,41 +72,133 @@ class Query
 		typedef Model row_t;                 /// Represents a record produced by a query.
 		typedef std::vector<row_t> table_t;  /// Collection of records produced by a query.
 
+		/// Receives each row of a query's results as it is produced; the row is only valid during the call.
+		typedef std::function<void(const row_t&)> row_sink_t;
+
+		/// Called before each partition of the datastore is scanned, so a long scan can let other work run.
+		typedef std::function<void()> yield_point_t;
+
 		/// Collection of fields + aggregate commands
 		typedef std::vector<Command::command_t> command_vector_t;
 
 		/// Collection of commands + arguments
 		typedef std::map<Command::Type, std::string> command_map_t;
 
+		/// What scanning the datastore read: partitions scanned, and those skipped by their statistics,
+		/// and the field whose index located the records read, if one did.
+		struct ScanStatistics {
+			ScanStatistics() : blocksRead(0), blocksSkipped(0), indexField(), indexedRecords(0) {}
+			size_t blocksRead;
+			size_t blocksSkipped;
+			std::string indexField;
+			size_t indexedRecords;
+		};
+
 		/// Construction
 		Query() = delete;
 		Query(const std::string& queryString);
+		Query(const Query&) = delete;
+		Query& operator= (const Query&) = delete;
 		~Query();
 
 		// Public API
 		Query::table_t QueryCommand(std::istream& inputStream);
+
+		/// Runs the query over newline delimited records held in memory, i.e. a memory mapped datastore.
+		Query::table_t QueryCommand(std::string_view dataStore);
+
+		/// Same as above, but passes each result row to the sink as soon as it is available instead of
+		/// collecting a table. Plain selects stream in constant memory; only ordering (-o) and grouping (-g)
+		/// hold rows back, and then only the rows (or groups) they need to.
+		void QueryCommand(std::string_view dataStore, const Query::row_sink_t& sink);
+
+		/// Same as above over any record source, i.e. a columnar segment, which is only asked for
+		/// the fields this query selects, filters, orders, or groups on.
+		void QueryCommand(const RecordSource& dataStore, const Query::row_sink_t& sink);
+
+		/// Plans how the datastore is read: if the filter narrows one of the indexed fields down to few
+		/// enough records, gets the offsets of those that could pass it, in datastore order, from the
+		/// most selective index and returns true. Returns false if the whole datastore should be scanned.
+		bool Plan(const std::vector<const SecondaryIndex*>& indexes, SecondaryIndex::offset_list_t& offsets);
+
+		/// Gets the query as parsed, written the same way for query strings that differ only in the
+		/// order of their commands, their spacing, or the case of field names; i.e. as a cache key.
+		std::string CanonicalForm() const;
+
 		static bool IsAggregateCommand(Command::Type commandType);
 		static bool IsValidQueryString(const std::string& queryString);
 
+		// Public accessors
+		/// Gets the memory budget in bytes for ordering rows; larger results are sorted on disk.
+		size_t MemoryBudget() const { return m_memoryBudget; }
+
+		/// Sets the memory budget in bytes for ordering rows.
+		void MemoryBudget(size_t memoryBudget) { m_memoryBudget = memoryBudget; }
+
+		/// Gets the directory that sort runs are spilled to.
+		const std::string& SpillDirectory() const { return m_spillDirectory; }
+
+		/// Sets the directory that sort runs are spilled to, i.e. the datastore's directory.
+		void SpillDirectory(const std::string& spillDirectory) { m_spillDirectory = spillDirectory; }
+
+		/// Gets the scheduler the datastore is scanned on; null if it is scanned on the calling thread.
+		TaskScheduler* Scheduler() const { return m_scheduler; }
+
+		/// Sets the scheduler the datastore is scanned on, which must outlive this object; null scans on the calling thread.
+		void Scheduler(TaskScheduler* scheduler) { m_scheduler = scheduler; }
+
+		/// Sets the token that stops the query, which must outlive it; once cancelled, no more partitions
+		/// are scanned and no more rows are produced. Null runs the query to the end.
+		void Cancellation(const CancellationToken* cancellation) { m_cancellation = cancellation; }
+
+		/// True if the query was stopped by its cancellation token; its results are then incomplete.
+		bool IsCancelled() const { return (m_cancellation != nullptr && m_cancellation->IsCancelled()); }
+
+		/// Sets the function called before each partition is scanned, from whichever thread scans it.
+		void YieldPoint(const Query::yield_point_t& yieldPoint) { m_yieldPoint = yieldPoint; }
+
+		/// Gets what ordering the results cost; empty if they were not ordered.
+		const ExternalSorter::Statistics& SortStatistics() const { return m_sortStatistics; }
+
+		/// Gets how many partitions of the datastore were scanned and skipped.
+		Query::ScanStatistics ScanStats() const;
+
 	private:
 		// Private query API
-		/// Selects specified fields from each record in the datastore.
-		/// if a filter was specified then records will be checked against it.
-		Query::table_t Select(std::istream& inputStream, const std::string& commandArgs);
+		/// Scans each record in a partition of the datastore, passing the field values of those that
+		/// pass the filter to the consumer until it returns false, which makes this return false too.
+		/// Records are never copied here, and a partition whose statistics rule out the filter is not
+		/// read at all.
+		bool Scan(const RecordSource& dataStore, size_t partition, const RecordSource::record_consumer_t& consumer) const;
+
+		/// Selects specified fields from each record in the datastore that passes the filter,
+		/// stopping once rowLimit rows have been passed to the sink. With more than one thread the
+		/// datastore is read and filtered in partitions concurrently, and rows still arrive in order.
+		void Select(const RecordSource& dataStore, const Query::row_sink_t& sink, size_t rowLimit) const;
+
+		/// Selects the first rows under the ordering, up to the row limit, keeping only that many rows
+		/// in a bounded heap rather than ordering every selected row.
+		void SelectTop(const RecordSource& dataStore, const Query::row_sink_t& sink) const;
 
-		// Order by the given fields
-		void Order(Query::table_t& queryData, const std::string& fields);
+		/// Orders rows by the ordering (-o) and truncates them to the row limit (-l). Ties keep their
+		/// original order, and only the rows within the limit are fully sorted.
+		void Order(Query::table_t& queryData);
 
-		// Group by the given field if it is in the select statement, with or without specified aggregates.
-		void Group(Query::table_t& queryData, const std::string& groupField);
+		/// Orders every selected row within the memory budget, spilling sorted runs to disk and
+		/// merging them into the sink when the rows don't fit.
+		void SelectOrdered(const RecordSource& dataStore, const Query::row_sink_t& sink);
 
-		// Accumulate the specified aggregating fields from previousRecord, and return the accumulated record
-		Query::row_t AggregateFields(const Query::row_t& prevRecord, Query::row_t& accumulator, const std::string& groupField) const;
+		/// Aggregates the selected fields of each record that passes the filter, by the given field
+		/// if one was given or over every record otherwise. Threads aggregate partitions separately
+		/// and their partial aggregates are merged.
+		Query::table_t Group(const RecordSource& dataStore, const std::string& groupField) const;
 
-		// Filters records out of the select command using either a single field value or boolean logical AND/OR
-		/// Returns true or false for whether the given record passes the filter.
-		static bool EvaluateFilterString(const row_t& record, const std::string& logicString);
-		static bool EvaluateFilterOperandString(const row_t& record, const std::string& operand);
+		/// Runs task(worker, i) for each i in [0, taskCount) on the scheduler, or on the calling thread as
+		/// worker 0 if there is none. worker identifies the thread in [0, WorkerCount()).
+		void RunWorkers(size_t taskCount, const TaskScheduler::task_body_t& task) const;
+
+		/// Gets the number of threads RunWorkers() runs tasks on.
+		size_t WorkerCount() const { return (m_scheduler != nullptr) ? m_scheduler->ThreadCount() : 1; }
 
 		/// Creates an ordered collection of commands to perform from the given query string.
 		static command_map_t ParseQueryString(const std::string& queryString);
@@ -104,6 +209,12 @@ class Query
 		/// Map of known strings to their related Query functions for parsing query strings.
 		static const std::map<std::string, Command::Type> m_knownCommands;
 
+		/// Memory budget for ordering rows unless one is set.
+		static const size_t m_defaultMemoryBudget;
+
+		/// Largest share of the records an index may locate for the plan to use it rather than a scan.
+		static const double m_maxIndexedFraction;
+
 		/// Ordered collection of commands to be performed when Command is called.
 		Query::command_map_t m_commandChain;
 
@@ -112,6 +223,42 @@ class Query
 
 		/// Cache the fields that will have aggregate functions run on them
 		Query::command_vector_t m_aggregateCommands;
+
+		/// Filter command compiled when the query is constructed.
+		Filter m_filter;
+
+		/// Order command compiled when the query is constructed.
+		Ordering m_ordering;
+
+		/// Fields the query reads from the datastore: those selected, filtered, ordered, or grouped on.
+		Model::projection_t m_scanFields;
+
+		/// Maximum number of rows to produce; unlimited unless a limit command was given.
+		size_t m_rowLimit;
+
+		/// Memory budget and spill directory for ordering rows.
+		size_t m_memoryBudget;
+		std::string m_spillDirectory;
+
+		/// Scheduler the datastore is scanned on, if any; not owned.
+		TaskScheduler* m_scheduler;
+
+		/// Token that stops the query, if any; not owned.
+		const CancellationToken* m_cancellation;
+
+		/// Called between partitions, if set.
+		Query::yield_point_t m_yieldPoint;
+
+		/// What ordering the results cost.
+		ExternalSorter::Statistics m_sortStatistics;
+
+		/// Partitions scanned and skipped, counted from every worker thread.
+		mutable std::atomic<size_t> m_blocksRead;
+		mutable std::atomic<size_t> m_blocksSkipped;
+
+		/// Index the plan read the datastore through, if any.
+		std::string m_indexField;
+		size_t m_indexedRecords;
 };
 
 #endif
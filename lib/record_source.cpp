@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "delimiter_scanner.h"
+#include "record_source.h"
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t TextRecordSource::m_partitionSize = 1 << 20;
+const size_t OffsetRecordSource::m_partitionRecordCount = 4096;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+TextRecordSource::TextRecordSource(std::string_view dataStore)
+	: m_partitions(), m_statistics(), m_dataStore(dataStore.data()), m_deadRuns(nullptr)
+{
+	std::string_view::size_type partitionBegin = 0;
+	while (partitionBegin < dataStore.size()) {
+		std::string_view::size_type partitionEnd = dataStore.find('\n', std::min(partitionBegin + TextRecordSource::m_partitionSize, dataStore.size()) - 1);
+		partitionEnd = (partitionEnd != std::string_view::npos) ? partitionEnd + 1 : dataStore.size();
+		m_partitions.emplace_back(dataStore.substr(partitionBegin, partitionEnd - partitionBegin));
+		partitionBegin = partitionEnd;
+	}
+}
+
+TextRecordSource::TextRecordSource(std::string_view dataStore, const ZoneMap& zoneMap)
+	: m_partitions(), m_statistics(), m_dataStore(dataStore.data()), m_deadRuns(nullptr)
+{
+	size_t partitionBegin = 0;
+	for (size_t i = 0; i < zoneMap.BlockCount(); ++i) {
+		const ZoneMap::Block& block = zoneMap.BlockAt(i);
+		const size_t partitionEnd = std::min(static_cast<size_t>(block.end), dataStore.size());
+		if (static_cast<size_t>(block.begin) != partitionBegin || partitionEnd < partitionBegin) {
+			throw std::invalid_argument("Zone map does not match the datastore.");
+		}
+
+		m_partitions.emplace_back(dataStore.substr(partitionBegin, partitionEnd - partitionBegin));
+		m_statistics.emplace_back(&block);
+		partitionBegin = partitionEnd;
+	}
+
+	// Anything past the last block, i.e. trailing blank lines, is scanned without statistics.
+	if (partitionBegin < dataStore.size()) {
+		m_partitions.emplace_back(dataStore.substr(partitionBegin));
+		m_statistics.emplace_back(nullptr);
+	}
+}
+
+TextRecordSource::TextRecordSource(std::string_view dataStore, const ZoneMap& zoneMap, const KeyIndex::offset_run_list_t& deadRuns)
+	: TextRecordSource(dataStore, zoneMap)
+{
+	m_deadRuns = deadRuns.empty() ? nullptr : &deadRuns;
+}
+
+TextRecordSource::~TextRecordSource()
+{
+}
+
+OffsetRecordSource::OffsetRecordSource(std::string_view dataStore, std::vector<std::int64_t>&& offsets)
+	: m_dataStore(dataStore), m_offsets(std::move(offsets))
+{
+}
+
+OffsetRecordSource::~OffsetRecordSource()
+{
+}
+
+
+// ****************************************************************************
+// RecordSource implementation
+// ****************************************************************************
+bool TextRecordSource::Scan(size_t partition, const Model::projection_t&, const RecordSource::record_consumer_t& consumer) const
+{
+	// Each thread keeps its scanner, so small partitions don't each pay to allocate delimiter offsets.
+	thread_local RecordScanner scanner{ std::string_view() };
+	Model::field_view_t record;
+	std::string_view recordString;
+	scanner.Reset(m_partitions[partition]);
+
+	// Dead lines are passed over by walking their offsets alongside the records, in each run that
+	// has any within the partition.
+	typedef KeyIndex::offset_list_t::const_iterator offset_iterator_t;
+	thread_local std::vector<std::pair<offset_iterator_t, offset_iterator_t>> deadRanges;
+	deadRanges.clear();
+	if (m_deadRuns != nullptr) {
+		const std::streamoff partitionBegin = m_partitions[partition].data() - m_dataStore;
+		const std::streamoff partitionEnd = partitionBegin + static_cast<std::streamoff>(m_partitions[partition].size());
+		for (auto& deadRun : *m_deadRuns) {
+			auto rangeBegin = std::lower_bound(std::begin(*deadRun), std::end(*deadRun), partitionBegin);
+			auto rangeEnd = std::lower_bound(rangeBegin, std::end(*deadRun), partitionEnd);
+			if (rangeBegin != rangeEnd) {
+				deadRanges.emplace_back(rangeBegin, rangeEnd);
+			}
+		}
+	}
+
+	while (scanner.Next(recordString, record)) {
+		if (recordString.empty()) {
+			continue;
+		}
+
+		bool isDead = false;
+		const std::streamoff offset = recordString.data() - m_dataStore;
+		for (auto& deadRange : deadRanges) {
+			while (deadRange.first != deadRange.second && *deadRange.first < offset) {
+				++deadRange.first;
+			}
+
+			isDead = isDead || (deadRange.first != deadRange.second && *deadRange.first == offset);
+		}
+
+		if (isDead) {
+			continue;
+		}
+
+		if (!consumer(record)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const ZoneMap::Block* TextRecordSource::PartitionStatistics(size_t partition) const
+{
+	return (partition < m_statistics.size()) ? m_statistics[partition] : nullptr;
+}
+
+size_t OffsetRecordSource::PartitionCount() const
+{
+	return (m_offsets.size() + OffsetRecordSource::m_partitionRecordCount - 1) / OffsetRecordSource::m_partitionRecordCount;
+}
+
+bool OffsetRecordSource::Scan(size_t partition, const Model::projection_t&, const RecordSource::record_consumer_t& consumer) const
+{
+	Model::field_view_t record;
+	const size_t begin = partition * OffsetRecordSource::m_partitionRecordCount;
+	const size_t end = std::min(begin + OffsetRecordSource::m_partitionRecordCount, m_offsets.size());
+	for (size_t i = begin; i < end; ++i) {
+		const size_t offset = static_cast<size_t>(m_offsets[i]);
+		if (offset >= m_dataStore.size()) {
+			continue;
+		}
+
+		const size_t recordEnd = m_dataStore.find('\n', offset);
+		const std::string_view recordString = m_dataStore.substr(offset, (recordEnd != std::string_view::npos) ? recordEnd - offset : std::string_view::npos);
+		if (recordString.empty()) {
+			continue;
+		}
+
+		Model::Split(recordString, record);
+		if (!consumer(record)) {
+			return false;
+		}
+	}
+
+	return true;
+}
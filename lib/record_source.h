@@ -0,0 +1,101 @@
+#ifndef RECORD_SOURCE_H
+#define RECORD_SOURCE_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string_view>
+#include <vector>
+#include "key_index.h"
+#include "model.h"
+#include "zone_map.h"
+
+/// Records as the query engine reads them, split into partitions that can be scanned independently
+/// and in any order; scanning every partition in order visits the records in datastore order.
+class RecordSource
+{
+	public:
+		/// Receives each record's field values until it returns false.
+		typedef std::function<bool(const Model::field_view_t&)> record_consumer_t;
+
+		virtual ~RecordSource() {}
+
+		/// Gets the number of partitions the records are split into.
+		virtual size_t PartitionCount() const = 0;
+
+		/// Passes each record of the partition to the consumer until it returns false, which makes
+		/// this return false too. Only the given fields need to be filled in; the rest may be left
+		/// empty. The field values are only valid during the call to the consumer.
+		virtual bool Scan(size_t partition, const Model::projection_t& fields, const RecordSource::record_consumer_t& consumer) const = 0;
+
+		/// Gets statistics of the partition's records a scan can be skipped by; null if it has none.
+		virtual const ZoneMap::Block* PartitionStatistics(size_t) const { return nullptr; }
+};
+
+
+/// Newline delimited text records held in memory, i.e. a memory mapped datastore, partitioned on
+/// record boundaries. Every field is always filled in since the whole record is split anyway.
+/// Field values are views of the text itself, so they stay valid as long as the text does.
+/// A consumer must not scan another text source on the same thread, which shares the scanner.
+class TextRecordSource : public RecordSource
+{
+	public:
+		// Construction
+		explicit TextRecordSource(std::string_view dataStore);
+
+		/// Partitions the text on the blocks of its zone map instead, which must outlive this object.
+		TextRecordSource(std::string_view dataStore, const ZoneMap& zoneMap);
+
+		/// Same as above, also passing over the dead lines at the given offsets of the text, i.e. the
+		/// superseded records and tombstones of the datastore's log; each run of them is in order, and
+		/// they must outlive this object.
+		TextRecordSource(std::string_view dataStore, const ZoneMap& zoneMap, const KeyIndex::offset_run_list_t& deadRuns);
+		TextRecordSource(const TextRecordSource&) = delete;
+		TextRecordSource& operator= (const TextRecordSource&) = delete;
+		~TextRecordSource();
+
+		// RecordSource implementation
+		size_t PartitionCount() const override { return m_partitions.size(); }
+		bool Scan(size_t partition, const Model::projection_t& fields, const RecordSource::record_consumer_t& consumer) const override;
+		const ZoneMap::Block* PartitionStatistics(size_t partition) const override;
+
+	private:
+		/// Size in bytes of the newline aligned partitions the text is split into.
+		static const size_t m_partitionSize;
+
+		/// Newline aligned slices of the text, in order.
+		std::vector<std::string_view> m_partitions;
+
+		/// Zone map block of each partition, if partitioned on a zone map.
+		std::vector<const ZoneMap::Block*> m_statistics;
+
+		/// Start of the text, which the dead line offsets are relative to, and the runs of offsets if any.
+		const char* m_dataStore;
+		const KeyIndex::offset_run_list_t* m_deadRuns;
+};
+
+
+
+/// The records at the given offsets of newline delimited text held in memory, i.e. those an index
+/// located in a memory mapped datastore, in the order the offsets are given. Every field is always
+/// filled in, and field values are views of the text itself.
+class OffsetRecordSource : public RecordSource
+{
+	public:
+		// Construction
+		OffsetRecordSource(std::string_view dataStore, std::vector<std::int64_t>&& offsets);
+		~OffsetRecordSource();
+
+		// RecordSource implementation
+		size_t PartitionCount() const override;
+		bool Scan(size_t partition, const Model::projection_t& fields, const RecordSource::record_consumer_t& consumer) const override;
+
+	private:
+		/// Number of records in each partition scanned.
+		static const size_t m_partitionRecordCount;
+
+		std::string_view m_dataStore;
+		std::vector<std::int64_t> m_offsets;
+};
+
+#endif
@@ -1,18 +1,39 @@
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
+#include <unordered_map>
+#include "mapped_file.h"
 #include "model.h"
 #include "repository.h"
 
 
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t Repository::m_writeBufferSize = 1 << 20;
+const double Repository::m_maxDeadRatio = 1.0;
+const std::uintmax_t Repository::m_maxLogSize = 64 << 20;
+
+
 // ****************************************************************************
 // Construction
 // ****************************************************************************
-Repository::Repository() : m_dataStoreFile(), m_dataStoreCache()
+Repository::Repository()
+	: m_dataStoreFile(), m_dataStorePath(), m_indexPath(), m_zoneMapPath(), m_logPath(), m_writeAheadLog(), m_keyIndex(), m_isIndexLoaded(false),
+	  m_deadRuns(), m_areDeadOffsetsLoaded(false),
+	  m_zoneMap(), m_isZoneMapLoaded(false), m_indexedFields(), m_secondaryIndexes(), m_areSecondaryIndexesLoaded(false),
+	  m_dataStoreCache(), m_writeMutex(), m_syncThread(), m_syncCondition(), m_isSyncStopping(false), m_snapshotMutex(), m_version(0), m_publishedSize(0), m_snapshot(), m_mappedDataStore(),
+	  m_isReadOnly(false), m_isWriter(false), m_mappedSize(0), m_mappedTime(0), m_isMappedStamped(false)
 {
 }
 
 Repository::~Repository()
 {
+	try {
+		this->Disconnect();
+	} catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
 }
 
 
@@ -27,14 +48,86 @@ void Repository::Connect(const std::string& connectionString)
 		return;
 	}
 
-	// Try to either open or create the datastore file
-	m_dataStoreFile.open(connectionString, std::ios::in | std::ios::out);
-	if (!m_dataStoreFile.is_open()) {
-		m_dataStoreFile.open(connectionString, std::ios::in | std::ios::out | std::ios::trunc);
+	// The key index and zone map live alongside the datastore, i.e. datastore.sds -> datastore.idx
+	// and datastore.zmp. They are only loaded once needed, so read only queries don't pay for the index.
+	m_dataStorePath = connectionString;
+	m_indexPath = std::filesystem::path(connectionString).replace_extension(".idx").string();
+	m_zoneMapPath = std::filesystem::path(connectionString).replace_extension(".zmp").string();
+	m_logPath = std::filesystem::path(connectionString).replace_extension(".wal").string();
+
+	// Only the connection holding the lock on the write-ahead log writes the datastore; others
+	// just read it.
+	m_isWriter = !m_isReadOnly && m_writeAheadLog.Lock(m_logPath);
+	if (!m_isWriter) {
+		m_dataStoreFile.open(connectionString, std::ios::in);
+		if (!m_dataStoreFile.is_open()) {
+			throw std::invalid_argument("Unable to open file: " + connectionString);
+		}
+
+		// The writer may be part way through a line, so only the whole lines written so far are read.
+		// The file is stamped either side of mapping it, so sidecar files can be checked against it.
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		std::uintmax_t mappedSize = 0;
+		std::int64_t mappedTime = 0;
+		const bool isStamped = KeyIndex::DataStoreStamp(m_dataStorePath, m_mappedSize, m_mappedTime);
+		m_mappedDataStore = std::make_shared<const MappedFile>(m_dataStorePath);
+		const std::string_view::size_type lastLineEnd = m_mappedDataStore->View().rfind('\n');
+		this->Publish((lastLineEnd == std::string_view::npos) ? 0 : lastLineEnd + 1);
+		m_isMappedStamped = (isStamped && KeyIndex::DataStoreStamp(m_dataStorePath, mappedSize, mappedTime) &&
+				mappedSize == m_mappedSize && mappedTime == m_mappedTime && m_mappedDataStore->Size() == m_publishedSize);
+	} else {
+		// Try to either open or create the datastore file
+		m_dataStoreFile.open(connectionString, std::ios::in | std::ios::out);
+		if (!m_dataStoreFile.is_open()) {
+			m_dataStoreFile.open(connectionString, std::ios::in | std::ios::out | std::ios::trunc);
+		}
+
+		if (!m_dataStoreFile.is_open()) {
+			throw std::invalid_argument("Unable to create file: " + connectionString);
+		}
+
+		// Writes logged since the datastore was last synced may not have reached it before a crash, so
+		// it is cut back to the size the log starts from and they are written again. A log that doesn't
+		// fit the datastore, i.e. one left by a datastore since removed, is started over.
+		std::uintmax_t loggedSize = 0;
+		std::vector<std::string> loggedEntries;
+		const bool isLogged = m_writeAheadLog.Open(loggedSize, loggedEntries);
+		const std::uintmax_t dataStoreSize = std::filesystem::file_size(m_dataStorePath);
+		if (isLogged && dataStoreSize >= loggedSize && (dataStoreSize != loggedSize || !loggedEntries.empty())) {
+			std::filesystem::resize_file(m_dataStorePath, loggedSize);
+			m_dataStoreFile.clear();
+			m_dataStoreFile.seekp(0, std::ios::end);
+			for (auto& entry : loggedEntries) {
+				m_dataStoreFile << entry << '\n';
+			}
+
+			if (m_dataStoreFile.fail()) {
+				throw std::runtime_error("Failed to write to datastore.");
+			}
+		}
+
+		if (!isLogged || dataStoreSize != loggedSize || !loggedEntries.empty()) {
+			this->Checkpoint();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_snapshotMutex);
+			this->Publish(std::filesystem::file_size(m_dataStorePath));
+		}
+
+		m_isSyncStopping = false;
+		m_syncThread = std::thread(&Repository::SyncLoop, this);
 	}
 
-	if (!m_dataStoreFile.is_open()) {
-		throw std::invalid_argument("Unable to create file: " + connectionString);
+	// Secondary indexes are kept on the fields asked for and any the datastore already has one on,
+	// i.e. datastore.stb.sdx
+	m_secondaryIndexes.clear();
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		const Model::FieldId fieldId = static_cast<Model::FieldId>(field);
+		if (std::find(std::begin(m_indexedFields), std::end(m_indexedFields), fieldId) != std::end(m_indexedFields) ||
+				std::filesystem::exists(SecondaryIndex::IndexPath(m_dataStorePath, fieldId))) {
+			m_secondaryIndexes.emplace_back(new SecondaryIndex(fieldId));
+		}
 	}
 
 	return;
@@ -42,17 +135,103 @@ void Repository::Connect(const std::string& connectionString)
 
 void Repository::Disconnect()
 {
-	if (m_dataStoreFile) {
-		m_dataStoreFile.close();
+	if (!m_dataStoreFile.is_open()) {
+		return;
+	}
+
+	if (m_syncThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> writeLock(m_writeMutex);
+			m_isSyncStopping = true;
+			m_syncCondition.notify_one();
+		}
+
+		m_syncThread.join();
+	}
+
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	std::lock_guard<std::mutex> lock(m_snapshotMutex);
+
+	// Sync the datastore so the log can start over, then persist the index and zone map against its
+	// final state. Those rebuilt by a reader only cover what it read, which may no longer be all of
+	// the datastore, so they aren't kept.
+	if (m_isWriter && !m_writeAheadLog.IsEmpty()) {
+		this->Checkpoint();
+	}
+
+	m_writeAheadLog.Close();
+	m_dataStoreFile.close();
+	if (m_isWriter && m_keyIndex.IsModified()) {
+		m_keyIndex.Save(m_indexPath, m_dataStorePath);
+	}
+
+	if (m_isWriter && m_zoneMap.IsModified()) {
+		m_zoneMap.Save(m_zoneMapPath, m_dataStorePath);
 	}
 
+	for (auto& index : m_secondaryIndexes) {
+		if (m_isWriter && index->IsModified()) {
+			index->Save(SecondaryIndex::IndexPath(m_dataStorePath, index->Field()), m_dataStorePath);
+		}
+	}
+
+	m_isIndexLoaded = false;
+	m_areDeadOffsetsLoaded = false;
+	m_deadRuns.clear();
+	m_isZoneMapLoaded = false;
+	m_areSecondaryIndexesLoaded = false;
+	m_snapshot.reset();
+	m_mappedDataStore.reset();
+	m_publishedSize = 0;
+	m_isWriter = false;
+	m_isMappedStamped = false;
+	m_dataStoreCache.Clear();
 	return;
 }
 
 Query::table_t Repository::QueryData(Query& query)
 {
-	m_dataStoreFile.seekg(0, std::ios::beg);
-	return query.QueryCommand(m_dataStoreFile);
+	Query::table_t results;
+	this->QueryData(query, [&](const Query::row_t& row) { results.emplace_back(row); });
+	return results;
+}
+
+void Repository::QueryData(Query& query, const Query::row_sink_t& sink)
+{
+	// Sorts that outgrow memory spill next to the datastore unless told otherwise.
+	if (query.SpillDirectory().empty()) {
+		query.SpillDirectory(std::filesystem::path(m_dataStorePath).parent_path().string());
+	}
+
+	// Read the latest version of the datastore through a snapshot, planned against the indexes as
+	// of the same version; writes published while it runs aren't seen.
+	std::shared_ptr<const DataStoreSnapshot> snapshot;
+	SecondaryIndex::offset_list_t offsets;
+	bool isPlanned = false;
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadSecondaryIndexes();
+		snapshot = this->LatestSnapshot();
+
+		// Only read the records an index locates if the filter narrows an indexed field down enough.
+		std::vector<const SecondaryIndex*> indexes;
+		for (auto& index : m_secondaryIndexes) {
+			indexes.emplace_back(index.get());
+		}
+
+		isPlanned = query.Plan(indexes, offsets);
+	}
+
+	if (isPlanned) {
+		OffsetRecordSource source(snapshot->View(), std::move(offsets));
+		query.QueryCommand(source, sink);
+		return;
+	}
+
+	// Otherwise scan it in the blocks of the zone map, so a filter can skip those that cannot match.
+	// Dead lines of the log are passed over.
+	TextRecordSource source(snapshot->View(), snapshot->Zones(), snapshot->DeadRuns());
+	query.QueryCommand(source, sink);
 }
 
 Model Repository::GetModelByKey(const std::string& key) const
@@ -60,15 +239,34 @@ Model Repository::GetModelByKey(const std::string& key) const
 	Model model;
 
 	// Check if object is cached already
-	if (m_dataStoreCache.count(key) != 0)
-	{
-		model = m_dataStoreCache.at(key);
+	if (m_dataStoreCache.Find(key, model)) {
+		return model;
 	}
-	else
+
+	// Otherwise read it from the data store on disk, at the offset the key index gives.
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	std::streamoff recordPos = 0;
+	if (!m_dataStoreFile.is_open()) {
+		return model;
+	}
+
 	{
-		// TODO: Read from data store on disk
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadIndex();
 	}
 
+	if (!m_keyIndex.Find(key, recordPos)) {
+		return model;
+	}
+
+	std::string recordString = "";
+	m_dataStoreFile.clear();
+	m_dataStoreFile.seekg(recordPos);
+	std::getline(m_dataStoreFile, recordString);
+	m_dataStoreFile.clear();
+
+	model = Model(recordString);
+	m_dataStoreCache.Insert(key, model);
 	return model;
 }
 
@@ -79,53 +277,123 @@ void Repository::CreateModel(const Model& model)
 	return;
 }
 
-void Repository::UpdateModel(const Model& model)
+void Repository::CreateModels(const model_batch_t& models)
 {
-	// Don't process an empty model object
-	if (!model)
-	{
+	// Dedupe the batch by key; the last record in the batch for a given key wins.
+	std::unordered_map<std::string, size_t> batchKeys;
+	batchKeys.reserve(models.size());
+	for (size_t i = 0; i < models.size(); ++i) {
+		if (!!models[i]) {
+			batchKeys[models[i].Key()] = i;
+		}
+	}
+
+	if (batchKeys.empty()) {
 		return;
 	}
 
-	// TODO: Enforce a configured limit to size of memory cache.
-	m_dataStoreCache.emplace(model.Key(), model);
+	this->CheckWriter();
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadIndex();
+		this->LoadZoneMap();
+		this->LoadSecondaryIndexes();
+	}
 
-	// Update the record on disk if present; create it otherwise.
-	// Could memory map portions of a file using configured memory size limit.
-	// This way an ordering scheme can be implemented if necessary.
-	bool foundMatchingLogicalRecord = false;
-	std::streampos recordPos = 0;
-	std::string recordString = "";
-	m_dataStoreFile.seekg(0, std::ios::beg);
-	while (m_dataStoreFile.good() && std::getline(m_dataStoreFile, recordString)) {
-		Model recordModel(recordString);
-		if (!recordModel) {
-			// Encountered an invalid record somehow, so go to next line.
+	// Records being replaced are read from a mapping of the datastore as it was before the batch,
+	// so their values can leave the secondary indexes.
+	m_dataStoreFile.flush();
+	MappedFile dataStore;
+	if (!m_secondaryIndexes.empty()) {
+		dataStore.Open(m_dataStorePath);
+	}
+
+	// Append the batch to the log in order of first appearance, through a buffer so the datastore
+	// file is only ever written sequentially. Each buffer full is published as it is written, so
+	// queries see a long import progress instead of waiting on it.
+	std::string writeBuffer = "";
+	writeBuffer.reserve(Repository::m_writeBufferSize);
+	std::vector<std::pair<std::string, std::streamoff>> bufferedRecords;
+	m_dataStoreFile.clear();
+	m_dataStoreFile.seekp(0, std::ios::end);
+	std::streamoff writeOffset = m_dataStoreFile.tellp();
+	std::vector<bool> isWritten(models.size(), false);
+	for (auto& model : models) {
+		if (!model) {
+			continue;
+		}
+
+		std::string key = model.Key();
+		size_t latest = batchKeys.at(key);
+		if (isWritten[latest]) {
 			continue;
-		} else if (recordModel.Key() == model.Key()) {
-			foundMatchingLogicalRecord = true;
-			break;
 		}
 
-		// Save the position of the logically identical record so we can overwrite.
-		recordPos = m_dataStoreFile.tellg();
+		const std::string recordString = models[latest].ToString(Model::SerializeMode::DataStore);
+		m_writeAheadLog.Append(recordString);
+		bufferedRecords.emplace_back(std::move(key), writeOffset);
+		writeBuffer.append(recordString).append(1, '\n');
+		writeOffset += static_cast<std::streamoff>(recordString.length()) + 1;
+		isWritten[latest] = true;
+		if (writeBuffer.size() >= Repository::m_writeBufferSize) {
+			this->WriteRecords(writeBuffer, bufferedRecords, dataStore);
+		}
 	}
 
-	// Seek to either the record we will overwrite, or to the end of the file to append.
-	m_dataStoreFile.clear();
-	if (foundMatchingLogicalRecord && recordPos >= 0) {
-		m_dataStoreFile.seekp(recordPos);
-	} else {
-		m_dataStoreFile.seekp(0, std::ios::end);
+	this->WriteRecords(writeBuffer, bufferedRecords, dataStore);
+
+	// The import is durable once the rest of it is in the log.
+	m_writeAheadLog.Commit();
+	this->CheckpointIfLarge();
+
+	// Keep already cached records current without caching the whole batch.
+	for (auto& batchKey : batchKeys) {
+		m_dataStoreCache.Refresh(batchKey.first, models[batchKey.second]);
 	}
 
-	// Write the record to the datastore file
-	m_dataStoreFile << model.ToString(Model::SerializeMode::DataStore) << std::endl;
-	if (m_dataStoreFile.fail())
+	this->CompactIfWasteful();
+	return;
+}
+
+void Repository::UpdateModel(const Model& model)
+{
+	// Don't process an empty model object
+	if (!model)
 	{
-		throw std::runtime_error("Failed to write to datastore.");
+		return;
+	}
+
+	this->CheckWriter();
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadIndex();
+		this->LoadZoneMap();
+		this->LoadSecondaryIndexes();
 	}
 
+	// Log the new version of the record, then append it to the datastore; the key index then marks
+	// any older version dead.
+	std::streamoff recordPos = 0;
+	const bool isReplaced = m_keyIndex.Find(model.Key(), recordPos);
+	const std::string oldRecordString = (isReplaced && !m_secondaryIndexes.empty()) ? this->ReadRecord(recordPos) : std::string();
+	const std::string recordString = model.ToString(Model::SerializeMode::DataStore);
+	this->LogRecord(recordString);
+	const std::streamoff newRecordPos = this->AppendRecord(recordString);
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		if (isReplaced && !m_secondaryIndexes.empty()) {
+			this->UnindexRecord(oldRecordString, recordPos);
+		}
+
+		this->IndexRecord(model.Key(), recordString, newRecordPos);
+		this->Publish(static_cast<std::uintmax_t>(newRecordPos) + recordString.length() + 1);
+	}
+
+	m_dataStoreCache.Insert(model.Key(), model);
+	this->CheckpointIfLarge();
+	this->CompactIfWasteful();
 	return;
 }
 
@@ -137,12 +405,399 @@ void Repository::DeleteModel(std::string& key)
 		return;
 	}
 
-	if (m_dataStoreCache.count(key) > 0)
+	this->CheckWriter();
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadIndex();
+		this->LoadZoneMap();
+		this->LoadSecondaryIndexes();
+	}
+
+	// Log a tombstone of the record, then append it to the datastore; like the record itself it is
+	// then dead.
+	std::streamoff recordPos = 0;
+	if (!m_keyIndex.Find(key, recordPos)) {
+		return;
+	}
+
+	const std::string recordString = this->ReadRecord(recordPos);
+	const std::string tombstone = Model::Tombstone(recordString);
+	this->LogRecord(tombstone);
+	const std::streamoff tombstonePos = this->AppendRecord(tombstone);
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->UnindexRecord(recordString, recordPos);
+		m_keyIndex.Erase(key);
+		Model::field_view_t fieldValues;
+		Model::Split(tombstone, fieldValues);
+		m_keyIndex.MarkDead(tombstonePos);
+		m_zoneMap.Insert(tombstonePos, static_cast<std::streamoff>(tombstone.length()) + 1, fieldValues);
+		this->Publish(static_cast<std::uintmax_t>(tombstonePos) + tombstone.length() + 1);
+	}
+
+	m_dataStoreCache.Erase(key);
+	this->CheckpointIfLarge();
+	this->CompactIfWasteful();
+	return;
+}
+
+void Repository::Compact()
+{
+	this->CheckWriter();
+	std::lock_guard<std::mutex> writeLock(m_writeMutex);
+	this->CompactLog();
+}
+
+std::uint64_t Repository::Version() const
+{
+	std::lock_guard<std::mutex> lock(m_snapshotMutex);
+	return m_version;
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void Repository::CheckWriter() const
+{
+	if (!m_isWriter) {
+		throw std::runtime_error(m_isReadOnly ? "Datastore is open read only: " + m_dataStorePath :
+				"Datastore is being written by another process: " + m_dataStorePath);
+	}
+}
+
+void Repository::CompactLog()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		this->LoadIndex();
+	}
+
+	if (m_keyIndex.DeadCount() == 0) {
+		return;
+	}
+
+	// Live records in file order, so the compacted file is written with one pass over the datastore.
+	std::vector<std::pair<std::streamoff, const std::string*>> liveRecords;
+	liveRecords.reserve(m_keyIndex.Size());
+	for (auto& entry : m_keyIndex.Offsets()) {
+		liveRecords.emplace_back(entry.second, &entry.first);
+	}
+
+	std::sort(std::begin(liveRecords), std::end(liveRecords));
+
+	// Everything logged is synced into the datastore first, as the log can't be replayed onto the
+	// compacted file.
+	this->Checkpoint();
+
+	std::vector<char> writeBuffer(Repository::m_writeBufferSize);
+	std::ofstream compactedFile;
+	std::string compactedPath = m_dataStorePath + ".tmp";
+	compactedFile.rdbuf()->pubsetbuf(writeBuffer.data(), static_cast<std::streamsize>(writeBuffer.size()));
+	compactedFile.open(compactedPath, std::ios::out | std::ios::trunc);
+	if (!compactedFile) {
+		throw std::runtime_error("Unable to create file: " + compactedPath);
+	}
+
+	KeyIndex::offset_map_t compactedOffsets;
+	compactedOffsets.reserve(liveRecords.size());
+	ZoneMap compactedZones;
+	std::vector<SecondaryIndex::offset_list_map_t> compactedOffsetLists(m_secondaryIndexes.size());
+	Model::field_view_t fieldValues;
+	std::streamoff writeOffset = 0;
+	m_dataStoreFile.flush();
+	MappedFile dataStore(m_dataStorePath);
+	for (auto& liveRecord : liveRecords) {
+		const std::string_view record = dataStore.View().substr(static_cast<size_t>(liveRecord.first));
+		const std::string_view recordString = record.substr(0, record.find('\n'));
+		const std::streamoff recordLength = static_cast<std::streamoff>(recordString.length()) + 1;
+		Model::Split(recordString, fieldValues);
+		compactedOffsets[*liveRecord.second] = writeOffset;
+		compactedZones.Insert(writeOffset, recordLength, fieldValues);
+		for (size_t i = 0; i < m_secondaryIndexes.size(); ++i) {
+			const std::string_view fieldValue = fieldValues[static_cast<size_t>(m_secondaryIndexes[i]->Field())];
+			compactedOffsetLists[i][std::string(fieldValue)].emplace_back(writeOffset);
+		}
+
+		compactedFile << recordString << '\n';
+		writeOffset += recordLength;
+	}
+
+	compactedFile.flush();
+	if (compactedFile.fail()) {
+		throw std::runtime_error("Failed to write to datastore.");
+	}
+
+	// Swap the compacted file in for the datastore; the rename replaces it atomically, so a crash
+	// leaves either the whole old log or the whole compacted one. Snapshots taken before keep
+	// their mappings of the old log.
+	compactedFile.close();
+	WriteAheadLog::SyncPath(compactedPath);
+	dataStore.Close();
 	{
-		auto model = m_dataStoreCache.find(key);
-		m_dataStoreCache.erase(model);
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		m_dataStoreFile.close();
+		std::filesystem::rename(compactedPath, m_dataStorePath);
+		m_dataStoreFile.open(m_dataStorePath, std::ios::in | std::ios::out);
+		if (!m_dataStoreFile.is_open()) {
+			throw std::runtime_error("Unable to reopen datastore: " + m_dataStorePath);
+		}
+
+		m_keyIndex.Assign(std::move(compactedOffsets));
+		m_zoneMap = std::move(compactedZones);
+		m_isZoneMapLoaded = true;
+		for (size_t i = 0; i < m_secondaryIndexes.size(); ++i) {
+			m_secondaryIndexes[i]->Assign(std::move(compactedOffsetLists[i]));
+		}
+
+		m_areSecondaryIndexesLoaded = true;
+		m_mappedDataStore.reset();
+		this->Publish(static_cast<std::uintmax_t>(writeOffset));
+	}
+
+	const std::string directory = std::filesystem::path(m_dataStorePath).parent_path().string();
+	WriteAheadLog::SyncPath(directory.empty() ? "." : directory);
+	this->Checkpoint();
+	return;
+}
+
+void Repository::LoadIndex() const
+{
+	if (m_isIndexLoaded) {
+		return;
+	}
+
+	m_isIndexLoaded = true;
+	if (m_keyIndex.Load(m_indexPath, m_dataStorePath) && this->AreSidecarsUsable()) {
+		return;
+	}
+
+	// Missing or stale index, so rebuild it from the records on disk; only those published, as
+	// the writer may be appending past them.
+	m_keyIndex.Rebuild(this->MappedDataStore()->View().substr(0, static_cast<size_t>(m_publishedSize)));
+	return;
+}
+
+void Repository::LoadZoneMap()
+{
+	if (m_isZoneMapLoaded) {
+		return;
+	}
+
+	m_isZoneMapLoaded = true;
+	if (m_zoneMap.Load(m_zoneMapPath, m_dataStorePath) && this->AreSidecarsUsable()) {
+		return;
+	}
+
+	// Missing or stale statistics, so rebuild them from the records on disk.
+	m_zoneMap.Rebuild(this->MappedDataStore()->View().substr(0, static_cast<size_t>(m_publishedSize)));
+	return;
+}
+
+void Repository::LoadSecondaryIndexes()
+{
+	if (m_areSecondaryIndexesLoaded) {
+		return;
+	}
+
+	m_areSecondaryIndexesLoaded = true;
+	for (auto& index : m_secondaryIndexes) {
+		if (index->Load(SecondaryIndex::IndexPath(m_dataStorePath, index->Field()), m_dataStorePath) && this->AreSidecarsUsable()) {
+			continue;
+		}
+
+		// Missing or stale index, so rebuild it from the live records on disk.
+		index->Rebuild(this->MappedDataStore()->View().substr(0, static_cast<size_t>(m_publishedSize)), this->DeadOffsets());
 	}
 
-	// TODO: Erase from data store on disk
 	return;
 }
+
+const KeyIndex::offset_list_t& Repository::DeadOffsets()
+{
+	// Those read from the key index file are a single run.
+	const KeyIndex::offset_run_list_t& deadRuns = this->DeadRuns();
+	return m_isIndexLoaded ? m_keyIndex.DeadOffsets() : *deadRuns.front();
+}
+
+const KeyIndex::offset_run_list_t& Repository::DeadRuns()
+{
+	if (m_isIndexLoaded) {
+		return m_keyIndex.DeadRuns();
+	}
+
+	// A scan only needs the dead lines, which lead the key index file, so the rest isn't read.
+	if (!m_areDeadOffsetsLoaded) {
+		m_areDeadOffsetsLoaded = true;
+		KeyIndex::offset_list_t deadOffsets;
+		if (!KeyIndex::LoadDeadOffsets(m_indexPath, m_dataStorePath, deadOffsets) || !this->AreSidecarsUsable()) {
+			this->LoadIndex();
+			return m_keyIndex.DeadRuns();
+		}
+
+		m_deadRuns.assign(1, std::make_shared<const KeyIndex::offset_list_t>(std::move(deadOffsets)));
+	}
+
+	return m_deadRuns;
+}
+
+std::shared_ptr<const DataStoreSnapshot> Repository::LatestSnapshot()
+{
+	if (m_snapshot == nullptr || m_snapshot->Version() != m_version) {
+		this->LoadZoneMap();
+		m_snapshot = std::make_shared<const DataStoreSnapshot>(m_version, this->MappedDataStore(), m_publishedSize, this->DeadRuns(), m_zoneMap);
+	}
+
+	return m_snapshot;
+}
+
+const std::shared_ptr<const MappedFile>& Repository::MappedDataStore() const
+{
+	if (m_mappedDataStore == nullptr || m_mappedDataStore->Size() < m_publishedSize) {
+		m_mappedDataStore = std::make_shared<const MappedFile>(m_dataStorePath);
+	}
+
+	return m_mappedDataStore;
+}
+
+bool Repository::AreSidecarsUsable() const
+{
+	// A sidecar file matched the datastore file when it was loaded, and the file's stamp only ever
+	// moves on, so if it is still as mapped, that is what the sidecar was saved against.
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	return (m_isWriter || (m_isMappedStamped && KeyIndex::DataStoreStamp(m_dataStorePath, dataStoreSize, dataStoreTime) &&
+			dataStoreSize == m_mappedSize && dataStoreTime == m_mappedTime));
+}
+
+void Repository::Publish(std::uintmax_t dataStoreSize)
+{
+	m_publishedSize = dataStoreSize;
+	++m_version;
+}
+
+std::string Repository::ReadRecord(std::streamoff recordPos)
+{
+	std::string recordString = "";
+	m_dataStoreFile.clear();
+	m_dataStoreFile.seekg(recordPos);
+	std::getline(m_dataStoreFile, recordString);
+	m_dataStoreFile.clear();
+	return recordString;
+}
+
+void Repository::LogRecord(const std::string& recordString)
+{
+	m_writeAheadLog.Append(recordString);
+	m_writeAheadLog.CommitIfDue();
+	if (m_writeAheadLog.IsPending()) {
+		m_syncCondition.notify_one();
+	}
+}
+
+void Repository::SyncLoop()
+{
+	std::unique_lock<std::mutex> writeLock(m_writeMutex);
+	try {
+		while (!m_isSyncStopping) {
+			if (m_writeAheadLog.IsPending()) {
+				m_syncCondition.wait_until(writeLock, m_writeAheadLog.CommitDue());
+				m_writeAheadLog.CommitIfDue();
+			} else {
+				m_syncCondition.wait(writeLock);
+			}
+		}
+	} catch (std::exception& e) {
+		// The writes that follow report the failure once they commit.
+		std::cout << e.what() << std::endl;
+	}
+}
+
+std::streamoff Repository::AppendRecord(const std::string& recordString)
+{
+	m_dataStoreFile.clear();
+	m_dataStoreFile.seekp(0, std::ios::end);
+	const std::streamoff recordPos = m_dataStoreFile.tellp();
+	m_dataStoreFile << recordString << '\n';
+	m_dataStoreFile.flush();
+	if (m_dataStoreFile.fail())
+	{
+		throw std::runtime_error("Failed to write to datastore.");
+	}
+
+	return recordPos;
+}
+
+void Repository::WriteRecords(std::string& writeBuffer, std::vector<std::pair<std::string, std::streamoff>>& records,
+		const MappedFile& dataStore)
+{
+	if (records.empty()) {
+		return;
+	}
+
+	m_dataStoreFile.write(writeBuffer.data(), static_cast<std::streamsize>(writeBuffer.size()));
+	m_dataStoreFile.flush();
+	if (m_dataStoreFile.fail()) {
+		throw std::runtime_error("Failed to write to datastore.");
+	}
+
+	// Keys are unique within a batch, so the records replaced all come before it, in the mapping.
+	const std::streamoff bufferOffset = records.front().second;
+	std::lock_guard<std::mutex> lock(m_snapshotMutex);
+	for (auto& record : records) {
+		std::streamoff recordPos = 0;
+		if (m_keyIndex.Find(record.first, recordPos) && !m_secondaryIndexes.empty()) {
+			const std::string_view oldRecord = dataStore.View().substr(static_cast<size_t>(recordPos));
+			this->UnindexRecord(oldRecord.substr(0, oldRecord.find('\n')), recordPos);
+		}
+
+		const std::string_view buffered = std::string_view(writeBuffer).substr(static_cast<size_t>(record.second - bufferOffset));
+		this->IndexRecord(record.first, buffered.substr(0, buffered.find('\n')), record.second);
+	}
+
+	this->Publish(static_cast<std::uintmax_t>(bufferOffset) + writeBuffer.size());
+	writeBuffer.clear();
+	records.clear();
+}
+
+void Repository::IndexRecord(const std::string& key, std::string_view recordString, std::streamoff recordPos)
+{
+	Model::field_view_t fieldValues;
+	Model::Split(recordString, fieldValues);
+	m_keyIndex.Insert(key, recordPos);
+	m_zoneMap.Insert(recordPos, static_cast<std::streamoff>(recordString.length()) + 1, fieldValues);
+	for (auto& index : m_secondaryIndexes) {
+		index->Insert(fieldValues[static_cast<size_t>(index->Field())], recordPos);
+	}
+}
+
+void Repository::UnindexRecord(std::string_view recordString, std::streamoff recordPos)
+{
+	Model::field_view_t fieldValues;
+	Model::Split(recordString, fieldValues);
+	for (auto& index : m_secondaryIndexes) {
+		index->Erase(fieldValues[static_cast<size_t>(index->Field())], recordPos);
+	}
+}
+
+void Repository::Checkpoint()
+{
+	m_dataStoreFile.flush();
+	WriteAheadLog::SyncPath(m_dataStorePath);
+	m_writeAheadLog.Checkpoint(std::filesystem::file_size(m_dataStorePath));
+}
+
+void Repository::CheckpointIfLarge()
+{
+	if (m_writeAheadLog.Size() >= Repository::m_maxLogSize) {
+		this->Checkpoint();
+	}
+}
+
+void Repository::CompactIfWasteful()
+{
+	if (static_cast<double>(m_keyIndex.DeadCount()) > static_cast<double>(m_keyIndex.Size()) * Repository::m_maxDeadRatio) {
+		this->CompactLog();
+	}
+}
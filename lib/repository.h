@@ -1,13 +1,28 @@
 #ifndef REPOSITORY_H
 #define REPOSITORY_H
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "datastore_snapshot.h"
+#include "key_index.h"
+#include "mapped_file.h"
 #include "model.h"
+#include "model_cache.h"
 #include "query.h"
+#include "secondary_index.h"
+#include "write_ahead_log.h"
+#include "zone_map.h"
 
-typedef std::map<std::string, Model> data_cache_t;
+typedef std::vector<Model> model_batch_t;
 
 class IRepository
 {
@@ -15,13 +30,36 @@ class IRepository
 		virtual void Connect(const std::string& connectionString) = 0;
 		virtual void Disconnect() = 0;
 		virtual Query::table_t QueryData(Query& query) = 0;
+		virtual void QueryData(Query& query, const Query::row_sink_t& sink) = 0;
 		virtual Model GetModelByKey(const std::string& key) const = 0;
 		virtual void CreateModel(const Model& model) = 0;
+		virtual void CreateModels(const model_batch_t& models) = 0;
 		virtual void UpdateModel(const Model& model) = 0;
 		virtual void DeleteModel(std::string& key) = 0;
+
+		/// True if writes are appended to the datastore, so a large import can be written as a run of
+		/// batches; otherwise every CreateModels call rewrites it, and an import is best written as one.
+		virtual bool IsAppendOnly() const = 0;
+
+		/// Gets a counter bumped by every write and connect, so a result computed at one version is
+		/// known to be current for as long as it holds.
+		virtual std::uint64_t Version() const = 0;
 		virtual ~IRepository() {}
 };
 
+/// Datastore kept as an append only log of records in a text file, with a key index, zone map, and
+/// secondary indexes alongside it.
+///
+/// Queries may run on any number of threads while one write at a time goes on. Each write appends
+/// to the log, flushes it, and then publishes a new version under a short lock, along with its
+/// changes to the indexes and zone map; a query takes a snapshot of the latest version under that
+/// lock, and plans against the indexes, then scans the snapshot without one. Writes, and lookups by
+/// key, which read through the writer's file stream, are serialized with one another. Connect and
+/// Disconnect must not overlap any other call.
+///
+/// Only one process at a time writes a datastore: the connection holding the lock on its
+/// write-ahead log, which alone recovers it after a crash. Any other connection reads the log as it
+/// stood when it connected, up to its last whole line, and never writes to it or its sidecar files.
 class Repository : public IRepository
 {
 	public:
@@ -32,20 +70,210 @@ class Repository : public IRepository
 		void Connect(const std::string& connectionString) override;
 		void Disconnect() override;
 		Query::table_t QueryData(Query& query) override;
+		void QueryData(Query& query, const Query::row_sink_t& sink) override;
 		Model GetModelByKey(const std::string& key) const override;
 		void CreateModel(const Model& model) override;
+		void CreateModels(const model_batch_t& models) override;
 		void UpdateModel(const Model& model) override;
 		void DeleteModel(std::string& key) override;
+		bool IsAppendOnly() const override { return true; }
+
+		/// Gets the number of versions published to queries.
+		std::uint64_t Version() const override;
+
+		/// Connects without writing from the next Connect on, i.e. for a process that only queries,
+		/// even if no other process is writing the datastore.
+		void ReadOnly(bool isReadOnly) { m_isReadOnly = isReadOnly; }
+
+		/// True if this connection holds the datastore's writer lock, so it may write to it.
+		bool IsWriter() const { return m_isWriter; }
+
+		/// Rewrites the live records of the datastore's log into a fresh file, dropping superseded
+		/// records and tombstones, and swaps it in for the datastore. Runs on its own once the log
+		/// holds more dead lines than live records.
+		void Compact();
+
+		// Public accessors
+		/// Gets the key index used to locate records in the datastore file.
+		const KeyIndex& Index() const { return m_keyIndex; }
+
+		/// Gets the block statistics filtered scans of the datastore file skip blocks by.
+		const ZoneMap& Zones() const { return m_zoneMap; }
+
+		/// Keeps a secondary index on each of the given fields from the next Connect on, along with
+		/// those the datastore already has index files for.
+		void IndexFields(const Model::projection_t& fields) { m_indexedFields = fields; }
+
+		/// Gets the secondary indexes kept on the datastore.
+		const std::vector<std::unique_ptr<SecondaryIndex>>& SecondaryIndexes() const { return m_secondaryIndexes; }
+
+		/// Gets the memory cache of records looked up or written by key.
+		const ModelCache& Cache() const { return m_dataStoreCache; }
+
+		/// Sets the most bytes the memory cache may hold.
+		void CacheCapacity(size_t capacity) { m_dataStoreCache.Capacity(capacity); }
+
+		/// Gets the write-ahead log that makes writes durable ahead of the datastore file.
+		const WriteAheadLog& Log() const { return m_writeAheadLog; }
+
+		/// Sets how long a single update or delete may wait to be synced to disk along with those
+		/// that follow it, after which it is synced even if no other write comes; zero syncs each
+		/// one before it returns. Imports are always synced before they return.
+		void SyncInterval(std::chrono::milliseconds syncInterval) { m_writeAheadLog.SyncInterval(syncInterval); }
 
 	private:
 		void ValidateDataStore();
 
-		/// File handle for the persistent data store.
-		std::fstream m_dataStoreFile;
+		/// Throws unless this connection holds the writer lock.
+		void CheckWriter() const;
+
+		/// Gets the mapping of the datastore file snapshots and rebuilds read, mapping the file again
+		/// if it was written past the mapping since; m_snapshotMutex must be held.
+		const std::shared_ptr<const MappedFile>& MappedDataStore() const;
+
+		/// True if sidecar files found to match the datastore file describe what this connection
+		/// reads: always for the writer, and for a reader only while the file is still exactly as
+		/// it was mapped, up to a whole line, when it connected.
+		bool AreSidecarsUsable() const;
+
+		/// Loads the key index sidecar file on first use, rebuilding it from the datastore if missing or stale.
+		void LoadIndex() const;
+
+		/// Gets the offsets of the datastore's dead lines, in order, only reading them from the key index
+		/// file if the index isn't loaded.
+		const KeyIndex::offset_list_t& DeadOffsets();
+
+		/// DeadOffsets() as the sorted runs snapshots share, which the writer adds to as lines die.
+		const KeyIndex::offset_run_list_t& DeadRuns();
+
+		/// Gets a snapshot of the latest published version, taking a new one if it has changed since
+		/// the last; m_snapshotMutex must be held.
+		std::shared_ptr<const DataStoreSnapshot> LatestSnapshot();
+
+		/// Makes the datastore file up to the given size, and the index changes made along with it,
+		/// the next version seen by queries; m_snapshotMutex must be held.
+		void Publish(std::uintmax_t dataStoreSize);
+
+		/// Reads the line at the given offset of the datastore file.
+		std::string ReadRecord(std::streamoff recordPos);
+
+		/// Logs a line about to be appended to the datastore file, syncing the log now if the sync
+		/// interval is up, or else leaving it to the sync thread.
+		void LogRecord(const std::string& recordString);
+
+		/// Commits the write-ahead log once the sync interval of a write left waiting in it has
+		/// passed, until told to stop; runs on m_syncThread while the writer is connected.
+		void SyncLoop();
+
+		/// Appends a line to the datastore file, flushed so it can be mapped, and returns its offset.
+		std::streamoff AppendRecord(const std::string& recordString);
+
+		/// Writes a batch's buffered records to the datastore file, then indexes and publishes them,
+		/// unindexing the records they replace as read from the given mapping. Clears the buffer.
+		void WriteRecords(std::string& writeBuffer, std::vector<std::pair<std::string, std::streamoff>>& records,
+				const MappedFile& dataStore);
+
+		/// Adds a record written at the given offset to the key index, zone map, and secondary
+		/// indexes; the record it replaces, if any, is marked dead.
+		void IndexRecord(const std::string& key, std::string_view recordString, std::streamoff recordPos);
+
+		/// Removes a record being replaced or deleted from the secondary indexes.
+		void UnindexRecord(std::string_view recordString, std::streamoff recordPos);
+
+		/// Syncs the datastore file to disk and starts the write-ahead log over from it.
+		void Checkpoint();
+
+		/// Checkpoints once the write-ahead log has grown past m_maxLogSize bytes, bounding how much a
+		/// recovery replays.
+		void CheckpointIfLarge();
+
+		/// Compact() for a caller already holding m_writeMutex.
+		void CompactLog();
+
+		/// Compacts the datastore once it holds more than m_maxDeadRatio dead lines per live record.
+		void CompactIfWasteful();
+
+		/// Loads the zone map sidecar file on first use, rebuilding it from the datastore if missing or stale.
+		void LoadZoneMap();
+
+		/// Maps the secondary index sidecar files on first use, rebuilding any missing or stale one from the datastore.
+		void LoadSecondaryIndexes();
+
+		/// Size of the write buffer used when rewriting the data store file.
+		static const size_t m_writeBufferSize;
+
+		/// Dead lines per live record the datastore's log may hold before it is compacted.
+		static const double m_maxDeadRatio;
+
+		/// Size in bytes the write-ahead log grows to before the datastore is checkpointed.
+		static const std::uintmax_t m_maxLogSize;
+
+		/// File handle for the persistent data store; lookups by key read through it too. Only used
+		/// while holding m_writeMutex, as queries read mappings of the file instead.
+		mutable std::fstream m_dataStoreFile;
+
+		/// Paths of the persistent data store, its key index and zone map sidecar files, and its write-ahead log.
+		std::string m_dataStorePath;
+		std::string m_indexPath;
+		std::string m_zoneMapPath;
+		std::string m_logPath;
+
+		/// Log of the datastore lines written since the datastore file was last synced.
+		WriteAheadLog m_writeAheadLog;
+
+		/// Maps record keys to their offset in the data store file; loaded on first use, which may be a lookup.
+		mutable KeyIndex m_keyIndex;
+		mutable bool m_isIndexLoaded;
+
+		/// Dead line offsets read for a scan while the key index isn't loaded, as a single run.
+		KeyIndex::offset_run_list_t m_deadRuns;
+		bool m_areDeadOffsetsLoaded;
+
+		/// Statistics of each block of the data store file.
+		ZoneMap m_zoneMap;
+		bool m_isZoneMapLoaded;
+
+		/// Fields given secondary indexes, and an index of each of them.
+		Model::projection_t m_indexedFields;
+		std::vector<std::unique_ptr<SecondaryIndex>> m_secondaryIndexes;
+		bool m_areSecondaryIndexesLoaded;
+
+		/// Memory cache of data store records, filled by lookups and writes.
+		mutable ModelCache m_dataStoreCache;
+
+		/// Serializes writes and lookups by key.
+		mutable std::mutex m_writeMutex;
+
+		/// Thread syncing writes left waiting in the write-ahead log, woken under m_writeMutex by
+		/// each one and by Disconnect.
+		std::thread m_syncThread;
+		std::condition_variable m_syncCondition;
+		bool m_isSyncStopping;
+
+		/// Guards the versions published to queries, along with the indexes, zone map, and their
+		/// loading, which queries share with the writer; the writer only changes them under it.
+		mutable std::mutex m_snapshotMutex;
+
+		/// Number of versions published, the size of the datastore file as of the latest one, and
+		/// the last snapshot taken, which stays current until the next.
+		std::uint64_t m_version;
+		std::uintmax_t m_publishedSize;
+		std::shared_ptr<const DataStoreSnapshot> m_snapshot;
+
+		/// Mapping of the datastore file covering at least the published size. A connection that
+		/// isn't the writer keeps the one it connected with, so a compaction by the writer can't
+		/// swap another file in under it.
+		mutable std::shared_ptr<const MappedFile> m_mappedDataStore;
+
+		/// Whether the next Connect is read only, and whether this connection holds the writer lock.
+		bool m_isReadOnly;
+		bool m_isWriter;
 
-		/// Memory cache of data store.
-		// TODO: Implement IDs / state for faster file store schemes
-		data_cache_t m_dataStoreCache;
+		/// Size and modification time of the datastore file a reader mapped as it connected, if the
+		/// file didn't change while it was mapped.
+		std::uintmax_t m_mappedSize;
+		std::int64_t m_mappedTime;
+		bool m_isMappedStamped;
 };
 
 #endif
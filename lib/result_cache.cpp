@@ -0,0 +1,142 @@
+#include <iterator>
+#include "result_cache.h"
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const size_t ResultCache::m_defaultCapacity = 64 << 20;
+const size_t ResultCache::m_maxResultShare = 8;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ResultCache::ResultCache() : ResultCache(ResultCache::m_defaultCapacity)
+{
+}
+
+ResultCache::ResultCache(size_t capacity)
+	: m_entries(), m_lookup(), m_capacity(capacity), m_size(0), m_hits(0), m_misses(0), m_evictions(0), m_savedTime(0)
+{
+}
+
+ResultCache::~ResultCache()
+{
+}
+
+ResultCache::Entry::Entry(const std::string& entryQueryKey, std::uint64_t entryVersion, const ResultCache::result_t& entryRows,
+		std::chrono::duration<double> entryRunTime, size_t entrySize)
+	: queryKey(entryQueryKey), version(entryVersion), rows(entryRows), runTime(entryRunTime), size(entrySize)
+{
+}
+
+ResultCache::Entry::~Entry()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool ResultCache::Find(const std::string& queryKey, std::uint64_t version, ResultCache::result_t& rows)
+{
+	auto found = m_lookup.find(queryKey);
+	if (found != std::end(m_lookup) && found->second->version != version) {
+		this->Erase(found->second);
+		found = std::end(m_lookup);
+	}
+
+	if (found == std::end(m_lookup)) {
+		++m_misses;
+		return false;
+	}
+
+	++m_hits;
+	m_savedTime += found->second->runTime;
+	m_entries.splice(std::begin(m_entries), m_entries, found->second);
+	rows = found->second->rows;
+	return true;
+}
+
+void ResultCache::Insert(const std::string& queryKey, std::uint64_t version, const ResultCache::result_t& rows,
+		std::chrono::duration<double> runTime)
+{
+	auto found = m_lookup.find(queryKey);
+	if (found != std::end(m_lookup)) {
+		this->Erase(found->second);
+	}
+
+	const size_t entrySize = ResultCache::EntrySize(queryKey, *rows);
+	if (entrySize > this->MaxResultSize()) {
+		return;
+	}
+
+	m_entries.emplace_front(queryKey, version, rows, runTime, entrySize);
+	m_lookup.emplace(m_entries.front().queryKey, std::begin(m_entries));
+	m_size += entrySize;
+	this->Evict();
+}
+
+void ResultCache::Clear()
+{
+	m_lookup.clear();
+	m_entries.clear();
+	m_size = 0;
+}
+
+size_t ResultCache::RowSize(const Query::row_t& row)
+{
+	// Values are held inline unless too long for it, i.e. those collected from many records.
+	size_t rowSize = sizeof(Query::row_t);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		const size_t fieldLength = row.Field(static_cast<Model::FieldId>(field)).length();
+		rowSize += (fieldLength > Model::string_len_max_t) ? fieldLength : 0;
+	}
+
+	// Extra result columns, i.e. of a field aggregated more than one way, are always held apart.
+	for (auto column : *row.FieldOrdering()) {
+		rowSize += (static_cast<size_t>(column) >= Model::field_count_t) ? sizeof(std::string) + row.Field(column).length() : 0;
+	}
+
+	return rowSize;
+}
+
+void ResultCache::Capacity(size_t capacity)
+{
+	m_capacity = capacity;
+	this->Evict();
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+size_t ResultCache::EntrySize(const std::string& queryKey, const Query::table_t& rows)
+{
+	// List node with its two links, hash node with its link and cached hash, and a bucket pointer.
+	const size_t listNodeSize = sizeof(ResultCache::entry_list_t::value_type) + 2 * sizeof(void*);
+	const size_t hashNodeSize = sizeof(std::string_view) + sizeof(ResultCache::entry_list_t::iterator) + 2 * sizeof(void*);
+	size_t entrySize = listNodeSize + hashNodeSize + sizeof(void*) + queryKey.size() + sizeof(Query::table_t);
+	for (auto& row : rows) {
+		entrySize += ResultCache::RowSize(row);
+	}
+
+	return entrySize;
+}
+
+void ResultCache::Erase(ResultCache::entry_list_t::iterator entry)
+{
+	// The hash table key views the entry's key, so it goes first.
+	m_size -= entry->size;
+	m_lookup.erase(entry->queryKey);
+	m_entries.erase(entry);
+}
+
+void ResultCache::Evict()
+{
+	while (m_size > m_capacity && !m_entries.empty()) {
+		this->Erase(std::prev(std::end(m_entries)));
+		++m_evictions;
+	}
+}
@@ -0,0 +1,115 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "query.h"
+
+/// Memory cache of query results, keyed by the canonical form of a query along with the version of
+/// the datastore it ran against, so a query repeated before the next write is answered without
+/// reading the datastore again. Like the record cache it is bounded by an estimate of the bytes it
+/// holds, evicting the least recently used results once it grows past its capacity.
+///
+/// Results are shared rather than copied out, so they can be sent on after the cache is unlocked.
+class ResultCache
+{
+	public:
+		/// Rows of a cached result, in the order the query produced them.
+		typedef std::shared_ptr<const Query::table_t> result_t;
+
+		// Construction
+		ResultCache();
+		explicit ResultCache(size_t capacity);
+		ResultCache(const ResultCache&) = delete;
+		ResultCache& operator= (const ResultCache&) = delete;
+		~ResultCache();
+
+		// Public API
+		/// Gets the result cached for the query at the given version and marks it most recently used;
+		/// counts towards the hit/miss statistics, and a hit saves the time the query took to run.
+		/// A result of another version is dropped. Returns false if there is none.
+		bool Find(const std::string& queryKey, std::uint64_t version, ResultCache::result_t& rows);
+
+		/// Caches the result of a query run at the given version as the most recently used, replacing
+		/// any already cached for it; runTime is how long the query took. A result bigger than
+		/// MaxResultSize() isn't held.
+		void Insert(const std::string& queryKey, std::uint64_t version, const ResultCache::result_t& rows,
+				std::chrono::duration<double> runTime);
+
+		/// Removes every entry; the statistics are kept.
+		void Clear();
+
+		/// Estimates the bytes a row of a result takes, i.e. to stop collecting one too big to cache.
+		static size_t RowSize(const Query::row_t& row);
+
+		// Public accessors
+		/// Sets the most bytes the cache may hold, evicting entries down to it.
+		void Capacity(size_t capacity);
+		size_t Capacity() const { return m_capacity; }
+
+		/// Gets the most bytes one result may take, so a single big result can't push out the many
+		/// small ones that are repeated most.
+		size_t MaxResultSize() const { return m_capacity / ResultCache::m_maxResultShare; }
+
+		/// Gets the estimated bytes held by the cached entries.
+		size_t Size() const { return m_size; }
+		size_t Count() const { return m_lookup.size(); }
+		size_t Hits() const { return m_hits; }
+		size_t Misses() const { return m_misses; }
+		size_t Evictions() const { return m_evictions; }
+
+		/// Gets the time the queries answered from the cache took when they were run.
+		std::chrono::duration<double> SavedTime() const { return m_savedTime; }
+
+		/// Capacity of a cache constructed without one.
+		static const size_t m_defaultCapacity;
+
+		/// Fraction of the capacity, as its inverse, one result may take.
+		static const size_t m_maxResultShare;
+
+	private:
+		/// A cached result and what it was computed from.
+		struct Entry {
+			Entry(const std::string& entryQueryKey, std::uint64_t entryVersion, const ResultCache::result_t& entryRows,
+					std::chrono::duration<double> entryRunTime, size_t entrySize);
+			~Entry();
+
+			std::string queryKey;
+			std::uint64_t version;
+			ResultCache::result_t rows;
+			std::chrono::duration<double> runTime;
+			size_t size;
+		};
+
+		typedef std::list<ResultCache::Entry> entry_list_t;
+
+		/// Estimates the bytes an entry takes: its rows, the list node, the key's characters, and the
+		/// hash table node and bucket referring to it.
+		static size_t EntrySize(const std::string& queryKey, const Query::table_t& rows);
+
+		/// Removes an entry from the cache.
+		void Erase(ResultCache::entry_list_t::iterator entry);
+
+		/// Evicts the least recently used entries until the cache is within its capacity.
+		void Evict();
+
+		/// Entries from most to least recently used. List nodes never move, so the hash table keys
+		/// are views of the keys held here.
+		ResultCache::entry_list_t m_entries;
+		std::unordered_map<std::string_view, ResultCache::entry_list_t::iterator> m_lookup;
+
+		size_t m_capacity;
+		size_t m_size;
+		size_t m_hits;
+		size_t m_misses;
+		size_t m_evictions;
+		std::chrono::duration<double> m_savedTime;
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include "delimiter_scanner.h"
+#include "key_index.h"
+#include "secondary_index.h"
+
+/// Fixed header at the start of an index file, followed by its sections:
+///     value offsets     uint64 offset of each distinct value in the value bytes, plus one for the end
+///     list offsets      uint64 index of each value's first record offset, plus one for the end
+///     record offsets    int64 datastore offset of each record, grouped by value and in file order
+///     value bytes       the distinct values back to back, in order
+struct IndexHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t field;
+	std::uint32_t reserved;
+	std::uint64_t dataStoreSize;
+	std::int64_t dataStoreTime;
+	std::uint64_t valueCount;
+	std::uint64_t offsetCount;
+};
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const char SecondaryIndex::m_magic[4] = { 'S', 'D', 'S', 'X' };
+const std::uint32_t SecondaryIndex::m_version = 1;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+SecondaryIndex::SecondaryIndex(Model::FieldId field)
+	: m_field(field), m_file(), m_valueOffsets(nullptr), m_listOffsets(nullptr), m_offsets(nullptr), m_valueBytes(nullptr),
+	  m_valueCount(0), m_isMapped(false), m_offsetLists(), m_size(0), m_isModified(false)
+{
+}
+
+SecondaryIndex::~SecondaryIndex()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool SecondaryIndex::Load(const std::string& indexPath, const std::string& dataStorePath)
+{
+	m_file.Close();
+	m_isMapped = false;
+	m_offsetLists.clear();
+	m_size = 0;
+	m_isModified = true;
+
+	std::error_code error;
+	if (std::filesystem::file_size(indexPath, error) < sizeof(IndexHeader) || error) {
+		return false;
+	}
+
+	m_file.Open(indexPath);
+	IndexHeader header;
+	std::memcpy(&header, m_file.Data(), sizeof(header));
+	if (std::memcmp(header.magic, SecondaryIndex::m_magic, sizeof(header.magic)) != 0 || header.version != SecondaryIndex::m_version ||
+			header.field != static_cast<std::uint32_t>(m_field)) {
+		m_file.Close();
+		return false;
+	}
+
+	// The index is only valid for the exact datastore state it was saved against.
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	if (!KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime) ||
+			dataStoreSize != header.dataStoreSize || dataStoreTime != header.dataStoreTime) {
+		m_file.Close();
+		return false;
+	}
+
+	// Locate the sections, checking each fits before it is used.
+	const size_t valueCount = static_cast<size_t>(header.valueCount);
+	const size_t offsetCount = static_cast<size_t>(header.offsetCount);
+	const size_t valueOffsetsBegin = sizeof(header);
+	const size_t listOffsetsBegin = valueOffsetsBegin + (valueCount + 1) * sizeof(std::uint64_t);
+	const size_t offsetsBegin = listOffsetsBegin + (valueCount + 1) * sizeof(std::uint64_t);
+	const size_t valueBytesBegin = offsetsBegin + offsetCount * sizeof(std::int64_t);
+	if (m_file.Size() < valueBytesBegin) {
+		m_file.Close();
+		return false;
+	}
+
+	const char* data = m_file.Data();
+	m_valueOffsets = reinterpret_cast<const std::uint64_t*>(data + valueOffsetsBegin);
+	m_listOffsets = reinterpret_cast<const std::uint64_t*>(data + listOffsetsBegin);
+	m_offsets = reinterpret_cast<const std::int64_t*>(data + offsetsBegin);
+	m_valueBytes = data + valueBytesBegin;
+	m_valueCount = valueCount;
+	if (m_file.Size() - valueBytesBegin < m_valueOffsets[valueCount] || m_listOffsets[valueCount] != offsetCount) {
+		m_file.Close();
+		return false;
+	}
+
+	m_isMapped = true;
+	m_size = offsetCount;
+	m_isModified = false;
+	return true;
+}
+
+void SecondaryIndex::Save(const std::string& indexPath, const std::string& dataStorePath)
+{
+	this->Materialize();
+
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	if (!KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime)) {
+		throw std::runtime_error("Unable to stat datastore: " + dataStorePath);
+	}
+
+	std::vector<std::uint64_t> valueOffsets(1, 0);
+	std::vector<std::uint64_t> listOffsets(1, 0);
+	std::string valueBytes;
+	valueOffsets.reserve(m_offsetLists.size() + 1);
+	listOffsets.reserve(m_offsetLists.size() + 1);
+	for (auto& offsetList : m_offsetLists) {
+		valueBytes.append(offsetList.first);
+		valueOffsets.emplace_back(valueBytes.size());
+		listOffsets.emplace_back(listOffsets.back() + offsetList.second.size());
+	}
+
+	// Written aside and renamed over the old file, so a reader never maps a partial index.
+	const std::string tmpPath = indexPath + ".tmp";
+	std::ofstream indexFile(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!indexFile) {
+		throw std::runtime_error("Unable to write index: " + tmpPath);
+	}
+
+	IndexHeader header = { { 0, 0, 0, 0 }, SecondaryIndex::m_version, static_cast<std::uint32_t>(m_field), 0,
+		dataStoreSize, dataStoreTime, m_offsetLists.size(), listOffsets.back() };
+	std::memcpy(header.magic, SecondaryIndex::m_magic, sizeof(header.magic));
+	indexFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	indexFile.write(reinterpret_cast<const char*>(valueOffsets.data()), static_cast<std::streamsize>(valueOffsets.size() * sizeof(std::uint64_t)));
+	indexFile.write(reinterpret_cast<const char*>(listOffsets.data()), static_cast<std::streamsize>(listOffsets.size() * sizeof(std::uint64_t)));
+	for (auto& offsetList : m_offsetLists) {
+		indexFile.write(reinterpret_cast<const char*>(offsetList.second.data()), static_cast<std::streamsize>(offsetList.second.size() * sizeof(std::int64_t)));
+	}
+
+	indexFile.write(valueBytes.data(), static_cast<std::streamsize>(valueBytes.size()));
+	indexFile.close();
+	if (!indexFile) {
+		throw std::runtime_error("Failed to write index: " + tmpPath);
+	}
+
+	std::filesystem::rename(tmpPath, indexPath);
+	m_isModified = false;
+}
+
+void SecondaryIndex::Rebuild(std::string_view dataStore, const std::vector<std::streamoff>& deadOffsets)
+{
+	m_file.Close();
+	m_isMapped = false;
+	m_offsetLists.clear();
+	m_size = 0;
+	m_isModified = true;
+
+	std::string_view recordString;
+	Model::field_view_t fieldValues;
+	RecordScanner scanner(dataStore);
+	size_t offset = scanner.Position();
+	auto deadOffset = std::begin(deadOffsets);
+	while (scanner.Next(recordString, fieldValues)) {
+		while (deadOffset != std::end(deadOffsets) && *deadOffset < static_cast<std::streamoff>(offset)) {
+			++deadOffset;
+		}
+
+		const bool isDead = (deadOffset != std::end(deadOffsets) && *deadOffset == static_cast<std::streamoff>(offset));
+		if (!recordString.empty() && !isDead) {
+			m_offsetLists[std::string(fieldValues[static_cast<size_t>(m_field)])].emplace_back(static_cast<std::int64_t>(offset));
+			++m_size;
+		}
+
+		offset = scanner.Position();
+	}
+}
+
+void SecondaryIndex::Assign(SecondaryIndex::offset_list_map_t&& offsets)
+{
+	m_file.Close();
+	m_isMapped = false;
+	m_offsetLists = std::move(offsets);
+	m_size = 0;
+	for (auto& offsetList : m_offsetLists) {
+		m_size += offsetList.second.size();
+	}
+
+	m_isModified = true;
+}
+
+void SecondaryIndex::Insert(std::string_view fieldValue, std::int64_t offset)
+{
+	this->Materialize();
+	SecondaryIndex::offset_list_t& offsets = m_offsetLists[std::string(fieldValue)];
+	auto position = std::lower_bound(std::begin(offsets), std::end(offsets), offset);
+	if (position == std::end(offsets) || *position != offset) {
+		offsets.insert(position, offset);
+		++m_size;
+	}
+
+	m_isModified = true;
+}
+
+void SecondaryIndex::Erase(std::string_view fieldValue, std::int64_t offset)
+{
+	this->Materialize();
+	auto offsetList = m_offsetLists.find(std::string(fieldValue));
+	if (offsetList == std::end(m_offsetLists)) {
+		return;
+	}
+
+	SecondaryIndex::offset_list_t& offsets = offsetList->second;
+	auto position = std::lower_bound(std::begin(offsets), std::end(offsets), offset);
+	if (position != std::end(offsets) && *position == offset) {
+		offsets.erase(position);
+		--m_size;
+		m_isModified = true;
+	}
+
+	if (offsets.empty()) {
+		m_offsetLists.erase(offsetList);
+	}
+}
+
+size_t SecondaryIndex::Count(const std::vector<Filter::Range>& ranges) const
+{
+	size_t count = 0;
+	for (auto& range : ranges) {
+		this->Visit(range, [&](const std::int64_t* begin, const std::int64_t* end) { count += static_cast<size_t>(end - begin); });
+	}
+
+	return count;
+}
+
+void SecondaryIndex::Lookup(const std::vector<Filter::Range>& ranges, SecondaryIndex::offset_list_t& offsets) const
+{
+	for (auto& range : ranges) {
+		this->Visit(range, [&](const std::int64_t* begin, const std::int64_t* end) { offsets.insert(std::end(offsets), begin, end); });
+	}
+}
+
+std::string SecondaryIndex::IndexPath(const std::string& dataStorePath, Model::FieldId field)
+{
+	return std::filesystem::path(dataStorePath).replace_extension("." + Model::m_validFields[static_cast<size_t>(field)] + ".sdx").string();
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+template <typename Visitor> void SecondaryIndex::Visit(const Filter::Range& range, const Visitor& visitor) const
+{
+	if (!m_isMapped) {
+		auto offsetList = !range.hasLower ? std::begin(m_offsetLists) :
+			range.isLowerInclusive ? m_offsetLists.lower_bound(range.lower) : m_offsetLists.upper_bound(range.lower);
+		for (; offsetList != std::end(m_offsetLists) && Filter::Contains(range, offsetList->first); ++offsetList) {
+			visitor(offsetList->second.data(), offsetList->second.data() + offsetList->second.size());
+		}
+
+		return;
+	}
+
+	// Binary search the mapped values for the first one in the range, then walk forward.
+	size_t first = 0;
+	size_t last = m_valueCount;
+	while (range.hasLower && first < last) {
+		const size_t middle = first + (last - first) / 2;
+		const std::string_view value = this->MappedValue(middle);
+		if (value < range.lower || (!range.isLowerInclusive && value == range.lower)) {
+			first = middle + 1;
+		} else {
+			last = middle;
+		}
+	}
+
+	for (size_t i = first; i < m_valueCount && Filter::Contains(range, this->MappedValue(i)); ++i) {
+		visitor(m_offsets + m_listOffsets[i], m_offsets + m_listOffsets[i + 1]);
+	}
+}
+
+void SecondaryIndex::Materialize()
+{
+	if (!m_isMapped) {
+		return;
+	}
+
+	m_offsetLists.clear();
+	for (size_t i = 0; i < m_valueCount; ++i) {
+		m_offsetLists.emplace_hint(std::end(m_offsetLists), std::string(this->MappedValue(i)),
+				SecondaryIndex::offset_list_t(m_offsets + m_listOffsets[i], m_offsets + m_listOffsets[i + 1]));
+	}
+
+	m_file.Close();
+	m_isMapped = false;
+}
+
+std::string_view SecondaryIndex::MappedValue(size_t i) const
+{
+	return std::string_view(m_valueBytes + m_valueOffsets[i], static_cast<size_t>(m_valueOffsets[i + 1] - m_valueOffsets[i]));
+}
@@ -0,0 +1,110 @@
+#ifndef SECONDARY_INDEX_H
+#define SECONDARY_INDEX_H
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "filter.h"
+#include "mapped_file.h"
+#include "model.h"
+
+/// Persistent index of one field's values to the offsets of the records in the datastore holding
+/// them, so a query filtering on the field only reads those records. Values are kept as they are
+/// held, i.e. encoded for typed fields, in byte order.
+///
+/// The index is kept in a sidecar file next to the datastore, stamped like the key index, holding
+/// the distinct values in order, each with its list of record offsets. The file is memory mapped
+/// and binary searched, so a lookup only touches the pages it needs however large the index is.
+/// Changes are made to a copy in memory, which is written out when the index is saved.
+class SecondaryIndex
+{
+	public:
+		typedef std::vector<std::int64_t> offset_list_t;
+		typedef std::map<std::string, SecondaryIndex::offset_list_t> offset_list_map_t;
+
+		// Construction
+		explicit SecondaryIndex(Model::FieldId field);
+		SecondaryIndex(const SecondaryIndex&) = delete;
+		SecondaryIndex& operator= (const SecondaryIndex&) = delete;
+		~SecondaryIndex();
+
+		// Public API
+		/// Maps the sidecar index file. Returns false if it is missing or does not match the datastore.
+		bool Load(const std::string& indexPath, const std::string& dataStorePath);
+
+		/// Writes the sidecar index file, stamped with the current state of the datastore file.
+		void Save(const std::string& indexPath, const std::string& dataStorePath);
+
+		/// Discards the current index and rebuilds it with a single pass over the datastore, skipping
+		/// the dead lines at the given offsets, which are in order.
+		void Rebuild(std::string_view dataStore, const std::vector<std::streamoff>& deadOffsets);
+
+		/// Replaces the whole index, i.e. after the datastore file has been rewritten.
+		void Assign(SecondaryIndex::offset_list_map_t&& offsets);
+
+		/// Adds the record at the given offset under the given value.
+		void Insert(std::string_view fieldValue, std::int64_t offset);
+
+		/// Removes the record at the given offset from under the given value, if present.
+		void Erase(std::string_view fieldValue, std::int64_t offset);
+
+		/// Counts the records with a value in any of the ranges; overlapping ranges count twice.
+		size_t Count(const std::vector<Filter::Range>& ranges) const;
+
+		/// Appends the offsets of the records with a value in any of the ranges; offsets are only
+		/// in order within each range, and overlapping ranges give the same record twice.
+		void Lookup(const std::vector<Filter::Range>& ranges, SecondaryIndex::offset_list_t& offsets) const;
+
+		/// Gets the path of the sidecar file of the given field's index, i.e. datastore.sds -> datastore.stb.sdx
+		static std::string IndexPath(const std::string& dataStorePath, Model::FieldId field);
+
+		// Public accessors
+		/// Gets the indexed field.
+		Model::FieldId Field() const { return m_field; }
+
+		/// Gets the number of records indexed.
+		size_t Size() const { return m_size; }
+
+		/// True if the index has changed since it was last loaded or saved.
+		bool IsModified() const { return m_isModified; }
+
+		/// Identifies an index file and its format version.
+		static const char m_magic[4];
+		static const std::uint32_t m_version;
+
+	private:
+		/// Passes each value in the range, and the offsets of the records holding it, to the visitor.
+		template <typename Visitor> void Visit(const Filter::Range& range, const Visitor& visitor) const;
+
+		/// Copies a mapped index into memory so it can be changed, and releases the mapping.
+		void Materialize();
+
+		/// Gets distinct value i of the mapped index.
+		std::string_view MappedValue(size_t i) const;
+
+		Model::FieldId m_field;
+
+		/// The mapped sidecar file and its sections: value i is valueBytes[valueOffsets[i],
+		/// valueOffsets[i + 1]) and is held by the records at offsets[listOffsets[i], listOffsets[i + 1]).
+		MappedFile m_file;
+		const std::uint64_t* m_valueOffsets;
+		const std::uint64_t* m_listOffsets;
+		const std::int64_t* m_offsets;
+		const char* m_valueBytes;
+		size_t m_valueCount;
+		bool m_isMapped;
+
+		/// Offsets by value, once the index has been built or changed in memory.
+		SecondaryIndex::offset_list_map_t m_offsetLists;
+
+		/// Number of record offsets held, mapped or in memory.
+		size_t m_size;
+
+		/// Set when the in-memory index no longer matches the sidecar file.
+		bool m_isModified;
+};
+
+#endif
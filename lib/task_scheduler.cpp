@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <exception>
+#include "task_scheduler.h"
+
+
+// ****************************************************************************
+// Job state
+// ****************************************************************************
+struct TaskScheduler::Job
+{
+	Job(const TaskScheduler::task_body_t& jobBody, CancellationToken& jobToken, size_t chunkCount)
+		: body(jobBody), token(jobToken), remainingChunks(chunkCount), mutex(), finished(), error(nullptr)
+	{
+	}
+
+	const TaskScheduler::task_body_t& body;
+	CancellationToken& token;
+
+	/// Guarded by mutex, so the job outlives the last chunk's completion signal.
+	size_t remainingChunks;
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::exception_ptr error;
+};
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+TaskScheduler::TaskScheduler(size_t threadCount)
+	: m_queues(), m_threads(), m_wakeMutex(), m_wakeCondition(), m_queuedChunks(0), m_isStopping(false),
+	  m_parallelForMutex(), m_stealCount(0)
+{
+	threadCount = std::max<size_t>(threadCount, 1);
+	for (size_t i = 0; i < threadCount; ++i) {
+		m_queues.emplace_back(std::make_unique<TaskScheduler::WorkerQueue>());
+	}
+
+	for (size_t worker = 1; worker < threadCount; ++worker) {
+		m_threads.emplace_back(&TaskScheduler::WorkerLoop, this, worker);
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_isStopping = true;
+	}
+
+	m_wakeCondition.notify_all();
+	for (auto& thread : m_threads) {
+		thread.join();
+	}
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+void TaskScheduler::ParallelFor(size_t count, size_t chunkSize, const TaskScheduler::task_body_t& body, CancellationToken& token)
+{
+	if (count == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> parallelForLock(m_parallelForMutex);
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	TaskScheduler::Job job(body, token, chunkCount);
+
+	// Count the chunks before they are visible so taking one never drives the count below zero.
+	m_queuedChunks += chunkCount;
+
+	// Deal contiguous runs of chunks to each worker so neighbouring indices tend to share a thread;
+	// owners work through their deque from the back, so start each deque with its earliest chunk last.
+	const size_t chunksPerWorker = (chunkCount + m_queues.size() - 1) / m_queues.size();
+	for (size_t worker = 0; worker < m_queues.size(); ++worker) {
+		const size_t firstChunk = std::min(worker * chunksPerWorker, chunkCount);
+		const size_t lastChunk = std::min(firstChunk + chunksPerWorker, chunkCount);
+		std::lock_guard<std::mutex> lock(m_queues[worker]->mutex);
+		for (size_t chunk = lastChunk; chunk > firstChunk; --chunk) {
+			const size_t begin = (chunk - 1) * chunkSize;
+			m_queues[worker]->chunks.push_back({ &job, begin, std::min(begin + chunkSize, count) });
+		}
+	}
+
+	// Sleeping workers check for chunks under the wake mutex; taking it here means none can miss this notify.
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+	}
+
+	m_wakeCondition.notify_all();
+
+	// Work alongside the pool as worker 0, then wait for chunks other workers are still running.
+	TaskScheduler::Chunk chunk = { nullptr, 0, 0 };
+	while (this->TryTakeChunk(0, chunk)) {
+		this->RunChunk(0, chunk);
+	}
+
+	std::unique_lock<std::mutex> lock(job.mutex);
+	job.finished.wait(lock, [&]() { return (job.remainingChunks == 0); });
+	if (job.error) {
+		std::rethrow_exception(job.error);
+	}
+}
+
+void TaskScheduler::ParallelFor(size_t count, size_t chunkSize, const TaskScheduler::task_body_t& body)
+{
+	CancellationToken token;
+	this->ParallelFor(count, chunkSize, body, token);
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void TaskScheduler::WorkerLoop(size_t worker)
+{
+	TaskScheduler::Chunk chunk = { nullptr, 0, 0 };
+	while (true) {
+		if (this->TryTakeChunk(worker, chunk)) {
+			this->RunChunk(worker, chunk);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.wait(lock, [&]() { return (m_isStopping || m_queuedChunks.load() > 0); });
+		if (m_isStopping) {
+			return;
+		}
+	}
+}
+
+bool TaskScheduler::TryTakeChunk(size_t worker, TaskScheduler::Chunk& chunk)
+{
+	{
+		TaskScheduler::WorkerQueue& queue = *m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.chunks.empty()) {
+			chunk = queue.chunks.back();
+			queue.chunks.pop_back();
+			--m_queuedChunks;
+			return true;
+		}
+	}
+
+	// Steal the oldest chunk of the next worker that has any.
+	for (size_t i = 1; i < m_queues.size(); ++i) {
+		TaskScheduler::WorkerQueue& victim = *m_queues[(worker + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.chunks.empty()) {
+			chunk = victim.chunks.front();
+			victim.chunks.pop_front();
+			--m_queuedChunks;
+			++m_stealCount;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TaskScheduler::RunChunk(size_t worker, const TaskScheduler::Chunk& chunk)
+{
+	TaskScheduler::Job& job = *chunk.job;
+	try {
+		for (size_t i = chunk.begin; i < chunk.end && !job.token.IsCancelled(); ++i) {
+			job.body(worker, i);
+		}
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(job.mutex);
+		job.error = job.error ? job.error : std::current_exception();
+		job.token.Cancel();
+	}
+
+	// The job may be destroyed as soon as its last chunk is counted, so don't touch it afterwards.
+	std::lock_guard<std::mutex> lock(job.mutex);
+	if (--job.remainingChunks == 0) {
+		job.finished.notify_all();
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Cooperative cancellation flag shared by the tasks of a parallel loop; tasks stop being started
+/// once it is cancelled, and a long running task may poll it to stop early.
+class CancellationToken
+{
+	public:
+		CancellationToken() : m_isCancelled(false) {}
+
+		/// Requests that no more tasks are started.
+		void Cancel() { m_isCancelled.store(true, std::memory_order_relaxed); }
+
+		/// Returns true once cancellation was requested.
+		bool IsCancelled() const { return m_isCancelled.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<bool> m_isCancelled;
+};
+
+
+/// Small work stealing thread pool shared by the import and query pipelines, so the process never
+/// runs more threads than it was given. Each worker owns a deque of chunked tasks: it takes work from
+/// the back of its own deque and, when that runs dry, steals from the front of the others'.
+///
+/// The thread that calls ParallelFor() takes part as worker 0, so a scheduler of one thread runs
+/// everything inline. Parallel loops are run one at a time and must not be nested.
+class TaskScheduler
+{
+	public:
+		/// Loop body; called with the index of the worker running it, in [0, ThreadCount()), and the loop index.
+		typedef std::function<void(size_t, size_t)> task_body_t;
+
+		// Construction
+		/// Starts threadCount - 1 worker threads; 0 is treated as 1.
+		explicit TaskScheduler(size_t threadCount);
+		TaskScheduler(const TaskScheduler&) = delete;
+		TaskScheduler& operator= (const TaskScheduler&) = delete;
+		~TaskScheduler();
+
+		// Public API
+		/// Runs body for every index in [0, count), in chunks of chunkSize consecutive indices, and
+		/// returns once they have all run or been skipped by cancellation. If a task throws, the
+		/// token is cancelled and the first exception is rethrown here.
+		void ParallelFor(size_t count, size_t chunkSize, const TaskScheduler::task_body_t& body, CancellationToken& token);
+
+		/// Same as above with a token private to this loop.
+		void ParallelFor(size_t count, size_t chunkSize, const TaskScheduler::task_body_t& body);
+
+		// Public accessors
+		/// Gets the number of threads that run tasks, including the calling thread.
+		size_t ThreadCount() const { return m_queues.size(); }
+
+		/// Gets the number of chunks taken from another worker's deque so far.
+		std::uint64_t StealCount() const { return m_stealCount.load(); }
+
+	private:
+		/// State of one ParallelFor() call, shared by its chunks.
+		struct Job;
+
+		/// A run of consecutive loop indices.
+		struct Chunk {
+			Job* job;
+			size_t begin;
+			size_t end;
+		};
+
+		/// A worker's deque of chunks; the owner uses the back and thieves the front.
+		struct WorkerQueue {
+			WorkerQueue() : mutex(), chunks() {}
+			std::mutex mutex;
+			std::deque<TaskScheduler::Chunk> chunks;
+		};
+
+		/// Runs chunks until the scheduler is stopped, sleeping while there are none.
+		void WorkerLoop(size_t worker);
+
+		/// Takes a chunk from the worker's own deque, or else steals one. Returns false if there were none.
+		bool TryTakeChunk(size_t worker, TaskScheduler::Chunk& chunk);
+
+		/// Runs a chunk's indices and marks it finished.
+		void RunChunk(size_t worker, const TaskScheduler::Chunk& chunk);
+
+		/// One deque per worker; worker 0 is whichever thread calls ParallelFor().
+		std::vector<std::unique_ptr<TaskScheduler::WorkerQueue>> m_queues;
+		std::vector<std::thread> m_threads;
+
+		/// Sleeping workers wait here for chunks to be queued or the scheduler to stop.
+		std::mutex m_wakeMutex;
+		std::condition_variable m_wakeCondition;
+		std::atomic<size_t> m_queuedChunks;
+		bool m_isStopping;
+
+		/// Serializes ParallelFor() calls.
+		std::mutex m_parallelForMutex;
+
+		std::atomic<std::uint64_t> m_stealCount;
+};
+
+#endif
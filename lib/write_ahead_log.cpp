@@ -0,0 +1,248 @@
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+#include "write_ahead_log.h"
+
+static std::uint64_t Checksum(std::string_view bytes);
+template <typename T> static bool ParseInteger(std::string_view token, T& value, int base);
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const std::string WriteAheadLog::m_fileTag = "sdswal1";
+const size_t WriteAheadLog::m_maxBatchSize = 4 << 20;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+WriteAheadLog::WriteAheadLog()
+	: m_fileDescriptor(-1), m_logPath(), m_batch(), m_batchCount(0), m_logSize(0), m_headerSize(0),
+	  m_syncInterval(0), m_lastCommit(std::chrono::steady_clock::now()), m_commits(0), m_committedEntries(0)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+	this->Close();
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool WriteAheadLog::Lock(const std::string& logPath)
+{
+	this->Close();
+	m_fileDescriptor = ::open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (m_fileDescriptor < 0) {
+		throw std::runtime_error("Unable to open write-ahead log: " + logPath);
+	}
+
+	if (::flock(m_fileDescriptor, LOCK_EX | LOCK_NB) != 0) {
+		const bool isHeld = (errno == EWOULDBLOCK);
+		this->Close();
+		if (!isHeld) {
+			throw std::runtime_error("Unable to lock write-ahead log: " + logPath);
+		}
+
+		return false;
+	}
+
+	m_logPath = logPath;
+	return true;
+}
+
+bool WriteAheadLog::Open(std::uintmax_t& dataStoreSize, std::vector<std::string>& entries)
+{
+	dataStoreSize = 0;
+	entries.clear();
+	m_batch.clear();
+	m_batchCount = 0;
+	m_logSize = 0;
+	m_headerSize = 0;
+	m_lastCommit = std::chrono::steady_clock::now();
+
+	MappedFile logFile(m_logPath);
+	const std::string_view log = logFile.View();
+	const std::string_view::size_type headerEnd = log.find('\n');
+	if (headerEnd == std::string_view::npos) {
+		return false;
+	}
+
+	const std::string_view header = log.substr(0, headerEnd);
+	const std::string_view::size_type separator = header.find(' ');
+	if (separator == std::string_view::npos || header.substr(0, separator) != WriteAheadLog::m_fileTag ||
+			!ParseInteger(header.substr(separator + 1), dataStoreSize, 10)) {
+		return false;
+	}
+
+	// Read whole batches until the end of the log, or a batch torn by a crash.
+	size_t position = headerEnd + 1;
+	m_headerSize = position;
+	while (position < log.size() && log[position] == '#') {
+		const std::string_view::size_type batchHeaderEnd = log.find('\n', position);
+		const std::string_view batchHeader = log.substr(position + 1, batchHeaderEnd - position - 1);
+		const std::string_view::size_type batchSeparator = batchHeader.find(' ');
+		size_t entryCount = 0;
+		std::uint64_t checksum = 0;
+		if (batchHeaderEnd == std::string_view::npos || batchSeparator == std::string_view::npos ||
+				!ParseInteger(batchHeader.substr(0, batchSeparator), entryCount, 10) ||
+				!ParseInteger(batchHeader.substr(batchSeparator + 1), checksum, 16)) {
+			break;
+		}
+
+		size_t batchEnd = batchHeaderEnd + 1;
+		for (size_t i = 0; i < entryCount && batchEnd != 0; ++i) {
+			batchEnd = log.find('\n', batchEnd) + 1;
+		}
+
+		const std::string_view batch = log.substr(batchHeaderEnd + 1, batchEnd - batchHeaderEnd - 1);
+		if (batchEnd == 0 || Checksum(batch) != checksum) {
+			break;
+		}
+
+		std::string_view::size_type entryBegin = 0;
+		while (entryBegin < batch.size()) {
+			const std::string_view::size_type entryEnd = batch.find('\n', entryBegin);
+			entries.emplace_back(batch.substr(entryBegin, entryEnd - entryBegin));
+			entryBegin = entryEnd + 1;
+		}
+
+		position = batchEnd;
+	}
+
+	// Cut off anything torn, so the next batch follows a whole one.
+	if (position < log.size() && ::ftruncate(m_fileDescriptor, static_cast<off_t>(position)) != 0) {
+		throw std::runtime_error("Unable to truncate write-ahead log: " + m_logPath);
+	}
+
+	m_logSize = position;
+	return true;
+}
+
+void WriteAheadLog::Close()
+{
+	if (m_fileDescriptor >= 0) {
+		::close(m_fileDescriptor);
+	}
+
+	m_fileDescriptor = -1;
+	m_batch.clear();
+	m_batchCount = 0;
+}
+
+void WriteAheadLog::Append(std::string_view entry)
+{
+	m_batch.append(entry).append(1, '\n');
+	++m_batchCount;
+	if (m_batch.size() >= WriteAheadLog::m_maxBatchSize) {
+		this->Commit();
+	}
+}
+
+void WriteAheadLog::Commit()
+{
+	if (m_batch.empty()) {
+		return;
+	}
+
+	char checksum[16];
+	auto result = std::to_chars(checksum, checksum + sizeof(checksum), Checksum(m_batch), 16);
+	std::string batch = "#" + std::to_string(m_batchCount) + " " + std::string(checksum, result.ptr) + "\n";
+	batch.append(m_batch);
+	this->Write(batch);
+
+	++m_commits;
+	m_committedEntries += m_batchCount;
+	m_batch.clear();
+	m_batchCount = 0;
+	m_lastCommit = std::chrono::steady_clock::now();
+}
+
+void WriteAheadLog::CommitIfDue()
+{
+	if (m_syncInterval.count() == 0 || std::chrono::steady_clock::now() - m_lastCommit >= m_syncInterval) {
+		this->Commit();
+	}
+}
+
+void WriteAheadLog::Checkpoint(std::uintmax_t dataStoreSize)
+{
+	m_batch.clear();
+	m_batchCount = 0;
+	if (::ftruncate(m_fileDescriptor, 0) != 0) {
+		throw std::runtime_error("Unable to truncate write-ahead log: " + m_logPath);
+	}
+
+	m_logSize = 0;
+	const std::string header = WriteAheadLog::m_fileTag + " " + std::to_string(dataStoreSize) + "\n";
+	this->Write(header);
+	m_headerSize = header.size();
+}
+
+void WriteAheadLog::SyncPath(const std::string& path)
+{
+	int fileDescriptor = ::open(path.c_str(), O_RDONLY);
+	if (fileDescriptor < 0) {
+		throw std::runtime_error("Unable to open file: " + path);
+	}
+
+	const bool isSynced = (::fsync(fileDescriptor) == 0);
+	::close(fileDescriptor);
+	if (!isSynced) {
+		throw std::runtime_error("Unable to sync file: " + path);
+	}
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void WriteAheadLog::Write(std::string_view buffer)
+{
+	while (!buffer.empty()) {
+		const ssize_t written = ::write(m_fileDescriptor, buffer.data(), buffer.size());
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (written < 0) {
+			throw std::runtime_error("Failed to write to write-ahead log: " + m_logPath);
+		}
+
+		buffer.remove_prefix(static_cast<size_t>(written));
+		m_logSize += static_cast<std::uintmax_t>(written);
+	}
+
+	if (::fsync(m_fileDescriptor) != 0) {
+		throw std::runtime_error("Unable to sync write-ahead log: " + m_logPath);
+	}
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static std::uint64_t Checksum(std::string_view bytes)
+{
+	// FNV-1a, so a log written by one build can be checked by another.
+	std::uint64_t hash = UINT64_C(14695981039346656037);
+	for (char c : bytes) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+template <typename T> static bool ParseInteger(std::string_view token, T& value, int base)
+{
+	auto result = std::from_chars(token.data(), token.data() + token.size(), value, base);
+	return (result.ec == std::errc() && result.ptr == token.data() + token.size());
+}
@@ -0,0 +1,110 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Log of the lines appended to the datastore since it was last synced to disk, so a write
+/// survives a crash once the log is, without syncing the datastore for every write. Entries are
+/// buffered and written as batches, each synced once (group commit): either when committed, i.e.
+/// at the end of an import, or once the sync interval has passed since the last commit.
+///
+/// The log starts with the size the datastore had when it was last synced, followed by the
+/// batches committed since, each with a header giving its entry count and checksum:
+///     sdswal1 <datastore size>
+///     #<entry count> <checksum>
+///     <entry>...
+/// A batch torn by a crash fails its checksum, and it and anything after it are discarded.
+class WriteAheadLog
+{
+	public:
+		// Construction
+		WriteAheadLog();
+		WriteAheadLog(const WriteAheadLog&) = delete;
+		WriteAheadLog& operator= (const WriteAheadLog&) = delete;
+		~WriteAheadLog();
+
+		// Public API
+		/// Opens the log file, creating it if missing, and takes an exclusive lock on it that is held
+		/// until it is closed, so only one process at a time writes the datastore or recovers it.
+		/// Returns false, leaving the log closed, if another process holds the lock.
+		bool Lock(const std::string& logPath);
+
+		/// Reads the datastore size the locked log starts from and the entries of every whole batch
+		/// in it, in order, cutting off a batch torn by a crash. Returns false if it has no valid
+		/// header, i.e. it was just created.
+		bool Open(std::uintmax_t& dataStoreSize, std::vector<std::string>& entries);
+
+		/// Closes the log file, releasing its lock; entries not yet committed are dropped.
+		void Close();
+
+		/// Buffers an entry for the next commit, committing on its own once the batch reaches m_maxBatchSize bytes.
+		void Append(std::string_view entry);
+
+		/// Writes the buffered entries as one batch and syncs the log file once.
+		void Commit();
+
+		/// Commits if the sync interval has passed since the last commit, or always without one.
+		void CommitIfDue();
+
+		/// Starts the log over from the given datastore size, dropping every entry; only once the
+		/// datastore has been synced to disk up to that size.
+		void Checkpoint(std::uintmax_t dataStoreSize);
+
+		/// Syncs a file, or a directory after renaming into it, to disk. Throws on failure.
+		static void SyncPath(const std::string& path);
+
+		// Public accessors
+		/// Sets how long entries may wait to be committed; zero commits every append with CommitIfDue().
+		void SyncInterval(std::chrono::milliseconds syncInterval) { m_syncInterval = syncInterval; }
+		std::chrono::milliseconds SyncInterval() const { return m_syncInterval; }
+
+		/// True if entries are buffered waiting for the next commit.
+		bool IsPending() const { return !m_batch.empty(); }
+
+		/// Gets when entries buffered now are due to be committed by CommitIfDue().
+		std::chrono::steady_clock::time_point CommitDue() const { return m_lastCommit + m_syncInterval; }
+
+		/// True if nothing has been logged since the last checkpoint.
+		bool IsEmpty() const { return (m_logSize == m_headerSize && m_batch.empty()); }
+
+		/// Gets the bytes written to the log file since the last checkpoint.
+		std::uintmax_t Size() const { return m_logSize; }
+
+		size_t Commits() const { return m_commits; }
+		size_t CommittedEntries() const { return m_committedEntries; }
+
+		/// Header tag written as the first token of the log file.
+		static const std::string m_fileTag;
+
+		/// Size in bytes a batch grows to before it is committed on its own.
+		static const size_t m_maxBatchSize;
+
+	private:
+		/// Writes the whole buffer to the log file, then syncs it.
+		void Write(std::string_view buffer);
+
+		int m_fileDescriptor;
+		std::string m_logPath;
+
+		/// Entries buffered for the next commit, each newline terminated.
+		std::string m_batch;
+		size_t m_batchCount;
+
+		/// Bytes in the log file, and in its header.
+		std::uintmax_t m_logSize;
+		std::uintmax_t m_headerSize;
+
+		std::chrono::milliseconds m_syncInterval;
+		std::chrono::steady_clock::time_point m_lastCommit;
+
+		/// Commit statistics.
+		size_t m_commits;
+		size_t m_committedEntries;
+};
+
+#endif
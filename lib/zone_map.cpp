@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include "delimiter_scanner.h"
+#include "key_index.h"
+#include "zone_map.h"
+
+/// Fixed header at the start of a zone map file, followed by each block in turn:
+///     int64 begin and end, uint64 record count
+///     uint32 length and bytes of each field's minimum, then of its maximum
+///     uint64 words of each bloom filter, of the fields that have one
+struct ZoneMapHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint64_t dataStoreSize;
+	std::int64_t dataStoreTime;
+	std::uint64_t blockCount;
+};
+
+static void WriteBlock(const ZoneMap::Block& block, size_t bloomWordCount, std::string& bytes);
+static bool ReadBlock(std::string_view& bytes, ZoneMap::Block& block, size_t bloomWordCount);
+template <typename T> static void WriteValue(T value, std::string& bytes);
+template <typename T> static bool ReadValue(std::string_view& bytes, T& value);
+
+
+// ****************************************************************************
+// Static initialization
+// ****************************************************************************
+const char ZoneMap::m_magic[4] = { 'S', 'D', 'S', 'Z' };
+const std::uint32_t ZoneMap::m_version = 2;
+const std::streamoff ZoneMap::m_blockSize = 64 << 10;
+const size_t ZoneMap::m_bloomBitCount = 8192;
+const size_t ZoneMap::m_segmentBlockCount = 32;
+
+
+// ****************************************************************************
+// Construction
+// ****************************************************************************
+ZoneMap::Block::Block(const ZoneMap::Block& other)
+	: begin(other.begin), end(other.end), recordCount(other.recordCount), minimums(other.minimums), maximums(other.maximums),
+	  blooms(other.blooms)
+{
+}
+
+ZoneMap::Block::~Block()
+{
+}
+
+ZoneMap::ZoneMap() : m_segments(), m_tail(), m_isModified(false)
+{
+}
+
+ZoneMap::ZoneMap(const ZoneMap& other) : m_segments(other.m_segments), m_tail(other.m_tail), m_isModified(other.m_isModified)
+{
+}
+
+ZoneMap::~ZoneMap()
+{
+}
+
+
+// ****************************************************************************
+// Public API
+// ****************************************************************************
+bool ZoneMap::Block::MayContain(Model::FieldId field, std::string_view fieldValue) const
+{
+	const size_t index = static_cast<size_t>(field);
+	if (this->recordCount == 0 || fieldValue < this->minimums[index] || this->maximums[index] < fieldValue) {
+		return false;
+	}
+
+	const std::vector<std::uint64_t>& bloom = this->blooms[index];
+	if (bloom.empty()) {
+		return true;
+	}
+
+	for (size_t bit : ZoneMap::BloomBits(fieldValue)) {
+		if (((bloom[bit / 64] >> (bit % 64)) & 1) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ZoneMap::Load(const std::string& zoneMapPath, const std::string& dataStorePath)
+{
+	this->Clear();
+
+	std::ifstream zoneMapFile(zoneMapPath, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!zoneMapFile) {
+		return false;
+	}
+
+	std::string zoneMap(static_cast<size_t>(zoneMapFile.tellg()), '\0');
+	zoneMapFile.seekg(0, std::ios::beg);
+	if (zoneMap.size() < sizeof(ZoneMapHeader) || !zoneMapFile.read(&zoneMap[0], static_cast<std::streamsize>(zoneMap.size()))) {
+		return false;
+	}
+
+	ZoneMapHeader header;
+	std::memcpy(&header, zoneMap.data(), sizeof(header));
+	if (std::memcmp(header.magic, ZoneMap::m_magic, sizeof(header.magic)) != 0 || header.version != ZoneMap::m_version) {
+		return false;
+	}
+
+	// The statistics are only valid for the exact datastore state they were saved against.
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	if (!KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime) ||
+			dataStoreSize != header.dataStoreSize || dataStoreTime != header.dataStoreTime) {
+		return false;
+	}
+
+	// Every block must be read whole, and nothing may follow the last.
+	std::string_view bytes = std::string_view(zoneMap).substr(sizeof(header));
+	while (this->BlockCount() < header.blockCount) {
+		ZoneMap::Block block;
+		if (!ReadBlock(bytes, block, ZoneMap::m_bloomBitCount / 64)) {
+			this->Clear();
+			return false;
+		}
+
+		this->Append(std::move(block));
+	}
+
+	if (!bytes.empty()) {
+		this->Clear();
+		return false;
+	}
+
+	m_isModified = false;
+	return true;
+}
+
+void ZoneMap::Save(const std::string& zoneMapPath, const std::string& dataStorePath)
+{
+	std::uintmax_t dataStoreSize = 0;
+	std::int64_t dataStoreTime = 0;
+	if (!KeyIndex::DataStoreStamp(dataStorePath, dataStoreSize, dataStoreTime)) {
+		throw std::runtime_error("Unable to stat datastore: " + dataStorePath);
+	}
+
+	// Written aside and renamed over the old file, so a crash never leaves a partial zone map.
+	const std::string tmpPath = zoneMapPath + ".tmp";
+	std::ofstream zoneMapFile(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!zoneMapFile) {
+		throw std::runtime_error("Unable to write zone map: " + tmpPath);
+	}
+
+	ZoneMapHeader header = { { 0, 0, 0, 0 }, ZoneMap::m_version, dataStoreSize, dataStoreTime, this->BlockCount() };
+	std::memcpy(header.magic, ZoneMap::m_magic, sizeof(header.magic));
+	zoneMapFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::string bytes = "";
+	for (size_t i = 0; i < this->BlockCount(); ++i) {
+		bytes.clear();
+		WriteBlock(this->BlockAt(i), ZoneMap::m_bloomBitCount / 64, bytes);
+		zoneMapFile.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+	}
+
+	zoneMapFile.close();
+	if (!zoneMapFile) {
+		throw std::runtime_error("Failed to write zone map: " + tmpPath);
+	}
+
+	std::filesystem::rename(tmpPath, zoneMapPath);
+	m_isModified = false;
+}
+
+void ZoneMap::Rebuild(std::string_view dataStore)
+{
+	this->Clear();
+
+	std::string_view recordString;
+	Model::field_view_t fieldValues;
+	RecordScanner scanner(dataStore);
+	size_t offset = scanner.Position();
+	while (scanner.Next(recordString, fieldValues)) {
+		if (!recordString.empty()) {
+			this->Insert(static_cast<std::streamoff>(offset), static_cast<std::streamoff>(scanner.Position() - offset), fieldValues);
+		}
+
+		offset = scanner.Position();
+	}
+}
+
+void ZoneMap::Insert(std::streamoff offset, std::streamoff length, const Model::field_view_t& record)
+{
+	m_isModified = true;
+
+	// An appended record extends the last block until it is full, then starts the next one where
+	// the last ended, so blocks also cover any blank lines between records.
+	if (m_tail.empty() || offset >= m_tail.back().end) {
+		if (m_tail.empty() || m_tail.back().end - m_tail.back().begin >= ZoneMap::m_blockSize) {
+			ZoneMap::Block nextBlock;
+			nextBlock.begin = m_tail.empty() ? 0 : m_tail.back().end;
+			this->Append(std::move(nextBlock));
+		}
+
+		ZoneMap::Block& block = m_tail.back();
+		ZoneMap::Widen(block, record);
+		block.end = offset + length;
+		++block.recordCount;
+		return;
+	}
+
+	// A record overwritten in place widens every block it now overlaps.
+	size_t index = 0;
+	for (size_t count = this->BlockCount(); count > 0;) {
+		const size_t half = count / 2;
+		if (this->BlockAt(index + half).begin <= offset) {
+			index += half + 1;
+			count -= half + 1;
+		} else {
+			count = half;
+		}
+	}
+
+	for (--index; index < this->BlockCount() && this->BlockAt(index).begin < offset + length; ++index) {
+		ZoneMap::Widen(this->MutableBlockAt(index), record);
+	}
+
+	m_tail.back().end = std::max(m_tail.back().end, offset + length);
+}
+
+void ZoneMap::Clear()
+{
+	m_segments.clear();
+	m_tail.clear();
+	m_isModified = true;
+}
+
+const ZoneMap::Block& ZoneMap::BlockAt(size_t index) const
+{
+	const size_t segment = index / ZoneMap::m_segmentBlockCount;
+	if (segment < m_segments.size()) {
+		return (*m_segments[segment])[index % ZoneMap::m_segmentBlockCount];
+	}
+
+	return m_tail[index - m_segments.size() * ZoneMap::m_segmentBlockCount];
+}
+
+bool ZoneMap::HasBloom(Model::FieldId field)
+{
+	return (field == Model::FieldId::Stb || field == Model::FieldId::Title);
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+void ZoneMap::Append(ZoneMap::Block&& block)
+{
+	// The last block is still written to, so a segment is only sealed once a block follows it.
+	if (m_tail.size() == ZoneMap::m_segmentBlockCount) {
+		m_segments.emplace_back(std::make_shared<const ZoneMap::block_list_t>(std::move(m_tail)));
+		m_tail.clear();
+	}
+
+	m_tail.emplace_back(std::move(block));
+}
+
+ZoneMap::Block& ZoneMap::MutableBlockAt(size_t index)
+{
+	const size_t segment = index / ZoneMap::m_segmentBlockCount;
+	if (segment < m_segments.size()) {
+		auto blocks = std::make_shared<ZoneMap::block_list_t>(*m_segments[segment]);
+		m_segments[segment] = blocks;
+		return (*blocks)[index % ZoneMap::m_segmentBlockCount];
+	}
+
+	return m_tail[index - m_segments.size() * ZoneMap::m_segmentBlockCount];
+}
+
+void ZoneMap::Widen(ZoneMap::Block& block, const Model::field_view_t& record)
+{
+	const bool isFirst = (block.recordCount == 0);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		const std::string_view fieldValue = record[field];
+		if (isFirst || fieldValue < block.minimums[field]) {
+			block.minimums[field].assign(fieldValue);
+		}
+
+		if (isFirst || block.maximums[field] < fieldValue) {
+			block.maximums[field].assign(fieldValue);
+		}
+
+		if (!ZoneMap::HasBloom(static_cast<Model::FieldId>(field))) {
+			continue;
+		}
+
+		std::vector<std::uint64_t>& bloom = block.blooms[field];
+		bloom.resize(ZoneMap::m_bloomBitCount / 64, 0);
+		for (size_t bit : ZoneMap::BloomBits(fieldValue)) {
+			bloom[bit / 64] |= std::uint64_t(1) << (bit % 64);
+		}
+	}
+}
+
+std::array<size_t, ZoneMap::bloom_hash_count_t> ZoneMap::BloomBits(std::string_view fieldValue)
+{
+	// FNV-1a, so the bits are the same in every build that reads the sidecar file, split into
+	// two halves that are combined into each bit position.
+	std::uint64_t hash = UINT64_C(14695981039346656037);
+	for (char c : fieldValue) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * UINT64_C(1099511628211);
+	}
+
+	const std::uint64_t lowHash = hash & 0xFFFFFFFF;
+	const std::uint64_t highHash = (hash >> 32) | 1;
+	std::array<size_t, ZoneMap::bloom_hash_count_t> bits;
+	for (size_t i = 0; i < bits.size(); ++i) {
+		bits[i] = static_cast<size_t>((lowHash + i * highHash) % ZoneMap::m_bloomBitCount);
+	}
+
+	return bits;
+}
+
+
+// ****************************************************************************
+// Helpers
+// ****************************************************************************
+static void WriteBlock(const ZoneMap::Block& block, size_t bloomWordCount, std::string& bytes)
+{
+	WriteValue<std::int64_t>(block.begin, bytes);
+	WriteValue<std::int64_t>(block.end, bytes);
+	WriteValue<std::uint64_t>(block.recordCount, bytes);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		WriteValue<std::uint32_t>(static_cast<std::uint32_t>(block.minimums[field].size()), bytes);
+		bytes.append(block.minimums[field]);
+		WriteValue<std::uint32_t>(static_cast<std::uint32_t>(block.maximums[field].size()), bytes);
+		bytes.append(block.maximums[field]);
+	}
+
+	// A block's bloom filters are only sized once it holds a record, so an empty one writes zeros.
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		if (!ZoneMap::HasBloom(static_cast<Model::FieldId>(field))) {
+			continue;
+		}
+
+		const std::vector<std::uint64_t>& bloom = block.blooms[field];
+		const size_t bloomSize = bloom.size() * sizeof(std::uint64_t);
+		bytes.append(reinterpret_cast<const char*>(bloom.data()), bloomSize);
+		bytes.append(bloomWordCount * sizeof(std::uint64_t) - bloomSize, '\0');
+	}
+}
+
+static bool ReadBlock(std::string_view& bytes, ZoneMap::Block& block, size_t bloomWordCount)
+{
+	std::int64_t begin = 0;
+	std::int64_t end = 0;
+	std::uint64_t recordCount = 0;
+	if (!ReadValue(bytes, begin) || !ReadValue(bytes, end) || !ReadValue(bytes, recordCount)) {
+		return false;
+	}
+
+	block.begin = begin;
+	block.end = end;
+	block.recordCount = static_cast<size_t>(recordCount);
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		for (std::string* value : { &block.minimums[field], &block.maximums[field] }) {
+			std::uint32_t length = 0;
+			if (!ReadValue(bytes, length) || bytes.size() < length) {
+				return false;
+			}
+
+			value->assign(bytes.substr(0, length));
+			bytes.remove_prefix(length);
+		}
+	}
+
+	for (size_t field = 0; field < Model::field_count_t; ++field) {
+		if (!ZoneMap::HasBloom(static_cast<Model::FieldId>(field))) {
+			continue;
+		}
+
+		const size_t bloomSize = bloomWordCount * sizeof(std::uint64_t);
+		if (bytes.size() < bloomSize) {
+			return false;
+		}
+
+		std::vector<std::uint64_t>& bloom = block.blooms[field];
+		bloom.resize(bloomWordCount);
+		std::memcpy(bloom.data(), bytes.data(), bloomSize);
+		bytes.remove_prefix(bloomSize);
+	}
+
+	return true;
+}
+
+template <typename T> static void WriteValue(T value, std::string& bytes)
+{
+	bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T> static bool ReadValue(std::string_view& bytes, T& value)
+{
+	if (bytes.size() < sizeof(value)) {
+		return false;
+	}
+
+	std::memcpy(&value, bytes.data(), sizeof(value));
+	bytes.remove_prefix(sizeof(value));
+	return true;
+}
@@ -0,0 +1,131 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "model.h"
+
+/// Per block statistics of the datastore file, so a filtered scan can skip the blocks that cannot
+/// hold a matching record. The file is divided into blocks of whole records of about m_blockSize
+/// bytes, and each block keeps the smallest and largest value of every field, compared as the bytes
+/// stored, along with small bloom filters of its stb and title values.
+///
+/// The statistics only ever widen: a record overwritten in place leaves its old values counted, so
+/// a block may be read needlessly but is never skipped wrongly. Like the key index they are kept in
+/// a sidecar file stamped with the size and modification time of the datastore.
+///
+/// Blocks are held in segments of m_segmentBlockCount that are never changed once full, only
+/// replaced, so a copy of the map shares them and only copies the blocks after them; a snapshot of
+/// the datastore takes one for each version.
+class ZoneMap
+{
+	public:
+		/// Statistics of a contiguous run of records of the datastore file.
+		struct Block {
+			Block() : begin(0), end(0), recordCount(0), minimums(), maximums(), blooms() {}
+			Block(const ZoneMap::Block& other);
+			Block(ZoneMap::Block&&) = default;
+			ZoneMap::Block& operator= (ZoneMap::Block&&) = default;
+			~Block();
+
+			/// Returns false only if no record in the block has the given value for the field.
+			bool MayContain(Model::FieldId field, std::string_view fieldValue) const;
+
+			/// Byte range [begin, end) of the datastore file the block covers.
+			std::streamoff begin;
+			std::streamoff end;
+			size_t recordCount;
+
+			/// Smallest and largest value of each field; only set once the block holds a record.
+			std::array<std::string, Model::field_count_t> minimums;
+			std::array<std::string, Model::field_count_t> maximums;
+
+			/// Bloom filter bits of each field that has one; empty for the others.
+			std::array<std::vector<std::uint64_t>, Model::field_count_t> blooms;
+		};
+
+		typedef std::vector<ZoneMap::Block> block_list_t;
+
+		/// Number of bits set in a bloom filter for each value.
+		static constexpr size_t bloom_hash_count_t = 3;
+
+		// Construction
+		ZoneMap();
+		ZoneMap(const ZoneMap& other);
+		ZoneMap(ZoneMap&&) = default;
+		ZoneMap& operator= (ZoneMap&&) = default;
+		~ZoneMap();
+
+		// Public API
+		/// Loads the sidecar file. Returns false if it is missing or does not match the datastore.
+		bool Load(const std::string& zoneMapPath, const std::string& dataStorePath);
+
+		/// Writes the sidecar file, stamped with the current state of the datastore file; the file is
+		/// replaced whole, so it is never left partly written.
+		void Save(const std::string& zoneMapPath, const std::string& dataStorePath);
+
+		/// Discards the current statistics and rebuilds them with a single pass over the datastore.
+		void Rebuild(std::string_view dataStore);
+
+		/// Counts a record written at the given offset of the datastore file, either appended after
+		/// every block or overwriting part of the blocks already there.
+		void Insert(std::streamoff offset, std::streamoff length, const Model::field_view_t& record);
+
+		/// Removes every block, i.e. before the datastore file is rewritten.
+		void Clear();
+
+		// Public accessors
+		size_t BlockCount() const { return m_segments.size() * ZoneMap::m_segmentBlockCount + m_tail.size(); }
+
+		/// Gets the block at the given index, in datastore order.
+		const ZoneMap::Block& BlockAt(size_t index) const;
+
+		/// True if the statistics have changed since they were last loaded or saved.
+		bool IsModified() const { return m_isModified; }
+
+		/// True if the given field's values are kept in bloom filters as well.
+		static bool HasBloom(Model::FieldId field);
+
+	private:
+		/// Widens a block's statistics to cover the record's field values; the first record of a
+		/// block sets them.
+		static void Widen(ZoneMap::Block& block, const Model::field_view_t& record);
+
+		/// Adds a block after the last, first sealing the blocks before it into a segment if they fill one.
+		void Append(ZoneMap::Block&& block);
+
+		/// Gets the block at the given index to change it, copying the segment it is in, if any, so
+		/// copies of the map keep the block as it was.
+		ZoneMap::Block& MutableBlockAt(size_t index);
+
+		/// Gets the bloom filter bit positions of a value.
+		static std::array<size_t, ZoneMap::bloom_hash_count_t> BloomBits(std::string_view fieldValue);
+
+		/// Identifies a sidecar file and its format version.
+		static const char m_magic[4];
+		static const std::uint32_t m_version;
+
+		/// Size in bytes a block grows to before the next record starts a new one.
+		static const std::streamoff m_blockSize;
+
+		/// Number of bits in each bloom filter.
+		static const size_t m_bloomBitCount;
+
+		/// Number of blocks in each sealed segment.
+		static const size_t m_segmentBlockCount;
+
+		/// Blocks in datastore order, covering the file from its start without gaps: the sealed
+		/// segments, then the blocks after them, the last of which records are still added to.
+		std::vector<std::shared_ptr<const ZoneMap::block_list_t>> m_segments;
+		ZoneMap::block_list_t m_tail;
+
+		/// Set when the statistics no longer match the sidecar file.
+		bool m_isModified;
+};
+
+#endif
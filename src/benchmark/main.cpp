@@ -0,0 +1,1365 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../../lib/datastore_client.h"
+#include "../../lib/datastore_manager.h"
+#include "../../lib/datastore_server.h"
+#include "../../lib/delimiter_scanner.h"
+#include "../../lib/model.h"
+#include "../../lib/query.h"
+#include "../../lib/repository.h"
+#include "../../lib/secondary_index.h"
+#include "../../lib/task_scheduler.h"
+#include "../../lib/zone_map.h"
+
+// Micro-benchmarks for the datastore and query tools
+
+static void PrintUsage();
+static std::string GenerateRecords(size_t rowCount);
+static void RunBenchmark(const std::string& name, size_t dataSize, size_t rowCount, const std::function<size_t()>& benchmark);
+static void BenchmarkParse(size_t rowCount);
+static void StressScheduler(size_t threadCount);
+static void BenchmarkScaling(size_t rowCount, size_t threadCount);
+static void BenchmarkZoneMap(size_t rowCount);
+static void BenchmarkIndex(size_t rowCount);
+static void BenchmarkCache(size_t rowCount);
+static void BenchmarkLog(size_t rowCount);
+static void BenchmarkWriteAheadLog(size_t rowCount);
+static void BenchmarkServer(size_t rowCount);
+static void BenchmarkLoad(size_t rowCount, size_t threadCount);
+static void BenchmarkSnapshot(size_t rowCount, size_t threadCount);
+static void BenchmarkResultCache(size_t rowCount);
+
+
+// ****************************************************************************
+// Command line options
+// ****************************************************************************
+static void PrintUsage()
+{
+	std::cout << "usage: benchmark <BENCHMARK> [options]" << std::endl
+		<< "benchmarks:" << std::endl
+		<< "    " << "parse                 Record parsing: istringstream/getline vs delimiter kernels" << std::endl
+		<< "    " << "scheduler             Stress test of the task scheduler: coverage, exceptions, and cancellation" << std::endl
+		<< "    " << "scaling               Full scan aggregate query on 1 thread up to --threads threads" << std::endl
+		<< "    " << "zonemap               Filtered scans of date ordered records with and without block statistics" << std::endl
+		<< "    " << "index                 Point and range filters through secondary indexes vs a full scan" << std::endl
+		<< "    " << "cache                 Skewed lookups by key through record caches of several sizes" << std::endl
+		<< "    " << "log                   Updates and deletes appended to the datastore log, then compaction" << std::endl
+		<< "    " << "wal                   Synced updates with and without group commit, and recovery after a crash" << std::endl
+		<< "    " << "server                Small queries each opening the datastore vs sent to a resident server" << std::endl
+		<< "    " << "load                  Point query latency on a server while heavy scans run; cancellation and backpressure" << std::endl
+		<< "    " << "snapshot              Scans alongside an import, in this process and in others, each checked against a published version" << std::endl
+		<< "    " << "results               Repeated dashboard queries with and without the result cache, and with writes between them" << std::endl
+		<< "options:" << std::endl
+		<< "    " << "-n <ROWS>             Number of synthetic records to generate (default: 10000000)" << std::endl
+		<< "    " << "--threads <N>         Most threads to use (default: all cores)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		if (argc < 2) {
+			PrintUsage();
+			return 0;
+		}
+
+		std::string benchmark(argv[1]);
+		size_t rowCount = 10000000;
+		size_t threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+		for (int i = 2; i < argc; ++i) {
+			std::string arg(argv[i]);
+			if (arg == "-n" && i + 1 < argc) {
+				rowCount = std::stoul(argv[++i]);
+			} else if ((arg == "--threads" || arg == "-j") && i + 1 < argc) {
+				threadCount = std::max<size_t>(std::stoul(argv[++i]), 1);
+			} else {
+				PrintUsage();
+				return 0;
+			}
+		}
+
+		if (benchmark == "parse") {
+			BenchmarkParse(rowCount);
+		} else if (benchmark == "scheduler") {
+			StressScheduler(threadCount);
+		} else if (benchmark == "scaling") {
+			BenchmarkScaling(rowCount, threadCount);
+		} else if (benchmark == "zonemap") {
+			BenchmarkZoneMap(rowCount);
+		} else if (benchmark == "index") {
+			BenchmarkIndex(rowCount);
+		} else if (benchmark == "cache") {
+			BenchmarkCache(rowCount);
+		} else if (benchmark == "log") {
+			BenchmarkLog(rowCount);
+		} else if (benchmark == "wal") {
+			BenchmarkWriteAheadLog(rowCount);
+		} else if (benchmark == "server") {
+			BenchmarkServer(rowCount);
+		} else if (benchmark == "load") {
+			BenchmarkLoad(rowCount, threadCount);
+		} else if (benchmark == "snapshot") {
+			BenchmarkSnapshot(rowCount, threadCount);
+		} else if (benchmark == "results") {
+			BenchmarkResultCache(rowCount);
+		} else {
+			PrintUsage();
+		}
+	}
+	catch (std::exception &e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+
+	return 0;
+}
+
+
+// ****************************************************************************
+// Benchmarks
+// ****************************************************************************
+static void BenchmarkParse(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string data = GenerateRecords(rowCount);
+
+	// Each benchmark returns the total length of every parsed field so the results can be cross checked.
+	RunBenchmark("istringstream/getline", data.size(), rowCount, [&]()
+			{
+				size_t checksum = 0;
+				std::string record;
+				std::string fieldValue;
+				std::istringstream dataStream(data);
+				while (std::getline(dataStream, record)) {
+					std::istringstream recordStream(record);
+					for (size_t field = 0; field < Model::field_count_t; ++field) {
+						if (std::getline(recordStream, fieldValue, '|')) {
+							checksum += fieldValue.length();
+						}
+					}
+				}
+
+				return checksum;
+			});
+
+	RunBenchmark("Model::Split", data.size(), rowCount, [&]()
+			{
+				size_t checksum = 0;
+				Model::field_view_t fieldValues;
+				std::string_view dataView(data);
+				std::string_view::size_type recordBegin = 0;
+				while (recordBegin < dataView.length()) {
+					std::string_view::size_type recordEnd = dataView.find('\n', recordBegin);
+					recordEnd = (recordEnd != std::string_view::npos) ? recordEnd : dataView.length();
+					Model::Split(dataView.substr(recordBegin, recordEnd - recordBegin), fieldValues);
+					for (auto& fieldValue : fieldValues) {
+						checksum += fieldValue.length();
+					}
+
+					recordBegin = recordEnd + 1;
+				}
+
+				return checksum;
+			});
+
+	for (auto kernel : { DelimiterScanner::Kernel::Scalar, DelimiterScanner::Kernel::Sse2, DelimiterScanner::Kernel::Avx2 }) {
+		if (!DelimiterScanner::IsSupported(kernel)) {
+			std::cout << std::setw(24) << std::left << DelimiterScanner::KernelName(kernel) << "not supported by this CPU" << std::endl;
+			continue;
+		}
+
+		RunBenchmark(std::string("RecordScanner/") + DelimiterScanner::KernelName(kernel), data.size(), rowCount, [&]()
+				{
+					size_t checksum = 0;
+					std::string_view record;
+					Model::field_view_t fieldValues;
+					RecordScanner scanner(data, kernel);
+					while (scanner.Next(record, fieldValues)) {
+						for (auto& fieldValue : fieldValues) {
+							checksum += fieldValue.length();
+						}
+					}
+
+					return checksum;
+				});
+	}
+}
+
+static void StressScheduler(size_t threadCount)
+{
+	// Uneven task costs and chunk sizes make workers run dry at different times, so chunks get stolen.
+	std::mt19937 random(42);
+	const size_t roundCount = 200;
+	for (size_t schedulerThreads = 1; schedulerThreads <= threadCount; schedulerThreads *= 2) {
+		TaskScheduler scheduler(schedulerThreads);
+		for (size_t round = 0; round < roundCount; ++round) {
+			const size_t count = random() % 5000;
+			const size_t chunkSize = random() % 64 + 1;
+			std::vector<std::atomic<unsigned>> runs(count);
+			std::vector<std::atomic<unsigned>> workerUse(schedulerThreads);
+			scheduler.ParallelFor(count, chunkSize, [&](size_t worker, size_t i)
+					{
+						volatile size_t spin = (i * 2654435761u) % 2000;
+						while (spin > 0) {
+							spin = spin - 1;
+						}
+
+						++runs[i];
+						++workerUse[worker];
+					});
+
+			for (size_t i = 0; i < count; ++i) {
+				if (runs[i] != 1) {
+					throw std::runtime_error("Scheduler stress: index " + std::to_string(i) + " ran " + std::to_string(runs[i]) + " times");
+				}
+			}
+		}
+
+		// The first exception is rethrown to the caller and stops the rest of the loop.
+		std::atomic<size_t> runCount(0);
+		bool wasRethrown = false;
+		try {
+			scheduler.ParallelFor(100000, 16, [&](size_t, size_t i)
+					{
+						++runCount;
+						if (i == 500) {
+							throw std::runtime_error("expected");
+						}
+					});
+		} catch (std::runtime_error& e) {
+			wasRethrown = (std::string(e.what()) == "expected");
+		}
+
+		if (!wasRethrown || runCount == 100000) {
+			throw std::runtime_error("Scheduler stress: exception was not propagated or did not cancel the loop");
+		}
+
+		// Cancelling the token from inside a task stops chunks that have not started.
+		CancellationToken token;
+		runCount = 0;
+		scheduler.ParallelFor(100000, 16, [&](size_t, size_t i)
+				{
+					++runCount;
+					if (i == 1000) {
+						token.Cancel();
+					}
+				}, token);
+
+		if (!token.IsCancelled() || runCount == 100000) {
+			throw std::runtime_error("Scheduler stress: cancellation did not stop the loop");
+		}
+
+		std::cout << std::setw(3) << schedulerThreads << " threads: " << roundCount << " rounds ok, "
+			<< scheduler.StealCount() << " chunks stolen" << std::endl;
+	}
+}
+
+static void BenchmarkScaling(size_t rowCount, size_t threadCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string data = GenerateRecords(rowCount);
+
+	// Double the threads each step, always finishing on the full count.
+	std::vector<size_t> steps;
+	for (size_t schedulerThreads = 1; schedulerThreads < threadCount; schedulerThreads *= 2) {
+		steps.emplace_back(schedulerThreads);
+	}
+
+	steps.emplace_back(threadCount);
+
+	double baseSeconds = 0.0;
+	for (size_t schedulerThreads : steps) {
+		TaskScheduler scheduler(schedulerThreads);
+		Query query("-s title,rev:sum,viewtime:sum,stb:count -g title -f provider=\"warner bros\" OR provider=fox");
+		query.Scheduler(&scheduler);
+
+		auto start = std::chrono::steady_clock::now();
+		size_t groupCount = 0;
+		query.QueryCommand(data, [&](const Query::row_t&) { ++groupCount; });
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double seconds = elapsed.count();
+		baseSeconds = (schedulerThreads == 1) ? seconds : baseSeconds;
+		std::cout << std::setw(3) << schedulerThreads << " threads" << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(9) << seconds << " s"
+			<< std::setw(10) << std::setprecision(1) << (static_cast<double>(data.size()) / (1 << 20)) / seconds << " MB/s"
+			<< std::setw(8) << std::setprecision(2) << baseSeconds / seconds << "x"
+			<< "    groups " << groupCount << std::endl;
+	}
+}
+
+static void BenchmarkZoneMap(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+
+	// Order the records by date, as if they had been imported a day at a time.
+	std::vector<std::string_view> lines;
+	std::string_view::size_type lineBegin = 0;
+	while (lineBegin < records.size()) {
+		std::string_view::size_type lineEnd = records.find('\n', lineBegin) + 1;
+		lines.emplace_back(std::string_view(records).substr(lineBegin, lineEnd - lineBegin));
+		lineBegin = lineEnd;
+	}
+
+	std::stable_sort(std::begin(lines), std::end(lines), [&](std::string_view lhs, std::string_view rhs)
+			{
+				return (lhs.substr(lhs.find('-') - 4, 10) < rhs.substr(rhs.find('-') - 4, 10));
+			});
+
+	std::string data;
+	data.reserve(records.size());
+	for (auto line : lines) {
+		data.append(line);
+	}
+
+	ZoneMap zoneMap;
+	auto start = std::chrono::steady_clock::now();
+	zoneMap.Rebuild(data);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Built " << zoneMap.BlockCount() << " blocks in " << std::fixed << std::setprecision(3) << elapsed.count() << " s" << std::endl;
+
+	const TextRecordSource partitions(data);
+	const TextRecordSource blocks(data, zoneMap);
+	for (auto filter : { "date=2014-04-21", "date=2014-04-21 OR date=2014-09-02", "stb=stb4242", "provider=fox" }) {
+		for (auto source : { &partitions, &blocks }) {
+			Query query(std::string("-s stb,rev -f ") + filter);
+			size_t selectedCount = 0;
+			RunBenchmark((source == &blocks) ? "  zone map" : "  full scan", data.size(), rowCount, [&]()
+					{
+						query.QueryCommand(*source, [&](const Query::row_t&) { ++selectedCount; });
+						return selectedCount;
+					});
+
+			Query::ScanStatistics statistics = query.ScanStats();
+			std::cout << "    " << filter << ": " << statistics.blocksRead << " blocks read, " << statistics.blocksSkipped << " skipped" << std::endl;
+		}
+	}
+}
+
+static void BenchmarkIndex(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+
+	std::vector<std::unique_ptr<SecondaryIndex>> indexes;
+	std::vector<const SecondaryIndex*> indexList;
+	for (auto field : { Model::FieldId::Stb, Model::FieldId::Date }) {
+		indexes.emplace_back(new SecondaryIndex(field));
+		auto start = std::chrono::steady_clock::now();
+		indexes.back()->Rebuild(records, {});
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Built " << Model::m_validFields[static_cast<size_t>(field)] << " index in " << std::fixed << std::setprecision(3)
+			<< elapsed.count() << " s" << std::endl;
+		indexList.emplace_back(indexes.back().get());
+	}
+
+	const TextRecordSource scan(records);
+	for (auto filter : { "stb=stb4242", "stb>=stb4242 AND stb<stb4250", "date=2014-04-21", "date>=2014-04-01 AND date<2014-05-01", "provider=fox" }) {
+		size_t selectedCount = 0;
+		Query scanQuery(std::string("-s stb,rev -f ") + filter);
+		RunBenchmark("  full scan", records.size(), rowCount, [&]()
+				{
+					scanQuery.QueryCommand(scan, [&](const Query::row_t&) { ++selectedCount; });
+					return selectedCount;
+				});
+
+		// The planner falls back to a scan if no index narrows the filter down enough.
+		size_t indexedCount = 0;
+		Query indexQuery(std::string("-s stb,rev -f ") + filter);
+		RunBenchmark("  planned", records.size(), rowCount, [&]()
+				{
+					SecondaryIndex::offset_list_t offsets;
+					if (!indexQuery.Plan(indexList, offsets)) {
+						indexQuery.QueryCommand(scan, [&](const Query::row_t&) { ++indexedCount; });
+						return indexedCount;
+					}
+
+					const OffsetRecordSource source(records, std::move(offsets));
+					indexQuery.QueryCommand(source, [&](const Query::row_t&) { ++indexedCount; });
+					return indexedCount;
+				});
+
+		Query::ScanStatistics statistics = indexQuery.ScanStats();
+		std::cout << "    " << filter << ": " << (statistics.indexField.empty() ? "no index" : "index on " + statistics.indexField)
+			<< ", " << indexedCount << " of " << selectedCount << " records selected" << std::endl;
+	}
+}
+
+static void BenchmarkCache(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	// A temporary datastore the lookups read through to on a miss.
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_cache.sds").string();
+	std::filesystem::remove(dataStorePath);
+	{
+		Repository repository;
+		repository.Connect(dataStorePath);
+		repository.CreateModels(models);
+	}
+
+	// Nine in ten lookups go to a tenth of the keys.
+	std::vector<std::string> keys;
+	std::mt19937 random(42);
+	const size_t lookupCount = std::min<size_t>(rowCount, 1000000);
+	const size_t hotCount = std::max<size_t>(models.size() / 10, 1);
+	for (size_t i = 0; i < lookupCount; ++i) {
+		const size_t model = (random() % 10 != 0) ? random() % hotCount : random() % models.size();
+		keys.emplace_back(models[model].Key());
+	}
+
+	for (size_t capacity : { size_t(0), size_t(1) << 20, size_t(16) << 20, size_t(256) << 20 }) {
+		Repository repository;
+		repository.CacheCapacity(capacity);
+		repository.Connect(dataStorePath);
+		std::ostringstream name;
+		name << "  " << (capacity >> 20) << " MiB cache";
+		RunBenchmark(name.str(), 0, lookupCount, [&]()
+				{
+					size_t foundCount = 0;
+					for (auto& key : keys) {
+						foundCount += !repository.GetModelByKey(key) ? 0 : 1;
+					}
+
+					return foundCount;
+				});
+
+		const ModelCache& cache = repository.Cache();
+		std::cout << "    " << cache.Hits() << " hits, " << cache.Misses() << " misses, " << cache.Evictions() << " evictions, "
+			<< cache.Count() << " records in " << cache.Size() << " of " << cache.Capacity() << " bytes" << std::endl;
+	}
+
+	for (auto extension : { ".sds", ".idx", ".zmp" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+}
+
+static void BenchmarkLog(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_log.sds").string();
+	std::filesystem::remove(dataStorePath);
+	Repository repository;
+	repository.CacheCapacity(0);
+	repository.SyncInterval(std::chrono::milliseconds(10));
+	repository.IndexFields({ Model::FieldId::Stb });
+	repository.Connect(dataStorePath);
+	RunBenchmark("  import", records.size(), models.size(), [&]()
+			{
+				repository.CreateModels(models);
+				return repository.Index().Size();
+			});
+
+	// Update a third of the records and delete a tenth, each appended to the log on its own.
+	std::mt19937 random(42);
+	const size_t updateCount = models.size() / 3;
+	const size_t deleteCount = models.size() / 10;
+	RunBenchmark("  updates", 0, updateCount, [&]()
+			{
+				for (size_t i = 0; i < updateCount; ++i) {
+					Model& model = models[random() % models.size()];
+					model.Field(Model::FieldId::Rev, std::to_string(random() % 20) + ".99");
+					repository.UpdateModel(model);
+				}
+
+				return repository.Index().DeadCount();
+			});
+
+	RunBenchmark("  deletes", 0, deleteCount, [&]()
+			{
+				for (size_t i = 0; i < deleteCount; ++i) {
+					std::string key = models[random() % models.size()].Key();
+					repository.DeleteModel(key);
+				}
+
+				return repository.Index().DeadCount();
+			});
+
+	// Scans and index lookups must see exactly the live records before and after compaction.
+	Query before("-s stb,title,rev,date");
+	Query beforeIndexed("-s stb,title,rev,date -f stb>=stb4000 AND stb<stb4100");
+	size_t beforeCount = 0;
+	size_t beforeIndexedCount = 0;
+	repository.QueryData(before, [&](const Query::row_t&) { ++beforeCount; });
+	repository.QueryData(beforeIndexed, [&](const Query::row_t&) { ++beforeIndexedCount; });
+	const std::uintmax_t logSize = std::filesystem::file_size(dataStorePath);
+	RunBenchmark("  compaction", static_cast<size_t>(logSize), repository.Index().Size(), [&]()
+			{
+				repository.Compact();
+				return repository.Index().Size();
+			});
+
+	Query after("-s stb,title,rev,date");
+	Query afterIndexed("-s stb,title,rev,date -f stb>=stb4000 AND stb<stb4100");
+	size_t afterCount = 0;
+	size_t afterIndexedCount = 0;
+	repository.QueryData(after, [&](const Query::row_t&) { ++afterCount; });
+	repository.QueryData(afterIndexed, [&](const Query::row_t&) { ++afterIndexedCount; });
+	std::cout << "    " << repository.Index().Size() << " live records, " << beforeCount << " scanned before and " << afterCount
+		<< " after, " << afterIndexedCount
+		<< " through the index; log of " << logSize << " bytes compacted to " << std::filesystem::file_size(dataStorePath) << std::endl;
+	if (beforeCount != repository.Index().Size() || afterCount != beforeCount || afterIndexedCount != beforeIndexedCount) {
+		throw std::runtime_error("Scan does not match the live records.");
+	}
+
+	repository.Disconnect();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+}
+
+static void BenchmarkWriteAheadLog(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_wal.sds").string();
+	auto removeDataStore = [&]()
+	{
+		for (auto extension : { ".sds", ".idx", ".zmp", ".wal" }) {
+			std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+		}
+	};
+
+	// Single updates, each synced on its own and then grouped by a sync interval.
+	const size_t updateCount = std::min<size_t>(models.size(), 20000);
+	for (auto syncInterval : { std::chrono::milliseconds(0), std::chrono::milliseconds(1), std::chrono::milliseconds(10) }) {
+		removeDataStore();
+		Repository repository;
+		repository.CacheCapacity(0);
+		repository.SyncInterval(syncInterval);
+		repository.Connect(dataStorePath);
+		RunBenchmark("  updates, sync " + std::to_string(syncInterval.count()) + " ms", 0, updateCount, [&]()
+				{
+					for (size_t i = 0; i < updateCount; ++i) {
+						repository.UpdateModel(models[i]);
+					}
+
+					return repository.Log().CommittedEntries();
+				});
+
+		// The last updates are synced once their interval is up, without waiting for another write.
+		std::this_thread::sleep_for(syncInterval * 2 + std::chrono::milliseconds(50));
+		std::cout << "    " << repository.Log().Commits() << " syncs, " << repository.Log().CommittedEntries() << " of "
+			<< updateCount << " updates synced after the interval" << std::endl;
+	}
+
+	// A whole import, synced once per batch.
+	removeDataStore();
+	{
+		Repository repository;
+		repository.Connect(dataStorePath);
+		RunBenchmark("  import", records.size(), models.size(), [&]()
+				{
+					repository.CreateModels(models);
+					return repository.Log().CommittedEntries();
+				});
+
+		std::cout << "    " << repository.Log().Commits() << " syncs" << std::endl;
+	}
+
+	// A child process imports, updates, and deletes, then exits without disconnecting as if it had
+	// crashed; every write it made must be found once the datastore is recovered.
+	removeDataStore();
+	const size_t changeCount = std::min<size_t>(models.size() / 2, 1000);
+	const pid_t child = ::fork();
+	if (child == 0) {
+		Repository repository;
+		repository.Connect(dataStorePath);
+		repository.CreateModels(models);
+		for (size_t i = 0; i < changeCount; ++i) {
+			Model model = models[2 * i];
+			model.Field(Model::FieldId::Rev, "99.99");
+			repository.UpdateModel(model);
+			std::string key = models[2 * i + 1].Key();
+			repository.DeleteModel(key);
+		}
+
+		std::_Exit(0);
+	}
+
+	int status = 0;
+	::waitpid(child, &status, 0);
+	Repository repository;
+	auto start = std::chrono::steady_clock::now();
+	repository.Connect(dataStorePath);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	size_t updatedCount = 0;
+	size_t deletedCount = 0;
+	for (size_t i = 0; i < changeCount; ++i) {
+		updatedCount += (repository.GetModelByKey(models[2 * i].Key()).Field("rev") == "99.99") ? 1 : 0;
+		deletedCount += !repository.GetModelByKey(models[2 * i + 1].Key()) ? 1 : 0;
+	}
+
+	std::cout << "Recovered in " << std::fixed << std::setprecision(3) << elapsed.count() << " s: " << updatedCount << " of "
+		<< changeCount << " updates and " << deletedCount << " of " << changeCount << " deletes found" << std::endl;
+	repository.Disconnect();
+	removeDataStore();
+	if (updatedCount != changeCount || deletedCount != changeCount) {
+		throw std::runtime_error("Writes were lost in the crash.");
+	}
+}
+
+static void BenchmarkServer(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_server.sds").string();
+	const std::string socketPath = (std::filesystem::temp_directory_path() / "benchmark_server.sock").string();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+
+	{
+		Repository repository;
+		repository.IndexFields({ Model::FieldId::Stb });
+		repository.Connect(dataStorePath);
+		repository.CreateModels(models);
+	}
+
+	// Dashboard style point queries, each answered through the stb index.
+	const size_t queryCount = 1000;
+	std::vector<std::string> queryStrings;
+	std::mt19937 random(7);
+	for (size_t i = 0; i < queryCount; ++i) {
+		queryStrings.emplace_back("-s stb,title,rev -f stb=stb" + std::to_string(random() % 100000));
+	}
+
+	auto printLatency = [&](const std::chrono::steady_clock::time_point& start)
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "    " << std::fixed << std::setprecision(3) << elapsed.count() / static_cast<double>(queryCount) << " ms per query" << std::endl;
+	};
+
+	// What a query process does: open the datastore and sign in, then query it once.
+	auto start = std::chrono::steady_clock::now();
+	RunBenchmark("  open per query", 0, queryCount, [&]()
+			{
+				size_t rowTotal = 0;
+				for (auto& queryString : queryStrings) {
+					Repository repository;
+					DataStoreManager dataStore(repository, dataStorePath);
+					Credentials credentials = dataStore.Connect("benchmark", "password");
+					Query query(queryString);
+					dataStore.QueryData(credentials, query, [&](const Query::row_t&) { ++rowTotal; });
+				}
+
+				return rowTotal;
+			});
+
+	printLatency(start);
+
+	// The same queries sent to a server holding the datastore open, over one connection and then a
+	// connection per query as separate client processes would.
+	// Repeated queries would be answered from the result cache, so it is left off.
+	Repository repository;
+	DataStoreManager dataStore(repository, dataStorePath);
+	dataStore.ResultCacheCapacity(0);
+	DataStoreServer server(dataStore, socketPath, 1);
+	std::thread serverThread([&]() { server.Run(); });
+	while (!server.IsListening()) {
+		std::this_thread::yield();
+	}
+
+	start = std::chrono::steady_clock::now();
+	RunBenchmark("  one connection", 0, queryCount, [&]()
+			{
+				size_t rowTotal = 0;
+				DataStoreClient client;
+				client.Connect(socketPath, "benchmark", "password");
+				for (auto& queryString : queryStrings) {
+					client.QueryData(queryString, [&](std::string_view) { ++rowTotal; });
+				}
+
+				return rowTotal;
+			});
+
+	printLatency(start);
+	start = std::chrono::steady_clock::now();
+	RunBenchmark("  connect per query", 0, queryCount, [&]()
+			{
+				size_t rowTotal = 0;
+				for (auto& queryString : queryStrings) {
+					DataStoreClient client;
+					client.Connect(socketPath, "benchmark", "password");
+					client.QueryData(queryString, [&](std::string_view) { ++rowTotal; });
+					client.Disconnect();
+				}
+
+				return rowTotal;
+			});
+
+	printLatency(start);
+	server.Stop();
+	serverThread.join();
+	std::cout << "Served " << server.Requests() << " requests over " << server.Connections() << " connections" << std::endl;
+}
+
+static void BenchmarkLoad(size_t rowCount, size_t threadCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_load.sds").string();
+	const std::string socketPath = (std::filesystem::temp_directory_path() / "benchmark_load.sock").string();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+
+	{
+		Repository repository;
+		repository.IndexFields({ Model::FieldId::Stb });
+		repository.Connect(dataStorePath);
+		repository.CreateModels(models);
+	}
+
+	// Fewer workers than heavy scans, so point queries only get through when scans yield.
+	const size_t workerCount = std::max<size_t>(threadCount / 4, 2);
+	const size_t pointClientCount = 4;
+	const size_t scanClientCount = workerCount + 1;
+	const std::chrono::seconds duration(2);
+	// The heavy scans repeat one query, which the result cache would otherwise answer.
+	Repository repository;
+	DataStoreManager dataStore(repository, dataStorePath);
+	dataStore.ResultCacheCapacity(0);
+	DataStoreServer server(dataStore, socketPath, workerCount);
+	std::thread serverThread([&]() { server.Run(); });
+	while (!server.IsListening()) {
+		std::this_thread::yield();
+	}
+
+	// Each point client issues index lookups back to back for the duration, timing every one.
+	auto runLoad = [&](size_t scanCount)
+	{
+		std::atomic<bool> isDone(false);
+		std::vector<std::thread> scanClients;
+		std::atomic<size_t> scanTotal(0);
+		for (size_t i = 0; i < scanCount; ++i) {
+			scanClients.emplace_back([&]()
+					{
+						DataStoreClient client;
+						client.Connect(socketPath, "scan", "password");
+						while (!isDone) {
+							client.QueryData("-s title,rev:sum,viewtime:sum -g title", [](std::string_view) {});
+							++scanTotal;
+						}
+					});
+		}
+
+		std::vector<std::vector<double>> latencies(pointClientCount);
+		std::vector<std::thread> pointClients;
+		for (size_t i = 0; i < pointClientCount; ++i) {
+			pointClients.emplace_back([&, i]()
+					{
+						DataStoreClient client;
+						client.Connect(socketPath, "point", "password");
+						std::mt19937 random(static_cast<std::mt19937::result_type>(i));
+						const auto end = std::chrono::steady_clock::now() + duration;
+						while (std::chrono::steady_clock::now() < end) {
+							const std::string queryString = "-s stb,title,rev -f stb=stb" + std::to_string(random() % 100000);
+							auto start = std::chrono::steady_clock::now();
+							client.QueryData(queryString, [](std::string_view) {});
+							std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+							latencies[i].emplace_back(elapsed.count());
+						}
+					});
+		}
+
+		for (auto& client : pointClients) {
+			client.join();
+		}
+
+		isDone = true;
+		for (auto& client : scanClients) {
+			client.join();
+		}
+
+		std::vector<double> allLatencies;
+		for (auto& clientLatencies : latencies) {
+			allLatencies.insert(std::end(allLatencies), std::begin(clientLatencies), std::end(clientLatencies));
+		}
+
+		std::sort(std::begin(allLatencies), std::end(allLatencies));
+		auto percentile = [&](double fraction) { return allLatencies[static_cast<size_t>(fraction * static_cast<double>(allLatencies.size() - 1))]; };
+		std::cout << "  " << scanCount << " heavy scans: " << allLatencies.size() << " point queries, " << std::fixed << std::setprecision(3)
+			<< "p50 " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms, max " << allLatencies.back() << " ms; "
+			<< scanTotal << " scans done" << std::endl;
+	};
+
+	std::cout << "Server with " << workerCount << " workers, " << pointClientCount << " point query clients" << std::endl;
+	runLoad(0);
+	runLoad(scanClientCount);
+
+	// A cancelled scan gives its worker back within a partition. The scan is cancelled once its first
+	// rows arrive, so it is still running, held back by its unread rows if nothing else.
+	{
+		DataStoreClient client;
+		client.Connect(socketPath, "cancel", "password");
+		size_t rowTotal = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::string message;
+		try {
+			client.QueryData("-s stb,title,date", [&](std::string_view)
+					{
+						if (rowTotal++ == 0) {
+							client.Cancel();
+						}
+					});
+		}
+		catch (std::exception& e) {
+			message = e.what();
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Cancelled scan: \"" << message << "\" after " << rowTotal << " rows, " << std::fixed << std::setprecision(3)
+			<< elapsed.count() << " ms" << std::endl;
+		if (message != "Query cancelled") {
+			throw std::runtime_error("Scan was not cancelled.");
+		}
+	}
+
+	// A client reading slowly holds its query back rather than letting its results pile up.
+	{
+		DataStoreClient client;
+		client.Connect(socketPath, "slow", "password");
+		size_t rowTotal = 0;
+		auto start = std::chrono::steady_clock::now();
+		client.QueryData("-s stb,title,date", [&](std::string_view)
+				{
+					if (++rowTotal % 10000 == 0) {
+						std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					}
+				});
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Slow client: " << rowTotal << " rows in " << std::fixed << std::setprecision(3) << elapsed.count()
+			<< " s, at most " << server.PeakPendingBytes() / 1024 << " KiB pending (queries pause at " << DataStoreServer::m_maxPendingBytes / 1024 << " KiB)" << std::endl;
+	}
+
+	// A slow client's query waiting behind the scans may be run inside one, but mustn't hold it up
+	// while its client reads.
+	{
+		std::atomic<bool> isDone(false);
+		std::vector<std::thread> scanClients;
+		std::vector<double> scanTimes;
+		std::mutex scanTimesMutex;
+		for (size_t i = 0; i < scanClientCount; ++i) {
+			scanClients.emplace_back([&]()
+					{
+						DataStoreClient client;
+						client.Connect(socketPath, "scan", "password");
+						while (!isDone) {
+							auto start = std::chrono::steady_clock::now();
+							client.QueryData("-s title,rev:sum,viewtime:sum -g title", [](std::string_view) {});
+							std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+							std::lock_guard<std::mutex> lock(scanTimesMutex);
+							scanTimes.emplace_back(elapsed.count());
+						}
+					});
+		}
+
+		DataStoreClient client;
+		client.Connect(socketPath, "slow", "password");
+		double slowTime = 0.0;
+		for (size_t i = 0; i < 4; ++i) {
+			size_t rowTotal = 0;
+			auto start = std::chrono::steady_clock::now();
+			client.QueryData("-s stb,title,date", [&](std::string_view)
+					{
+						if (++rowTotal % 10000 == 0) {
+							std::this_thread::sleep_for(std::chrono::milliseconds(5));
+						}
+					});
+
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			slowTime = std::max(slowTime, elapsed.count());
+		}
+
+		isDone = true;
+		for (auto& scanClient : scanClients) {
+			scanClient.join();
+		}
+
+		std::sort(std::begin(scanTimes), std::end(scanTimes));
+		std::cout << "Slow client among scans: slowest query " << std::fixed << std::setprecision(3) << slowTime << " ms, "
+			<< scanTimes.size() << " scans, p50 " << scanTimes[scanTimes.size() / 2] << " ms, max " << scanTimes.back() << " ms" << std::endl;
+	}
+
+	server.Stop();
+	serverThread.join();
+	std::cout << "Served " << server.Requests() << " requests over " << server.Connections() << " connections, "
+		<< server.Yields() << " run while a scan yielded, " << server.Cancellations() << " cancelled" << std::endl;	if (server.Cancellations() == 0) {
+		throw std::runtime_error("Server counted no cancellations.");
+	}
+}
+
+static void BenchmarkSnapshot(size_t rowCount, size_t threadCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_snapshot.sds").string();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+
+	// Readers in other processes are forked before this one has any threads. Each waits for a byte
+	// on the pipe, then connects read only, scans, and disconnects over and over until the pipe is
+	// closed, noting when it connected and how many live records it counted.
+	const size_t readerCount = std::min<size_t>(std::max<size_t>(threadCount - 1, 1), 4);
+	int readerPipe[2] = { -1, -1 };
+	if (::pipe(readerPipe) != 0) {
+		throw std::runtime_error("Unable to create pipe.");
+	}
+
+	auto readerResultPath = [&](size_t reader) { return dataStorePath + ".reader" + std::to_string(reader); };
+	std::vector<pid_t> readerProcesses;
+	for (size_t i = 0; i < readerCount; ++i) {
+		const pid_t child = ::fork();
+		if (child == 0) {
+			::close(readerPipe[1]);
+			char start = 0;
+			std::ofstream resultFile(readerResultPath(i), std::ios::out | std::ios::trunc);
+			struct pollfd stopEvent = { readerPipe[0], POLLIN, 0 };
+			if (::read(readerPipe[0], &start, 1) == 1) {
+				while (::poll(&stopEvent, 1, 0) == 0) {
+					Repository reader;
+					reader.ReadOnly(true);
+					const auto connectBegin = std::chrono::steady_clock::now();
+					reader.Connect(dataStorePath);
+					const auto connectEnd = std::chrono::steady_clock::now();
+					Query query("-s stb");
+					size_t rowTotal = 0;
+					reader.QueryData(query, [&](const Query::row_t&) { ++rowTotal; });
+					std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - connectBegin;
+					resultFile << connectBegin.time_since_epoch().count() << " " << connectEnd.time_since_epoch().count() << " "
+						<< rowTotal << " " << elapsed.count() << " " << reader.IsWriter() << "\n";
+					reader.Disconnect();
+				}
+			}
+
+			resultFile.close();
+			std::_Exit(0);
+		}
+
+		readerProcesses.emplace_back(child);
+	}
+
+	::close(readerPipe[0]);
+
+	// A quarter of the records are there to begin with; the rest are imported a quarter at a time,
+	// alone, while readers scan, and while readers in other processes do.
+	Repository repository;
+	repository.CacheCapacity(0);
+	repository.SyncInterval(std::chrono::milliseconds(10));
+	repository.IndexFields({ Model::FieldId::Stb });
+	repository.Connect(dataStorePath);
+	repository.CreateModels(model_batch_t(std::begin(models), std::begin(models) + static_cast<std::ptrdiff_t>(models.size() / 4)));
+
+	// Live records as of each version published, recorded by the writer after each of its writes,
+	// along with when. Batches are small enough to be published whole, so every version a scan can
+	// see is recorded.
+	const size_t batchSize = 2000;
+	std::mutex liveCountMutex;
+	std::map<std::uint64_t, size_t> liveCounts;
+	std::vector<std::pair<std::chrono::steady_clock::rep, size_t>> liveHistory;
+	auto recordVersions = [&]()
+	{
+		std::lock_guard<std::mutex> lock(liveCountMutex);
+		const std::uint64_t version = repository.Version();
+		const std::uint64_t firstVersion = liveCounts.empty() ? version : liveCounts.rbegin()->first + 1;
+		for (std::uint64_t v = firstVersion; v <= version; ++v) {
+			liveCounts[v] = repository.Index().Size();
+		}
+
+		liveHistory.emplace_back(std::chrono::steady_clock::now().time_since_epoch().count(), repository.Index().Size());
+	};
+
+	recordVersions();
+	std::mt19937 random(42);
+	auto importQuarter = [&](size_t quarter)
+	{
+		const size_t end = models.size() * (quarter + 1) / 4;
+		for (size_t begin = models.size() * quarter / 4; begin < end; begin += batchSize) {
+			repository.CreateModels(model_batch_t(std::begin(models) + static_cast<std::ptrdiff_t>(begin),
+					std::begin(models) + static_cast<std::ptrdiff_t>(std::min(begin + batchSize, end))));
+			recordVersions();
+
+			// Along with some updates and deletes of records already there.
+			for (size_t i = 0; i < 10; ++i) {
+				Model& model = models[random() % begin];
+				model.Field(Model::FieldId::Rev, std::to_string(random() % 20) + ".99");
+				repository.UpdateModel(model);
+				recordVersions();
+			}
+
+			std::string key = models[random() % begin].Key();
+			repository.DeleteModel(key);
+			recordVersions();
+		}
+
+		return repository.Index().Size();
+	};
+
+	// Each scan counts the live records, which must be those of a version published while it ran.
+	struct ScanResult {
+		ScanResult(std::uint64_t first, std::uint64_t last, size_t count, double ms)
+			: firstVersion(first), lastVersion(last), rowCount(count), milliseconds(ms) {}
+		std::uint64_t firstVersion;
+		std::uint64_t lastVersion;
+		size_t rowCount;
+		double milliseconds;
+	};
+
+	std::atomic<bool> isWriting(false);
+	auto runReaders = [&](std::vector<std::vector<ScanResult>>& results, size_t minimumScans)
+	{
+		results.assign(readerCount, std::vector<ScanResult>());
+		std::vector<std::thread> readers;
+		for (size_t i = 0; i < readerCount; ++i) {
+			readers.emplace_back([&, i, minimumScans]()
+					{
+						while (results[i].size() < minimumScans || isWriting) {
+							Query query("-s stb");
+							size_t rowTotal = 0;
+							auto start = std::chrono::steady_clock::now();
+							const std::uint64_t firstVersion = repository.Version();
+							repository.QueryData(query, [&](const Query::row_t&) { ++rowTotal; });
+							const std::uint64_t lastVersion = repository.Version();
+							std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+							results[i].emplace_back(firstVersion, lastVersion, rowTotal, elapsed.count());
+						}
+					});
+		}
+
+		return readers;
+	};
+
+	auto joinReaders = [&](std::vector<std::thread>& readers, const std::vector<std::vector<ScanResult>>& results, const std::string& name)
+	{
+		for (auto& reader : readers) {
+			reader.join();
+		}
+
+		size_t scanCount = 0;
+		size_t inconsistentCount = 0;
+		double totalMilliseconds = 0;
+		for (auto& readerResults : results) {
+			for (auto& result : readerResults) {
+				bool isConsistent = false;
+				for (auto v = liveCounts.lower_bound(result.firstVersion); v != std::end(liveCounts) && v->first <= result.lastVersion; ++v) {
+					isConsistent = isConsistent || (v->second == result.rowCount);
+				}
+
+				inconsistentCount += isConsistent ? 0 : 1;
+				totalMilliseconds += result.milliseconds;
+				++scanCount;
+			}
+		}
+
+		std::cout << "    " << name << ": " << scanCount << " scans, " << std::fixed << std::setprecision(3)
+			<< totalMilliseconds / static_cast<double>(scanCount) << " ms each, " << inconsistentCount << " not matching a version" << std::endl;
+		if (inconsistentCount != 0) {
+			throw std::runtime_error("Scan does not match any version published while it ran.");
+		}
+	};
+
+	std::cout << readerCount << " scanning threads" << std::endl;
+	std::vector<std::vector<ScanResult>> idleResults;
+	std::vector<std::thread> idleReaders = runReaders(idleResults, 3);
+	joinReaders(idleReaders, idleResults, "scans alone");
+
+	RunBenchmark("  import alone", records.size() / 4, models.size() / 4, [&]() { return importQuarter(1); });
+
+	// The writer is never held up by the scans, nor they by it, beyond sharing the cores.
+	const std::uint64_t firstVersion = repository.Version();
+	isWriting = true;
+	std::vector<std::vector<ScanResult>> results;
+	std::vector<std::thread> readers = runReaders(results, 1);
+	RunBenchmark("  import with scans", records.size() / 4, models.size() / 4, [&]()
+			{
+				const size_t liveCount = importQuarter(2);
+				isWriting = false;
+				return liveCount;
+			});
+
+	joinReaders(readers, results, "scans during import");
+	std::cout << "    " << repository.Version() - firstVersion << " versions published during the import" << std::endl;
+
+	// A reader in another process sees the log as it stood when it connected, up to its last whole
+	// line, so its count must lie within those of the versions published around its connect; the
+	// writer may be partway through a batch, which only adds records, or another write.
+	recordVersions();
+	const char start = 1;
+	for (size_t i = 0; i < readerCount; ++i) {
+		if (::write(readerPipe[1], &start, 1) != 1) {
+			throw std::runtime_error("Unable to start the reader processes.");
+		}
+	}
+
+	RunBenchmark("  import with readers", records.size() / 4, models.size() / 4, [&]() { return importQuarter(3); });
+	recordVersions();
+	::close(readerPipe[1]);
+	size_t scanCount = 0;
+	size_t inconsistentCount = 0;
+	size_t writerCount = 0;
+	double totalMilliseconds = 0;
+	for (size_t i = 0; i < readerCount; ++i) {
+		int status = 0;
+		::waitpid(readerProcesses[i], &status, 0);
+		std::ifstream resultFile(readerResultPath(i));
+		std::chrono::steady_clock::rep connectBegin = 0;
+		std::chrono::steady_clock::rep connectEnd = 0;
+		size_t rowTotal = 0;
+		double milliseconds = 0;
+		bool isWriter = false;
+		while (resultFile >> connectBegin >> connectEnd >> rowTotal >> milliseconds >> isWriter) {
+			auto first = std::upper_bound(std::begin(liveHistory), std::end(liveHistory), connectBegin,
+					[](std::chrono::steady_clock::rep time, const std::pair<std::chrono::steady_clock::rep, size_t>& entry) { return time < entry.first; });
+			auto last = std::lower_bound(first, std::end(liveHistory), connectEnd,
+					[](const std::pair<std::chrono::steady_clock::rep, size_t>& entry, std::chrono::steady_clock::rep time) { return entry.first < time; });
+			first = (first == std::begin(liveHistory)) ? first : std::prev(first);
+			last = (last == std::end(liveHistory)) ? last : std::next(last);
+			size_t minimum = SIZE_MAX;
+			size_t maximum = 0;
+			for (auto entry = first; entry != last; ++entry) {
+				minimum = std::min(minimum, entry->second);
+				maximum = std::max(maximum, entry->second);
+			}
+
+			inconsistentCount += (rowTotal < minimum || rowTotal > maximum) ? 1 : 0;
+			writerCount += isWriter ? 1 : 0;
+			totalMilliseconds += milliseconds;
+			++scanCount;
+		}
+
+		resultFile.close();
+		std::filesystem::remove(readerResultPath(i));
+	}
+
+	std::cout << "    " << readerCount << " reader processes: " << scanCount << " connects and scans, " << std::fixed << std::setprecision(3)
+		<< totalMilliseconds / static_cast<double>(std::max<size_t>(scanCount, 1)) << " ms each, " << inconsistentCount
+		<< " outside the versions around their connect, " << writerCount << " took the writer lock" << std::endl;
+	if (scanCount == 0 || inconsistentCount != 0 || writerCount != 0) {
+		throw std::runtime_error("Reader process did not see a version published while it connected.");
+	}
+
+	repository.Disconnect();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+}
+
+static void BenchmarkResultCache(size_t rowCount)
+{
+	std::cout << "Generating " << rowCount << " records..." << std::endl;
+	const std::string records = GenerateRecords(rowCount);
+	model_batch_t models;
+	std::istringstream recordStream(records);
+	std::string line;
+	while (std::getline(recordStream, line)) {
+		models.emplace_back(line);
+	}
+
+	const std::string dataStorePath = (std::filesystem::temp_directory_path() / "benchmark_results.sds").string();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+
+	Repository repository;
+	repository.CacheCapacity(0);
+	repository.SyncInterval(std::chrono::milliseconds(10));
+	repository.IndexFields({ Model::FieldId::Stb });
+	DataStoreManager dataStore(repository, dataStorePath);
+	Credentials credentials = dataStore.Connect("dashboard", "password");
+	repository.CreateModels(models);
+
+	// A dashboard's panels, each written a couple of ways by the clients asking for it.
+	const std::vector<std::vector<std::string>> panels = {
+		{ "-s title,rev:sum,viewtime:sum -g title", "-g TITLE -s Title,Rev:sum,ViewTime:sum" },
+		{ "-s provider,rev:sum -g provider", "-s PROVIDER,REV:sum  -g PROVIDER" },
+		{ "-s date,rev:sum -g date -f date>=2014-04-01 AND date<2014-05-01", "-f date>=2014-04-01  AND  date<2014-05-01 -s date,rev:sum -g date" },
+		{ "-s stb,title,rev -o rev:desc,stb -l 20", "-l 20 -o REV:DESC,STB -s STB,TITLE,REV" },
+		{ "-s title,rev,date -f stb=stb4242", "-s TITLE,REV,DATE -f stb=stb4242" },
+		{ "-s title,stb:count -g title -f provider=fox", "-f provider=fox -s TITLE,STB:count -g TITLE" },
+	};
+
+	const size_t requestCount = 600;
+	std::mt19937 random(42);
+	auto runDashboard = [&](size_t writeInterval)
+	{
+		size_t rowTotal = 0;
+		for (size_t i = 0; i < requestCount; ++i) {
+			if (writeInterval != 0 && i % writeInterval == writeInterval - 1) {
+				Model& model = models[random() % models.size()];
+				model.Field(Model::FieldId::Rev, std::to_string(random() % 20) + ".99");
+				repository.UpdateModel(model);
+			}
+
+			const std::vector<std::string>& panel = panels[random() % panels.size()];
+			Query query(panel[random() % panel.size()]);
+			dataStore.QueryData(credentials, query, [&](const Query::row_t&) { ++rowTotal; });
+		}
+
+		return rowTotal;
+	};
+
+	// Statistics of each run, as the cache keeps counting across them.
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+	std::chrono::duration<double> savedTime(0);
+	auto printStatistics = [&]()
+	{
+		const ResultCache& results = dataStore.Results();
+		std::cout << "    " << results.Hits() - hits << " hits, " << results.Misses() - misses << " misses, " << std::fixed << std::setprecision(3)
+			<< (results.SavedTime() - savedTime).count() << " s of queries saved, " << results.Count() << " results in "
+			<< results.Size() / 1024 << " KiB, " << results.Evictions() - evictions << " evicted" << std::endl;
+		hits = results.Hits();
+		misses = results.Misses();
+		evictions = results.Evictions();
+		savedTime = results.SavedTime();
+	};
+
+	dataStore.ResultCacheCapacity(0);
+	RunBenchmark("  uncached", 0, requestCount, [&]() { return runDashboard(0); });
+
+	dataStore.ResultCacheCapacity(ResultCache::m_defaultCapacity);
+	RunBenchmark("  cached", 0, requestCount, [&]() { return runDashboard(0); });
+	printStatistics();
+
+	// A write makes every result stale, so each panel runs again once after it.
+	RunBenchmark("  cached, write per 50", 0, requestCount, [&]() { return runDashboard(50); });
+	printStatistics();
+
+	// Too small for every panel, so the least recently used ones are evicted.
+	dataStore.ResultCacheCapacity(64 << 10);
+	RunBenchmark("  cached in 64 KiB", 0, requestCount, [&]() { return runDashboard(0); });
+	printStatistics();
+
+	// Results answered from the cache must be those the query gives when run again.
+	auto serialize = [](const Query::table_t& rows)
+	{
+		std::string serialized;
+		for (auto& row : rows) {
+			serialized.append(row.ToString(Model::SerializeMode::Query)).append(1, '\n');
+		}
+
+		return serialized;
+	};
+
+	dataStore.ResultCacheCapacity(ResultCache::m_defaultCapacity);
+	for (auto& panel : panels) {
+		for (auto& queryString : panel) {
+			Query cachedQuery(queryString);
+			Query freshQuery(queryString);
+			if (serialize(dataStore.QueryData(credentials, cachedQuery)) != serialize(repository.QueryData(freshQuery))) {
+				throw std::runtime_error("Cached result does not match the query: " + queryString);
+			}
+		}
+	}
+
+	dataStore.Disconnect(credentials);
+	repository.Disconnect();
+	for (auto extension : { ".sds", ".idx", ".zmp", ".wal", ".stb.sdx" }) {
+		std::filesystem::remove(std::filesystem::path(dataStorePath).replace_extension(extension));
+	}
+}
+
+
+// ****************************************************************************
+// Private implementation
+// ****************************************************************************
+static std::string GenerateRecords(size_t rowCount)
+{
+	static const std::vector<std::string> titles = { "the matrix", "unbreakable", "the hobbit", "the fellowship of the ring", "heat" };
+	static const std::vector<std::string> providers = { "warner bros", "buena vista", "new line", "fox" };
+
+	// Fixed seed so runs are comparable.
+	std::mt19937 random(42);
+	std::ostringstream records;
+	for (size_t i = 0; i < rowCount; ++i) {
+		records << "stb" << random() % 100000 << '|'
+			<< titles[random() % titles.size()] << '|'
+			<< providers[random() % providers.size()] << '|'
+			<< "2014-" << std::setw(2) << std::setfill('0') << (random() % 12 + 1) << '-'
+			<< std::setw(2) << (random() % 28 + 1) << std::setfill(' ') << '|'
+			<< random() % 20 << '.' << std::setw(2) << std::setfill('0') << random() % 100 << std::setfill(' ') << '|'
+			<< random() % 4 << ':' << std::setw(2) << std::setfill('0') << random() % 60 << std::setfill(' ') << '\n';
+	}
+
+	return records.str();
+}
+
+static void RunBenchmark(const std::string& name, size_t dataSize, size_t rowCount, const std::function<size_t()>& benchmark)
+{
+	auto start = std::chrono::steady_clock::now();
+	size_t checksum = benchmark();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double seconds = elapsed.count();
+	std::cout << std::setw(24) << std::left << name << std::right << std::fixed << std::setprecision(3)
+		<< std::setw(9) << seconds << " s"
+		<< std::setw(10) << std::setprecision(1) << (static_cast<double>(dataSize) / (1 << 20)) / seconds << " MB/s"
+		<< std::setw(10) << std::setprecision(2) << (static_cast<double>(rowCount) / 1e6) / seconds << " Mrows/s"
+		<< "    checksum " << checksum << std::endl;
+}
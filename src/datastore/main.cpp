@@ -1,27 +1,52 @@
+#include <algorithm>
+#include <cctype>
+#include <csignal>
 #include <exception>
+#include <sstream>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 #include "../../lib/authenticate.h"
+#include "../../lib/columnar_repository.h"
 #include "../../lib/datastore_manager.h"
+#include "../../lib/datastore_server.h"
 
 static void PrintUsage();
+static void StopServer(int signalNumber);
+
+/// Server a signal stops, while one is running.
+static DataStoreServer* g_server = nullptr;
 
 
 // ****************************************************************************
 // Sample custom datastore manager
 // ****************************************************************************
 //
-// Below are the foll
+// Below are the following command line options:
 // -d [/path/to/datastore.sds]	Specify the path to the datastore (default: ./datastore.sds)
-// -l [/path/to/logfile]		Specify the path to a log file (default: ./datastore.log)
+// --threads, -j [threads]		Number of threads used to parse the import files (default: 1)
+// --columnar					Keep the datastore as a columnar segment directory (default: ./datastore.cds)
+// --index [FIELD1,FIELD2]		Keep secondary indexes on the given fields (i.e. datastore.stb.sdx)
+// --compact					Rewrite the datastore without superseded records and tombstones after importing
+// --serve [/path/to/socket]	Keep the datastore open after importing and serve queries on a Unix domain socket
+// --workers [workers]			Number of queries the server runs at once (default: number of cores)
+// --result-cache [MiB]			Memory for the results of repeated queries when serving; 0 disables it (default: 64)
+// [/path/to/import.txt ...]	Data files to import, applied in the order given
 
 int main(int argc, char **argv)
 {
 	try
 	{
-		std::string dataStorePath = "./datastore.sds";
-		std::string logFilePath = "./datastore.log";
+		std::string dataStorePath = "";
 		std::vector<std::string> importDataPaths;
+		size_t threadCount = 1;
+		bool isColumnar = false;
+		bool isCompacted = false;
+		std::string socketPath = "";
+		size_t workerCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+		size_t resultCacheCapacity = ResultCache::m_defaultCapacity;
+		Model::projection_t indexedFields;
 
 		// Parse command line arguments
 		if (argc == 1) {
@@ -30,25 +55,92 @@ int main(int argc, char **argv)
 		}
 
 		for (int i = 1; i < argc; ++i) {
-			// TODO: Write better arg parsing that doesn't suck
-			importDataPaths.emplace_back(std::string(argv[i]));
+			std::string arg(argv[i]);
+			if (arg == "-d" && i + 1 < argc) {
+				dataStorePath = argv[++i];
+			} else if ((arg == "--threads" || arg == "-j") && i + 1 < argc) {
+				threadCount = std::stoul(argv[++i]);
+			} else if (arg == "--columnar") {
+				isColumnar = true;
+			} else if (arg == "--compact") {
+				isCompacted = true;
+			} else if (arg == "--serve" && i + 1 < argc) {
+				socketPath = argv[++i];
+			} else if (arg == "--workers" && i + 1 < argc) {
+				workerCount = std::stoul(argv[++i]);
+			} else if (arg == "--result-cache" && i + 1 < argc) {
+				resultCacheCapacity = std::stoul(argv[++i]) << 20;
+			} else if (arg == "--index" && i + 1 < argc) {
+				std::string field;
+				std::istringstream iss(argv[++i]);
+				while (std::getline(iss, field, ',')) {
+					std::transform(std::begin(field), std::end(field), std::begin(field), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+					indexedFields.emplace_back(Model::FieldIndex(field));
+				}
+			} else {
+				importDataPaths.emplace_back(arg);
+			}
+		}
+
+		if (dataStorePath.empty()) {
+			dataStorePath = isColumnar ? "./datastore.cds" : "./datastore.sds";
 		}
 
 		// Create instances of the datastore manager and it's repository dependency.
 		Repository repository;
-		DataStoreManager dataStore(repository, dataStorePath);
+		repository.IndexFields(indexedFields);
+		ColumnarRepository columnarRepository;
+		DataStoreManager dataStore(isColumnar ? static_cast<IRepository&>(columnarRepository) : repository, dataStorePath);
+		TaskScheduler scheduler(threadCount);
+		dataStore.Scheduler(&scheduler);
 
 		// Authenticate with the datastore manager so we can import our data sets.
 		std::string clientId = "dosferatu";
 		std::string password = "password123";
 		Credentials credentials = dataStore.Connect(clientId, password);
 		if (dataStore.Authenticate(credentials)) {
-			for (auto& importDataPath : importDataPaths) {
-				dataStore.ImportData(credentials, importDataPath);
+			dataStore.ImportData(credentials, importDataPaths);
+			if (isCompacted && !isColumnar) {
+				repository.Compact();
+			}
+
+			if (isColumnar) {
+				std::cout << "Columnar segment: " << columnarRepository.Segment().RowCount() << " rows" << std::endl;
+			} else {
+				const KeyIndex& index = repository.Index();
+				std::cout << "Key index: " << index.Size() << " keys, " << index.Hits() << " hits, "
+					<< index.Misses() << " misses, " << index.DeadCount() << " dead lines" << std::endl;
+				std::cout << "Write-ahead log: " << repository.Log().CommittedEntries() << " entries in "
+					<< repository.Log().Commits() << " commits" << std::endl;
+				for (auto& secondaryIndex : repository.SecondaryIndexes()) {
+					std::cout << "Secondary index on " << Model::m_validFields[static_cast<size_t>(secondaryIndex->Field())] << ": "
+						<< secondaryIndex->Size() << " records" << std::endl;
+				}
 			}
 		}
 
-		// Inject datastore interface in to API layer (message loop)
+		// Keep the datastore resident and answer queries from clients until interrupted.
+		if (!socketPath.empty()) {
+			dataStore.ResultCacheCapacity(resultCacheCapacity);
+			DataStoreServer server(dataStore, socketPath, workerCount);
+			g_server = &server;
+			struct sigaction action;
+			action.sa_handler = StopServer;
+			sigemptyset(&action.sa_mask);
+			action.sa_flags = 0;
+			::sigaction(SIGINT, &action, nullptr);
+			::sigaction(SIGTERM, &action, nullptr);
+
+			std::cout << "Serving queries on " << socketPath << std::endl;
+			server.Run();
+			g_server = nullptr;
+			std::cout << "Served " << server.Requests() << " requests over " << server.Connections() << " connections, "
+				<< server.Cancellations() << " queries cancelled" << std::endl;
+			const ResultCache& results = dataStore.Results();
+			std::cout << "Result cache: " << results.Hits() << " hits, " << results.Misses() << " misses, "
+				<< results.SavedTime().count() << " s of queries saved, " << results.Count() << " results in "
+				<< results.Size() << " bytes, " << results.Evictions() << " evicted" << std::endl;
+		}
 	}
 	catch (std::exception &e)
 	{
@@ -60,6 +152,22 @@ int main(int argc, char **argv)
 
 static void PrintUsage()
 {
-	std::cout << "" << std::endl;
+	std::cout << "usage: datastore [options] <IMPORT_FILE1> [IMPORT_FILE2 ...]" << std::endl
+		<< "options:" << std::endl
+		<< "    " << "-d <PATH>              Path to the datastore (default: ./datastore.sds, or ./datastore.cds if columnar)" << std::endl
+		<< "    " << "--threads <N>, -j <N>  Parse import files with N threads (default: 1)" << std::endl
+		<< "    " << "--columnar             Keep the datastore as a directory of column files" << std::endl
+		<< "    " << "--index <FIELD1,FIELD2> Keep secondary indexes on the given fields for filters to use" << std::endl
+		<< "    " << "--compact              Rewrite the datastore without superseded records and tombstones" << std::endl
+		<< "    " << "--serve <PATH>         Keep the datastore open and serve queries on a Unix domain socket until interrupted" << std::endl
+		<< "    " << "--workers <N>          Run up to N queries at once when serving (default: all cores)" << std::endl
+		<< "    " << "--result-cache <MiB>   Keep the results of repeated queries when serving, until the next write (default: 64)" << std::endl;
 	return;
 }
+
+static void StopServer(int)
+{
+	if (g_server != nullptr) {
+		g_server->Stop();
+	}
+}
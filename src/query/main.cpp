@@ -1,11 +1,20 @@
+#include <algorithm>
 #include <exception>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <sys/resource.h>
+#include "../../lib/columnar_repository.h"
+#include "../../lib/datastore_client.h"
 #include "../../lib/datastore_manager.h"
 #include "../../lib/query.h"
 
 // Sample query tool for custom datastore
 
+static void PrintUsage();
+static void PrintSortStatistics(const ExternalSorter::Statistics& statistics);
+static void PrintScanStatistics(const Query::ScanStatistics& statistics);
+
 // ****************************************************************************
 // Command line options
 // ****************************************************************************
@@ -13,12 +22,19 @@ static void PrintUsage()
 {
 	std::cout << "usage: query -s <FIELD1,FIELD2:AGGREGATE> [options]" << std::endl
 		<< "options:" << std::endl
-		<< "    " << "-o <FIELD1,FIELD2>    Order by ',' delimited fields" << std::endl
+		<< "    " << "-o <FIELD1:DESC,FIELD2> Order by ',' delimited fields, each optionally :ASC or :DESC" << std::endl
 		<< "    " << "-g <FIELD>            Group by field" << std::endl
-		<< "    " << "-f <FIELD=\"value\" AND FIELD2=\"value\" OR FIELD3=\"value\">" << std::endl;
+		<< "    " << "-l <N>                Limit the results to the first N rows" << std::endl
+		<< "    " << "--threads <N>, -j <N> Number of threads the datastore is scanned with (default: 1)" << std::endl
+		<< "    " << "-m <MiB>              Memory budget for ordering; larger results are sorted on disk (default: 256)" << std::endl
+		<< "    " << "--columnar            Query the columnar datastore (./datastore.cds) instead" << std::endl
+		<< "    " << "--socket <PATH>       Send the query to a datastore server (datastore --serve) instead" << std::endl
+		<< "    " << "-v                    Report how many datastore blocks or indexed records were read" << std::endl
+		<< "    " << "-f <FIELD=\"value\" AND (FIELD2=\"value\" OR FIELD3=\"value\")>" << std::endl;
 
 	std::cout << std::endl;
 	std::cout << "example: query -s TITLE,DATE:collect -o TITLE -f DATE=2014-04-21 OR DATE=2014-04-22" << std::endl;
+	std::cout << "example: query -s STB,TITLE,REV -f DATE>=2014-04-01 AND DATE<2014-05-01 AND REV>4.00" << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -26,7 +42,6 @@ int main(int argc, char **argv)
 	try
 	{
 		std::string dataStorePath = "./datastore.sds";
-		std::string logFilePath = "./datastore.log";
 
 		// Parse command line options
 		if (argc == 1) {
@@ -34,25 +49,84 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
-		// Parse commandline and build the query command
+		// Parse commandline and build the query command from everything that isn't a tool option
 		std::stringstream ss;
 		std::string queryString = "";
+		size_t memoryBudget = 0;
+		size_t threadCount = 1;
+		bool isColumnar = false;
+		bool isVerbose = false;
+		std::string socketPath = "";
 		for (int i = 1; i < argc; ++i) {
-			ss << argv[i] << " ";
+			std::string arg(argv[i]);
+			if (arg == "-m" && i + 1 < argc) {
+				memoryBudget = std::stoul(argv[++i]) << 20;
+			} else if ((arg == "--threads" || arg == "-j") && i + 1 < argc) {
+				threadCount = std::stoul(argv[++i]);
+			} else if (arg == "--columnar") {
+				isColumnar = true;
+				dataStorePath = "./datastore.cds";
+			} else if (arg == "-v") {
+				isVerbose = true;
+			} else if (arg == "--socket" && i + 1 < argc) {
+				socketPath = argv[++i];
+			} else {
+				ss << argv[i] << " ";
+			}
 		}
 
 		queryString = ss.str();
-		Query query(queryString);
-		Repository repository;
-		DataStoreManager dataStore(repository, dataStorePath);
 
 		// Authenticate with the datastore manager so we can perform our queries
 		std::string clientId = "dosferatu";
 		std::string password = "password123";
+
+		// A resident server already has the datastore open, so just pass the query on to it.
+		if (!socketPath.empty()) {
+			DataStoreClient client;
+			client.Connect(socketPath, clientId, password);
+			Query::ScanStatistics statistics = client.QueryData(queryString, [](std::string_view record)
+					{
+						std::cout << record << '\n';
+					});
+
+			std::cout.flush();
+			client.Disconnect();
+			if (isVerbose) {
+				PrintScanStatistics(statistics);
+			}
+
+			return 0;
+		}
+
+		Query query(queryString);
+		if (memoryBudget > 0) {
+			query.MemoryBudget(memoryBudget);
+		}
+
+		TaskScheduler scheduler(threadCount);
+		query.Scheduler(&scheduler);
+
+		// Only reads, so it never recovers or writes the datastore, even while another process does.
+		Repository repository;
+		repository.ReadOnly(true);
+		ColumnarRepository columnarRepository;
+		DataStoreManager dataStore(isColumnar ? static_cast<IRepository&>(columnarRepository) : repository, dataStorePath);
 		Credentials credentials = dataStore.Connect(clientId, password);
+
+		// The one query this process runs is never asked for again, so its results aren't kept.
+		dataStore.ResultCacheCapacity(0);
 		if (dataStore.Authenticate(credentials)) {
-			for (auto& record : dataStore.QueryData(credentials, query)) {
-				std::cout << record.ToString(Model::SerializeMode::Query) << std::endl;
+			// Print rows as the query produces them rather than after collecting every result.
+			dataStore.QueryData(credentials, query, [](const Query::row_t& record)
+					{
+						std::cout << record.ToString(Model::SerializeMode::Query) << '\n';
+					});
+
+			std::cout.flush();
+			PrintSortStatistics(query.SortStatistics());
+			if (isVerbose) {
+				PrintScanStatistics(query.ScanStats());
 			}
 		}
 	}
@@ -63,3 +137,36 @@ int main(int argc, char **argv)
 
 	return 0;
 }
+
+
+// ****************************************************************************
+// Reporting
+// ****************************************************************************
+static void PrintSortStatistics(const ExternalSorter::Statistics& statistics)
+{
+	if (statistics.rowCount == 0) {
+		return;
+	}
+
+	// Reported on stderr so the results on stdout stay clean.
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	double seconds = std::max(statistics.seconds, 1e-9);
+	std::cerr << std::fixed << std::setprecision(3)
+		<< "Sorted " << statistics.rowCount << " rows in " << statistics.seconds << " s ("
+		<< std::setprecision(0) << static_cast<double>(statistics.rowCount) / seconds << " rows/s), "
+		<< statistics.runCount << " runs spilled (" << std::setprecision(1)
+		<< static_cast<double>(statistics.spilledBytes) / (1 << 20) << " MiB)" << std::endl
+		<< "Peak RSS: " << static_cast<double>(usage.ru_maxrss) / 1024 << " MiB" << std::endl;
+}
+
+static void PrintScanStatistics(const Query::ScanStatistics& statistics)
+{
+	if (!statistics.indexField.empty()) {
+		std::cerr << "Used index on " << statistics.indexField << ": " << statistics.indexedRecords << " records" << std::endl;
+		return;
+	}
+
+	std::cerr << "Scanned " << statistics.blocksRead << " of " << statistics.blocksRead + statistics.blocksSkipped
+		<< " blocks, " << statistics.blocksSkipped << " skipped" << std::endl;
+}